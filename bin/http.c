@@ -0,0 +1,161 @@
+/* Nujel - Copyright (C) 2020-2022 - Benjamin Vincent Schulenburg
+ * This project uses the MIT license, a copy should be included under /LICENSE */
+#ifndef NUJEL_AMALGAMATION
+#include "private.h"
+#endif
+
+#include <ctype.h>
+
+/*
+ * An incremental HTTP/1.1 request parser, incremental in the sense that it
+ * gets handed whatever has been read so far and returns #nil until a complete
+ * request header has arrived. Since it reports where the body starts, the
+ * caller can just continue parsing from there once the body has been
+ * consumed, which is all that is needed for pipelining.
+ */
+
+#define HTTP_MAX_HEADER_SIZE (1 << 16)
+#define HTTP_MAX_NAME_SIZE 128
+
+static THREAD_LOCAL lSymbol *lSymHTTPError;
+static THREAD_LOCAL lSymbol *lsMethod;
+static THREAD_LOCAL lSymbol *lsPath;
+static THREAD_LOCAL lSymbol *lsVersion;
+static THREAD_LOCAL lSymbol *lsHeaders;
+static THREAD_LOCAL lSymbol *lsBodyStart;
+static THREAD_LOCAL lSymbol *lsContentLength;
+static THREAD_LOCAL lSymbol *lsKeepAlive;
+
+static int httpFindHeaderEnd(const char *buf, int start, int end){
+	for(int i = start; i + 3 < end; i++){
+		if((buf[i] == '\r') && (buf[i+1] == '\n') && (buf[i+2] == '\r') && (buf[i+3] == '\n')){
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool httpEqualCI(const char *a, int len, const char *b){
+	for(int i = 0; i < len; i++){
+		if((b[i] == 0) || (tolower((u8)a[i]) != b[i])){
+			return false;
+		}
+	}
+	return b[len] == 0;
+}
+
+static lVal lnfHTTPParseRequest(lVal aBuffer, lVal aStart, lVal aEnd){
+	const char *buf = NULL;
+	int bufSize = 0;
+	switch(lValType(aBuffer)){
+	default:
+		return lValException(lSymTypeError, "Can't parse that", aBuffer);
+	case ltString:
+	case ltBuffer:
+		buf = lBufferData(lValGetBuffer(aBuffer));
+		bufSize = lBufferLength(lValGetBuffer(aBuffer));
+		break;
+	}
+	const int start = castToInt(aStart, 0);
+	const int end = castToInt(aEnd, bufSize);
+	if((start < 0) || (end > bufSize) || (start > end)){
+		return lValException(lSymTypeError, "Invalid range for that buffer", aBuffer);
+	}
+	const int headerEnd = httpFindHeaderEnd(buf, start, end);
+	if(headerEnd < 0){
+		if(end - start > HTTP_MAX_HEADER_SIZE){
+			return lValException(lSymHTTPError, "Request header too large", aBuffer);
+		}
+		return NIL;
+	}
+
+	/* Request line, METHOD SP TARGET SP VERSION CRLF */
+	int p = start;
+	const int methodStart = p;
+	while((p < headerEnd) && (buf[p] != ' ')){ p++; }
+	const int methodEnd = p++;
+	const int pathStart = p;
+	while((p < headerEnd) && (buf[p] != ' ')){ p++; }
+	const int pathEnd = p++;
+	const int versionStart = p;
+	while((p < headerEnd) && (buf[p] != '\r')){ p++; }
+	const int versionEnd = p;
+	if((methodEnd == methodStart) || (pathEnd <= pathStart) || (versionEnd - versionStart != 8)
+		|| (memcmp(&buf[versionStart], "HTTP/1.", 7) != 0)){
+		return lValException(lSymHTTPError, "Malformed request line", lValStringLen(&buf[start], versionEnd - start));
+	}
+	bool keepAlive = buf[versionStart + 7] != '0';
+	i64 contentLength = 0;
+
+	lMap *headers = lMapAllocRaw();
+	p = versionEnd + 2;
+	while(p < headerEnd){
+		const int nameStart = p;
+		while((p < headerEnd) && (buf[p] != ':') && (buf[p] != '\r')){ p++; }
+		if((p >= headerEnd) || (buf[p] != ':') || (p == nameStart)){
+			return lValException(lSymHTTPError, "Malformed header", lValStringLen(&buf[nameStart], p - nameStart));
+		}
+		const int nameLen = p - nameStart;
+		p++;
+		while((p < headerEnd) && ((buf[p] == ' ') || (buf[p] == '\t'))){ p++; }
+		const int valueStart = p;
+		while((p < headerEnd) && (buf[p] != '\r')){ p++; }
+		int valueEnd = p;
+		while((valueEnd > valueStart) && ((buf[valueEnd-1] == ' ') || (buf[valueEnd-1] == '\t'))){ valueEnd--; }
+		p += 2;
+
+		char nameData[HTTP_MAX_NAME_SIZE];
+		if(nameLen >= HTTP_MAX_NAME_SIZE){
+			return lValException(lSymHTTPError, "Header name too long", lValStringLen(&buf[nameStart], nameLen));
+		}
+		for(int i = 0; i < nameLen; i++){
+			nameData[i] = tolower((u8)buf[nameStart + i]);
+		}
+		const char *value = &buf[valueStart];
+		const int valueLen = valueEnd - valueStart;
+		lMapSet(headers, lValStringLen(nameData, nameLen), lValStringLen(value, valueLen));
+
+		if(httpEqualCI(nameData, nameLen, "content-length")){
+			contentLength = 0;
+			for(int i = 0; i < valueLen; i++){
+				if((value[i] < '0') || (value[i] > '9') || (contentLength > (1LL << 40))){
+					return lValException(lSymHTTPError, "Invalid Content-Length", lValStringLen(value, valueLen));
+				}
+				contentLength = (contentLength * 10) + (value[i] - '0');
+			}
+		}else if(httpEqualCI(nameData, nameLen, "connection")){
+			if(httpEqualCI(value, valueLen, "close")){
+				keepAlive = false;
+			}else if(httpEqualCI(value, valueLen, "keep-alive")){
+				keepAlive = true;
+			}
+		}else if(httpEqualCI(nameData, nameLen, "transfer-encoding")){
+			if(!httpEqualCI(value, valueLen, "identity")){
+				return lValException(lSymHTTPError, "Unsupported Transfer-Encoding", lValStringLen(value, valueLen));
+			}
+		}
+	}
+
+	lMap *req = lMapAllocRaw();
+	lMapSet(req, lValKeywordS(lsMethod),        lValStringLen(&buf[methodStart], methodEnd - methodStart));
+	lMapSet(req, lValKeywordS(lsPath),          lValStringLen(&buf[pathStart], pathEnd - pathStart));
+	lMapSet(req, lValKeywordS(lsVersion),       lValStringLen(&buf[versionStart], versionEnd - versionStart));
+	lMapSet(req, lValKeywordS(lsHeaders),       lValMap(headers));
+	lMapSet(req, lValKeywordS(lsBodyStart),     lValInt(headerEnd + 4));
+	lMapSet(req, lValKeywordS(lsContentLength), lValInt(contentLength));
+	lMapSet(req, lValKeywordS(lsKeepAlive),     lValBool(keepAlive));
+	return lValMap(req);
+}
+
+void lOperationsHTTP(){
+	lSymHTTPError   = lSymSM("http-error");
+	lsMethod        = lSymSM("method");
+	lsPath          = lSymSM("path");
+	lsVersion       = lSymSM("version");
+	lsHeaders       = lSymSM("headers");
+	lsBodyStart     = lSymSM("body-start");
+	lsContentLength = lSymSM("content-length");
+	lsKeepAlive     = lSymSM("keep-alive?");
+
+	lAddNativeFuncVVV("http/parse-request*", "(buffer start end)", "Parse the HTTP request header in BUFFER between START and END, returning #nil if it is incomplete", lnfHTTPParseRequest, 0);
+}
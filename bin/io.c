@@ -28,26 +28,28 @@
 	#include <sys/wait.h>
 #endif
 
-lSymbol *lsError;
-lSymbol *lsErrorNumber;
-lSymbol *lsErrorText;
-lSymbol *lsMode;
-lSymbol *lsSize;
-lSymbol *lsUserID;
-lSymbol *lsGroupID;
-lSymbol *lsAccessTime;
-lSymbol* lsCreationTime;
-lSymbol *lsModificationTime;
-
-lSymbol *lsRegularFile;
-lSymbol *lsDirectory;
-lSymbol *lsCharacterDevice;
-lSymbol *lsBlockDevice;
-lSymbol *lsNamedPipe;
-
-lSymbol *lSymError;
-lSymbol *lSymReplace;
-lSymbol *lSymAppend;
+THREAD_LOCAL lSymbol *lsError;
+THREAD_LOCAL lSymbol *lsErrorNumber;
+THREAD_LOCAL lSymbol *lsErrorText;
+THREAD_LOCAL lSymbol *lsMode;
+THREAD_LOCAL lSymbol *lsSize;
+THREAD_LOCAL lSymbol *lsUserID;
+THREAD_LOCAL lSymbol *lsGroupID;
+THREAD_LOCAL lSymbol *lsAccessTime;
+THREAD_LOCAL lSymbol* lsCreationTime;
+THREAD_LOCAL lSymbol *lsModificationTime;
+
+THREAD_LOCAL lSymbol *lsRegularFile;
+THREAD_LOCAL lSymbol *lsDirectory;
+THREAD_LOCAL lSymbol *lsCharacterDevice;
+THREAD_LOCAL lSymbol *lsBlockDevice;
+THREAD_LOCAL lSymbol *lsNamedPipe;
+
+THREAD_LOCAL lSymbol *lSymError;
+THREAD_LOCAL lSymbol *lSymReplace;
+THREAD_LOCAL lSymbol *lSymAppend;
+THREAD_LOCAL lSymbol *lSymRead;
+THREAD_LOCAL lSymbol *lSymWrite;
 
 void setIOSymbols(){
 	lsError            = lSymSM("error?");
@@ -70,6 +72,8 @@ void setIOSymbols(){
 	lSymError          = lSymSM("error");
 	lSymReplace        = lSymSM("replace");
 	lSymAppend         = lSymSM("append");
+	lSymRead           = lSymSM("read");
+	lSymWrite          = lSymSM("write");
 }
 
 static lVal lnfExit(lVal aStatus){
@@ -79,7 +83,7 @@ static lVal lnfExit(lVal aStatus){
 
 static lVal lnfFileRemove(lVal aPath){
 	reqString(aPath);
-	unlink(lBufferData(aPath.vString));
+	unlink(lBufferData(lValGetString(aPath)));
 	return aPath;
 }
 
@@ -103,11 +107,11 @@ static lVal lnfFileStat(lVal aPath){
 	HANDLE hFind = INVALID_HANDLE_VALUE;
 	DWORD dwError = 0;
 
-	if (unlikely(lStringLength(aPath.vString) >= MAX_PATH)) {
+	if (unlikely(lStringLength(lValGetString(aPath)) >= MAX_PATH)) {
 		return lValException(lSymIOError, "Directory path is too long.", lCar(v));
 	}
 
-	hFind = FindFirstFile(lBufferData(aPath.vString), &ffd);
+	hFind = FindFirstFile(lBufferData(lValGetString(aPath)), &ffd);
 
 
 	lMap *map = lMapAllocRaw();
@@ -132,7 +136,7 @@ static lVal lnfFileStat(lVal aPath){
 	return lValMap(map);
 #else
 	struct stat statbuf;
-	int err = stat(lBufferData(aPath.vString), &statbuf);
+	int err = stat(lBufferData(lValGetString(aPath)), &statbuf);
 	lMap *map = lMapAllocRaw();
 	lMapSet(map, lValKeywordS(lsError), lValBool(err));
 	if(err){
@@ -163,7 +167,7 @@ static lVal lnfPopen(lVal aCommand){
 	int bufSize = readSize;
 	char *buf = malloc(readSize);
 
-	FILE *child = popen(lBufferData(aCommand.vString), "r");
+	FILE *child = popen(lBufferData(lValGetString(aCommand)), "r");
 	if(child == NULL){
 		free(buf);
 		return NIL;
@@ -206,7 +210,7 @@ static lVal lnfPopen(lVal aCommand){
 #endif
 
 static lVal lnfDirectoryRead(lVal aPath, lVal aShowHidden){
-	const char *path = aPath.type == ltString ? lBufferData(aPath.vString) : "./";
+	const char *path = lValType(aPath) == ltString ? lBufferData(lValGetString(aPath)) : "./";
 	const bool showHidden = castToBool(aShowHidden);
 
 #ifdef _MSC_VER
@@ -251,12 +255,12 @@ static lVal lnfDirectoryRead(lVal aPath, lVal aShowHidden){
 		}
 		if((de->d_name[0] == '.') && (de->d_name[1] == 0)){continue;}
 		if((de->d_name[0] == '.') && (de->d_name[1] == '.') && (de->d_name[2] == 0)){continue;}
-		if(cur.type == ltNil){
+		if(lValType(cur) == ltNil){
 			ret = cur = lCons(NIL, NIL);
 		}else{
-			cur = cur.vList->cdr = lCons(NIL, NIL);
+			cur = lValGetPair(cur)->cdr = lCons(NIL, NIL);
 		}
-		cur.vList->car = lValString(de->d_name);
+		lValGetPair(cur)->car = lValString(de->d_name);
 	}
 
 	closedir(dp);
@@ -266,17 +270,17 @@ static lVal lnfDirectoryRead(lVal aPath, lVal aShowHidden){
 
 static lVal lnfDirectoryMake(lVal aPath){
 	reqString(aPath);
-	return lValBool(makeDir(lBufferData(aPath.vString)) == 0);
+	return lValBool(makeDir(lBufferData(lValGetString(aPath))) == 0);
 }
 
 static lVal lnfDirectoryRemove(lVal aPath){
 	reqString(aPath);
-	return lValBool(rmdir(lBufferData(aPath.vString)) == 0);
+	return lValBool(rmdir(lBufferData(lValGetString(aPath))) == 0);
 }
 
 static lVal lnfChangeDirectory(lVal aPath){
 	reqString(aPath);
-	return lValBool(chdir(lBufferData(aPath.vString)) == 0);
+	return lValBool(chdir(lBufferData(lValGetString(aPath))) == 0);
 }
 
 static lVal lnfGetCurrentWorkingDirectory(){
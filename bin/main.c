@@ -4,10 +4,12 @@
 #include "private.h"
 #endif
 
-static void initBinNativeFuncs(){
+void initBinNativeFuncs(){
 	lOperationsIO();
 	lOperationsPort();
 	lOperationsNet();
+	lOperationsHTTP();
+	lOperationsWorker();
 }
 
 static lClosure *createRootClosureFromExternalImage(const char *filename, lVal *init){
@@ -25,6 +27,74 @@ static lClosure *createRootClosureFromExternalImage(const char *filename, lVal *
 	return c;
 }
 
+/* Set the heap limit from a string containing the amount of megabytes,
+ * 0 meaning no limit at all */
+static void setHeapLimit(const char *megabytes){
+	char *end = NULL;
+	const long mb = strtol(megabytes, &end, 10);
+	if((end == megabytes) || (*end != 0) || (mb < 0)){
+		fprintf(stderr, "Invalid heap limit: %s\n", megabytes);
+		exit(127);
+	}
+	lSetHeapLimit(((size_t)mb) << 20);
+}
+
+/* Set the maximum GC pause from a string containing the amount of
+ * microseconds, 0 meaning no limit at all */
+static void setGCMaxPause(const char *usecs){
+	char *end = NULL;
+	const long us = strtol(usecs, &end, 10);
+	if((end == usecs) || (*end != 0) || (us < 0)){
+		fprintf(stderr, "Invalid GC pause: %s\n", usecs);
+		exit(127);
+	}
+	lSetGCMaxPause(us);
+}
+
+static void printGCPauses(){
+	lGCPrintPauses(stderr);
+}
+
+static void printGCStats(){
+	lGCPrintStats(stderr);
+}
+
+/* Prime so that the samples don't line up with allocation patterns in loops */
+#define ALLOC_PROFILE_DEFAULT_RATE 997
+
+static const char *allocProfileFile = NULL;
+
+static void writeAllocProfile(){
+	lAllocationProfilePrint(stderr);
+	FILE *fp = fopen(allocProfileFile, "w");
+	if(fp == NULL){
+		fprintf(stderr, "Couldn't write allocation profile to %s\n", allocProfileFile);
+		return;
+	}
+	lAllocationProfileWriteStacks(fp);
+	fclose(fp);
+}
+
+/* Start sampling allocations, the collapsed stacks get written to FILE
+ * at exit, the sampling rate can be set via NUJEL_ALLOC_PROFILE_RATE */
+static void startAllocProfile(const char *file){
+	long rate = ALLOC_PROFILE_DEFAULT_RATE;
+	const char *rateStr = getenv("NUJEL_ALLOC_PROFILE_RATE");
+	if(rateStr){
+		char *end = NULL;
+		rate = strtol(rateStr, &end, 10);
+		if((end == rateStr) || (*end != 0) || (rate <= 0)){
+			fprintf(stderr, "Invalid allocation profile rate: %s\n", rateStr);
+			exit(127);
+		}
+	}
+	if(allocProfileFile == NULL){
+		atexit(writeAllocProfile);
+	}
+	allocProfileFile = file;
+	lSetAllocationProfileRate(rate);
+}
+
 /* Initialize the Nujel context with an stdlib as well
  * as parsing arguments passed to the runtime */
 static lVal initNujel(int argc, char *argv[]){
@@ -45,6 +115,37 @@ static lVal initNujel(int argc, char *argv[]){
 			ret = lCdr(ret);
 			continue;
 		}
+		if(strcmp(argv[i], "--heap-limit") == 0){
+			if(i > (argc-2)){
+				fprintf(stderr, "Please specify a heap limit in megabytes\n");
+				exit(126);
+			}
+			setHeapLimit(argv[i+1]);
+			ret = lCdr(ret);
+			continue;
+		}
+		if(strcmp(argv[i], "--gc-stats") == 0){
+			atexit(printGCStats);
+			continue;
+		}
+		if(strcmp(argv[i], "--alloc-profile") == 0){
+			if(i > (argc-2)){
+				fprintf(stderr, "Please specify a file for the allocation profile\n");
+				exit(126);
+			}
+			startAllocProfile(argv[i+1]);
+			ret = lCdr(ret);
+			continue;
+		}
+		if(strcmp(argv[i], "--gc-max-pause") == 0){
+			if(i > (argc-2)){
+				fprintf(stderr, "Please specify a GC pause in microseconds\n");
+				exit(126);
+			}
+			setGCMaxPause(argv[i+1]);
+			ret = lCdr(ret);
+			continue;
+		}
 		ret = lCons(lValString(argv[i]), ret);
 	}
 	if(c == NULL){
@@ -53,7 +154,7 @@ static lVal initNujel(int argc, char *argv[]){
 	lRedefineFileHandles(c);
 	lRedefineEnvironment(c);
 
-	if(init.type == ltNil){
+	if(lValType(init) == ltNil){
 		init = lGetClosureSym(c, lSymS("init"));
 	}
 	return lApply(init, ret);
@@ -62,6 +163,24 @@ static lVal initNujel(int argc, char *argv[]){
 int main(int argc, char *argv[]){
 	setvbuf(stdout, NULL, _IONBF, 0);
 	setvbuf(stderr, NULL, _IONBF, 0);
+	const char *heapLimit = getenv("NUJEL_HEAP_LIMIT");
+	if(heapLimit){
+		setHeapLimit(heapLimit);
+	}
+	const char *gcMaxPause = getenv("NUJEL_GC_MAX_PAUSE");
+	if(gcMaxPause){
+		setGCMaxPause(gcMaxPause);
+	}
+	if(getenv("NUJEL_GC_FULL")){
+		lSetGenerationalGC(false);
+	}
+	if(getenv("NUJEL_GC_PAUSES")){
+		atexit(printGCPauses);
+	}
+	const char *allocProfile = getenv("NUJEL_ALLOC_PROFILE");
+	if(allocProfile){
+		startAllocProfile(allocProfile);
+	}
 	lInit();
 	initBinNativeFuncs();
 	setIOSymbols();
@@ -16,11 +16,18 @@
 #include <unistd.h>
 #endif
 
+#if defined(__linux__)
+#define NUJEL_EPOLL
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#endif
+
 #if (!defined(_WIN32)) && (!defined(__wasi__))
 static lVal lnfSocketConect(lVal host, lVal port){
 	reqString(host);
 	reqInt(port);
-	if((port.vInt < 0) || (port.vInt > 0xFFFF)){
+	if((lValGetInt(port) < 0) || (lValGetInt(port) > 0xFFFF)){
 		return lValException(lSymError, "Port numbers need to be between 0-65535", port);
 	}
 
@@ -30,16 +37,16 @@ static lVal lnfSocketConect(lVal host, lVal port){
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_flags |= AI_CANONNAME;
 
-	int errcode = getaddrinfo(lBufferData(host.vBuffer), NULL, &hints, &result);
+	int errcode = getaddrinfo(lBufferData(lValGetBuffer(host)), NULL, &hints, &result);
 	if(errcode != 0){
 		return NIL;
 	}
 	res = result;
 	while (res){
 		if(res->ai_family == AF_INET){
-			((struct sockaddr_in*)((void *)res->ai_addr))->sin_port = htons(port.vInt);
+			((struct sockaddr_in*)((void *)res->ai_addr))->sin_port = htons(lValGetInt(port));
 		} else if(res->ai_family == AF_INET6){
-			((struct sockaddr_in6*)((void *)res->ai_addr))->sin6_port = htons(port.vInt);
+			((struct sockaddr_in6*)((void *)res->ai_addr))->sin6_port = htons(lValGetInt(port));
 		} else {
 			continue;
 		}
@@ -65,9 +72,310 @@ static lVal lnfSocketConect(lVal host, lVal port){
 }
 #endif
 
+#ifdef NUJEL_EPOLL
+/*
+ * Non-blocking sockets and an epoll based poller, sockets and pollers are
+ * plain file descriptors here. The event loop built on top of these lives in
+ * binlib/event.nuj, which suspends the coroutine of whatever task would
+ * block until the poller reports its socket as ready.
+ */
+
+static lVal lValErrno(const char *prefix, lVal v){
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%s: %s", prefix, strerror(errno));
+	buf[sizeof(buf)-1] = 0;
+	return lValException(lSymIOError, buf, v);
+}
+
+static lVal lnfSocketOpenAst(lVal host, lVal port){
+	reqString(host);
+	reqInt(port);
+	if((lValGetInt(port) < 0) || (lValGetInt(port) > 0xFFFF)){
+		return lValException(lSymError, "Port numbers need to be between 0-65535", port);
+	}
+
+	struct addrinfo hints, *res, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	const int errcode = getaddrinfo(lBufferData(lValGetBuffer(host)), NULL, &hints, &result);
+	if(errcode != 0){
+		return lValException(lSymIOError, gai_strerror(errcode), host);
+	}
+	int err = 0;
+	for(res = result; res; res = res->ai_next){
+		if(res->ai_family == AF_INET){
+			((struct sockaddr_in*)((void *)res->ai_addr))->sin_port = htons(lValGetInt(port));
+		} else if(res->ai_family == AF_INET6){
+			((struct sockaddr_in6*)((void *)res->ai_addr))->sin6_port = htons(lValGetInt(port));
+		} else {
+			continue;
+		}
+		const int fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(fd < 0){
+			err = errno;
+			continue;
+		}
+		if((connect(fd, res->ai_addr, res->ai_addrlen) == 0) || (errno == EINPROGRESS)){
+			freeaddrinfo(result);
+			return lValInt(fd);
+		}
+		err = errno;
+		close(fd);
+	}
+	freeaddrinfo(result);
+	errno = err;
+	return lValErrno("Couldn't connect", host);
+}
+
+static lVal lnfSocketListenAst(lVal host, lVal port, lVal aBacklog){
+	reqString(host);
+	reqInt(port);
+	if((lValGetInt(port) < 0) || (lValGetInt(port) > 0xFFFF)){
+		return lValException(lSymError, "Port numbers need to be between 0-65535", port);
+	}
+	const int backlog = castToInt(aBacklog, SOMAXCONN);
+
+	struct addrinfo hints, *res, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = PF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	const int errcode = getaddrinfo(lBufferData(lValGetBuffer(host)), NULL, &hints, &result);
+	if(errcode != 0){
+		return lValException(lSymIOError, gai_strerror(errcode), host);
+	}
+	int err = 0;
+	for(res = result; res; res = res->ai_next){
+		if(res->ai_family == AF_INET){
+			((struct sockaddr_in*)((void *)res->ai_addr))->sin_port = htons(lValGetInt(port));
+		} else if(res->ai_family == AF_INET6){
+			((struct sockaddr_in6*)((void *)res->ai_addr))->sin6_port = htons(lValGetInt(port));
+		} else {
+			continue;
+		}
+		const int fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(fd < 0){
+			err = errno;
+			continue;
+		}
+		const int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if((bind(fd, res->ai_addr, res->ai_addrlen) == 0) && (listen(fd, backlog) == 0)){
+			freeaddrinfo(result);
+			return lValInt(fd);
+		}
+		err = errno;
+		close(fd);
+	}
+	freeaddrinfo(result);
+	errno = err;
+	return lValErrno("Couldn't listen", host);
+}
+
+static lVal lnfSocketAcceptAst(lVal aFd){
+	reqNaturalInt(aFd);
+	const int fd = accept4(lValGetInt(aFd), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(fd < 0){
+		if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) || (errno == ECONNABORTED)){
+			return NIL;
+		}
+		return lValErrno("Couldn't accept", aFd);
+	}
+	return lValInt(fd);
+}
+
+static lVal lnfSocketPortAst(lVal aFd){
+	reqNaturalInt(aFd);
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	if(getsockname(lValGetInt(aFd), (struct sockaddr *)&addr, &len) < 0){
+		return lValErrno("Couldn't query socket", aFd);
+	}
+	if(addr.ss_family == AF_INET){
+		return lValInt(ntohs(((struct sockaddr_in *)&addr)->sin_port));
+	}else if(addr.ss_family == AF_INET6){
+		return lValInt(ntohs(((struct sockaddr_in6 *)&addr)->sin6_port));
+	}
+	return NIL;
+}
+
+static lVal lnfSocketErrorAst(lVal aFd){
+	reqNaturalInt(aFd);
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if(getsockopt(lValGetInt(aFd), SOL_SOCKET, SO_ERROR, &err, &len) < 0){
+		return lValErrno("Couldn't query socket", aFd);
+	}
+	if(err){
+		errno = err;
+		return lValErrno("Socket error", aFd);
+	}
+	return NIL;
+}
+
+static lVal lnfSocketReadAst(lVal aFd, lVal aBuffer, lVal aSize, lVal aOffset){
+	reqNaturalInt(aFd);
+	reqNaturalInt(aSize);
+	const i64 size = lValGetInt(aSize);
+	const i64 offset = castToInt(aOffset, 0);
+
+	void *buf = NULL;
+	i64 bufSize = 0;
+	switch(lValType(aBuffer)){
+	default:
+		return lValException(lSymTypeError, "Can't read into that", aBuffer);
+	case ltBuffer:
+		buf = lBufferDataMutable(lValGetBuffer(aBuffer));
+		bufSize = lBufferLength(lValGetBuffer(aBuffer));
+		break;
+	case ltBufferView:
+		buf = lBufferViewDataMutable(lValGetBufferView(aBuffer));
+		bufSize = lBufferViewLength(lValGetBufferView(aBuffer));
+		break;
+	}
+	if(buf == NULL){
+		return lValException(lSymTypeError, "Can't read into an immutable buffer", aBuffer);
+	}
+	if((offset < 0) || (offset > bufSize)){
+		return lValException(lSymTypeError, "Offset is outside of the buffer", aOffset);
+	}
+	if((bufSize - offset) < size){
+		return lValException(lSymTypeError, "Buffer is too small for that read operation", aBuffer);
+	}
+	const ssize_t r = read(lValGetInt(aFd), &((u8 *)buf)[offset], size);
+	if(r < 0){
+		if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)){
+			return NIL;
+		}
+		return lValErrno("IO Error occured during read", aFd);
+	}
+	return lValInt(r);
+}
+
+static lVal lnfSocketWriteAst(lVal aFd, lVal aBuffer, lVal aSize, lVal aOffset){
+	reqNaturalInt(aFd);
+	i64 size = castToInt(aSize, -1);
+	const i64 offset = castToInt(aOffset, 0);
+
+	const void *buf = NULL;
+	i64 bufSize = 0;
+	switch(lValType(aBuffer)){
+	default:
+		return lValException(lSymTypeError, "Can't write that", aBuffer);
+	case ltString:
+	case ltBuffer:
+		buf = lBufferData(lValGetBuffer(aBuffer));
+		bufSize = lBufferLength(lValGetBuffer(aBuffer));
+		break;
+	case ltBufferView:
+		buf = lBufferViewData(lValGetBufferView(aBuffer));
+		bufSize = lBufferViewLength(lValGetBufferView(aBuffer));
+		break;
+	}
+	if((offset < 0) || (offset > bufSize)){
+		return lValException(lSymTypeError, "Offset is outside of the buffer", aOffset);
+	}
+	if(size < 0){
+		size = bufSize - offset;
+	}
+	if((bufSize - offset) < size){
+		return lValException(lSymTypeError, "Buffer is too small for that write operation", aBuffer);
+	}
+	const ssize_t r = send(lValGetInt(aFd), &((const u8 *)buf)[offset], size, MSG_NOSIGNAL);
+	if(r < 0){
+		if((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)){
+			return NIL;
+		}
+		return lValErrno("IO Error occured during write", aFd);
+	}
+	return lValInt(r);
+}
+
+static lVal lnfSocketCloseAst(lVal aFd){
+	reqNaturalInt(aFd);
+	close(lValGetInt(aFd));
+	return NIL;
+}
+
+static lVal lnfPollerNew(){
+	const int fd = epoll_create1(EPOLL_CLOEXEC);
+	if(fd < 0){
+		return lValErrno("Couldn't create a poller", NIL);
+	}
+	return lValInt(fd);
+}
+
+/* Sockets are watched in oneshot mode, so every readiness notification has
+ * to be asked for again, which is exactly what a suspended task does */
+static lVal lnfPollerWatch(lVal aPoller, lVal aFd, lVal aMode){
+	reqNaturalInt(aPoller);
+	reqNaturalInt(aFd);
+	reqSymbolic(aMode);
+	const lSymbol *mode = lValGetSymbol(aMode);
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = lValGetInt(aFd);
+	if(mode == lSymRead){
+		ev.events = EPOLLIN | EPOLLONESHOT;
+	}else if(mode == lSymWrite){
+		ev.events = EPOLLOUT | EPOLLONESHOT;
+	}else{
+		return lValException(lSymTypeError, "Can only watch for :read or :write", aMode);
+	}
+	const int pfd = lValGetInt(aPoller);
+	if(epoll_ctl(pfd, EPOLL_CTL_MOD, ev.data.fd, &ev) < 0){
+		if((errno != ENOENT) || (epoll_ctl(pfd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0)){
+			return lValErrno("Couldn't watch", aFd);
+		}
+	}
+	return aFd;
+}
+
+static lVal lnfPollerUnwatch(lVal aPoller, lVal aFd){
+	reqNaturalInt(aPoller);
+	reqNaturalInt(aFd);
+	epoll_ctl(lValGetInt(aPoller), EPOLL_CTL_DEL, lValGetInt(aFd), NULL);
+	return aFd;
+}
+
+static lVal lnfPollerWait(lVal aPoller, lVal aTimeout){
+	reqNaturalInt(aPoller);
+	const i64 timeout = castToInt(aTimeout, -1);
+	struct epoll_event events[256];
+	const int n = epoll_wait(lValGetInt(aPoller), events, countof(events), MIN(timeout, INT32_MAX));
+	if(n < 0){
+		if(errno == EINTR){
+			return NIL;
+		}
+		return lValErrno("Couldn't wait for events", aPoller);
+	}
+	lVal ret = NIL;
+	for(int i = n-1; i >= 0; i--){
+		ret = lCons(lValInt(events[i].data.fd), ret);
+	}
+	return ret;
+}
+#endif
 
 void lOperationsNet(){
 	#if (!defined(_WIN32)) && (!defined(__wasi__))
 	lAddNativeFuncVV("socket/connect", "(host port)", "Quits with code a", lnfSocketConect, 0);
 	#endif
+	#ifdef NUJEL_EPOLL
+	lAddNativeFuncVV  ("socket/open*",   "(host port)",             "Start a non-blocking connection to HOST:PORT, returning the socket", lnfSocketOpenAst, 0);
+	lAddNativeFuncVVV ("socket/listen*", "(host port backlog)",     "Return a non-blocking socket listening on HOST:PORT, port 0 picking any free one", lnfSocketListenAst, 0);
+	lAddNativeFuncV   ("socket/accept*", "(socket)",                "Accept a connection on the listening SOCKET, returning the new socket or #nil if it would block", lnfSocketAcceptAst, 0);
+	lAddNativeFuncV   ("socket/port*",   "(socket)",                "Return the local port SOCKET is bound to", lnfSocketPortAst, 0);
+	lAddNativeFuncV   ("socket/error*",  "(socket)",                "Return the pending error of SOCKET as an exception, or #nil if there is none", lnfSocketErrorAst, 0);
+	lAddNativeFuncVVVV("socket/read*",   "(socket buffer size offset)", "Read up to SIZE bytes from SOCKET into BUFFER, 0 meaning EOF and #nil that it would block", lnfSocketReadAst, 0);
+	lAddNativeFuncVVVV("socket/write*",  "(socket buffer size offset)", "Write up to SIZE bytes of BUFFER to SOCKET, returning how many got written or #nil if it would block", lnfSocketWriteAst, 0);
+	lAddNativeFuncV   ("socket/close*",  "(socket)",                "Close SOCKET", lnfSocketCloseAst, 0);
+	lAddNativeFunc    ("poller/new",     "",                        "Return a new poller", lnfPollerNew, 0);
+	lAddNativeFuncVVV ("poller/watch",   "(poller socket mode)",    "Have POLLER report SOCKET once it is ready to :read or :write", lnfPollerWatch, 0);
+	lAddNativeFuncVV  ("poller/unwatch", "(poller socket)",         "Stop POLLER from reporting on SOCKET", lnfPollerUnwatch, 0);
+	lAddNativeFuncVV  ("poller/wait",    "(poller timeout)",        "Wait up to TIMEOUT milliseconds, or forever if it is negative, for sockets watched by POLLER to become ready, and return them as a list", lnfPollerWait, 0);
+	#endif
 }
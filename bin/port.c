@@ -17,7 +17,7 @@ static void disableRawMode() {
 static lVal lnfFileRaw(lVal handle){
 	struct termios raw;
 	reqFileHandle(handle);
-	FILE *fh = handle.vFileHandle;
+	FILE *fh = lValGetFileHandle(handle);
 
 	tcgetattr(fileno(fh), &raw);
 	if(!rawMode){
@@ -42,12 +42,12 @@ static lVal lnfFileRaw(lVal handle){
 
 static lVal lnfFileOpenOutput(lVal aPathname, lVal aIfExists){
 	reqString(aPathname);
-	const char *path = lBufferData(aPathname.vString);
+	const char *path = lBufferData(lValGetString(aPathname));
 	lVal cadr = optionalSymbolic(aIfExists, lSymError);
-	if(unlikely(cadr.type == ltException)){
+	if(unlikely(lValType(cadr) == ltException)){
 		return cadr;
 	}
-	const lSymbol *mode = cadr.vSymbol;
+	const lSymbol *mode = lValGetSymbol(cadr);
 
 	FILE *fh = NULL;
 	if(mode == lSymError){
@@ -73,7 +73,7 @@ static lVal lnfBytesLeftToRead(lVal file){
 #if (defined(_WIN32)) || (defined(__wasi__)) || (defined(__MINGW32__))
 	return lValInt(0);
 #else
-	int fd = fileno(file.vFileHandle);
+	int fd = fileno(lValGetFileHandle(file));
 	int bytesAvailable = 0;
 	int err = ioctl(fd, FIONREAD, &bytesAvailable);
 	if(err){
@@ -86,37 +86,37 @@ static lVal lnfBytesLeftToRead(lVal file){
 
 static lVal lnfFileOpenInput(lVal aPathname){
 	reqString(aPathname);
-	FILE *fh = fopen(lBufferData(aPathname.vString), "rb");
+	FILE *fh = fopen(lBufferData(lValGetString(aPathname)), "rb");
 	return fh ? lValFileHandle(fh) : NIL;
 }
 
 static lVal lnfFileClose(lVal aHandle){
 	reqFileHandle(aHandle);
-	fclose(aHandle.vFileHandle);
+	fclose(lValGetFileHandle(aHandle));
 	return NIL;
 }
 
 static lVal lnfFileReadAst(lVal aHandle, lVal aBuffer, lVal aSize, lVal aOffset){
 	reqFileHandle(aHandle);
-	FILE *fh = aHandle.vFileHandle;
+	FILE *fh = lValGetFileHandle(aHandle);
 	lVal contentV = aBuffer;
 	reqNaturalInt(aSize);
-	const i64 size = aSize.vInt;
+	const i64 size = lValGetInt(aSize);
 	const i64 offset = castToInt(aOffset, 0);
 
 	void *buf = NULL;
 	i64 bufSize = 0;
 	i64 bytesRead = 0;
-	switch(contentV.type){
+	switch(lValType(contentV)){
 	default:
 		return lValException(lSymTypeError, "Can't read into that", contentV);
 	case ltBuffer:
-		buf = lBufferDataMutable(contentV.vBuffer);
-		bufSize = lBufferLength(contentV.vBuffer);
+		buf = lBufferDataMutable(lValGetBuffer(contentV));
+		bufSize = lBufferLength(lValGetBuffer(contentV));
 		break;
 	case ltBufferView:{
-		buf = lBufferViewDataMutable(contentV.vBufferView);
-		bufSize = lBufferViewLength(contentV.vBufferView);
+		buf = lBufferViewDataMutable(lValGetBufferView(contentV));
+		bufSize = lBufferViewLength(lValGetBufferView(contentV));
 		break;
 	}}
 	if(buf == NULL){
@@ -140,7 +140,7 @@ static lVal lnfFileReadAst(lVal aHandle, lVal aBuffer, lVal aSize, lVal aOffset)
 
 static lVal lnfFileWriteAst(lVal aHandle, lVal aBuffer, lVal aSize, lVal aOffset){
 	reqFileHandle(aHandle);
-	FILE *fh = aHandle.vFileHandle;
+	FILE *fh = lValGetFileHandle(aHandle);
 	lVal contentV = aBuffer;
 	i64 size = castToInt(aSize, -1);
 	const i64 offset = castToInt(aOffset, 0);
@@ -148,17 +148,17 @@ static lVal lnfFileWriteAst(lVal aHandle, lVal aBuffer, lVal aSize, lVal aOffset
 	const void * buf = NULL;
 	i64 bufSize = 0;
 	i64 bytesWritten = 0;
-	switch(contentV.type){
+	switch(lValType(contentV)){
 	default:
 		return lValException(lSymTypeError, "Can't read into that", contentV);
 	case ltString:
 	case ltBuffer:
-		buf = lBufferData(contentV.vBuffer);
-		bufSize = lBufferLength(contentV.vBuffer);
+		buf = lBufferData(lValGetBuffer(contentV));
+		bufSize = lBufferLength(lValGetBuffer(contentV));
 		break;
 	case ltBufferView:{
-		buf = lBufferViewData(contentV.vBufferView);
-		bufSize = lBufferViewLength(contentV.vBufferView);
+		buf = lBufferViewData(lValGetBufferView(contentV));
+		bufSize = lBufferViewLength(lValGetBufferView(contentV));
 		break;
 	}}
 	if(buf == NULL){
@@ -183,12 +183,12 @@ static lVal lnfFileWriteAst(lVal aHandle, lVal aBuffer, lVal aSize, lVal aOffset
 
 static lVal lnfFileFlush(lVal aHandle){
 	reqFileHandle(aHandle);
-	fflush(aHandle.vFileHandle);
+	fflush(lValGetFileHandle(aHandle));
 	return aHandle;
 }
 
 static lVal lnfFileTell(lVal aHandle){
-	const i64 pos = ftell(aHandle.vFileHandle);
+	const i64 pos = ftell(lValGetFileHandle(aHandle));
 	return lValInt(pos);
 }
 
@@ -196,9 +196,9 @@ static lVal lnfFileSeek(lVal aHandle, lVal aOffset, lVal aWhence){
 	reqFileHandle(aHandle);
 	reqInt(aOffset);
 	reqInt(aWhence);
-	FILE *fh = aHandle.vFileHandle;
-	const i64 offset = aOffset.vInt;
-	const i64 whenceRaw = aWhence.vInt;
+	FILE *fh = lValGetFileHandle(aHandle);
+	const i64 offset = lValGetInt(aOffset);
+	const i64 whenceRaw = lValGetInt(aWhence);
 	if((whenceRaw < 0) || (whenceRaw > 2)){
 		return lValException(lSymTypeError, "Whence has to be in the range 0-2", aWhence);
 	}
@@ -209,12 +209,12 @@ static lVal lnfFileSeek(lVal aHandle, lVal aOffset, lVal aWhence){
 
 static lVal lnfFileEof(lVal aHandle){
 	reqFileHandle(aHandle);
-	return lValBool(feof(aHandle.vFileHandle));
+	return lValBool(feof(lValGetFileHandle(aHandle)));
 }
 
 static lVal lnfFileError(lVal aHandle){
 	reqFileHandle(aHandle);
-	return lValBool(ferror(aHandle.vFileHandle));
+	return lValBool(ferror(lValGetFileHandle(aHandle)));
 }
 
 void lOperationsPort(){
@@ -20,9 +20,11 @@
 	#include <unistd.h>
 #endif
 
-extern lSymbol *lSymError;
-extern lSymbol *lSymReplace;
-extern lSymbol *lSymAppend;
+extern THREAD_LOCAL lSymbol *lSymError;
+extern THREAD_LOCAL lSymbol *lSymReplace;
+extern THREAD_LOCAL lSymbol *lSymAppend;
+extern THREAD_LOCAL lSymbol *lSymRead;
+extern THREAD_LOCAL lSymbol *lSymWrite;
 
 void lRedefineEnvironment(lClosure *c);
 void lRedefineFileHandles(lClosure *c);
@@ -31,6 +33,9 @@ void setIOSymbols();
 void lOperationsIO   ();
 void lOperationsPort ();
 void lOperationsNet  ();
+void lOperationsHTTP ();
+void lOperationsWorker();
+void initBinNativeFuncs();
 void *loadFile(const char *filename, size_t *len);
 
 int  makeDir   (const char *name);
@@ -0,0 +1,322 @@
+/* Nujel - Copyright (C) 2020-2022 - Benjamin Vincent Schulenburg
+ * This project uses the MIT license, a copy should be included under /LICENSE */
+#ifndef NUJEL_AMALGAMATION
+#include "private.h"
+#endif
+
+/*
+ * Workers run a function in a fresh isolate on their own OS thread. Since
+ * isolates can't share values, everything crossing from one isolate into
+ * another is copied by serializing it into an image, which the receiving
+ * side then reads back into its own heap. This is also true for the
+ * function itself, so a worker starts out with a copy of everything its
+ * function could reach when it was spawned.
+ *
+ * Every worker has two queues, an inbox for messages sent by whoever
+ * spawned it, and an outbox for messages going the other way. The value
+ * returned by the function is put into the outbox as the last message,
+ * once that one has been received the worker is gone.
+ */
+
+#if (!defined(_MSC_VER)) && (!defined(__wasi__)) && (!defined(__EMSCRIPTEN__)) && (!defined(__DJGPP__))
+#define NUJEL_WORKERS
+#include <pthread.h>
+#endif
+
+#ifdef NUJEL_WORKERS
+
+typedef struct lWorkerMessage {
+	struct lWorkerMessage *next;
+	void *img;
+	i32 size;
+	bool exception;
+} lWorkerMessage;
+
+typedef struct {
+	lWorkerMessage *first;
+	lWorkerMessage *last;
+} lWorkerQueue;
+
+typedef struct {
+	i64 id;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	lWorkerQueue inbox;
+	lWorkerQueue outbox;
+	lWorkerMessage *job;
+	int refs;
+	bool finished;
+	bool reaped;
+} lWorker;
+
+/* Workers are referred to by their ID, since handing out pointers to
+ * other isolates would be asking for trouble. IDs are never reused.
+ * The list holds a reference to every worker until its final message
+ * has been received, everyone else looking a worker up holds one until
+ * they are done with it, both of which are protected by the list lock. */
+static pthread_mutex_t lWorkerListLock = PTHREAD_MUTEX_INITIALIZER;
+static lWorker **lWorkerList = NULL;
+static i64 lWorkerCount = 0;
+
+/* The worker the current thread is running, NULL on the main thread */
+static THREAD_LOCAL lWorker *lWorkerSelf = NULL;
+
+static lWorker *lWorkerGet(i64 id){
+	lWorker *ret = NULL;
+	pthread_mutex_lock(&lWorkerListLock);
+	if((id > 0) && (id <= lWorkerCount)){
+		ret = lWorkerList[id - 1];
+		if(ret){
+			ret->refs++;
+		}
+	}
+	pthread_mutex_unlock(&lWorkerListLock);
+	return ret;
+}
+
+static void lWorkerFree(lWorker *w){
+	for(lWorkerMessage *m = w->inbox.first; m;){
+		lWorkerMessage *next = m->next;
+		free(m->img);
+		free(m);
+		m = next;
+	}
+	pthread_cond_destroy(&w->changed);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
+
+static void lWorkerRelease(lWorker *w){
+	pthread_mutex_lock(&lWorkerListLock);
+	const bool last = --w->refs == 0;
+	pthread_mutex_unlock(&lWorkerListLock);
+	if(last){
+		lWorkerFree(w);
+	}
+}
+
+static lWorker *lWorkerNew(){
+	lWorker *w = calloc(1, sizeof(lWorker));
+	if(unlikely(w == NULL)){
+		return NULL;
+	}
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->changed, NULL);
+	pthread_mutex_lock(&lWorkerListLock);
+	lWorker **t = realloc(lWorkerList, (lWorkerCount + 1) * sizeof(lWorker *));
+	if(unlikely(t == NULL)){
+		pthread_mutex_unlock(&lWorkerListLock);
+		free(w);
+		return NULL;
+	}
+	lWorkerList = t;
+	lWorkerList[lWorkerCount++] = w;
+	w->id = lWorkerCount;
+	w->refs = 1;
+	pthread_mutex_unlock(&lWorkerListLock);
+	return w;
+}
+
+/* Has to be called exactly once, after the final message has been
+ * received, so that no new references can be handed out */
+static void lWorkerReap(lWorker *w){
+	pthread_join(w->thread, NULL);
+	pthread_mutex_lock(&lWorkerListLock);
+	lWorkerList[w->id - 1] = NULL;
+	pthread_mutex_unlock(&lWorkerListLock);
+	lWorkerRelease(w);
+}
+
+/* Copy V out of the current isolate, exceptions are sent as the list
+ * they are made of and turned back into an exception on arrival. */
+static lWorkerMessage *lWorkerMessageNew(lVal v){
+	lWorkerMessage *m = calloc(1, sizeof(lWorkerMessage));
+	if(unlikely(m == NULL)){
+		return NULL;
+	}
+	if(lValType(v) == ltException){
+		m->exception = true;
+		v = lValAlloc(ltPair, lValGetPair(v));
+	}
+	m->img = writeImage(v, &m->size);
+	if(unlikely(m->img == NULL)){
+		free(m);
+		return NULL;
+	}
+	return m;
+}
+
+/* Read M into the current isolate and free it */
+static lVal lWorkerMessageRead(lWorkerMessage *m){
+	lVal ret = readImage(m->img, m->size, false);
+	if(m->exception && (lValType(ret) == ltPair)){
+		ret = lValAlloc(ltException, lValGetPair(ret));
+	}
+	free(m->img);
+	free(m);
+	return ret;
+}
+
+static void lWorkerPost(lWorker *w, lWorkerQueue *q, lWorkerMessage *m){
+	pthread_mutex_lock(&w->lock);
+	if(q->last){
+		q->last->next = m;
+	}else{
+		q->first = m;
+	}
+	q->last = m;
+	pthread_cond_broadcast(&w->changed);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Wait for the next message in Q, returns NULL if none is going to come
+ * since the worker has already finished */
+static lWorkerMessage *lWorkerWait(lWorker *w, lWorkerQueue *q){
+	pthread_mutex_lock(&w->lock);
+	while((q->first == NULL) && !((q == &w->outbox) && w->finished)){
+		pthread_cond_wait(&w->changed, &w->lock);
+	}
+	lWorkerMessage *m = q->first;
+	if(m){
+		q->first = m->next;
+		if(q->first == NULL){
+			q->last = NULL;
+		}
+	}
+	const bool done = (q == &w->outbox) && w->finished && (q->first == NULL) && !w->reaped;
+	if(done){
+		w->reaped = true;
+	}
+	pthread_mutex_unlock(&w->lock);
+	if(done){
+		lWorkerReap(w);
+	}
+	return m;
+}
+
+static void *lWorkerRun(void *arg){
+	lWorker *w = arg;
+	lWorkerSelf = w;
+	lInit();
+	initBinNativeFuncs();
+	setIOSymbols();
+
+	lVal job = lWorkerMessageRead(w->job);
+	w->job = NULL;
+	lVal ret = lApply(lCar(job), lCdr(job));
+	lWorkerMessage *m = lWorkerMessageNew(ret);
+	if(m == NULL){
+		m = lWorkerMessageNew(lValException(lSymTypeError, "Can't send the result of a worker", NIL));
+	}
+
+	pthread_mutex_lock(&w->lock);
+	if(m){
+		if(w->outbox.last){
+			w->outbox.last->next = m;
+		}else{
+			w->outbox.first = m;
+		}
+		w->outbox.last = m;
+	}
+	w->finished = true;
+	pthread_cond_broadcast(&w->changed);
+	pthread_mutex_unlock(&w->lock);
+
+	lDestroy();
+	return NULL;
+}
+
+static lVal lnfWorkerSpawn(lVal v){
+	lVal fun = lCar(v);
+	if(unlikely(lValType(fun) != ltLambda)){
+		return lValException(lSymTypeError, "Need a function to run", fun);
+	}
+	lWorkerMessage *job = lWorkerMessageNew(v);
+	if(unlikely(job == NULL)){
+		return lValException(lSymTypeError, "Can't send that function to a worker", fun);
+	}
+	lWorker *w = lWorkerNew();
+	if(unlikely(w == NULL)){
+		free(job->img);
+		free(job);
+		return lValException(lSymOOM, "Couldn't allocate a new worker", NIL);
+	}
+	w->job = job;
+	if(pthread_create(&w->thread, NULL, lWorkerRun, w) != 0){
+		pthread_mutex_lock(&lWorkerListLock);
+		lWorkerList[w->id - 1] = NULL;
+		pthread_mutex_unlock(&lWorkerListLock);
+		w->job = NULL;
+		free(job->img);
+		free(job);
+		lWorkerRelease(w);
+		return lValException(lSymError, "Couldn't start a new thread", NIL);
+	}
+	return lValInt(w->id);
+}
+
+/* Return the worker referred to by V, #nil meaning the one we are running
+ * in, the reference has to be given back with lWorkerRelease */
+static lWorker *lWorkerOf(lVal v){
+	if(lValType(v) == ltNil){
+		if(lWorkerSelf){
+			pthread_mutex_lock(&lWorkerListLock);
+			lWorkerSelf->refs++;
+			pthread_mutex_unlock(&lWorkerListLock);
+		}
+		return lWorkerSelf;
+	}
+	if(lValType(v) != ltInt){
+		return NULL;
+	}
+	return lWorkerGet(lValGetInt(v));
+}
+
+static lVal lnfWorkerSend(lVal worker, lVal msg){
+	lWorker *w = lWorkerOf(worker);
+	if(unlikely(w == NULL)){
+		return lValException(lSymTypeError, "Can't find that worker", worker);
+	}
+	lWorkerMessage *m = lWorkerMessageNew(msg);
+	if(unlikely(m == NULL)){
+		lWorkerRelease(w);
+		return lValException(lSymTypeError, "Can't send that to a worker", msg);
+	}
+	lWorkerPost(w, lValType(worker) == ltNil ? &w->outbox : &w->inbox, m);
+	lWorkerRelease(w);
+	return msg;
+}
+
+static lVal lnfWorkerReceive(lVal worker){
+	lWorker *w = lWorkerOf(worker);
+	if(unlikely(w == NULL)){
+		return lValException(lSymTypeError, "Can't find that worker", worker);
+	}
+	lWorkerMessage *m = lWorkerWait(w, lValType(worker) == ltNil ? &w->inbox : &w->outbox);
+	lWorkerRelease(w);
+	if(unlikely(m == NULL)){
+		return lValException(lSymError, "That worker has already finished", worker);
+	}
+	return lWorkerMessageRead(m);
+}
+
+#endif
+
+static lVal lnfWorkerCPUCount(){
+	#if defined(NUJEL_WORKERS) && defined(_SC_NPROCESSORS_ONLN)
+	const long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return lValInt(count > 0 ? count : 1);
+	#else
+	return lValInt(1);
+	#endif
+}
+
+void lOperationsWorker(){
+	lAddNativeFunc("worker/cpu-count", "()", "Return how many workers could run in parallel on this machine", lnfWorkerCPUCount, 0);
+	#ifdef NUJEL_WORKERS
+	lAddNativeFuncR ("worker/spawn",   "(fun . args)", "Run (FUN ...ARGS) on a new thread, returning the ID of the worker", lnfWorkerSpawn, 0);
+	lAddNativeFuncVV("worker/send",    "(worker msg)", "Send a copy of MSG to WORKER, or to our parent if WORKER is #nil", lnfWorkerSend, 0);
+	lAddNativeFuncV ("worker/receive", "(worker)",     "Wait for the next message from WORKER, or from our parent if WORKER is #nil", lnfWorkerReceive, 0);
+	#endif
+}
@@ -5,61 +5,181 @@
 #endif
 
 /* This boolean flag is used to determine if the garbage collector should run soon.
- * It is set to true when the number of remaining slots in the static array falls below 128.
+ * It is set to true when one of the heaps has grown past its GC threshold.
  * This is used to make sure that the GC only runs when it is safe to, since otherwise we'd have to
  * scan the entire stack and dump all registers. By only doing a collection at certain safe points
  * we can greatly simplify the overall codebase.
  */
-bool lGCShouldRunSoon = false;
+THREAD_LOCAL bool lGCShouldRunSoon = false;
 
-/* This macro defines a simple allocator for a given type T with a maximum capacity of typeMax.
+/* Set when the next collection has to look at the entire heap, for example
+ * because we are about to hit the heap limit. Disabling lGCGenerational makes
+ * every collection a major one, which is mainly useful for comparisons. */
+THREAD_LOCAL bool lGCShouldRunMajor = false;
+THREAD_LOCAL bool lGCGenerational = true;
+
+/* Total amount of memory used by heap segments, and the limit we are not
+ * allowed to go beyond, 0 meaning there is no limit */
+THREAD_LOCAL size_t lHeapSize = 0;
+THREAD_LOCAL size_t lHeapLimit = 0;
+
+static THREAD_LOCAL uint lHeapSegmentIDs = 0;
+
+/* Limit the heap to BYTES, 0 meaning there is no limit */
+void lSetHeapLimit(size_t bytes){
+	lHeapLimit = bytes;
+}
+
+/* Allocate a new, zeroed, heap segment, exiting when we would go beyond the
+ * heap limit. Since we can only collect garbage at safe points we ask for a
+ * collection a little while before actually hitting the limit. */
+void *lHeapSegmentAlloc(){
+	if(unlikely(lHeapLimit && ((lHeapSize + HEAP_SEGMENT_BYTES) > lHeapLimit))){
+		fprintf(stderr, "OOM: heap limit of %uMB exceeded\n", (uint)(lHeapLimit >> 20));
+		exit(123);
+	}
+	void *ret = lAlignedAlloc(HEAP_SEGMENT_BYTES, HEAP_SEGMENT_BYTES);
+	if(unlikely(ret == NULL)){
+		fprintf(stderr, "OOM: Couldn't allocate a new heap segment\n");
+		exit(123);
+	}
+	#ifdef NUJEL_NAN_BOXING
+	if(unlikely(((uintptr_t)ret + HEAP_SEGMENT_BYTES) > NAN_BOX_ADDRESS_LIMIT)){
+		fprintf(stderr, "Heap segment at %p doesn't fit into a NaN-boxed value\n", ret);
+		exit(123);
+	}
+	#endif
+	memset(ret, 0, HEAP_SEGMENT_BYTES);
+	lHeapSize += HEAP_SEGMENT_BYTES;
+	if(unlikely(lHeapLimit && (lHeapSize > (lHeapLimit / 8) * 7))){
+		lGCShouldRunSoon = true;
+		lGCShouldRunMajor = true;
+	}
+	return ret;
+}
+
+void lHeapSegmentFree(void *seg){
+	lAlignedFree(seg);
+	lHeapSize -= HEAP_SEGMENT_BYTES;
+}
+
+/* This macro defines a simple allocator for a given type T with a nursery of at most typeMax objects.
  * For each type T it defines:
- * - A static array TList to store all instances
- * - TMax tracking the next free index in TList
+ * - TSegments, a growable list of aligned segments storing all instances
  * - TActive counting currently allocated objects
- * - TFFree pointing to the first free object in the free list
+ * - TAllocated counting objects allocated since the last collection
+ * - TGCThreshold, the amount of allocations at which we ask for a GC run
+ * - TFFree pointing to the first object of the free list we currently allocate from
  * - TAllocRaw() function to allocate new instances
  *
- * The allocator works in two ways:
+ * Every segment has its own free list, the allocator works in three ways:
  * 1. If there are freed objects (TFFree != NULL), reuse one from the free list
- * 2. Otherwise allocate a new object from TList if space remains
+ * 2. Otherwise take over the free list of the next segment, sweeping it
+ *    first if the last collection left that to us
+ * 3. Otherwise allocate from the last segment if space remains, or add
+ *    a new segment to the heap
  *
  * It also integrates with the GC by:
- * - Triggering collection when fewer than 128 slots remain
- * - Clearing mark bits in TMarkMap for new allocations
+ * - Triggering collection when TAllocated grows beyond TGCThreshold
+ * - Marking new allocations as young in the segments mark map
  * - Zeroing new objects with memset
+ * - Handing every lAllocationSampleRate-th allocation to the profiler
  */
 #define defineAllocator(T, typeMax) \
-T T##List[typeMax]; \
-uint T##Max = 0; \
-uint T##Active = 0; \
-T * T##FFree = NULL; \
-T * T##AllocRaw (){\
-	T *ret;\
-	if((T##FFree) == NULL){			\
-		if(unlikely(T##Max >= typeMax-1)){	\
-			fprintf(stderr, "OOM: static %s heap exhausted \n", #T);\
+THREAD_LOCAL T##Segment **T##Segments = NULL; \
+THREAD_LOCAL uint T##SegmentCount = 0; \
+static THREAD_LOCAL uint T##SegmentCapacity = 0; \
+THREAD_LOCAL uint T##Active = 0; \
+THREAD_LOCAL uint T##Allocated = 0; \
+THREAD_LOCAL uint T##GCThreshold = HEAP_NURSERY_CAPACITY(T, typeMax); \
+THREAD_LOCAL T * T##FFree = NULL; \
+THREAD_LOCAL uint T##SweepCursor = 0; \
+THREAD_LOCAL bool T##SweepPending = false; \
+static T##Segment *T##SegmentNew(){\
+	if(T##SegmentCount >= T##SegmentCapacity){\
+		T##SegmentCapacity = MAX(16, T##SegmentCapacity * 2);\
+		T##Segment **t = realloc(T##Segments, T##SegmentCapacity * sizeof(T##Segment *));\
+		if(unlikely(t == NULL)){\
+			fprintf(stderr, "OOM: Couldn't grow the %s heap\n", #T);\
 			exit(123);\
-		}else{\
-			ret = &(T##List)[(T##Max)++];	\
 		}\
+		T##Segments = t;\
+	}\
+	T##Segment *seg = lHeapSegmentAlloc();\
+	seg->id = lHeapSegmentIDs++;\
+	T##Segments[T##SegmentCount++] = seg;\
+	return seg;\
+}\
+static T *T##AllocSlow(){\
+	while(T##SweepCursor < T##SegmentCount){\
+		T##Segment *seg = T##Segments[T##SweepCursor++];\
+		if(T##SweepPending){\
+			T##SweepSegment(seg);\
+		}\
+		T *ret = seg->freeList;\
+		if(ret){\
+			seg->freeList = NULL;\
+			T##FFree = ret->nextFree;\
+			return ret;\
+		}\
+	}\
+	T##SweepPending = false;\
+	T##Segment *seg = T##SegmentCount ? T##Segments[T##SegmentCount-1] : NULL;\
+	if((seg == NULL) || (seg->used >= HEAP_SEGMENT_CAPACITY(T))){\
+		seg = T##SegmentNew();\
+		T##SweepCursor = T##SegmentCount;\
+	}\
+	return &seg->list[seg->used++];\
+}\
+T * T##AllocRaw (){\
+	T *ret = T##FFree;\
+	if(unlikely(ret == NULL)){\
+		ret = T##AllocSlow();\
 	}else{\
-		ret = T ## FFree;\
-		(T##FFree) = ret->nextFree;\
+		T##FFree = ret->nextFree;\
 	}\
-	if(unlikely((typeMax - (++T##Active) < 128))){lGCShouldRunSoon = true;} \
-	T##MarkMap[ret - T##List] = 0;\
+	T##Active++;\
+	if(unlikely(++T##Allocated >= T##GCThreshold)){lGCShouldRunSoon = true;} \
+	T##Segment *retSeg = T##SegmentOf(ret);\
+	retSeg->markMap[ret - retSeg->list] = GC_YOUNG;\
+	retSeg->young = true;\
 	memset(ret,0,sizeof(T));\
+	if(unlikely(--lAllocationSampleCountdown == 0)){lAllocationSample(lHeapType##T);} \
 	return ret;\
 }
 allocatorTypes()
 #undef defineAllocator
 
+/* Give every segment back to the OS and reset the allocators, the objects
+ * within have to have been freed already. */
+void lAllocatorDestroy(){
+	#define defineAllocator(T, typeMax) \
+	for(uint s=0;s < T##SegmentCount;s++){\
+		lHeapSegmentFree(T##Segments[s]);\
+	}\
+	free(T##Segments);\
+	T##Segments = NULL;\
+	T##SegmentCount = 0;\
+	T##SegmentCapacity = 0;\
+	T##Active = 0;\
+	T##Allocated = 0;\
+	T##GCThreshold = HEAP_NURSERY_CAPACITY(T, typeMax);\
+	T##FFree = NULL;\
+	T##SweepCursor = 0;\
+	T##SweepPending = false;
+	allocatorTypes()
+	#undef defineAllocator
+	lHeapSegmentIDs = 0;
+	lGCShouldRunSoon = false;
+	lGCShouldRunMajor = false;
+	lNFuncMax = 0;
+}
+
 /* We could also use the defineAllocator macro for this, but right now it doesn't make sense to free Native Function bindings
  * since they can't be created from within Nujel, only via the C API.
  */
-lNFunc   lNFuncList[NFN_MAX];
-uint     lNFuncMax    = 0;
+THREAD_LOCAL lNFunc   lNFuncList[NFN_MAX];
+THREAD_LOCAL uint     lNFuncMax    = 0;
 
 
 int lBufferViewTypeSize(lBufferViewType T){
@@ -106,7 +226,7 @@ lBufferView *lBufferViewAlloc(lBuffer *buf, lBufferViewType type, size_t offset,
 
 lBytecodeArray *lBytecodeArrayAlloc(size_t len){
 	lBytecodeArray *ret = lBytecodeArrayAllocRaw();
-	ret->data = calloc(len, sizeof(lBytecodeOp));
+	ret->data = lSlabAlloc(len * sizeof(lBytecodeOp));
 	if(unlikely(ret->data == NULL)){
 		fprintf(stderr, "OOM: Couldn't allocate a new BC array\n");
 		exit(134);
@@ -117,7 +237,7 @@ lBytecodeArray *lBytecodeArrayAlloc(size_t len){
 
 lArray *lArrayAlloc(size_t len){
 	lArray *ret = lArrayAllocRaw();
-	ret->data = calloc(len + 1, sizeof(lVal));
+	ret->data = lSlabAlloc(lArrayDataBytes(len));
 	if(unlikely(ret->data == NULL)){
 		fprintf(stderr, "OOM: Couldn't allocate a new array");
 		exit(135);
@@ -126,6 +246,15 @@ lArray *lArrayAlloc(size_t len){
 	return ret;
 }
 
+#ifdef NUJEL_NAN_BOXING
+/* Ints that don't fit into the payload of a NaN-boxed value */
+lVal lValBoxedInt(i64 v){
+	lBoxedInt *ret = lBoxedIntAllocRaw();
+	ret->value = v;
+	return (lVal){lValAlloc(ltInt, ret).raw | NAN_BOX_INT_BOXED};
+}
+#endif
+
 lNFunc *lNFuncAlloc(){
 	if(unlikely(lNFuncMax >= NFN_MAX-1)){
 		exit(124);
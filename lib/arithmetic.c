@@ -9,331 +9,331 @@ static lVal lValExceptionFloat(lVal v){
 }
 
 static lVal lnfAdd(lVal a, lVal b){
-	if(unlikely(a.type == ltNil)){return lValInt(0);}
-	if(unlikely(b.type == ltNil)){return a;}
-	lType t = lTypecast(a.type, b.type);
+	if(unlikely(lValType(a) == ltNil)){return lValInt(0);}
+	if(unlikely(lValType(b) == ltNil)){return a;}
+	lType t = lTypecast(lValType(a), lValType(b));
 	switch(t){
 	default:
 		return lValExceptionNonNumeric(a);
 	case ltInt:
 		reqInt(a);
 		reqInt(b);
-		return lValInt(a.vInt + b.vInt);
+		return lValInt(lValGetInt(a) + lValGetInt(b));
 	case ltFloat: {
 		lVal av = requireFloat(a);
-		if(unlikely(av.type == ltException)){
+		if(unlikely(lValType(av) == ltException)){
 			return av;
 		}
 		lVal bv = requireFloat(b);
-		if(unlikely(bv.type == ltException)){
+		if(unlikely(lValType(bv) == ltException)){
 			return bv;
 		}
-		return lValFloat(av.vFloat + bv.vFloat); }
+		return lValFloat(lValGetFloat(av) + lValGetFloat(bv)); }
 	}
 }
 
 static lVal lnfSub(lVal a, lVal b){
-	if(unlikely(a.type == ltNil)){
+	if(unlikely(lValType(a) == ltNil)){
 		return lValExceptionArity(a, 2);
 	}
-	if(unlikely(b.type == ltNil)){
-		switch(a.type){
+	if(unlikely(lValType(b) == ltNil)){
+		switch(lValType(a)){
 		default:
 			return lValExceptionNonNumeric(a);
 		case ltInt:
-			return lValInt(-a.vInt);
+			return lValInt(-lValGetInt(a));
 		case ltFloat:
-			return lValFloat(-a.vFloat);
+			return lValFloat(-lValGetFloat(a));
 		}
 	}
-	lType t = lTypecast(a.type, b.type);
+	lType t = lTypecast(lValType(a), lValType(b));
 	switch(t){
 	default:
 		return lValExceptionNonNumeric(a);
 	case ltInt:
 		reqInt(a);
 		reqInt(b);
-		return lValInt(a.vInt - b.vInt);
+		return lValInt(lValGetInt(a) - lValGetInt(b));
 	case ltFloat: {
 		lVal av = requireFloat(a);
-		if(unlikely(av.type == ltException)){
+		if(unlikely(lValType(av) == ltException)){
 			return av;
 		}
 		lVal bv = requireFloat(b);
-		if(unlikely(bv.type == ltException)){
+		if(unlikely(lValType(bv) == ltException)){
 			return bv;
 		}
-		return lValFloat(av.vFloat - bv.vFloat); }
+		return lValFloat(lValGetFloat(av) - lValGetFloat(bv)); }
 	}
 }
 
 static lVal lnfMul(lVal a, lVal b){
-	if(unlikely(a.type == ltNil)){return lValInt(1);}
-	if(unlikely(b.type == ltNil)){
+	if(unlikely(lValType(a) == ltNil)){return lValInt(1);}
+	if(unlikely(lValType(b) == ltNil)){
 		return lValExceptionArity(b, 2);
 	}
-	lType t = lTypecast(a.type, b.type);
+	lType t = lTypecast(lValType(a), lValType(b));
 	switch(t){
 	default:
 		return lValExceptionNonNumeric(a);
 	case ltInt:
 		reqInt(a);
 		reqInt(b);
-		return lValInt(a.vInt * b.vInt);
+		return lValInt(lValGetInt(a) * lValGetInt(b));
 	case ltFloat: {
 		lVal av = requireFloat(a);
-		if(unlikely(av.type == ltException)){
+		if(unlikely(lValType(av) == ltException)){
 			return av;
 		}
 		lVal bv = requireFloat(b);
-		if(unlikely(bv.type == ltException)){
+		if(unlikely(lValType(bv) == ltException)){
 			return bv;
 		}
-		return lValFloat(av.vFloat * bv.vFloat); }
+		return lValFloat(lValGetFloat(av) * lValGetFloat(bv)); }
 	}
 }
 
 static lVal lnfDiv(lVal a, lVal b){
-	if(unlikely((a.type == ltNil) || (b.type == ltNil))){
+	if(unlikely((lValType(a) == ltNil) || (lValType(b) == ltNil))){
 		return lValExceptionArity(b, 2);
 	}
-	lType t = lTypecast(a.type, b.type);
+	lType t = lTypecast(lValType(a), lValType(b));
 	switch(t){
 	default:
 		return lValExceptionNonNumeric(a);
 	case ltInt:
 	case ltFloat: {
 		lVal av = requireFloat(a);
-		if(unlikely(av.type == ltException)){
+		if(unlikely(lValType(av) == ltException)){
 			return av;
 		}
 		lVal bv = requireFloat(b);
-		if(unlikely(bv.type == ltException)){
+		if(unlikely(lValType(bv) == ltException)){
 			return bv;
 		}
-		return lValFloat(av.vFloat / bv.vFloat); }
+		return lValFloat(lValGetFloat(av) / lValGetFloat(bv)); }
 	}
 }
 
 static lVal lnfRem(lVal a, lVal b){
-	if(unlikely(a.type == ltNil)){return b;}
-	if(unlikely(b.type == ltNil)){return a;}
-	lType t = lTypecast(a.type, b.type);
+	if(unlikely(lValType(a) == ltNil)){return b;}
+	if(unlikely(lValType(b) == ltNil)){return a;}
+	lType t = lTypecast(lValType(a), lValType(b));
 	switch(t){
 		default:
 			return lValExceptionNonNumeric(a);
 		case ltInt:
 			reqInt(a);
 			reqInt(b);
-			if(b.vInt == 0){
+			if(lValGetInt(b) == 0){
 				return lValException(lSymDivisionByZero, "Module/Dividing by zero is probably not what you wanted", NIL);
 			}
-			return lValInt(a.vInt % b.vInt);
+			return lValInt(lValGetInt(a) % lValGetInt(b));
 		case ltFloat: {
 			lVal av = requireFloat(a);
-			if(unlikely(av.type == ltException)){
+			if(unlikely(lValType(av) == ltException)){
 				return av;
 			}
 			lVal bv = requireFloat(b);
-			if(unlikely(bv.type == ltException)){
+			if(unlikely(lValType(bv) == ltException)){
 				return bv;
 			}
-			return lValFloat(fmod(av.vFloat, bv.vFloat)); }
+			return lValFloat(fmod(lValGetFloat(av), lValGetFloat(bv))); }
 	}
 }
 
 static lVal lnfPow(lVal a, lVal b){
-	if(unlikely(b.type == ltNil)){return a;}
-	if(unlikely(a.type == ltNil)){
+	if(unlikely(lValType(b) == ltNil)){return a;}
+	if(unlikely(lValType(a) == ltNil)){
 		return lValExceptionArity(b, 2);
 	}
-	lType t = lTypecast(a.type, b.type);
+	lType t = lTypecast(lValType(a), lValType(b));
 	switch(t){
 	default:
 		return lValExceptionFloat(b);
 	case ltInt:
 		reqInt(a);
 		reqInt(b);
-		return lValInt(pow(a.vInt, b.vInt));
+		return lValInt(pow(lValGetInt(a), lValGetInt(b)));
 	case ltFloat: {
 		lVal av = requireFloat(a);
-		if(unlikely(av.type == ltException)){
+		if(unlikely(lValType(av) == ltException)){
 			return av;
 		}
 		lVal bv = requireFloat(b);
-		if(unlikely(bv.type == ltException)){
+		if(unlikely(lValType(bv) == ltException)){
 			return bv;
 		}
-		return lValFloat(pow(av.vFloat, bv.vFloat)); }
+		return lValFloat(pow(lValGetFloat(av), lValGetFloat(bv))); }
 	}
 }
 
 static lVal lnfIncAstI(lVal a){
-	if(unlikely(a.type == ltNil)){
+	if(unlikely(lValType(a) == ltNil)){
 		return lValExceptionNonNumeric(a);
 	}
-	return lValInt(a.vInt + 1);
+	return lValInt(lValGetInt(a) + 1);
 }
 
 static lVal lnfAddAstI(lVal a, lVal b){
-	return lValInt(a.vInt + b.vInt);
+	return lValInt(lValGetInt(a) + lValGetInt(b));
 }
 
 static lVal lnfSubAstI(lVal a, lVal b){
-	return lValInt(a.vInt - b.vInt);
+	return lValInt(lValGetInt(a) - lValGetInt(b));
 }
 
 static lVal lnfMulAstI(lVal a, lVal b){
-	return lValInt(a.vInt * b.vInt);
+	return lValInt(lValGetInt(a) * lValGetInt(b));
 }
 
 static lVal lnfDivAstI(lVal a, lVal b){
-	if(unlikely(b.vInt == 0)){
+	if(unlikely(lValGetInt(b) == 0)){
 		return lValException(lSymDivisionByZero, "Can't divide by zero", a);
 	}
-	return lValInt(a.vInt / b.vInt);
+	return lValInt(lValGetInt(a) / lValGetInt(b));
 }
 
 static lVal lnfModAstI(lVal a, lVal b){
-	if(unlikely(b.vInt == 0)){
+	if(unlikely(lValGetInt(b) == 0)){
 		return lValException(lSymDivisionByZero, "Can't divide by zero", a);
 	}
-	return lValInt(a.vInt % b.vInt);
+	return lValInt(lValGetInt(a) % lValGetInt(b));
 }
 
 static lVal lnfLogAnd(lVal a, lVal b){
 	reqInt(a);
 	reqInt(b);
-	return lValInt(a.vInt & b.vInt);
+	return lValInt(lValGetInt(a) & lValGetInt(b));
 }
 
 static lVal lnfLogIor(lVal a, lVal b){
 	reqInt(a);
 	reqInt(b);
-	return lValInt(a.vInt | b.vInt);
+	return lValInt(lValGetInt(a) | lValGetInt(b));
 }
 
 static lVal lnfLogXor(lVal a, lVal b){
 	reqInt(a);
 	reqInt(b);
-	return lValInt(a.vInt ^ b.vInt);
+	return lValInt(lValGetInt(a) ^ lValGetInt(b));
 }
 
 static lVal lnfLogNot(lVal a){
 	reqInt(a);
-	return lValInt(~a.vInt);
+	return lValInt(~lValGetInt(a));
 }
 
 static lVal lnfPopCount(lVal a){
 	reqInt(a);
 #ifdef _MSC_VER
-	return lValInt(__popcnt64(a.vInt));
+	return lValInt(__popcnt64(lValGetInt(a)));
 #else
-	return lValInt(__builtin_popcountll(a.vInt));
+	return lValInt(__builtin_popcountll(lValGetInt(a)));
 #endif
 }
 
 static lVal lnfAsh(lVal a, lVal b){
 	reqInt(a);
 	reqInt(b);
-	const u64 iv = a.vInt;
-	const i64 sv = b.vInt;
+	const u64 iv = lValGetInt(a);
+	const i64 sv = lValGetInt(b);
 	return lValInt((sv > 0) ? (iv << sv) : (iv >> -sv));
 }
 
 static lVal lnfBitShiftRight(lVal a, lVal b){
 	reqInt(a);
 	reqInt(b);
-	const u64 iv = a.vInt;
-	const i64 sv = b.vInt;
+	const u64 iv = lValGetInt(a);
+	const i64 sv = lValGetInt(b);
 	return lValInt((sv > 0) ? (iv >> sv) : (iv << -sv));
 }
 
 static lVal lnfAbs(lVal t){
-	switch(t.type){
+	switch(lValType(t)){
 	default:
 		return lValExceptionNonNumeric(t);
 	case ltFloat:
-		return lValFloat(fabs(t.vFloat));
+		return lValFloat(fabs(lValGetFloat(t)));
 	case ltInt:
-		return lValInt(llabs(t.vInt));
+		return lValInt(llabs(lValGetInt(t)));
 	}
 }
 
 static lVal lnfCbrt(lVal t){
-	switch(t.type){
+	switch(lValType(t)){
 	default:
 		return lValExceptionNonNumeric(t);
 	case ltFloat:
-		return lValFloat(cbrt(t.vFloat));
+		return lValFloat(cbrt(lValGetFloat(t)));
 	case ltInt:
-		return lValFloat(cbrt(t.vInt));
+		return lValFloat(cbrt(lValGetInt(t)));
 	}
 }
 
 static lVal lnfSqrt(lVal t){
-	switch(t.type){
+	switch(lValType(t)){
 	default:
 		return lValExceptionNonNumeric(t);
 	case ltFloat:
-		return lValFloat(sqrt(t.vFloat));
+		return lValFloat(sqrt(lValGetFloat(t)));
 	case ltInt:
-		return lValFloat(sqrt(t.vInt));
+		return lValFloat(sqrt(lValGetInt(t)));
 	}
 }
 
 static lVal lnfCeil(lVal t){
-	if(likely(t.type == ltFloat)){
-		return lValFloat(ceil(t.vFloat));
+	if(likely(lValType(t) == ltFloat)){
+		return lValFloat(ceil(lValGetFloat(t)));
 	}
 	return lValExceptionNonNumeric(t);
 }
 
 static lVal lnfFloor(lVal t){
-	if(likely(t.type == ltFloat)){
-		return lValFloat(floor(t.vFloat));
+	if(likely(lValType(t) == ltFloat)){
+		return lValFloat(floor(lValGetFloat(t)));
 	}
 	return lValExceptionNonNumeric(t);
 }
 
 static lVal lnfRound(lVal t){
-	if(likely(t.type == ltFloat)){
-		return lValFloat(round(t.vFloat));
+	if(likely(lValType(t) == ltFloat)){
+		return lValFloat(round(lValGetFloat(t)));
 	}
 	return lValExceptionNonNumeric(t);
 }
 
 static lVal lnfSin(lVal t){
-	if(likely(t.type == ltFloat)){
-		return lValFloat(sin(t.vFloat));
+	if(likely(lValType(t) == ltFloat)){
+		return lValFloat(sin(lValGetFloat(t)));
 	}
 	return lValExceptionNonNumeric(t);
 }
 
 static lVal lnfCos(lVal t){
-	if(likely(t.type == ltFloat)){
-		return lValFloat(cos(t.vFloat));
+	if(likely(lValType(t) == ltFloat)){
+		return lValFloat(cos(lValGetFloat(t)));
 	}
 	return lValExceptionNonNumeric(t);
 }
 
 static lVal lnfTan(lVal t){
-	if(likely(t.type == ltFloat)){
-		return lValFloat(tan(t.vFloat));
+	if(likely(lValType(t) == ltFloat)){
+		return lValFloat(tan(lValGetFloat(t)));
 	}
 	return lValExceptionNonNumeric(t);
 }
 
 static lVal lnfAtanTwo(lVal aA, lVal aB){
 	lVal a = requireFloat(aA);
-	if(unlikely(a.type == ltException)){
+	if(unlikely(lValType(a) == ltException)){
 		return a;
 	}
 	lVal b = requireFloat(aB);
-	if(unlikely(b.type == ltException)){
+	if(unlikely(lValType(b) == ltException)){
 		return b;
 	}
-	return lValFloat(atan2(a.vFloat, b.vFloat));
+	return lValFloat(atan2(lValGetFloat(a), lValGetFloat(b)));
 }
 
 void lOperationsArithmetic(){
@@ -5,17 +5,16 @@
 #endif
 
 static lVal lnmArrayLength(lVal self){
-	return lValInt(self.vArray->length);
+	return lValInt(lValGetArray(self)->length);
 }
 
 static lVal lnmArrayLengthSet(lVal self, lVal newLength){
 	reqNaturalInt(newLength);
-	const size_t length = newLength.vInt;
-	lArray *arr = self.vArray;
+	const size_t length = lValGetInt(newLength);
+	lArray *arr = lValGetArray(self);
 
-	lVal *newData = realloc(arr->data,length * sizeof(lVal));
+	lVal *newData = lSlabRealloc(arr->data, lArrayDataBytes(arr->length), lArrayDataBytes(length));
 	if (unlikely(newData == NULL)) {
-		free(newData);
 		return lValException(lSymOOM, "(:length Array) couldn't allocate its array", self);
 	}
 	arr->data = newData;
@@ -29,7 +28,7 @@ static lVal lnmArrayLengthSet(lVal self, lVal newLength){
 /* Return the length of the list V */
 static int lListLength(lVal v){
 	int i = 0;
-	for(lVal n = v;(n.type == ltPair) && (n.vList->car.type != ltNil); n = n.vList->cdr){
+	for(lVal n = v;(lValType(n) == ltPair) && (lValType(lValGetPair(n)->car) != ltNil); n = lValGetPair(n)->cdr){
 		i++;
 	}
 	return i;
@@ -39,26 +38,26 @@ lVal lnfArrNew(lVal v){
 	int length = lListLength(v);
 	lVal r = lValAlloc(ltArray, lArrayAlloc(length));
 	int key = 0;
-	for(lVal n = v; n.type == ltPair; n = n.vList->cdr){
-		r.vArray->data[key++] = n.vList->car;
+	for(lVal n = v; lValType(n) == ltPair; n = lValGetPair(n)->cdr){
+		lValGetArray(r)->data[key++] = lValGetPair(n)->car;
 	}
 	return r;
 }
 
 static lVal lnmArrayToBytecodeArray(lVal self, lVal aLiterals){
-	lArray *arr = self.vArray;
+	lArray *arr = lValGetArray(self);
 	const int len = arr->length;
 
 	reqArray(aLiterals);
 	lBytecodeOp *ops = malloc(sizeof(lBytecodeOp) * len);
 	for(int i=0;i<len;i++){
-		if(unlikely(arr->data[i].type != ltInt)){
+		if(unlikely(lValType(arr->data[i]) != ltInt)){
 			free(ops);
 			return lValException(lSymTypeError, "Need an Int", arr->data[i]);
 		}
-		ops[i] = arr->data[i].vInt;
+		ops[i] = lValGetInt(arr->data[i]);
 	}
-	lVal ret = lValBytecodeArray(ops, len, aLiterals.vArray);
+	lVal ret = lValBytecodeArray(ops, len, lValGetArray(aLiterals));
 	free(ops);
 	return ret;
 }
@@ -66,8 +65,8 @@ static lVal lnmArrayToBytecodeArray(lVal self, lVal aLiterals){
 static lVal lnmArrayAllocate(lVal self, lVal size){
 	(void)self;
 	reqNaturalInt(size);
-	lVal r = lValAlloc(ltArray, lArrayAlloc(size.vInt));
-	if(unlikely(size.vInt && (r.vArray->data == NULL))){
+	lVal r = lValAlloc(ltArray, lArrayAlloc(lValGetInt(size)));
+	if(unlikely(lValGetInt(size) && (lValGetArray(r)->data == NULL))){
 		return lValException(lSymOOM, "(:alloc Array) couldn't allocate its array", size);
 	}
 	return r;
@@ -75,8 +74,8 @@ static lVal lnmArrayAllocate(lVal self, lVal size){
 
 static lVal lnmArrayHas(lVal self, lVal index){
 	reqInt(index);
-	const i64 i = index.vInt;
-	return lValBool((i >= 0) && (i < self.vArray->length));
+	const i64 i = lValGetInt(index);
+	return lValBool((i >= 0) && (i < lValGetArray(self)->length));
 }
 
 void lOperationsArray(){
@@ -10,7 +10,8 @@ const void *lBufferData (lBuffer *v){
 
 void *lBufferDataMutable(lBuffer *v){
 	if(v->flags & BUFFER_IMMUTABLE){return NULL;}
-	return v == NULL ? NULL : v->buf;
+	v->flags &= ~BUFFER_HASHED;
+	return v->buf;
 }
 
 size_t lBufferLength(const lBuffer *v){
@@ -24,6 +25,7 @@ const void *lBufferViewData(lBufferView *v){
 }
 
 void *lBufferViewDataMutable(lBufferView *v){
+	v->buf->flags &= ~BUFFER_HASHED;
 	return &((u8 *)v->buf->buf)[v->offset * lBufferViewTypeSize(v->type)];
 }
 
@@ -33,7 +35,7 @@ size_t lBufferViewLength(const lBufferView *v){
 
 static lVal lnfBufferAllocate(lVal a) {
 	reqNaturalInt(a);
-	lBuffer *buf = lBufferAlloc(a.vInt, false);
+	lBuffer *buf = lBufferAlloc(lValGetInt(a), false);
 	return lValAlloc(ltBuffer, buf);
 }
 
@@ -53,32 +55,35 @@ static lVal bufferFromPointer(bool immutable, const void *data, size_t length){
 static lVal lnfBufferCopy(lVal aDest, lVal vSrc, lVal aDestOffset, lVal aLength){
 	reqMutableBuffer(aDest);
 	reqNaturalInt(aDestOffset);
-	const int destOffset = aDestOffset.vInt;
+	const int destOffset = lValGetInt(aDestOffset);
 	const void *buf = NULL;
 	int length = 0;
 
-	switch(vSrc.type){
+	switch(lValType(vSrc)){
+	default:
+		break;
 	case ltString:
 	case ltBuffer:
-		buf = vSrc.vBuffer->data;
-		length = castToInt(aLength, vSrc.vBuffer->length);
+		buf = lValGetBuffer(vSrc)->data;
+		length = castToInt(aLength, lValGetBuffer(vSrc)->length);
 		break;
 	}
 
 	if(unlikely((buf == NULL) || (length < 0))){
 		return lValException(lSymTypeError, "Can't copy from that", vSrc);
 	}
-	if(unlikely(((length + destOffset) > aDest.vBuffer->length) || (length > vSrc.vBuffer->length))){
+	if(unlikely(((length + destOffset) > lValGetBuffer(aDest)->length) || (length > lValGetBuffer(vSrc)->length))){
 		return lValException(lSymOutOfBounds, "Can't fit everything in that buffer", vSrc);
 	}
-	memcpy(&((u8*)aDest.vBuffer->buf)[destOffset], buf, length);
+	lValGetBuffer(aDest)->flags &= ~BUFFER_HASHED;
+	memcpy(&((u8*)lValGetBuffer(aDest)->buf)[destOffset], buf, length);
 	return aDest;
 }
 
 static lVal lnfBufferToString(lVal a, lVal aLength, lVal aOffset){
 	reqBuffer(a);
-	const i64 length = MIN(a.vBuffer->length, castToInt(aLength, a.vBuffer->length));
-	i64 offset = aOffset.type == ltInt ? aOffset.vInt : 0;
+	const i64 length = MIN(lValGetBuffer(a)->length, castToInt(aLength, lValGetBuffer(a)->length));
+	i64 offset = lValType(aOffset) == ltInt ? lValGetInt(aOffset) : 0;
 	if(unlikely(offset > length)){
 		return lValString("");
 	}
@@ -86,21 +91,21 @@ static lVal lnfBufferToString(lVal a, lVal aLength, lVal aOffset){
 		return lValException(lSymTypeError, "Length has to be greater than 0", aLength);
 	}
 
-	return lValStringLen(a.vBuffer->buf + offset, length - offset);
+	return lValStringLen(lValGetBuffer(a)->buf + offset, length - offset);
 }
 
 static lVal bufferView(lVal a, lVal aImmutable, lBufferViewType T){
 	reqBuffer(a);
 	bool immutable = castToBool(aImmutable);
-	if(unlikely(!immutable && (a.vBuffer->flags & BUFFER_IMMUTABLE))){
-		if(aImmutable.type == ltBool){
+	if(unlikely(!immutable && (lValGetBuffer(a)->flags & BUFFER_IMMUTABLE))){
+		if(lValType(aImmutable) == ltBool){
 			return lValException(lSymTypeError, "Can't create a mutable view for an immutable buffer", a);
 		} else {
 			immutable = true;
 		}
 	}
-	const size_t length = a.vBuffer->length / lBufferViewTypeSize(T);
-	lBufferView *bufView = lBufferViewAlloc(a.vBuffer, T, 0, length, immutable);
+	const size_t length = lValGetBuffer(a)->length / lBufferViewTypeSize(T);
+	lBufferView *bufView = lBufferViewAlloc(lValGetBuffer(a), T, 0, length, immutable);
 	return lValAlloc(ltBufferView, bufView);
 }
 
@@ -115,25 +120,25 @@ static lVal lnmBufferS64(lVal a, lVal aImmutable){ return bufferView(a, aImmutab
 static lVal lnmBufferF64(lVal a, lVal aImmutable){ return bufferView(a, aImmutable, lbvtF64); }
 
 static lVal lnmBufferViewBuffer(lVal self){
-	return lValAlloc(ltBuffer, self.vBufferView->buf);
+	return lValAlloc(ltBuffer, lValGetBufferView(self)->buf);
 }
 
 static lVal lnmBufferLength(lVal self){
-	return lValInt(self.vBuffer->length);
+	return lValInt(lValGetBuffer(self)->length);
 }
 
 static lVal lnmBufferViewLength(lVal self){
-	return lValInt(self.vBufferView->length);
+	return lValInt(lValGetBufferView(self)->length);
 }
 
 static lVal lnmBufferLengthSet(lVal self, lVal newLength){
-	if(unlikely(self.vBuffer->flags & BUFFER_IMMUTABLE)){
+	if(unlikely(lValGetBuffer(self)->flags & BUFFER_IMMUTABLE)){
 		return lValException(lSymTypeError, ":length! requires a mutable buffer", self);
 	}
-	lBuffer *buf = self.vBuffer;
+	lBuffer *buf = lValGetBuffer(self);
 
 	reqNaturalInt(newLength);
-	const int length = newLength.vInt;
+	const int length = lValGetInt(newLength);
 	if(length < buf->length){
 		return lValException(lSymOutOfBounds, "Buffers can only grow, not shrink.", self);
 	}
@@ -144,28 +149,29 @@ static lVal lnmBufferLengthSet(lVal self, lVal newLength){
 	memset(&((u8 *)nBuf)[buf->length], 0, length - buf->length);
 	buf->buf = nBuf;
 	buf->length = length;
+	buf->flags &= ~BUFFER_HASHED;
 	return self;
 }
 
 static lVal lnmBufferImmutable(lVal self){
-	return lValBool(self.vBuffer->flags & BUFFER_IMMUTABLE);
+	return lValBool(lValGetBuffer(self)->flags & BUFFER_IMMUTABLE);
 }
 
 static lVal lnmBufferViewImmutable(lVal self){
-	return lValBool(self.vBufferView->flags & BUFFER_VIEW_IMMUTABLE);
+	return lValBool(lValGetBufferView(self)->flags & BUFFER_VIEW_IMMUTABLE);
 }
 
 static lVal lnmBufferClone(lVal self, lVal immutable){
-	return bufferFromPointer(castToBool(immutable), self.vBuffer->buf, self.vBuffer->length);
+	return bufferFromPointer(castToBool(immutable), lValGetBuffer(self)->buf, lValGetBuffer(self)->length);
 }
 
 static lVal lnmBufferCut(lVal self, lVal start, lVal stop){
 	i64 slen, len;
-	const char *buf = self.vBuffer->data;
-	slen = len = lBufferLength(self.vBuffer);
+	const char *buf = lValGetBuffer(self)->data;
+	slen = len = lBufferLength(lValGetBuffer(self));
 	reqInt(start);
-	i64 off = MAX(0, start.vInt);
-	len = MIN(slen - off, (((stop.type == ltInt)) ? stop.vInt : len) - off);
+	i64 off = MAX(0, lValGetInt(start));
+	len = MIN(slen - off, (((lValType(stop) == ltInt)) ? lValGetInt(stop) : len) - off);
 
 	if(unlikely(len <= 0)){
 		return lnfBufferAllocate(lValInt(0));
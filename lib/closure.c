@@ -15,40 +15,88 @@ lClosure *lClosureNew(lClosure *parent, closureType t) {
 	memset(c,0,sizeof(lClosure));
 	c->parent = parent;
 	c->type = t;
+	if(parent){
+		parent->flags |= CLOSURE_CAPTURED;
+	}
 	return c;
 }
 
-lClosure *lClosureNewFunCall(lVal args, lVal lambda) {
-	lClosure *tmpc = lClosureAllocRaw();
-	tmpc->parent = lambda.vClosure;
-	tmpc->type   = closureCall;
-	tmpc->text   = lambda.vClosure->text;
-	tmpc->ip     = tmpc->text->data;
-	for (lVal n = lambda.vClosure->args; ; n = n.vList->cdr) {
-		if (likely(n.type == ltPair)) {
-			if(unlikely(args.type != ltPair)){
-				tmpc->data = lTreeInsert(tmpc->data, n.vList->car.vSymbol, NIL);
+/* Bind ARGS to the argument list of LAMBDA within the call closure C, using
+ * slots when there are few enough arguments and the data tree otherwise */
+static void lClosureBindArgs(lClosure *c, lVal args, lVal lambda){
+	const lVal allArgs = args;
+	lVal n = lValGetClosure(lambda)->args;
+	int i = 0;
+	for(; (lValType(n) == ltPair) && (i < CLOSURE_SLOTS); n = lValGetPair(n)->cdr){
+		c->slots[i++] = lCar(args);
+		args = lCdr(args);
+	}
+	if(likely(lValType(n) == ltNil) || ((lValType(n) == ltSymbol) && (i < CLOSURE_SLOTS))){
+		if(lValType(n) == ltSymbol){
+			c->slots[i++] = args;
+		}
+		c->args = lValGetClosure(lambda)->args;
+		c->slotCount = i;
+		return;
+	}
+
+	memset(c->slots, 0, sizeof(c->slots));
+	args = allArgs;
+	for (n = lValGetClosure(lambda)->args; ; n = lValGetPair(n)->cdr) {
+		if (likely(lValType(n) == ltPair)) {
+			if(unlikely(lValType(args) != ltPair)){
+				c->data = lTreeInsert(c->data, lValGetSymbol(lValGetPair(n)->car), NIL);
 			} else {
-				tmpc->data = lTreeInsert(tmpc->data, n.vList->car.vSymbol, args.vList->car);
-				args = args.vList->cdr;
+				c->data = lTreeInsert(c->data, lValGetSymbol(lValGetPair(n)->car), lValGetPair(args)->car);
+				args = lValGetPair(args)->cdr;
 			}
 			continue;
-		} else if(likely(n.type == ltSymbol)) {
-			tmpc->data = lTreeInsert(tmpc->data, n.vSymbol, args);
+		} else if(likely(lValType(n) == ltSymbol)) {
+			c->data = lTreeInsert(c->data, lValGetSymbol(n), args);
 		}
-		return tmpc;
+		return;
 	}
+}
+
+lClosure *lClosureNewFunCall(lVal args, lVal lambda) {
+	lClosure *tmpc = lClosureAllocRaw();
+	tmpc->parent = lValGetClosure(lambda);
+	tmpc->type   = closureCall;
+	tmpc->text   = lValGetClosure(lambda)->text;
+	tmpc->ip     = tmpc->text->data;
+	lClosureBindArgs(tmpc, args, lambda);
 	return tmpc;
 }
 
+/* Return a tree containing every binding of C, including the slots */
+lTree *lClosureDataTree(const lClosure *c){
+	if(likely(c->slotCount == 0)){
+		return c->data;
+	}
+	lTree *ret = lTreeDup(c->data);
+	lVal n = c->args;
+	for(int i=0; i < c->slotCount; i++){
+		if(lValType(n) == ltPair){
+			ret = lTreeInsert(ret, lValGetSymbol(lValGetPair(n)->car), c->slots[i]);
+			n = lValGetPair(n)->cdr;
+		} else {
+			ret = lTreeInsert(ret, lValGetSymbol(n), c->slots[i]);
+		}
+	}
+	return ret;
+}
+
 lVal lGetClosureSym(lClosure *c, const lSymbol *s){
 	for (const lClosure *cc = c; cc; cc = cc->parent) {
-		const lTree *t = cc->data;
-		while(t){
-			if(s == t->key){
-				return t->value;
+		if(cc->slotCount){
+			const int i = lClosureSlotIndex(cc, s);
+			if(i >= 0){
+				return cc->slots[i];
 			}
-			t = s > t->key ? t->right : t->left;
+		}
+		const lTree *t = lTreeLookup(cc->data, s);
+		if(t){
+			return t->value;
 		}
 	}
 	return lValException(lSymUnboundVariable, "Can't resolve symbol", lValSymS(s));
@@ -56,19 +104,31 @@ lVal lGetClosureSym(lClosure *c, const lSymbol *s){
 
 /* Bind the value V to the Symbol S in the closure C, defining it if necessary */
 void lDefineClosureSym(lClosure *c, const lSymbol *s, lVal v){
+	lClosureWriteBarrier(c);
+	if(c->slotCount){
+		const int i = lClosureSlotIndex(c, s);
+		if(i >= 0){
+			c->slots[i] = v;
+			return;
+		}
+	}
 	c->data = lTreeInsert(c->data, s, v);
 }
 
 /* Set the value bound to S in C to V, if it has already been bound */
 bool lSetClosureSym(lClosure *c, const lSymbol *s, lVal v){
 	for (lClosure *cc = c; cc; cc = cc->parent) {
-		lTree *t = cc->data;
-		while(t){
-			if(t->key == s){
-				t->value = v;
+		if(cc->slotCount){
+			const int i = lClosureSlotIndex(cc, s);
+			if(i >= 0){
+				lClosureWriteBarrier(cc);
+				cc->slots[i] = v;
 				return true;
 			}
-			t = s > t->key ? t->right : t->left;
+		}
+		if(lTreeSet(&cc->data, s, v)){
+			lClosureWriteBarrier(cc);
+			return true;
 		}
 	}
 	return false;
@@ -82,19 +142,19 @@ void lDefineVal(lClosure *c, const char *str, lVal val){
 static lVal lAddNativeFuncRaw(const char *sym, const char *args, const char *doc, void *func, uint flags, u8 argCount){
 	lVal v = lValAlloc(ltNativeFunc, lNFuncAlloc());
 	lSymbol *name = lSymS(sym);
-	v.vNFunc->fp   = func;
-	v.vNFunc->args = lCar(lRead(args, strlen(args)));
-	v.vNFunc->meta = lTreeInsert(NULL, symDocumentation, lValString(doc));
-	v.vNFunc->argCount = argCount;
-	v.vNFunc->name = name;
+	lValGetNFunc(v)->fp   = func;
+	lValGetNFunc(v)->args = lCar(lRead(args, strlen(args)));
+	lValGetNFunc(v)->meta = lTreeInsert(NULL, symDocumentation, lValString(doc));
+	lValGetNFunc(v)->argCount = argCount;
+	lValGetNFunc(v)->name = name;
 	if(flags & NFUNC_FOLD){
-		v.vNFunc->meta = lTreeInsert(v.vNFunc->meta, symFold, lValBool(true));
+		lValGetNFunc(v)->meta = lTreeInsert(lValGetNFunc(v)->meta, symFold, lValBool(true));
 	}
 	if(flags & NFUNC_PURE){
-		v.vNFunc->meta = lTreeInsert(v.vNFunc->meta, symPure, lValBool(true));
+		lValGetNFunc(v)->meta = lTreeInsert(lValGetNFunc(v)->meta, symPure, lValBool(true));
 	}
 
-	v.vNFunc->meta = lTreeInsert(v.vNFunc->meta, symName, lValSymS(name));
+	lValGetNFunc(v)->meta = lTreeInsert(lValGetNFunc(v)->meta, symName, lValSymS(name));
 	return v;
 }
 lVal lAddNativeFunc(const char *sym, const char *args, const char *doc, lVal (*func)(), uint flags){
@@ -135,11 +195,11 @@ lVal lAddNativeFuncCR(const char *sym, const char *args, const char *doc, lVal (
 }
 
 lClosure *findRoot (lVal v){
-	switch(v.type){
+	switch(lValType(v)){
 	case ltEnvironment:
 	case ltMacro:
 	case ltLambda: {
-		lClosure *c = v.vClosure;
+		lClosure *c = lValGetClosure(v);
 		while(c->parent){
 			c = c->parent;
 		}
@@ -173,8 +233,8 @@ lClosure *lRedefineNativeFuncs(lClosure *c){
 
 /* Run fun with args  */
 lVal lApply(lVal fun, lVal args){
-	if(unlikely(fun.type != ltLambda)){
+	if(unlikely(lValType(fun) != ltLambda)){
 		return lValException(lSymTypeError, "Can't apply to following val", fun);
 	}
-	return lBytecodeEval(lClosureNewFunCall(args, fun), fun.vClosure->text);
+	return lBytecodeEval(lClosureNewFunCall(args, fun), lValGetClosure(fun)->text);
 }
@@ -43,6 +43,10 @@ void __sync_synchronize() {}
 	#include <pthread_time.h>
 #endif
 
+#if defined(_MSC_VER) || defined(__MINGW32__)
+	#include <malloc.h>
+#endif
+
 /* Return monotonic time in milliseconds */
 u64 getMSecs(){
 #ifdef _MSC_VER
@@ -54,6 +58,35 @@ u64 getMSecs(){
 #endif
 }
 
+/* Return monotonic time in microseconds */
+u64 getUSecs(){
+#ifdef _MSC_VER
+	return GetTickCount64() * 1000;
+#else
+	struct timespec tv;
+	clock_gettime(CLOCK_MONOTONIC,&tv);
+	return (tv.tv_nsec / 1000) + (tv.tv_sec * 1000000);
+#endif
+}
+
+/* Allocate SIZE bytes aligned to ALIGNMENT, which has to be a power of 2 */
+void *lAlignedAlloc(size_t alignment, size_t size){
+#if defined(_MSC_VER) || defined(__MINGW32__)
+	return _aligned_malloc(size, alignment);
+#else
+	void *ret = NULL;
+	return posix_memalign(&ret, alignment, size) ? NULL : ret;
+#endif
+}
+
+void lAlignedFree(void *ptr){
+#if defined(_MSC_VER) || defined(__MINGW32__)
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
 /* Add all the platform specific constants to C */
 void lAddPlatformVars(lClosure *c){
 	lVal valOS, valArch;
@@ -9,13 +9,13 @@
 
 static lVal lnfResolvesPred(lClosure *c, lVal aSym, lVal env){
 	lVal car = aSym;
-	if(unlikely(car.type != ltSymbol)){return lValBool(false);}
-	const lSymbol *sym = car.vSymbol;
-	if((env.type != ltNil) && (env.type != ltLambda) && (env.type != ltEnvironment)){
+	if(unlikely(lValType(car) != ltSymbol)){return lValBool(false);}
+	const lSymbol *sym = lValGetSymbol(car);
+	if((lValType(env) != ltNil) && (lValType(env) != ltLambda) && (lValType(env) != ltEnvironment)){
 		return lValException(lSymTypeError, "You can only check symbols in Lambdas or Objects", env);
 	}
-	const lVal ret = lGetClosureSym(env.type != ltNil ? env.vClosure : c, sym);
-	return lValBool(ret.type != ltException);
+	const lVal ret = lGetClosureSym(lValType(env) != ltNil ? lValGetClosure(env) : c, sym);
+	return lValBool(lValType(ret) != ltException);
 }
 
 static lVal lnfCurrentClosure(lClosure *c){
@@ -28,9 +28,10 @@ static lVal lnfCurrentLambda(lClosure *c){
 
 static lVal lnfNReverse(lVal l){
 	lVal t = NIL;
-	while(l.type == ltPair){
-		lVal next = l.vList->cdr;
-		l.vList->cdr = t;
+	while(lValType(l) == ltPair){
+		lVal next = lValGetPair(l)->cdr;
+		lPairWriteBarrier(lValGetPair(l));
+		lValGetPair(l)->cdr = t;
 		t = l;
 		l = next;
 	}
@@ -51,50 +52,63 @@ static lVal lnfQuote(lVal v){
 
 static lVal lnfRead(lVal a){
 	reqString(a);
-	return lRead(a.vString->data, a.vString->length);
+	return lRead(lValGetString(a)->data, lValGetString(a)->length);
 }
 
 static lVal lnfGarbageCollectRuns(){
 	return lValInt(lGCRuns);
 }
 
+static lVal lnfQuickenStats(){
+	lTree *t = lTreeInsert(NULL, lSymS("quickened"), lValInt(lQuickenCount));
+	t = lTreeInsert(t, lSymS("dequickened"), lValInt(lDequickenCount));
+	return lValTree(t);
+}
+
+static lVal lnfMethodCacheStats(){
+	lTree *t = lTreeInsert(NULL, lSymS("hits"), lValInt(lMethodCacheHits));
+	t = lTreeInsert(t, lSymS("misses"), lValInt(lMethodCacheMisses));
+	return lValTree(t);
+}
+
 static lVal lnfFloat(lVal v){
-	if(likely(v.type == ltFloat)){
+	if(likely(lValType(v) == ltFloat)){
 		return v;
-	} else if(likely(v.type == ltInt)){
-		return lValFloat(v.vInt);
+	} else if(likely(lValType(v) == ltInt)){
+		return lValFloat(lValGetInt(v));
 	} else {
 		return lValExceptionType(v, ltFloat);
 	}
 }
 
 static lVal lnfInt(lVal v){
-	if(likely(v.type == ltInt)){
+	if(likely(lValType(v) == ltInt)){
 		return v;
-	} else if(likely(v.type == ltFloat)){
-		return lValInt(v.vFloat);
+	} else if(likely(lValType(v) == ltFloat)){
+		return lValInt(lValGetFloat(v));
 	} else {
 		return lValExceptionType(v, ltInt);
 	}
 }
 
 static i64 lValToId(lVal v){
-	switch(v.type){
+	switch(lValType(v)){
 	default:      return 0;
 	case ltEnvironment:
 	case ltMacro:
-	case ltLambda: return v.vClosure - lClosureList;
-	case ltBufferView: return v.vBufferView - lBufferViewList;
+	case ltLambda: return lClosureID(lValGetClosure(v));
+	case ltBufferView: return lBufferViewID(lValGetBufferView(v));
 	case ltString:
-	case ltBuffer: return v.vBuffer - lBufferList;
-	case ltArray: return v.vArray - lArrayList;
-	case ltTree: return v.vTree - lTreeRootList;
-	case ltMap: return v.vMap - lMapList;
-	case ltBytecodeArr: return v.vBytecodeArr - lBytecodeArrayList;
+	case ltBuffer: return lBufferID(lValGetBuffer(v));
+	case ltArray: return lArrayID(lValGetArray(v));
+	case ltTree: return lTreeRootID(lValGetTreeRoot(v));
+	case ltMap: return lMapID(lValGetMap(v));
+	case ltBytecodeArr: return lBytecodeArrayID(lValGetBytecodeArray(v));
 	case ltKeyword:
-	case ltSymbol: return v.vSymbol - lSymbolList;
-	case ltFileHandle: return fileno(v.vFileHandle);
-	case ltNativeFunc: return v.vNFunc - lNFuncList;
+	case ltSymbol: return lSymbolID(lValGetSymbol(v));
+	case ltFileHandle: return fileno(lValGetFileHandle(v));
+	case ltNativeFunc: return lNFuncID(lValGetNFunc(v));
+	case ltCoroutine: return lCoroutineID(lValGetCoroutine(v));
 	}
 }
 
@@ -103,19 +117,19 @@ static lVal lnfValToId(lVal a){
 }
 
 static lVal lnfSymbolToKeyword(lVal v){
-	return lValKeywordS(v.vSymbol);
+	return lValKeywordS(lValGetSymbol(v));
 }
 
 static lVal lnfStringToKeyword(lVal v){
-	return lValKeyword(v.vString->data);
+	return lValKeyword(lValGetString(v)->data);
 }
 
 static lVal lnfKeywordToSymbol(lVal a){
-	return lValSymS(a.vSymbol);
+	return lValSymS(lValGetSymbol(a));
 }
 
 static lVal lnfStringToSymbol(lVal a){
-	return lValSym(a.vString->data);
+	return lValSym(lValGetString(a)->data);
 }
 
 static lVal lnfIdentity(lVal a){
@@ -128,22 +142,22 @@ static lVal lnfNilToString(lVal a){
 }
 
 static lVal lnfBufferToString(lVal a){
-	return lValStringLen(a.vBuffer->data, a.vBuffer->length);
+	return lValStringLen(lValGetBuffer(a)->data, lValGetBuffer(a)->length);
 }
 
 static lVal lnfSymbolToString(lVal a){
-	return lValString(a.vSymbol->c);
+	return lValString(lValGetSymbol(a)->c);
 }
 
 static lVal lnfIntToString(lVal a){
 	char buf[32];
-	const int snret = snprintf(buf, sizeof(buf),"%" PRId64, a.vInt);
+	const int snret = snprintf(buf, sizeof(buf),"%" PRId64, lValGetInt(a));
 	return lValStringLen(buf,snret);
 }
 
 static lVal lnfFloatToString(lVal a){
 	char buf[32];
-	int snret = snprintf(buf,sizeof(buf),"%f", a.vFloat);
+	int snret = snprintf(buf,sizeof(buf),"%f", lValGetFloat(a));
 	if(snret < 0){
 		return lValException(lSymIOError, "Unprintable flonum", a);
 	}
@@ -156,25 +170,28 @@ static lVal lnfFloatToString(lVal a){
 
 lVal lValBytecodeArray(const lBytecodeOp *ops, int opsLength, lArray *literals){
 	lVal ret = lValAlloc(ltBytecodeArr, lBytecodeArrayAlloc(opsLength));
-	ret.vBytecodeArr->literals = literals;
-	ret.vBytecodeArr->literals->flags |= ARRAY_IMMUTABLE;
-	memcpy(ret.vBytecodeArr->data, ops, opsLength);
+	lValGetBytecodeArray(ret)->literals = literals;
+	lValGetBytecodeArray(ret)->literals->flags |= ARRAY_IMMUTABLE;
+	memcpy(lValGetBytecodeArray(ret)->data, ops, opsLength);
 	return ret;
 }
 
 static lVal lnmBytecodeArrayArray(lVal self){
-	lBytecodeArray *arr = self.vBytecodeArr;
+	lBytecodeArray *arr = lValGetBytecodeArray(self);
 	const int len = arr->dataEnd - arr->data;
 
 	lVal ret = lValAlloc(ltArray, lArrayAlloc(len));
 	for(int i=0;i<len;i++){
-		ret.vArray->data[i] = lValInt(arr->data[i]);
+		lValGetArray(ret)->data[i] = lValInt(arr->data[i]);
+	}
+	for(int i=0;i<len;i+=lBytecodeOpLength(arr->data[i])){
+		lValGetArray(ret)->data[i] = lValInt(lBytecodeOpDequicken(arr->data[i]));
 	}
 	return ret;
 }
 
 static lVal lnmBytecodeArrayLiterals(lVal self){
-	lBytecodeArray *arr = self.vBytecodeArr;
+	lBytecodeArray *arr = lValGetBytecodeArray(self);
 	if(unlikely(arr->literals == NULL)){
 		return NIL;
 	} else {
@@ -183,7 +200,7 @@ static lVal lnmBytecodeArrayLiterals(lVal self){
 }
 
 static lVal lnmBytecodeArrayLength(lVal self){
-	lBytecodeArray *arr = self.vBytecodeArr;
+	lBytecodeArray *arr = lValGetBytecodeArray(self);
 	return lValInt(arr->dataEnd - arr->data);
 }
 
@@ -194,8 +211,9 @@ void lOperationsBytecode(){
 	lAddNativeMethodV(BytecodeArray, lSymS("length"),   "(self)", lnmBytecodeArrayLength, 0);
 }
 
-/* Initialize the allocator and symbol table, needs to be called before as
- * soon as possible, since most procedures depend on it.*/
+/* Initialize the isolate of the calling thread, that is its allocator,
+ * symbol table and types. Needs to be called as soon as possible on every
+ * thread that wants to run Nujel code, since most procedures depend on it. */
 void lInit(){
 	lSymbolInit();
 	lTypesInit();
@@ -207,11 +225,20 @@ void lInit(){
 	lOperationsTree();
 	lOperationsMap();
 	lOperationsBytecode();
+	lOperationsCoroutine();
 	lOperationsString();
 }
 
-static lVal lnfSymbolTable(){
-	return lValMap(lSymbolTable);
+/* Free everything belonging to the isolate of the calling thread, no value
+ * from it may be used afterwards. Has to be called outside of any
+ * evaluation, mainly so that threads can clean up before exiting, lInit
+ * may be called again to start over. */
+void lDestroy(){
+	lVMDestroy();
+	lReaderDestroy();
+	lHeapDestroy();
+	lSymbolDestroy();
+	lTypesDestroy();
 }
 
 void lOperationsCore(){
@@ -231,6 +258,12 @@ void lOperationsCore(){
 	lAddNativeFunc("time/milliseconds","", "Return monotonic msecs",lnfTimeMsecs, 0);
 
 	lAddNativeFunc("garbage-collection-runs", "", "Return the amount of times the GC ran since runtime startup", lnfGarbageCollectRuns, 0);
+	lAddNativeFunc("gc/stats", "", "Return some statistics about the garbage collector, pause times are in microseconds", lGCStats, 0);
+	lAddNativeFunc("gc/allocation-profile", "", "Return a list of (count . stack) for every stack sampled by the allocation profiler, counts are estimated allocations", lAllocationProfile, 0);
+	lAddNativeFunc("gc/pause-histogram", "", "Return how many minor/major collections paused for less than 2^(i+1) microseconds, for every index i", lGCPauseHistogram, 0);
+	lAddNativeFunc("vm/quicken-stats", "", "Return how many times the VM quickened or de-quickened an op since runtime startup", lnfQuickenStats, 0);
+	lAddNativeFunc("vm/method-cache-stats", "", "Return how many keyword method calls were resolved by an inline cache since runtime startup", lnfMethodCacheStats, 0);
+	lAddNativeFunc("vm/opcode-profile", "", "Return a list of (count . ops) for every opcode pair/triple executed, needs an instrumented build", lOpcodeProfile, 0);
 
 	lAddNativeFuncV("int",   "(α)", "Convert α into an integer number", lnfInt, NFUNC_PURE);
 	lAddNativeFuncV("float", "(α)", "Convert α into a floating-point number", lnfFloat, NFUNC_PURE);
@@ -241,7 +274,7 @@ void lOperationsCore(){
 
 	lAddNativeFuncV("image/serialize",   "(val)", "Serializes val into a binary representation that can be stored", lnfSerialize, 0);
 	lAddNativeFuncV("image/deserialize", "(buf)", "Deserializes buf into a value", lnfDeserialize, 0);
-	lAddNativeFunc("symbol-table", "()", "Returns the global symbol table", lnfSymbolTable, 0);
+	lAddNativeFunc("symbol-table", "()", "Returns the global symbol table", lSymbolTableMap, 0);
 
 	lAddNativeMethodV(&lClassList[ltNil],     lSymLTString, "(self)", lnfNilToString, NFUNC_PURE);
 	lAddNativeMethodV(&lClassList[ltInt],     lSymLTString, "(self)", lnfIntToString, NFUNC_PURE);
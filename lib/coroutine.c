@@ -0,0 +1,68 @@
+/* Nujel - Copyright (C) 2020-2022 - Benjamin Vincent Schulenburg
+ * This project uses the MIT license, a copy should be included under /LICENSE */
+#ifndef NUJEL_AMALGAMATION
+#include "nujel-private.h"
+#endif
+
+/*
+ * Coroutines run on their own set of VM stacks, so resuming one or yielding
+ * from one is just a matter of lBytecodeEval swapping stacks, without
+ * recursing on the C stack. The natives below only check their arguments and
+ * leave a request for the VM, which is why yield can't cross a native
+ * function that calls back into Nujel.
+ */
+
+static lVal lnfCoroutineNew(lVal fun){
+	if(unlikely(lValType(fun) != ltLambda)){
+		return lValException(lSymTypeError, "Need a function to run as a coroutine", fun);
+	}
+	lCoroutine *co = lCoroutineAllocRaw();
+	co->fun = fun;
+	co->state = lcsFresh;
+	co->thread.csp = co->thread.sp = -1;
+	return lValAlloc(ltCoroutine, co);
+}
+
+static lVal lnfResume(lVal co, lVal v){
+	if(unlikely(lValType(co) != ltCoroutine)){
+		return lValException(lSymTypeError, "Need a coroutine", co);
+	}
+	switch(lValGetCoroutine(co)->state){
+	case lcsRunning:
+		return lValException(lSymTypeError, "Can't resume a coroutine that is already running", co);
+	case lcsDone:
+		return lValException(lSymTypeError, "Can't resume a coroutine that has already finished", co);
+	default:
+		break;
+	}
+	lCoroutineRequest = lcrResume;
+	lCoroutineTarget = lValGetCoroutine(co);
+	lCoroutineTransfer = v;
+	return lCoroutineSwitch;
+}
+
+static lVal lnfYield(lVal v){
+	lCoroutineRequest = lcrYield;
+	lCoroutineTransfer = v;
+	return lCoroutineSwitch;
+}
+
+static lVal lnfCoroutineStatus(lVal co){
+	if(unlikely(lValType(co) != ltCoroutine)){
+		return lValException(lSymTypeError, "Need a coroutine", co);
+	}
+	switch(lValGetCoroutine(co)->state){
+	default:
+	case lcsFresh:     return lValKeyword("fresh");
+	case lcsSuspended: return lValKeyword("suspended");
+	case lcsRunning:   return lValKeyword("running");
+	case lcsDone:      return lValKeyword("done");
+	}
+}
+
+void lOperationsCoroutine(){
+	lAddNativeFuncV ("coroutine/new",    "(fun)",    "Return a new coroutine that will call FUN with the value passed to the first resume", lnfCoroutineNew, 0);
+	lAddNativeFuncV ("coroutine/status", "(co)",     "Return whether CO is :fresh, :suspended, :running or :done", lnfCoroutineStatus, 0);
+	lAddNativeFuncVV("resume",           "(co v)",   "Continue CO, returning what it yields next, or returns. V is what the yield CO is suspended in returns", lnfResume, 0);
+	lAddNativeFuncV ("yield",            "(v)",      "Suspend the current coroutine, making resume return V", lnfYield, 0);
+}
@@ -2,28 +2,42 @@
  * This project uses the MIT license, a copy should be included under /LICENSE */
 
 /*
- * Contains a terrible implementation of a mark-sweep garbage collector, but it
- * is good enough for now.
+ * Contains a generational, non-moving, mark-sweep garbage collector.
+ *
+ * Objects that survive a collection become old, from then on minor
+ * collections treat them as live without looking at them. Instead the write
+ * barrier remembers old objects that had a reference stored into them since
+ * the last collection, those are then marked again, so young objects only
+ * reachable through them survive as well. Every once in a while, when the
+ * old generation has grown enough, a major collection looks at the entire
+ * heap. Symbols are only freed by major collections.
  */
 #ifndef NUJEL_AMALGAMATION
 #include "nujel-private.h"
 #endif
 
-int lGCRuns = 0;
+THREAD_LOCAL int lGCRuns = 0;
 
-u8 fileDescriptorMarkMap[MAX_OPEN_FILE_DESCRIPTORS];
+/* Pause times of minor/major collections, bucket N counts pauses taking
+ * less than 2^(N+1) microseconds, the last one everything beyond. */
+#define GC_PAUSE_BUCKETS 20
+static THREAD_LOCAL u64 lGCPauses[2][GC_PAUSE_BUCKETS];
+static THREAD_LOCAL u64 lGCPauseTotal[2];
+static THREAD_LOCAL u64 lGCPauseMax[2];
 
-#define defineAllocator(T, TMAX) u8 T##MarkMap[TMAX];
-allocatorTypes()
-defineAllocator(lSymbol, SYM_MAX)
-defineAllocator(lNFunc, NFN_MAX)
-#undef defineAllocator
+THREAD_LOCAL u8 fileDescriptorMarkMap[MAX_OPEN_FILE_DESCRIPTORS];
+
+THREAD_LOCAL u8 lNFuncMarkMap[NFN_MAX];
+
+static inline u8 *lNFuncMarkOf(const lNFunc *v){
+	return &lNFuncMarkMap[v - lNFuncList];
+}
 
 #define markerPrefix(T) \
 if(unlikely(v == NULL)){return;} \
-const uint ci = v - T##List; \
-if(T##MarkMap[ci]){return;} \
-T##MarkMap[ci] = 1
+u8 *mark = T##MarkOf(v); \
+if(*mark){return;} \
+*mark = GC_MARKED
 
 static void lValGCMark         (lVal v);
 static void lBufferGCMark      (const lBuffer *v);
@@ -36,95 +50,149 @@ static void lArrayGCMark       (const lArray *v);
 static void lNFuncGCMark       (const lNFunc *f);
 static void lSymbolGCMark      (const lSymbol *v);
 static void lThreadGCMark      (lThread *c);
-static void lBytecodeArrayMark (const lBytecodeArray *v);
-
+static void lCoroutineGCMark   (lCoroutine *v);
+static void lBytecodeArrayGCMark (const lBytecodeArray *v);
+
+
+/* Put V onto the free list of its segment */
+#define defineAllocator(T, typeMax) \
+static inline void T##FreeSlot(T *v){\
+	T##Segment *seg = T##SegmentOf(v);\
+	v->nextFree = seg->freeList;\
+	seg->freeList = v;\
+	seg->markMap[v - seg->list] = GC_FREE;\
+	T##Active--;\
+}
+allocatorTypes()
+#undef defineAllocator
 
 static void lBufferFree(lBuffer *buf){
 	if(!(buf->flags & BUFFER_STATIC)){
 		free(buf->buf);
 	}
-	buf->nextFree = lBufferFFree;
-	lBufferActive--;
-	lBufferFFree = buf;
-	lBufferMarkMap[buf - lBufferList] = 2;
+	lBufferFreeSlot(buf);
 }
 
-
 static void lBufferViewFree(lBufferView *buf){
-	buf->nextFree = lBufferViewFFree;
-	lBufferViewActive--;
-	lBufferViewFFree = buf;
-	lBufferViewMarkMap[buf - lBufferViewList] = 2;
+	lBufferViewFreeSlot(buf);
 }
 
 static void lBytecodeArrayFree(lBytecodeArray *v){
 	if(!(v->flags & BUFFER_STATIC)){
-		free(v->data);
+		lSlabFree(v->data, (v->dataEnd - v->data) * sizeof(lBytecodeOp));
 	}
-	v->nextFree = lBytecodeArrayFFree;
-	lBytecodeArrayActive--;
-	lBytecodeArrayFFree = v;
-	lBytecodeArrayMarkMap[v - lBytecodeArrayList] = 2;
-}
-
-static void lNFuncFree(lNFunc *n){
-	(void)n;
+	lBytecodeArrayFreeSlot(v);
 }
 
 static void lArrayFree(lArray *v){
-	free(v->data);
-	v->nextFree = lArrayFFree;
-	lArrayFFree = v;
-	lArrayActive--;
-	lArrayMarkMap[v - lArrayList] = 2;
+	lSlabFree(v->data, lArrayDataBytes(v->length));
+	v->data = NULL;
+	lArrayFreeSlot(v);
 }
 
 static void lClosureFree(lClosure *clo){
-	clo->nextFree = lClosureFFree;
-	lClosureFFree = clo;
-	lClosureActive--;
-	lClosureMarkMap[clo - lClosureList] = 2;
+	lClosureFreeSlot(clo);
 }
 
 static void lTreeFree(lTree *t){
-	t->nextFree = lTreeFFree;
-	lTreeFFree = t;
-	lTreeActive--;
-	lTreeMarkMap[t - lTreeList] = 2;
+	#ifdef NUJEL_TREE_HAMT
+	if(t->flags & TREE_BRANCH){
+		lSlabFree(t->children, t->length * sizeof(lTree *));
+		t->children = NULL;
+	}
+	#endif
+	lTreeFreeSlot(t);
 }
 
 static void lMapFree(lMap *t){
-	free(t->entries);
+	lSlabFree(t->entries, lMapAllocationSize(t->size));
 	t->entries = NULL;
-	t->nextFree = lMapFFree;
-	lMapFFree = t;
-	lMapActive--;
-	lMapMarkMap[t - lMapList] = 2;
+	lMapFreeSlot(t);
 }
 
 static void lTreeRootFree(lTreeRoot *t){
-	t->nextFree = lTreeRootFFree;
-	lTreeRootFFree = t;
-	lTreeRootActive--;
-	lTreeRootMarkMap[t - lTreeRootList] = 2;
+	lTreeRootFreeSlot(t);
+}
+
+static void lCoroutineFree(lCoroutine *v){
+	free(v->thread.closureStack);
+	free(v->thread.valueStack);
+	v->thread.closureStack = NULL;
+	v->thread.valueStack = NULL;
+	lCoroutineFreeSlot(v);
 }
 
 static void lPairFree(lPair *cons){
 	cons->car = NIL;
-	cons->nextFree = lPairFFree;
-	lPairFFree = cons;
-	lPairActive--;
-	lPairMarkMap[cons - lPairList] = 2;
+	lPairFreeSlot(cons);
+}
+
+#ifdef NUJEL_NAN_BOXING
+static void lBoxedIntFree(lBoxedInt *v){
+	lBoxedIntFreeSlot(v);
+}
+
+static void lBoxedIntGCMark(const lBoxedInt *v){
+	markerPrefix(lBoxedInt);
+}
+#endif
+
+/* Objects that have been marked but whose references still need to be looked
+ * at are pushed onto the grey stack instead of recursing on the C stack, that
+ * way the depth of the data doesn't matter. */
+typedef enum {
+	lgcPair,
+	lgcArray,
+	lgcClosure,
+	lgcTree,
+	lgcMap,
+	lgcNFunc
+} lGreyType;
+
+typedef struct {
+	const void *v;
+	lGreyType T;
+} lGreyObject;
+
+static THREAD_LOCAL lGreyObject *lGreyStack = NULL;
+static THREAD_LOCAL uint lGreyStackSize = 0;
+static THREAD_LOCAL uint lGreyStackCapacity = 0;
+
+static void lGreyStackGrow(){
+	lGreyStackCapacity = MAX(1024, lGreyStackCapacity * 2);
+	lGreyObject *t = realloc(lGreyStack, lGreyStackCapacity * sizeof(lGreyObject));
+	if(unlikely(t == NULL)){
+		fprintf(stderr, "OOM: Couldn't grow the GC mark stack\n");
+		exit(123);
+	}
+	lGreyStack = t;
+}
+
+static inline void lGreyPush(lGreyType T, const void *v){
+	if(unlikely(lGreyStackSize >= lGreyStackCapacity)){
+		lGreyStackGrow();
+	}
+	prefetch(v);
+	lGreyStack[lGreyStackSize++] = (lGreyObject){v, T};
 }
 
 static void lThreadGCMark(lThread *c){
-	lBytecodeArrayMark(c->text);
+	lBytecodeArrayGCMark(c->text);
 	for(int i=0;i <= c->csp;i++){
 		lClosureGCMark(c->closureStack[i]);
 	}
 	for(int i=0;i <= c->sp;i++){
 		lValGCMark(c->valueStack[i]);
 	}
+	lCoroutineGCMark(c->coroutine);
+}
+
+/* While a coroutine is running its thread holds the stacks of whoever
+ * resumed it, so marking it also marks every coroutine further up */
+static void lCoroutineGCMark(lCoroutine *v){
+	markerPrefix(lCoroutine);
+	lValGCMark(v->fun);
+	lThreadGCMark(&v->thread);
 }
 
 static void lBufferGCMark(const lBuffer *v){
@@ -134,7 +202,7 @@ static void lBufferGCMark(const lBuffer *v){
 static void lBufferViewGCMark(const lBufferView *v){
 	markerPrefix(lBufferView);
 
-	lBufferGCMark(lBufferViewList[ci].buf);
+	lBufferGCMark(v->buf);
 }
 
 static void lSymbolGCMark(const lSymbol *v){
@@ -143,54 +211,58 @@ static void lSymbolGCMark(const lSymbol *v){
 
 static void lNFuncGCMark(const lNFunc *v){
 	markerPrefix(lNFunc);
-
-	lValGCMark(v->args);
-	lTreeGCMark(v->meta);
+	lGreyPush(lgcNFunc, v);
 }
 
 static void lPairGCMark(const lPair *v){
 	markerPrefix(lPair);
-
-	lValGCMark(v->car);
-	lValGCMark(v->cdr);
+	lGreyPush(lgcPair, v);
 }
 
 static void lValGCMark(lVal v){
-	switch(v.type){
+	switch(lValType(v)){
 	case ltPair:
-		lPairGCMark(v.vList);
+		lPairGCMark(lValGetPair(v));
 		break;
 	case ltMacro:
 	case ltEnvironment:
 	case ltLambda:
-		lClosureGCMark(v.vClosure);
+		lClosureGCMark(lValGetClosure(v));
 		break;
 	case ltArray:
-		lArrayGCMark(v.vArray);
+		lArrayGCMark(lValGetArray(v));
 		break;
 	case ltNativeFunc:
-		lNFuncGCMark(v.vNFunc);
+		lNFuncGCMark(lValGetNFunc(v));
 		break;
 	case ltKeyword:
 	case ltSymbol:
-		lSymbolGCMark(v.vSymbol);
+		lSymbolGCMark(lValGetSymbol(v));
 		break;
 	case ltMap:
-		lMapGCMark(v.vMap);
+		lMapGCMark(lValGetMap(v));
 		break;
 	case ltTree:
-		lTreeRootGCMark(v.vTree);
+		lTreeRootGCMark(lValGetTreeRoot(v));
 		break;
 	case ltBytecodeArr:
-		lBytecodeArrayMark(v.vBytecodeArr);
+		lBytecodeArrayGCMark(lValGetBytecodeArray(v));
 		break;
 	case ltString:
 	case ltBuffer:
-		lBufferGCMark(v.vBuffer);
+		lBufferGCMark(lValGetBuffer(v));
 		break;
 	case ltBufferView:
-		lBufferViewGCMark(v.vBufferView);
+		lBufferViewGCMark(lValGetBufferView(v));
+		break;
+	case ltCoroutine:
+		lCoroutineGCMark(lValGetCoroutine(v));
 		break;
+	#ifdef NUJEL_NAN_BOXING
+	case ltInt:
+		lBoxedIntGCMark(lValGetBoxedInt(v));
+		break;
+	#endif
 	default:
 		break;
 	}
@@ -198,21 +270,12 @@ static void lValGCMark(lVal v){
 
 static void lMapGCMark(const lMap *v){
 	markerPrefix(lMap);
-	for(int i=0;i<v->size;i++){
-		if(v->entries[i].key.type == ltNil){continue;}
-		lValGCMark(v->entries[i].key);
-		lValGCMark(v->entries[i].val);
-	}
+	lGreyPush(lgcMap, v);
 }
 
 static void lTreeGCMark(const lTree *v){
 	markerPrefix(lTree);
-
-	lSymbolGCMark(v->key);
-	lValGCMark(v->value);
-
-	lTreeGCMark(v->left);
-	lTreeGCMark(v->right);
+	lGreyPush(lgcTree, v);
 }
 
 static void lTreeRootGCMark(const lTreeRoot *v){
@@ -222,26 +285,113 @@ static void lTreeRootGCMark(const lTreeRoot *v){
 
 static void lClosureGCMark(const lClosure *v){
 	markerPrefix(lClosure);
+	lGreyPush(lgcClosure, v);
+}
+
+static void lArrayGCMark(const lArray *v){
+	markerPrefix(lArray);
+	lGreyPush(lgcArray, v);
+}
 
+static void lBytecodeArrayGCMark(const lBytecodeArray *v){
+	markerPrefix(lBytecodeArray);
+	lArrayGCMark(v->literals);
+}
+
+/* Lists are walked along their cdr right away, so even very long ones only
+ * ever take up a single entry on the grey stack */
+static void lPairGCScan(const lPair *v){
+	while(true){
+		lValGCMark(v->car);
+		if(lValType(v->cdr) != ltPair){
+			lValGCMark(v->cdr);
+			return;
+		}
+		v = lValGetPair(v->cdr);
+		u8 *mark = lPairMarkOf(v);
+		if(*mark){return;}
+		*mark = GC_MARKED;
+	}
+}
+
+static void lNFuncGCScan(const lNFunc *v){
+	lSymbolGCMark(v->name);
+	lValGCMark(v->args);
+	lTreeGCMark(v->meta);
+}
+
+static void lMapGCScan(const lMap *v){
+	for(uint i=0;i<v->size;i++){
+		if(lValType(v->entries[i].key) == ltNil){continue;}
+		lValGCMark(v->entries[i].key);
+		lValGCMark(v->entries[i].val);
+	}
+}
+
+static void lTreeGCScan(const lTree *v){
+	#ifdef NUJEL_TREE_HAMT
+	if(v->flags & TREE_BRANCH){
+		for(uint i=0;i<v->length;i++){
+			lTreeGCMark(v->children[i]);
+		}
+		return;
+	}
+	#else
+	lTreeGCMark(v->left);
+	lTreeGCMark(v->right);
+	#endif
+	lSymbolGCMark(v->key);
+	lValGCMark(v->value);
+}
+
+static void lClosureGCScan(const lClosure *v){
 	lClosureGCMark(v->parent);
 	lTreeGCMark(v->data);
 	lTreeGCMark(v->meta);
-	lBytecodeArrayMark(v->text);
+	lBytecodeArrayGCMark(v->text);
 	lValGCMark(v->args);
+	for(int i=0;i<v->slotCount;i++){
+		lValGCMark(v->slots[i]);
+	}
 }
 
-static void lArrayGCMark(const lArray *v){
-	markerPrefix(lArray);
-
+static void lArrayGCScan(const lArray *v){
 	for(int i=0;i<v->length;i++){
 		lValGCMark(v->data[i]);
 	}
 }
 
-static void lBytecodeArrayMark(const lBytecodeArray *v){
-	markerPrefix(lBytecodeArray);
-
-	lArrayGCMark(v->literals);
+/* Look at everything on the grey stack until it is empty, marking all the
+ * objects referenced by it. With a DEADLINE other than 0 we might stop
+ * early, returning whether the grey stack has been emptied. */
+static bool lGreyStackDrain(u64 deadline){
+	for(uint steps=1; lGreyStackSize; steps++){
+		if(deadline && ((steps & 0xFF) == 0) && (getUSecs() >= deadline)){
+			return false;
+		}
+		const lGreyObject o = lGreyStack[--lGreyStackSize];
+		switch(o.T){
+		case lgcPair:
+			lPairGCScan(o.v);
+			break;
+		case lgcArray:
+			lArrayGCScan(o.v);
+			break;
+		case lgcClosure:
+			lClosureGCScan(o.v);
+			break;
+		case lgcTree:
+			lTreeGCScan(o.v);
+			break;
+		case lgcMap:
+			lMapGCScan(o.v);
+			break;
+		case lgcNFunc:
+			lNFuncGCScan(o.v);
+			break;
+		}
+	}
+	return true;
 }
 
 /* Mark every single root and everything they point to */
@@ -255,36 +405,559 @@ static void lRootsMark(){
 	for(uint i=0;i<lNFuncMax;i++){
 		lNFuncGCMark(&lNFuncList[i]);
 	}
-	lMapGCMark(lSymbolTable);
+	lMapGCMark(lStringInternTable);
 }
 
 lSymbol *lRootsSymbolPush(lSymbol *v){
-	lSymbolMarkMap[v - lSymbolList] = 2;
+	*lSymbolMarkOf(v) = GC_OLD;
 	return v;
 }
 
-/* Free all values that have not been marked by lGCMark */
-static void lGCSweep(){
-	#define defineAllocator(T, TMAX) \
-	for(uint i=0;i < T##Max;i++){\
-		if(T##MarkMap[i] == 0) {\
-			T##Free(&T##List[i]);\
+/* Whether we are in the middle of an incremental collection, and if it is a
+ * major one. lGCMaxPause is the amount of microseconds a single increment
+ * should take at most, 0 meaning collections are done in one go. */
+static THREAD_LOCAL bool lGCMarking = false;
+static THREAD_LOCAL bool lGCMajor = false;
+THREAD_LOCAL u64 lGCMaxPause = 0;
+static THREAD_LOCAL u64 lGCIncrements = 0;
+
+/* Cumulative statistics, times are in microseconds */
+static THREAD_LOCAL uint lGCMajorRuns = 0;
+static THREAD_LOCAL uint lGCHeapLimitTriggers = 0;
+static THREAD_LOCAL u64 lGCMarkTime = 0;
+static THREAD_LOCAL u64 lGCSweepFinishTime = 0;
+
+/* The amount of objects that were alive after the last collection, once
+ * that grows beyond the major threshold the next collection looks at the
+ * entire heap. */
+#define defineAllocator(T, typeMax) \
+static THREAD_LOCAL uint T##Old = 0;\
+static THREAD_LOCAL uint T##MajorThreshold = typeMax;\
+static THREAD_LOCAL bool T##SweepMajor = false;\
+static THREAD_LOCAL u64 T##AllocatedTotal = 0;\
+static THREAD_LOCAL u64 T##SweepTime = 0;\
+static THREAD_LOCAL uint T##Triggers = 0;
+allocatorTypes()
+#undef defineAllocator
+
+/* Mark everything reachable from old objects the write barrier has caught,
+ * they are turned young again so that their marker looks at them. This
+ * happens at the start of minor collections and once more at the end of
+ * every collection, to catch objects that were written to while we were
+ * marking incrementally. */
+#define defineAllocator(T, typeMax) \
+static void T##MarkDirty(){\
+	for(uint s=0;s < T##SegmentCount;s++){\
+		T##Segment *seg = T##Segments[s];\
+		if(!seg->dirty){continue;}\
+		for(uint i=0;i < seg->used;i++){\
+			if(seg->markMap[i] == GC_DIRTY){\
+				seg->markMap[i] = GC_YOUNG;\
+				T##GCMark(&seg->list[i]);\
+			}\
+		}\
+	}\
+}
+allocatorTypes()
+#undef defineAllocator
+
+/* Before a major collection every object has to be considered young again,
+ * otherwise we wouldn't find out about old objects that became garbage. */
+#define defineAllocator(T, typeMax) \
+static void T##Rejuvenate(){\
+	for(uint s=0;s < T##SegmentCount;s++){\
+		T##Segment *seg = T##Segments[s];\
+		for(uint i=0;i < seg->used;i++){\
+			if(seg->markMap[i] >= GC_OLD){\
+				seg->markMap[i] = GC_YOUNG;\
+			}\
+		}\
+		seg->dirty = false;\
+	}\
+}
+allocatorTypes()
+#undef defineAllocator
+
+/* Free all young values in SEG that have not been marked, survivors become
+ * old. Segments are swept lazily by the allocator once it needs room, minor
+ * collections can skip segments that nothing was allocated in, or written
+ * to, since the last collection. */
+#define defineAllocator(T, typeMax) \
+void T##SweepSegment(T##Segment *seg){\
+	if(!T##SweepMajor && !seg->young && !seg->dirty){return;}\
+	const u64 start = getUSecs();\
+	uint live = 0;\
+	bool dirty = false;\
+	for(uint i=0;i < seg->used;i++){\
+		switch(seg->markMap[i]){\
+		case GC_YOUNG:\
+			T##Free(&seg->list[i]);\
+			break;\
+		case GC_MARKED:\
+			seg->markMap[i] = GC_OLD;\
+			live++;\
+			break;\
+		case GC_OLD:\
+			live++;\
+			break;\
+		case GC_DIRTY:\
+			dirty = true;\
+			live++;\
+			break;\
+		}\
+	}\
+	seg->live = live;\
+	seg->young = false;\
+	seg->dirty = dirty;\
+	T##SweepTime += getUSecs() - start;\
+}
+allocatorTypes()
+#undef defineAllocator
+
+/* Sweep whatever segments the allocator hasn't gotten to yet, which has to
+ * happen before the next collection can start marking. Afterwards we know
+ * how many objects survived, after a major collection segments without any
+ * live objects are given back to the OS, as long as enough room remains for
+ * the nursery. */
+#define defineAllocator(T, typeMax) \
+static void T##SweepFinish(){\
+	if(T##FFree){\
+		T##SegmentOf(T##FFree)->freeList = T##FFree;\
+		T##FFree = NULL;\
+	}\
+	if(T##SweepPending){\
+		for(uint s=T##SweepCursor;s < T##SegmentCount;s++){\
+			T##SweepSegment(T##Segments[s]);\
+		}\
+		T##SweepPending = false;\
+	}\
+	uint live = 0;\
+	for(uint s=0;s < T##SegmentCount;s++){\
+		live += T##Segments[s]->live;\
+	}\
+	T##Old = live;\
+	if(T##SweepMajor){\
+		T##SweepMajor = false;\
+		T##MajorThreshold = MAX(typeMax, live * 2);\
+		const uint needed = live + HEAP_NURSERY_CAPACITY(T, typeMax);\
+		uint capacity = T##SegmentCount * HEAP_SEGMENT_CAPACITY(T);\
+		uint kept = 0;\
+		for(uint s=0;s < T##SegmentCount;s++){\
+			T##Segment *seg = T##Segments[s];\
+			if((seg->live == 0) && !seg->young && ((capacity - HEAP_SEGMENT_CAPACITY(T)) >= needed)){\
+				capacity -= HEAP_SEGMENT_CAPACITY(T);\
+				lHeapSegmentFree(seg);\
+			}else{\
+				T##Segments[kept++] = seg;\
+			}\
 		}\
-		T##MarkMap[i] = T##MarkMap[i]&2;\
+		T##SegmentCount = kept;\
+	}\
+	T##SweepCursor = 0;\
+}
+allocatorTypes()
+#undef defineAllocator
+
+/* Everything has been marked, so the allocator may start sweeping */
+#define defineAllocator(T, typeMax) \
+static void T##SweepStart(bool major){\
+	if(T##FFree){\
+		T##SegmentOf(T##FFree)->freeList = T##FFree;\
+		T##FFree = NULL;\
+	}\
+	T##SweepCursor = 0;\
+	T##SweepPending = true;\
+	T##SweepMajor = major;\
+	T##AllocatedTotal += T##Allocated;\
+	T##Allocated = 0;\
+	T##GCThreshold = HEAP_NURSERY_CAPACITY(T, typeMax);\
+}
+allocatorTypes()
+#undef defineAllocator
+
+/* While marking incrementally we come back for the next increment after a
+ * fraction of the nursery has been allocated */
+#define defineAllocator(T, typeMax) \
+static void T##PaceIncrement(){\
+	T##GCThreshold = T##Allocated + MAX(64, HEAP_NURSERY_CAPACITY(T, typeMax) / 16);\
+}
+allocatorTypes()
+#undef defineAllocator
+
+/* Whether the next collection has to be a major one, which is the case once
+ * any old generation, or the amount of symbols, has grown past its threshold */
+static bool lGCNeedsMajor(){
+	if(lGCShouldRunMajor || !lGCGenerational || (lSymbolActive >= lSymbolMajorThreshold)){
+		return true;
 	}
+	#define defineAllocator(T, typeMax) if(T##Old >= T##MajorThreshold){ return true; }
 	allocatorTypes()
-	defineAllocator(lSymbol, SYM_MAX)
-	defineAllocator(lNFunc, NFN_MAX)
 	#undef defineAllocator
+	return false;
 }
 
-/* Force a garbage collection cycle, shouldn't need to be called manually since
- * when the heap is exhausted the GC is run */
-void lGarbageCollect(lThread *ctx){
+static void lGCRecordPause(bool major, u64 usecs){
+	int bucket = 0;
+	for(u64 t = usecs >> 1; t && (bucket < (GC_PAUSE_BUCKETS-1)); t >>= 1){
+		bucket++;
+	}
+	lGCPauses[major][bucket]++;
+	lGCPauseTotal[major] += usecs;
+	lGCPauseMax[major] = MAX(lGCPauseMax[major], usecs);
+}
+
+/* Mark every root, whatever they point to gets marked over the next couple
+ * of increments */
+static void lGCStart(lThread *ctx){
+	#define defineAllocator(T, typeMax) if(T##Allocated >= T##GCThreshold){ T##Triggers++; }
+	allocatorTypes()
+	#undef defineAllocator
+	if(lGCShouldRunMajor){
+		lGCHeapLimitTriggers++;
+	}
+
+	const u64 sweepStart = getUSecs();
+	#define defineAllocator(T, typeMax) T##SweepFinish();
+	allocatorTypes()
+	#undef defineAllocator
+	lSlabReclaim();
+	lGCSweepFinishTime = getUSecs() - sweepStart;
+
 	lGCRuns++;
+	lGCMajor = lGCNeedsMajor();
+	lGCMajorRuns += lGCMajor;
+	lGCShouldRunMajor = false;
+	if(lGCMajor){
+		#define defineAllocator(T, typeMax) T##Rejuvenate();
+		allocatorTypes()
+		#undef defineAllocator
+	}else{
+		#define defineAllocator(T, typeMax) T##MarkDirty();
+		allocatorTypes()
+		#undef defineAllocator
+	}
+	lRootsMark();
+	for(lThread *t = ctx; t; t = t->parent){
+		lThreadGCMark(t);
+	}
+	lGCMarking = true;
+}
+
+/* Since the roots aren't protected by a write barrier we have to mark them
+ * once more, together with everything written to while we were marking
+ * incrementally, afterwards we can start sweeping. */
+static void lGCFinish(lThread *ctx){
+	#define defineAllocator(T, typeMax) T##MarkDirty();
+	allocatorTypes()
+	#undef defineAllocator
+	lGreyStackDrain(0);
 	lRootsMark();
-	lThreadGCMark(ctx);
+	lGreyStackDrain(0);
+	/* Nested evaluations, e.g. natives calling back into Nujel, still
+	 * have live values on the stacks of the outer ones */
+	for(lThread *t = ctx; t; t = t->parent){
+		lThreadGCMark(t);
+		lGreyStackDrain(0);
+	}
+
+	#define defineAllocator(T, typeMax) T##SweepStart(lGCMajor);
+	allocatorTypes()
+	#undef defineAllocator
+	lSymbolSweep(lGCMajor);
+	for(uint i=0;i < lNFuncMax;i++){
+		lNFuncMarkMap[i] = lNFuncMarkMap[i]&2;
+	}
+	lMethodCacheInvalidate();
+	lGCMarking = false;
+}
 
-	lGCSweep();
+/* Run a garbage collection cycle, or the next increment of one when a
+ * maximum pause has been set. Shouldn't need to be called manually since
+ * the allocator asks for a collection once enough objects have been
+ * allocated, which then happens at the next safe point. */
+void lGarbageCollect(lThread *ctx){
+	const u64 start = getUSecs();
+	lGCSweepFinishTime = 0;
+	if(!lGCMarking){
+		lGCStart(ctx);
+	}
+	lGCIncrements++;
+	/* When we are about to run out of memory we can't afford to wait */
+	const u64 deadline = (lGCMaxPause && !lGCShouldRunMajor) ? start + lGCMaxPause : 0;
+	if(lGreyStackDrain(deadline)){
+		lGCFinish(ctx);
+	}else{
+		#define defineAllocator(T, typeMax) T##PaceIncrement();
+		allocatorTypes()
+		#undef defineAllocator
+	}
 	lGCShouldRunSoon = false;
+	const u64 pause = getUSecs() - start;
+	lGCMarkTime += pause - lGCSweepFinishTime;
+	lGCRecordPause(lGCMajor, pause);
+}
+
+/* Free every single object, regardless of whether it is still reachable,
+ * together with all the memory held by the heaps of this isolate */
+#define defineAllocator(T, typeMax) \
+static void T##Destroy(){\
+	for(uint s=0;s < T##SegmentCount;s++){\
+		T##Segment *seg = T##Segments[s];\
+		for(uint i=0;i < seg->used;i++){\
+			if(seg->markMap[i] != GC_FREE){\
+				T##Free(&seg->list[i]);\
+			}\
+		}\
+	}\
+	T##Old = 0;\
+	T##MajorThreshold = typeMax;\
+	T##SweepMajor = false;\
+}
+allocatorTypes()
+#undef defineAllocator
+
+void lHeapDestroy(){
+	#define defineAllocator(T, typeMax) T##Destroy();
+	allocatorTypes()
+	#undef defineAllocator
+	lAllocatorDestroy();
+	lSlabDestroy();
+	free(lGreyStack);
+	lGreyStack = NULL;
+	lGreyStackSize = lGreyStackCapacity = 0;
+	lGCMarking = lGCMajor = false;
+	memset(lNFuncMarkMap, 0, sizeof(lNFuncMarkMap));
+}
+
+/* Collections shouldn't pause for more than USECS microseconds at a time,
+ * 0 meaning there is no limit. Only marking is done incrementally, the
+ * final increment still has to look at all roots and everything written
+ * to while marking. */
+void lSetGCMaxPause(u64 usecs){
+	lGCMaxPause = usecs;
+}
+
+/* Bytes held by V outside of its heap segment */
+static size_t lArrayExternalBytes(const lArray *v){
+	return v->data ? lSlabBlockBytes(lArrayDataBytes(v->length)) : 0;
+}
+
+static size_t lBufferExternalBytes(const lBuffer *v){
+	return (v->buf && !(v->flags & BUFFER_STATIC)) ? v->length : 0;
+}
+
+static size_t lMapExternalBytes(const lMap *v){
+	return v->entries ? lSlabBlockBytes(lMapAllocationSize(v->size)) : 0;
+}
+
+static size_t lBytecodeArrayExternalBytes(const lBytecodeArray *v){
+	return (v->data && !(v->flags & BUFFER_STATIC)) ? lSlabBlockBytes((v->dataEnd - v->data) * sizeof(lBytecodeOp)) : 0;
+}
+
+static size_t lClosureExternalBytes(const lClosure *v){ (void)v; return 0; }
+#ifdef NUJEL_TREE_HAMT
+static size_t lTreeExternalBytes(const lTree *v){
+	return (v->flags & TREE_BRANCH) ? lSlabBlockBytes(v->length * sizeof(lTree *)) : 0;
+}
+#else
+static size_t lTreeExternalBytes(const lTree *v){ (void)v; return 0; }
+#endif
+static size_t lTreeRootExternalBytes(const lTreeRoot *v){ (void)v; return 0; }
+static size_t lBufferViewExternalBytes(const lBufferView *v){ (void)v; return 0; }
+static size_t lPairExternalBytes(const lPair *v){ (void)v; return 0; }
+
+static size_t lCoroutineExternalBytes(const lCoroutine *v){
+	return (v->thread.valueStack ? v->thread.valueStackSize * sizeof(lVal) : 0)
+		+ (v->thread.closureStack ? v->thread.closureStackSize * sizeof(lClosure *) : 0);
+}
+#ifdef NUJEL_NAN_BOXING
+static size_t lBoxedIntExternalBytes(const lBoxedInt *v){ (void)v; return 0; }
+#endif
+
+/* Statistics about a single type heap, EXTERNAL only gets calculated if it
+ * is requested since we have to look at every single object */
+typedef struct {
+	u64 active;
+	u64 capacity;
+	u64 segments;
+	u64 nursery;
+	u64 threshold;
+	u64 allocated;
+	u64 triggers;
+	u64 sweepTime;
+	u64 external;
+} lHeapStats;
+
+#define defineAllocator(T, typeMax) \
+static lHeapStats T##Stats(bool external){\
+	lHeapStats ret = {\
+		.active    = T##Active,\
+		.capacity  = (u64)T##SegmentCount * HEAP_SEGMENT_CAPACITY(T),\
+		.segments  = T##SegmentCount,\
+		.nursery   = HEAP_NURSERY_CAPACITY(T, typeMax),\
+		.threshold = T##GCThreshold,\
+		.allocated = T##AllocatedTotal + T##Allocated,\
+		.triggers  = T##Triggers,\
+		.sweepTime = T##SweepTime\
+	};\
+	for(uint s=0;external && (s < T##SegmentCount);s++){\
+		const T##Segment *seg = T##Segments[s];\
+		for(uint i=0;i < seg->used;i++){\
+			if(seg->markMap[i] != GC_FREE){\
+				ret.external += T##ExternalBytes(&seg->list[i]);\
+			}\
+		}\
+	}\
+	return ret;\
+}
+allocatorTypes()
+#undef defineAllocator
+
+static void lHeapStatsAll(lHeapStats *out, bool external){
+	int i = 0;
+	#define defineAllocator(T, typeMax) out[i++] = T##Stats(external);
+	allocatorTypes()
+	#undef defineAllocator
+}
+
+/* Return the Nujel name of a heap type, turning a C type name like
+ * lBytecodeArray into bytecode-array */
+const char *lHeapTypeName(lHeapType type){
+	static const char *cNames[lHeapTypeCount] = {
+		#define defineAllocator(T, typeMax) #T,
+		allocatorTypes()
+		#undef defineAllocator
+	};
+	static THREAD_LOCAL char names[lHeapTypeCount][32];
+	char *buf = names[type];
+	if(buf[0]){
+		return buf;
+	}
+	uint len = 0;
+	for(const char *c = cNames[type]+1; *c && (len < sizeof(names[type]) - 2); c++){
+		if((*c >= 'A') && (*c <= 'Z')){
+			if(len){ buf[len++] = '-'; }
+			buf[len++] = *c - 'A' + 'a';
+		}else{
+			buf[len++] = *c;
+		}
+	}
+	buf[len] = 0;
+	return buf;
+}
+
+/* Return some statistics about the collector, as well as every type heap.
+ * Times are in microseconds, sizes in bytes. */
+lVal lGCStats(){
+	lTree *t = lTreeInsert(NULL, lSymS("runs"), lValInt(lGCRuns));
+	t = lTreeInsert(t, lSymS("major-runs"), lValInt(lGCMajorRuns));
+	t = lTreeInsert(t, lSymS("increments"), lValInt(lGCIncrements));
+	t = lTreeInsert(t, lSymS("max-pause"), lValInt(lGCMaxPause));
+	t = lTreeInsert(t, lSymS("longest-minor-pause"), lValInt(lGCPauseMax[0]));
+	t = lTreeInsert(t, lSymS("longest-major-pause"), lValInt(lGCPauseMax[1]));
+	t = lTreeInsert(t, lSymS("mark-time"), lValInt(lGCMarkTime));
+	t = lTreeInsert(t, lSymS("heap-size"), lValInt(lHeapSize));
+	t = lTreeInsert(t, lSymS("slab-size"), lValInt(lSlabSize));
+	t = lTreeInsert(t, lSymS("heap-limit"), lValInt(lHeapLimit));
+	t = lTreeInsert(t, lSymS("heap-limit-triggers"), lValInt(lGCHeapLimitTriggers));
+	t = lTreeInsert(t, lSymS("symbols"), lValInt(lSymbolActive));
+
+	lHeapStats stats[lHeapTypeCount];
+	lHeapStatsAll(stats, true);
+	u64 sweepTime = 0;
+	lTree *types = NULL;
+	for(uint i=0;i < lHeapTypeCount;i++){
+		const lHeapStats *h = &stats[i];
+		lTree *ht = lTreeInsert(NULL, lSymS("active"), lValInt(h->active));
+		ht = lTreeInsert(ht, lSymS("capacity"), lValInt(h->capacity));
+		ht = lTreeInsert(ht, lSymS("segments"), lValInt(h->segments));
+		ht = lTreeInsert(ht, lSymS("nursery"), lValInt(h->nursery));
+		ht = lTreeInsert(ht, lSymS("threshold"), lValInt(h->threshold));
+		ht = lTreeInsert(ht, lSymS("allocated"), lValInt(h->allocated));
+		ht = lTreeInsert(ht, lSymS("triggers"), lValInt(h->triggers));
+		ht = lTreeInsert(ht, lSymS("sweep-time"), lValInt(h->sweepTime));
+		ht = lTreeInsert(ht, lSymS("external-bytes"), lValInt(h->external));
+		types = lTreeInsert(types, lSymS(lHeapTypeName(i)), lValTree(ht));
+		sweepTime += h->sweepTime;
+	}
+	t = lTreeInsert(t, lSymS("sweep-time"), lValInt(sweepTime));
+	t = lTreeInsert(t, lSymS("types"), lValTree(types));
+	return lValTree(t);
+}
+
+/* Print a summary of the collector and every type heap to FP */
+void lGCPrintStats(FILE *fp){
+	lHeapStats stats[lHeapTypeCount];
+	lHeapStatsAll(stats, true);
+	u64 sweepTime = 0;
+	for(uint i=0;i < lHeapTypeCount;i++){
+		sweepTime += stats[i].sweepTime;
+	}
+	fprintf(fp, "GC: %u runs (%u major), %llu increments, %llums marking, %llums sweeping\n",
+		lGCRuns, lGCMajorRuns,
+		(unsigned long long)lGCIncrements,
+		(unsigned long long)lGCMarkTime / 1000,
+		(unsigned long long)sweepTime / 1000);
+	fprintf(fp, "Heap: %lluKB in segments, %lluKB in slabs", (unsigned long long)lHeapSize >> 10, (unsigned long long)lSlabSize >> 10);
+	if(lHeapLimit){
+		fprintf(fp, ", limited to %lluKB, reached %u times", (unsigned long long)lHeapLimit >> 10, lGCHeapLimitTriggers);
+	}
+	fprintf(fp, "\n%-16s %10s %10s %6s %10s %12s %8s %12s %9s\n",
+		"type", "active", "capacity", "segs", "nursery", "allocated", "triggers", "external", "sweep-ms");
+	for(uint i=0;i < lHeapTypeCount;i++){
+		const lHeapStats *h = &stats[i];
+		fprintf(fp, "%-16s %10llu %10llu %6llu %10llu %12llu %8llu %12llu %9llu\n",
+			lHeapTypeName(i),
+			(unsigned long long)h->active,
+			(unsigned long long)h->capacity,
+			(unsigned long long)h->segments,
+			(unsigned long long)h->nursery,
+			(unsigned long long)h->allocated,
+			(unsigned long long)h->triggers,
+			(unsigned long long)h->external,
+			(unsigned long long)h->sweepTime / 1000);
+	}
+	lGCPrintPauses(fp);
+}
+
+void lSetGenerationalGC(bool enabled){
+	lGCGenerational = enabled;
+}
+
+/* Return a tree containing the pause time histograms of minor and major
+ * collections, as arrays of counts for every bucket */
+lVal lGCPauseHistogram(){
+	lTree *t = NULL;
+	for(int major=0;major < 2;major++){
+		lArray *arr = lArrayAlloc(GC_PAUSE_BUCKETS);
+		for(int i=0;i < GC_PAUSE_BUCKETS;i++){
+			arr->data[i] = lValInt(lGCPauses[major][i]);
+		}
+		t = lTreeInsert(t, lSymS(major ? "major" : "minor"), lValAlloc(ltArray, arr));
+	}
+	return lValTree(t);
+}
+
+/* Print a summary of all GC pauses so far to FP */
+void lGCPrintPauses(FILE *fp){
+	fprintf(fp, "GC pauses (us)       minor      major\n");
+	for(int i=0;i < GC_PAUSE_BUCKETS;i++){
+		if(!lGCPauses[0][i] && !lGCPauses[1][i]){continue;}
+		if(i == (GC_PAUSE_BUCKETS-1)){
+			fprintf(fp, "   >= %-10llu", 1ULL << i);
+		}else{
+			fprintf(fp, "    < %-10llu", 1ULL << (i+1));
+		}
+		fprintf(fp, " %10llu %10llu\n", (unsigned long long)lGCPauses[0][i], (unsigned long long)lGCPauses[1][i]);
+	}
+	for(int major=0;major < 2;major++){
+		u64 runs = 0;
+		for(int i=0;i < GC_PAUSE_BUCKETS;i++){
+			runs += lGCPauses[major][i];
+		}
+		fprintf(fp, "%s: %llu pauses, %lluus total, %lluus max\n", major ? "major" : "minor",
+			(unsigned long long)runs,
+			(unsigned long long)lGCPauseTotal[major],
+			(unsigned long long)lGCPauseMax[major]);
+	}
 }
@@ -5,9 +5,9 @@
 #endif
 
 static lVal lBufferViewRef(lVal car, size_t i){
-	const void *buf = car.vBufferView->buf->buf;
-	const size_t length = car.vBufferView->length;
-	const lBufferViewType viewType = car.vBufferView->type;
+	const void *buf = lValGetBufferView(car)->buf->buf;
+	const size_t length = lValGetBufferView(car)->length;
+	const lBufferViewType viewType = lValGetBufferView(car)->type;
 
 	if(unlikely(buf == NULL)){
 		return lValException(lSymTypeError, "Can't ref that", car);
@@ -42,57 +42,57 @@ static lVal lBufferViewRef(lVal car, size_t i){
 }
 
 lVal lGenericRef(lVal col, lVal key){
-	switch(col.type){
+	switch(lValType(col)){
 	case ltMap:
-		return lMapRef(col.vMap, key);
+		return lMapRef(lValGetMap(col), key);
 	case ltPair:
 		reqNaturalInt(key);
-		for(int i=0;i<key.vInt;i++){
+		for(int i=0;i<lValGetInt(key);i++){
 			col = lCdr(col);
 		}
 		return lCar(col);
 	case ltBytecodeArr: {
-		const lBytecodeArray *arr = col.vBytecodeArr;
+		const lBytecodeArray *arr = lValGetBytecodeArray(col);
 		reqNaturalInt(key);
-		const int i = key.vInt;
+		const int i = lValGetInt(key);
 		if(unlikely((arr->data + i) >= arr->dataEnd)){
 			return lValException(lSymOutOfBounds, "(ref) bytecode-array index provided is out of bounds", col);
 		}
 		return lValInt(arr->data[i]); }
 	case ltArray: {
-		lArray *arr = col.vArray;
+		lArray *arr = lValGetArray(col);
 		reqNaturalInt(key);
-		const int i = key.vInt;
+		const int i = lValGetInt(key);
 		if(unlikely(arr->length <= i)){
 			return lValException(lSymOutOfBounds, "(ref) array index provided is out of bounds", col);
 		}
 		return arr->data[i]; }
 	case ltString:
 	case ltBuffer: {
-		const uint8_t *buf = (uint8_t *)col.vBuffer->data;
-		const size_t len = col.vBuffer->length;
+		const uint8_t *buf = (uint8_t *)lValGetBuffer(col)->data;
+		const size_t len = lValGetBuffer(col)->length;
 		reqNaturalInt(key);
-		const size_t i = key.vInt;
+		const size_t i = lValGetInt(key);
 		if(unlikely(len <= i)){
 			return lValException(lSymOutOfBounds, "(ref) buffer index provided is out of bounds", col);
 		}
 		return lValInt(buf[i]); }
 	case ltBufferView:
 		reqNaturalInt(key);
-		return lBufferViewRef(col, key.vInt);
+		return lBufferViewRef(col, lValGetInt(key));
 	case ltLambda:
 	case ltMacro:
 	case ltEnvironment:
-		if(unlikely((key.type != ltSymbol) && (key.type != ltKeyword))){
+		if(unlikely((lValType(key) != ltSymbol) && (lValType(key) != ltKeyword))){
 			return lValExceptionType(col, ltKeyword);
 		}
-		return lGetClosureSym(col.vClosure, key.vSymbol);
+		return lGetClosureSym(lValGetClosure(col), lValGetSymbol(key));
 	case ltTree: {
-		if(unlikely((key.type != ltSymbol) && (key.type != ltKeyword))){
+		if(unlikely((lValType(key) != ltSymbol) && (lValType(key) != ltKeyword))){
 			return lValExceptionType(col, ltKeyword);
 		}
-		lVal r = lTreeRef(col.vTree->root, key.vSymbol);
-		return r.type != ltException ? r : NIL; }
+		lVal r = lTreeRef(lValGetTreeRoot(col)->root, lValGetSymbol(key));
+		return lValType(r) != ltException ? r : NIL; }
 	default:
 		return lValException(lSymTypeError, "Can't ref that", col);
 	}
@@ -100,9 +100,9 @@ lVal lGenericRef(lVal col, lVal key){
 
 
 static lVal lBufferViewSet(lVal car, size_t i, lVal v){
-	const void *buf = car.vBufferView->buf->buf;
-	const size_t length = car.vBufferView->length;
-	const lBufferViewType viewType = car.vBufferView->type;
+	const void *buf = lValGetBufferView(car)->buf->buf;
+	const size_t length = lValGetBufferView(car)->length;
+	const lBufferViewType viewType = lValGetBufferView(car)->type;
 
 	if(unlikely(buf == NULL)){
 		return lValException(lSymTypeError, "Can't ref that", car);
@@ -110,6 +110,7 @@ static lVal lBufferViewSet(lVal car, size_t i, lVal v){
 	if(unlikely(i >= length)){
 		return lValException(lSymOutOfBounds, "ref - index provided is out of bounds", car);
 	}
+	lValGetBufferView(car)->buf->flags &= ~BUFFER_HASHED;
 
 	switch(viewType){
 	default:
@@ -117,106 +118,113 @@ static lVal lBufferViewSet(lVal car, size_t i, lVal v){
 		return NIL;
 	case lbvtU8:
 		reqInt(v);
-		((u8 *)buf)[i] = v.vInt;
+		((u8 *)buf)[i] = lValGetInt(v);
 		return car;
 	case lbvtS8:
 		reqInt(v);
-		((i8 *)buf)[i] = v.vInt;
+		((i8 *)buf)[i] = lValGetInt(v);
 		return car;
 	case lbvtU16:
 		reqInt(v);
-		((u16 *)buf)[i] = v.vInt;
+		((u16 *)buf)[i] = lValGetInt(v);
 		return car;
 	case lbvtS16:
 		reqInt(v);
-		((i16 *)buf)[i] = v.vInt;
+		((i16 *)buf)[i] = lValGetInt(v);
 		return car;
 	case lbvtU32:
 		reqInt(v);
-		((u32 *)buf)[i] = v.vInt;
+		((u32 *)buf)[i] = lValGetInt(v);
 		return car;
 	case lbvtS32:
 		reqInt(v);
-		((i32 *)buf)[i] = v.vInt;
+		((i32 *)buf)[i] = lValGetInt(v);
 		return car;
 	case lbvtS64:
 		reqInt(v);
-		((i64 *)buf)[i] = v.vInt;
+		((i64 *)buf)[i] = lValGetInt(v);
 		return car;
 	case lbvtF32: {
 		const lVal nv = requireFloat(v);
-		if(unlikely(nv.type == ltException)){
+		if(unlikely(lValType(nv) == ltException)){
 			return nv;
 		}
-		((float *)buf)[i] = nv.vFloat;
+		((float *)buf)[i] = lValGetFloat(nv);
 		return car; }
 	case lbvtF64: {
 		const lVal nv = requireFloat(v);
-		if(unlikely(nv.type == ltException)){
+		if(unlikely(lValType(nv) == ltException)){
 			return nv;
 		}
-		((double *)buf)[i] = nv.vFloat;
+		((double *)buf)[i] = lValGetFloat(nv);
 		return car; }
 	}
 }
 
 lVal lGenericSet(lVal col, lVal key, lVal v){
-	switch(col.type){
+	switch(lValType(col)){
 	case ltMap:
-		return lMapSet(col.vMap, key, v);
+		return lMapSet(lValGetMap(col), key, v);
 	case ltBytecodeArr: {
-		const lBytecodeArray *arr = col.vBytecodeArr;
+		const lBytecodeArray *arr = lValGetBytecodeArray(col);
 		reqNaturalInt(key);
-		const int i = key.vInt;
+		const int i = lValGetInt(key);
 		if(unlikely((arr->data + i) >= arr->dataEnd)){
 			return lValException(lSymOutOfBounds, "(ref) bytecode-array index provided is out of bounds", col);
 		}
-		if(unlikely((v.type != ltInt))){
+		if(unlikely((lValType(v) != ltInt))){
 			return lValException(lSymTypeError, "Can't set! a non int value into a BytecodeArray", v);
 		}
-		arr->data[i] = v.vInt;
+		arr->data[i] = lValGetInt(v);
 		return col; }
 	case ltArray: {
-		lArray *arr = col.vArray;
+		lArray *arr = lValGetArray(col);
 		reqNaturalInt(key);
-		const int i = key.vInt;
+		const int i = lValGetInt(key);
 		if(unlikely(arr->length <= i)){
 			return lValException(lSymOutOfBounds, "(ref) array index provided is out of bounds", col);
 		}
+		lArrayWriteBarrier(arr);
 		arr->data[i] = v;
 		return col; }
 	case ltBuffer: {
-		char *buf  = col.vBuffer->buf;
-		const size_t len = col.vBuffer->length;
+		char *buf  = lValGetBuffer(col)->buf;
+		const size_t len = lValGetBuffer(col)->length;
 		reqNaturalInt(key);
-		const size_t i = key.vInt;
+		const size_t i = lValGetInt(key);
 		if(unlikely(len <= i)){
 			return lValException(lSymOutOfBounds, "(ref) buffer index provided is out of bounds", col);
 		}
-		if(unlikely((v.type != ltInt))){
+		if(unlikely((lValType(v) != ltInt))){
 			return lValException(lSymTypeError, "Can't set! a non int value into a BytecodeArray", v);
 		}
-		buf[i] = v.vInt;
+		buf[i] = lValGetInt(v);
+		lValGetBuffer(col)->flags &= ~BUFFER_HASHED;
 		return col; }
 	case ltBufferView:
 		reqNaturalInt(key);
-		return lBufferViewSet(col, key.vInt, v);
+		return lBufferViewSet(col, lValGetInt(key), v);
 	case ltLambda:
 	case ltMacro:
 	case ltEnvironment:
-		if(unlikely((key.type != ltSymbol) && (key.type != ltKeyword))){
+		if(unlikely((lValType(key) != ltSymbol) && (lValType(key) != ltKeyword))){
 			return lValExceptionType(col, ltKeyword);
 		}
-		lDefineClosureSym(col.vClosure, key.vSymbol, v);
+		lDefineClosureSym(lValGetClosure(col), lValGetSymbol(key), v);
 		return col;
 	case ltTree:
-		if(unlikely((key.type != ltSymbol) && (key.type != ltKeyword))){
+		if(unlikely((lValType(key) != ltSymbol) && (lValType(key) != ltKeyword))){
 			return lValExceptionType(col, ltKeyword);
 		}
-		if(unlikely(col.vTree->root && col.vTree->root->flags & TREE_IMMUTABLE)){
+		if(unlikely(lValGetTreeRoot(col)->root && lValGetTreeRoot(col)->root->flags & TREE_IMMUTABLE)){
 			return lValException(lSymTypeError, "Can only set! mutable trees", col);
 		}
-		col.vTree->root = lTreeInsert(col.vTree->root, key.vSymbol, v);
+		if((lValGetSymbol(key) == lSymPrototype) || (lValType(lTreeRef(lValGetTreeRoot(col)->root, lValGetSymbol(key))) == ltException)){
+			/* Might shadow a method or change where we look for them */
+			lMethodCacheInvalidate();
+		}
+		lTreeRootWriteBarrier(lValGetTreeRoot(col));
+		lValGetTreeRoot(col)->root = lTreeInsert(lValGetTreeRoot(col)->root, lValGetSymbol(key), v);
 		return col;
 	default:
 		return lValException(lSymTypeError, "Can't set! that", col);
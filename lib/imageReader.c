@@ -25,8 +25,8 @@ static lVal readVal(readImageMap *map, const lImage *img, i32 off, bool staticIm
 
 static void *readMapGet(readImageMap *map, i32 key){
 	lVal v = lMapRef(map->map, lValInt(key));
-	if(v.type == ltInt){
-		return (void *)(intptr_t)v.vInt;
+	if(lValType(v) == ltInt){
+		return (void *)(intptr_t)lValGetInt(v);
 	} else {
 		return NULL;
 	}
@@ -52,7 +52,17 @@ static i32 readI32(const lImage *img, i32 off){
 	return img->data[off  ] | (img->data[off+1]<<8) | (img->data[off+2]<<16) | (img->data[off+3]<<24);
 }
 
-
+/* Read the length of a map or tree at *OFF, see writeLength */
+static i32 readLength(const lImage *img, i32 *off){
+	const i32 len = readI16(img, *off);
+	if(len == 0xFFFF){
+		const i32 ret = readI32(img, *off + 2);
+		*off += 6;
+		return ret;
+	}
+	*off += 2;
+	return len;
+}
 
 static const lSymbol *readSymbol(readImageMap *map, const lImage *img, i32 off, bool staticImage){
 	(void)staticImage;
@@ -92,7 +102,7 @@ static lBytecodeArray *readBytecodeArray(readImageMap *map, const lImage *img, i
 	if(staticImage){
 		ret->data = (void *)in;
 	} else {
-		ret->data = malloc(len);
+		ret->data = lSlabAlloc(len);
 		memcpy(ret->data, in, len);
 	}
 	ret->dataEnd = &ret->data[len];
@@ -124,7 +134,9 @@ static lBuffer *readBuffer(readImageMap *map, const lImage *img, i32 off, bool s
 		buf->buf = data;
 		buf->flags |= BUFFER_STATIC;
 	} else {
-		buf->buf = malloc(len);
+		if(buf->buf == NULL){
+			buf->buf = malloc(len);
+		}
 		memcpy(buf->buf, data, len);
 	}
 	return buf;
@@ -148,10 +160,9 @@ static lBufferView *readBufferView(readImageMap *map, const lImage *img, i32 off
 static lMap *readMap(readImageMap *map, const lImage *img, i32 off, bool staticImage){
 	readPrefix(lMap, off);
 
-	const i32 len = readI16(img, off);
 	lMap *ret = lMapAllocRaw();
 	readMapSet(map, off, ret);
-	off += 2;
+	const i32 len = readLength(img, &off);
 	for(int i=0;i<len;i++){
 		const i32 key = readI24(img, off+0);
 		const i32 val = readI24(img, off+3);
@@ -169,15 +180,20 @@ static lTree *readTree(readImageMap *map, const lImage *img, i32 off, bool stati
 	if(off < 0){return NULL;}
 	if(off >= (1<<24)-1){return NULL;}
 
-	const i32 len = readI16(img, off);
 	lTreeRoot *root = lTreeRootAllocRaw();
 	readMapSet(map, off, root);
-	off += 2;
+	const i32 len = readLength(img, &off);
 	for(int i=0;i<len;i++){
 		const lSymbol *s = readSymbol(map, img, readI24(img, off), staticImage);
 		if(s){
-			lVal v = readVal(map, img, readI24(img, off+3), staticImage);
-			root->root = lTreeInsert(root->root, s, v);
+			const i32 valOff = readI24(img, off+3);
+			lVal v = readVal(map, img, valOff, staticImage);
+			/* Natives missing from this build, like worker/spawn on
+			 * platforms without threads, are left unbound */
+			const bool missing = (valOff >= 0) && (img->data[valOff] == litNativeFunc) && (lValType(v) == ltNil);
+			if(!missing){
+				root->root = lTreeInsert(root->root, s, v);
+			}
 		}
 		off += 6;
 	}
@@ -210,6 +226,23 @@ static lClass *readType(readImageMap *map, const lImage *img, i32 off, bool stat
 	return NULL;
 }
 
+/* Move the arguments of a call closure from its data tree into slots, so
+ * that lopGetSlot/lopSetSlot work after reading an image */
+static void readClosureSlots(lClosure *c){
+	lVal n = c->args;
+	int i = 0;
+	for(; (lValType(n) == ltPair) && (i < CLOSURE_SLOTS); n = lValGetPair(n)->cdr){
+		c->slots[i++] = lTreeRef(c->data, lValGetSymbol(lValGetPair(n)->car));
+	}
+	if((lValType(n) == ltSymbol) && (i < CLOSURE_SLOTS)){
+		c->slots[i++] = lTreeRef(c->data, lValGetSymbol(n));
+	} else if(lValType(n) != ltNil){
+		memset(c->slots, 0, sizeof(c->slots));
+		return;
+	}
+	c->slotCount = i;
+}
+
 static lClosure *readClosure(readImageMap *map, const lImage *img, i32 off, bool staticImage){
 	readPrefix(lClosure, off);
 
@@ -224,6 +257,9 @@ static lClosure *readClosure(readImageMap *map, const lImage *img, i32 off, bool
 	ret->sp = clo->sp;
 	ret->text = readBytecodeArray(map, img, clo->text, staticImage);
 	ret->type = clo->type;
+	if(ret->type == closureCall){
+		readClosureSlots(ret);
+	}
 	if(ret->text != NULL){
 		ret->ip = &ret->text->data[clo->ip];
 	} else {
@@ -275,8 +311,9 @@ static lVal readVal(readImageMap *map, const lImage *img, i32 off, bool staticIm
 	switch(T){
 	default:
 		return lValException(lSymReadError, "Can't have rootValues of that Type", NIL);
-	case litNativeFunc:
-		return lValAlloc(ltNativeFunc, readNFunc(map, img, valOff, staticImage));
+	case litNativeFunc: {
+		lNFunc *fn = readNFunc(map, img, valOff, staticImage);
+		return fn ? lValAlloc(ltNativeFunc, fn) : NIL; }
 	case litType:
 		return lValAlloc(ltType, readType(map, img, valOff, staticImage));
 	case litBytecodeArr:
@@ -335,5 +372,5 @@ lVal readImage(const void *ptr, size_t imgSize, bool staticImage){
 
 lVal lnfDeserialize(lVal val){
 	reqBuffer(val);
-	return readImage(val.vBuffer->buf, val.vBuffer->length, false);
+	return readImage(lValGetBuffer(val)->buf, lValGetBuffer(val)->length, false);
 }
@@ -12,6 +12,7 @@ typedef struct {
 	i32 curOff;
 	i32 size;
 	lMap *map;
+	bool failed;
 } writeImageContext;
 
 static void writeI8(writeImageContext *ctx, i32 curOff, i32 v){
@@ -36,12 +37,28 @@ static void writeI32(writeImageContext *ctx, i32 curOff, i32 v){
 	ctx->start[curOff+3] = (v>>24)&0xFF;
 }
 
+/* Maps and trees store their length in 16 bits, longer ones are marked by
+ * 0xFFFF followed by the actual length in 32 bits */
+static i32 lengthSize(i32 len){
+	return len >= 0xFFFF ? 6 : 2;
+}
+
+static i32 writeLength(writeImageContext *ctx, i32 curOff, i32 len){
+	if(len >= 0xFFFF){
+		writeI16(ctx, curOff, 0xFFFF);
+		writeI32(ctx, curOff+2, len);
+		return curOff + 6;
+	}
+	writeI16(ctx, curOff, len);
+	return curOff + 2;
+}
+
 static i32 ctxAddVal(writeImageContext *ctx, lVal v);
 
 static i32 writeMapGet(lMap *map, void *key){
 	lVal v = lMapRef(map, lValInt((intptr_t)key));
-	if(v.type == ltInt){
-		return v.vInt;
+	if(lValType(v) == ltInt){
+		return lValGetInt(v);
 	} else {
 		return 0;
 	}
@@ -66,7 +83,7 @@ static i32 ctxAddSymbol(writeImageContext *ctx, const lSymbol *v){
 	const i32 mapOff = writeMapGet(ctx->map, (void *)v);
 	if(mapOff > 0){ return mapOff; }
 
-	const i32 strLen = strnlen(v->c, sizeof(v->c));
+	const i32 strLen = strlen(v->c);
 	const i32 eleSize = strLen+1;
 	ctxRealloc(ctx, eleSize);
 
@@ -85,16 +102,15 @@ static i32 ctxAddMap(writeImageContext *ctx, lMap *v){
 	if(mapOff > 0){ return mapOff; }
 
 	const int len = v->length;
-	const i32 eleSize = 2 + (6*len);
+	const i32 eleSize = lengthSize(len) + (6*len);
 	ctxRealloc(ctx, eleSize);
 
 	const i32 curOff = ctx->curOff;
 	writeMapSet(ctx->map, (void *)v, curOff);
-	writeI16(ctx, curOff, len);
 	ctx->curOff += eleSize;
-	i32 off = curOff + 2;
+	i32 off = writeLength(ctx, curOff, len);
 	for(uint i=0;i<v->size;i++){
-		if(v->entries[i].key.type == ltNil){continue;}
+		if(lValType(v->entries[i].key) == ltNil){continue;}
 		writeI24(ctx, off  , ctxAddVal(ctx, v->entries[i].key));
 		writeI24(ctx, off+3, ctxAddVal(ctx, v->entries[i].val));
 		off += 6;
@@ -102,6 +118,19 @@ static i32 ctxAddMap(writeImageContext *ctx, lMap *v){
 	return curOff;
 }
 static i32 ctxAddTreeVal(writeImageContext *ctx, i32 curOff, lTree *v){
+	#ifdef NUJEL_TREE_HAMT
+	if(v == NULL){return curOff;}
+	if(v->flags & TREE_BRANCH){
+		for(uint i=0;i<v->length;i++){
+			curOff = ctxAddTreeVal(ctx, curOff, v->children[i]);
+		}
+		return curOff;
+	}
+
+	writeI24(ctx, curOff  , ctxAddSymbol(ctx, v->key));
+	writeI24(ctx, curOff+3, ctxAddVal(ctx, v->value));
+	return curOff + 6;
+	#else
 	if((v == NULL) || (v->key == NULL)){return curOff;}
 
 	writeI24(ctx, curOff  , ctxAddSymbol(ctx, v->key));
@@ -111,6 +140,7 @@ static i32 ctxAddTreeVal(writeImageContext *ctx, i32 curOff, lTree *v){
 	curOff = ctxAddTreeVal(ctx, curOff, v->left);
 	curOff = ctxAddTreeVal(ctx, curOff, v->right);
 	return curOff;
+	#endif
 }
 
 static i32 ctxAddTree(writeImageContext *ctx, lTree *v){
@@ -119,14 +149,13 @@ static i32 ctxAddTree(writeImageContext *ctx, lTree *v){
 	if(mapOff > 0){ return mapOff; }
 
 	const int len = lTreeSize(v);
-	const i32 eleSize = 2 + (6*len);
+	const i32 eleSize = lengthSize(len) + (6*len);
 	ctxRealloc(ctx, eleSize);
 
 	const i32 curOff = ctx->curOff;
 	writeMapSet(ctx->map, (void *)v, curOff);
-	writeI16(ctx, curOff, len);
 	ctx->curOff += eleSize;
-	ctxAddTreeVal(ctx, curOff + 2, v);
+	ctxAddTreeVal(ctx, writeLength(ctx, curOff, len), v);
 	return curOff;
 }
 
@@ -170,6 +199,7 @@ static i32 ctxAddBytecodeArray(writeImageContext *ctx, lBytecodeArray *v){
 	const i32 arr = ctxAddArray(ctx, v->literals);
 	*((i32 *)((void *)&ctx->start[curOff+4])) = arr;
 	memcpy(&ctx->start[curOff+8], v->data, len);
+	lBytecodeDequicken((lBytecodeOp *)&ctx->start[curOff+8], len);
 
 	return curOff;
 }
@@ -187,7 +217,7 @@ static i32 ctxAddClosure(writeImageContext *ctx, lClosure *v){
 	ctx->curOff += eleSize;
 
 	const i32 args = ctxAddVal(ctx, v->args);
-	const i32 data = ctxAddTree(ctx, v->data);
+	const i32 data = ctxAddTree(ctx, lClosureDataTree(v));
 	const i32 meta = ctxAddTree(ctx, v->meta);
 	const i32 text = ctxAddBytecodeArray(ctx, v->text);
 	const i32 parent = ctxAddClosure(ctx, v->parent);
@@ -216,7 +246,9 @@ static i32 ctxAddBuffer(writeImageContext *ctx, lBuffer *v){
 	const i32 curOff = ctx->curOff;
 	writeMapSet(ctx->map, (void *)v, curOff);
 	u32 *out = (u32 *)((void *)&ctx->start[ctx->curOff]);
-	const u32 outVal = (v->length & 0x0FFFFFFF) | (v->flags << 28);
+	/* Only BUFFER_IMMUTABLE survives being read back in, the other flags
+	 * describe state specific to this heap */
+	const u32 outVal = (v->length & 0x0FFFFFFF) | ((u32)(v->flags & BUFFER_IMMUTABLE) << 28);
 	*out = outVal;
 	ctx->curOff += eleSize;
 
@@ -256,10 +288,10 @@ static i32 ctxAddPair(writeImageContext *ctx, lPair *v){
 	writeMapSet(ctx->map, (void *)v, curOff);
 	ctx->curOff += eleSize;
 
-	const i32 car = v->car.type != ltNil ? ctxAddVal(ctx, v->car) : -1;
+	const i32 car = lValType(v->car) != ltNil ? ctxAddVal(ctx, v->car) : -1;
 	writeI24(ctx, curOff, car);
 
-	const i32 cdr = v->cdr.type != ltNil ? ctxAddVal(ctx, v->cdr) : -1;
+	const i32 cdr = lValType(v->cdr) != ltNil ? ctxAddVal(ctx, v->cdr) : -1;
 	writeI24(ctx, curOff+3, cdr);
 
 	return curOff;
@@ -283,114 +315,118 @@ static i32 ctxAddVal(writeImageContext *ctx, lVal v){
 	const i32 curOff = ctx->curOff;
 	u8 *outb = (u8 *)((void *)&ctx->start[curOff]);
 
-	switch(v.type){
+	switch(lValType(v)){
 	case ltAny:
 	case ltComment:
 	case ltException:
-		exit(234);
+	case ltCoroutine:
+		ctx->curOff += 1;
+		*outb = litNil;
+		ctx->failed = true;
+		break;
 	case ltFileHandle:
 		ctx->curOff += 2;
 		*outb++ = litFileHandle;
-		*outb = ctxAddFilehandle(v.vFileHandle);
+		*outb = ctxAddFilehandle(lValGetFileHandle(v));
 		break;
 	case ltNativeFunc:
 		ctx->curOff += 4;
 		*outb = litNativeFunc;
-		writeI24(ctx, curOff+1, ctxAddSymbol(ctx, v.vNFunc->name));
+		writeI24(ctx, curOff+1, ctxAddSymbol(ctx, lValGetNFunc(v)->name));
 		break;
 	case ltType:
 		ctx->curOff += 4;
 		*outb = litType;
-		writeI24(ctx, curOff+1, ctxAddSymbol(ctx, v.vType->name));
+		writeI24(ctx, curOff+1, ctxAddSymbol(ctx, lValGetClass(v)->name));
 		break;
 	case ltBytecodeArr:
 		ctx->curOff += 4;
 		*outb = litBytecodeArr;
-		writeI24(ctx, curOff+1, ctxAddBytecodeArray(ctx, v.vBytecodeArr));
+		writeI24(ctx, curOff+1, ctxAddBytecodeArray(ctx, lValGetBytecodeArray(v)));
 		break;
 	case ltTree:
 		ctx->curOff += 4;
 		*outb = litTree;
-		writeI24(ctx, curOff+1, ctxAddTree(ctx, v.vTree->root));
+		writeI24(ctx, curOff+1, ctxAddTree(ctx, lValGetTreeRoot(v)->root));
 		break;
 	case ltMap:
 		ctx->curOff += 4;
 		*outb = litMap;
-		writeI24(ctx, curOff+1, ctxAddMap(ctx, v.vMap));
+		writeI24(ctx, curOff+1, ctxAddMap(ctx, lValGetMap(v)));
 		break;
 	case ltArray:
 		ctx->curOff += 5;
 		*outb = litArray;
-		writeI24(ctx, curOff+1, ctxAddArray(ctx, v.vArray));
+		writeI24(ctx, curOff+1, ctxAddArray(ctx, lValGetArray(v)));
 		break;
 	case ltPair:
 		ctx->curOff += 4;
 		*outb = litPair;
-		writeI24(ctx, curOff+1, ctxAddPair(ctx, v.vList));
+		writeI24(ctx, curOff+1, ctxAddPair(ctx, lValGetPair(v)));
 		break;
 	case ltSymbol:
 	case ltKeyword:
 		ctx->curOff += 4;
-		*outb = v.type == ltSymbol ? litSymbol : litKeyword;
-		writeI24(ctx, curOff+1, ctxAddSymbol(ctx, v.vSymbol));
+		*outb = lValType(v) == ltSymbol ? litSymbol : litKeyword;
+		writeI24(ctx, curOff+1, ctxAddSymbol(ctx, lValGetSymbol(v)));
 		break;
 	case ltBufferView:
 		ctx->curOff += 4;
 		*outb = litBufferView;
-		writeI24(ctx, curOff+1, ctxAddBufferView(ctx, v.vBufferView));
+		writeI24(ctx, curOff+1, ctxAddBufferView(ctx, lValGetBufferView(v)));
 		break;
 	case ltLambda:
 		ctx->curOff += 4;
 		*outb = litLambda;
-		writeI24(ctx, curOff+1, ctxAddClosure(ctx, v.vClosure));
+		writeI24(ctx, curOff+1, ctxAddClosure(ctx, lValGetClosure(v)));
 		break;
 	case ltMacro:
 		ctx->curOff += 4;
 		*outb = litMacro;
-		writeI24(ctx, curOff+1, ctxAddClosure(ctx, v.vClosure));
+		writeI24(ctx, curOff+1, ctxAddClosure(ctx, lValGetClosure(v)));
 		break;
 	case ltEnvironment:
 		ctx->curOff += 4;
 		*outb = litEnvironment;
-		writeI24(ctx, curOff+1, ctxAddClosure(ctx, v.vClosure));
+		writeI24(ctx, curOff+1, ctxAddClosure(ctx, lValGetClosure(v)));
 		break;
 	case ltString:
 	case ltBuffer:
 		ctx->curOff += 4;
-		*outb = v.type == ltString ? litString : litBuffer;
-		writeI24(ctx, curOff+1, ctxAddBuffer(ctx, v.vBuffer));
+		*outb = lValType(v) == ltString ? litString : litBuffer;
+		writeI24(ctx, curOff+1, ctxAddBuffer(ctx, lValGetBuffer(v)));
 		break;
 	case ltInt:
-		if(v.vInt == ((i8)v.vInt)){
+		if(lValGetInt(v) == ((i8)lValGetInt(v))){
 			ctx->curOff += 2;
 			*outb++ = litInt8;
-			*outb++ = v.vInt;
-		} else if(v.vInt == ((i16)v.vInt)){
+			*outb++ = lValGetInt(v);
+		} else if(lValGetInt(v) == ((i16)lValGetInt(v))){
 			*outb++ = litInt16;
 			ctx->curOff += 3;
 			i16 *out = (i16 *)((void *)&ctx->start[curOff+1]);
-			*out = v.vInt;
-		} else if(v.vInt == ((i32)v.vInt)){
+			*out = lValGetInt(v);
+		} else if(lValGetInt(v) == ((i32)lValGetInt(v))){
 			*outb++ = litInt32;
 			ctx->curOff += 5;
 			i32 *out = (i32 *)((void *)&ctx->start[curOff+1]);
-			*out = v.vInt;
+			*out = lValGetInt(v);
 		} else {
 			*outb++ = litInt64;
 			ctx->curOff += 9;
 			u64 *outq = (u64 *)((void *)&ctx->start[curOff+1]);
-			*outq = v.vInt;
+			*outq = lValGetInt(v);
 		}
 		break;
 	case ltFloat: {
 		ctx->curOff += 9;
 		*outb = litFloat;
 		double *outf = (double *)((void *)&ctx->start[curOff+1]);
-		*outf = v.vFloat;
+		*outf = lValGetFloat(v);
 		break; }
 	case ltBool:
 		ctx->curOff += 1;
-		*outb = v.vBool ? litTrue : litFalse;
+		*outb = lValGetBool(v) ? litTrue : litFalse;
 		break;
 	case ltNil:
 		ctx->curOff += 1;
@@ -400,7 +436,10 @@ static i32 ctxAddVal(writeImageContext *ctx, lVal v){
 	return curOff;
 }
 
-static lImage *writeImage(lVal rootValue, i32 *outSize){
+/* Serialize everything reachable from ROOTVALUE into a freshly malloc'ed
+ * image, returns NULL if there is something in there that can't be
+ * serialized, like an exception. */
+void *writeImage(lVal rootValue, i32 *outSize){
 	size_t size = sizeof(lImage);
 	writeImageContext ctx;
 	memset(&ctx, 0, sizeof(ctx));
@@ -414,6 +453,11 @@ static lImage *writeImage(lVal rootValue, i32 *outSize){
 
 	ctxAddVal(&ctx, rootValue);
 
+	if(unlikely(ctx.failed)){
+		free(ctx.start);
+		free(buf);
+		return NULL;
+	}
 	buf = realloc(buf, sizeof(lImage) + ctx.curOff);
 	memcpy(buf->data, ctx.start, ctx.curOff);
 	size += ctx.curOff;
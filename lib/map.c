@@ -7,6 +7,12 @@
 
 #include "../third-party/fasthash/fasthash.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 static const u64 hashSeed = 0x5b0a159d9eac0381ULL;
 
 u32 lHashString(const char *str, i32 len){
@@ -14,7 +20,7 @@ u32 lHashString(const char *str, i32 len){
 }
 
 static inline u32 lHashVal(lVal v){
-	switch(v.type){
+	switch(lValType(v)){
 	case ltType:
 	case ltFileHandle:
 	case ltBytecodeArr:
@@ -27,102 +33,207 @@ static inline u32 lHashVal(lVal v){
 	case ltTree:
 	case ltArray:
 	case ltPair:
+	case ltCoroutine:
 		#if INTPTR_MAX == INT32_MAX
-		return fasthash32v((u32)v.vPointer);
+		return fasthash32v((u32)lValGetPointer(v));
 		#else
-		return fasthash64v((u64)v.vPointer);
+		return fasthash64v((u64)lValGetPointer(v));
 		#endif
 
 	case ltString:
-		return lHashString(v.vString->data, v.vString->length);
+		return lStringHash(lValGetString(v));
 	case ltBool:
-		return fasthash64v((u64)v.vBool);
+		return fasthash64v((u64)lValGetBool(v));
 	case ltKeyword:
 	case ltSymbol:
-		return v.vSymbol->hash;
+		return lValGetSymbol(v)->hash;
 	case ltInt:
-		return fasthash64v(v.vInt);
+		return fasthash64v(lValGetInt(v));
 	case ltFloat:
-		return fasthash64v(v.vFloat);
+		return fasthash64v(lValGetFloat(v));
 	default: // Anything else can't be used as keys in maps
 		return 0xdeadbeef;
 	}
 }
 
-static bool lMapSetSimple(lMap *map, lVal key, lVal val){
-	const u32 size = map->size;
-	const u32 mask = size-1;
-	u32 off = lHashVal(key) & mask;
-	if(unlikely(map->entries == NULL)){
-		return false;
+/* Return a bitmask of the control bytes in the group starting at CTRL
+ * that are equal to H2, or that have their high bit set, which is true for
+ * empty as well as deleted slots */
+#if defined(__SSE2__)
+static inline u32 lMapGroupMatch(const u8 *ctrl, u8 h2){
+	const __m128i group = _mm_loadu_si128((const __m128i *)(const void *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+static inline u32 lMapGroupMatchFree(const u8 *ctrl){
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(const void *)ctrl));
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+static inline u32 lMapGroupMask(uint8x16_t v){
+	static const u8 weights[16] = {1,2,4,8,16,32,64,128,1,2,4,8,16,32,64,128};
+	const uint8x16_t m = vandq_u8(v, vld1q_u8(weights));
+	return vaddv_u8(vget_low_u8(m)) | (vaddv_u8(vget_high_u8(m)) << 8);
+}
+static inline u32 lMapGroupMatch(const u8 *ctrl, u8 h2){
+	return lMapGroupMask(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(h2)));
+}
+static inline u32 lMapGroupMatchFree(const u8 *ctrl){
+	return lMapGroupMask(vcltq_s8(vreinterpretq_s8_u8(vld1q_u8(ctrl)), vdupq_n_s8(0)));
+}
+#else
+static inline u32 lMapGroupMatch(const u8 *ctrl, u8 h2){
+	u32 ret = 0;
+	for(int i=0;i<MAP_GROUP_WIDTH;i++){
+		ret |= (ctrl[i] == h2) << i;
+	}
+	return ret;
+}
+static inline u32 lMapGroupMatchFree(const u8 *ctrl){
+	u32 ret = 0;
+	for(int i=0;i<MAP_GROUP_WIDTH;i++){
+		ret |= (ctrl[i] >> 7) << i;
+	}
+	return ret;
+}
+#endif
+
+static inline u32 lMapGroupMatchEmpty(const u8 *ctrl){
+	return lMapGroupMatch(ctrl, MAP_CTRL_EMPTY);
+}
+
+/* The top 7 bits of the hash are stored in the control bytes, while the
+ * bottom bits choose where to start probing, so the two only overlap once a
+ * table grows past 2^25 slots */
+static inline u8 lMapH2(u32 hash){
+	return hash >> 25;
+}
+
+static inline u32 lMapH1(u32 hash, u32 mask){
+	return hash & mask;
+}
+
+/* Set the control byte of slot I, along with its mirrors at the end */
+static inline void lMapSetCtrl(lMap *map, u32 i, u8 c){
+	u8 *ctrl = lMapCtrl(map);
+	ctrl[i] = c;
+	for(u32 j = i + map->size; j < map->size + MAP_GROUP_WIDTH; j += map->size){
+		ctrl[j] = c;
 	}
-	for(u32 i=0; i < size; i++){
-		if(map->entries[off].key.type == ltNil){
-			map->entries[off].key = key;
-			map->entries[off].val = val;
-			return true;
+}
+
+/* Return the slot KEY is stored in, or -1 if it isn't part of MAP. Groups
+ * are probed quadratically, which visits every group since the amount of
+ * groups is a power of two. We can stop at the first group with an empty
+ * slot, since an insertion would never have continued past it. */
+static i64 lMapFind(const lMap *map, lVal key, u32 hash){
+	if(unlikely(map->size == 0)){ return -1; }
+	const u32 mask = map->size - 1;
+	const u8 *ctrl = lMapCtrl(map);
+	const u8 h2 = lMapH2(hash);
+	u32 pos = lMapH1(hash, mask);
+	/* Most keys live in the very first slot they probe, so we can overlap
+	 * fetching that entry with the control bytes */
+	prefetch(&map->entries[pos]);
+	for(u32 stride = MAP_GROUP_WIDTH;; stride += MAP_GROUP_WIDTH){
+		for(u32 m = lMapGroupMatch(&ctrl[pos], h2); m; m &= m - 1){
+			const u32 i = (pos + ctz(m)) & mask;
+			if(lValEqual(key, map->entries[i].key)){
+				return i;
+			}
 		}
-		if(lValEqual(key, map->entries[off].key)){
-			map->entries[off].key = key;
-			map->entries[off].val = val;
-			return false;
+		if(likely(lMapGroupMatchEmpty(&ctrl[pos]))){
+			return -1;
 		}
-		off = (off + 1) & mask;
+		pos = (pos + stride) & mask;
 	}
-	// This can only occur if the hashmap is full, which must be checked outside ot lMapSetSimple
-	exit(176);
 }
 
-static lVal lMapRefSimple(lMap *map, lVal key){
-	const u32 size = map->size;
-	const u32 mask = size-1;
-	u32 off = lHashVal(key) & mask;
-	for(u32 i=0; i < size; i++){
-		if(map->entries[off].key.type == ltNil){ return NIL; }
-		if(lValEqual(key, map->entries[off].key)){
-			return map->entries[off].val;
+/* Return the first empty or deleted slot on the probe sequence of HASH */
+static u32 lMapFindFree(const lMap *map, u32 hash){
+	const u32 mask = map->size - 1;
+	const u8 *ctrl = lMapCtrl(map);
+	u32 pos = lMapH1(hash, mask);
+	for(u32 stride = MAP_GROUP_WIDTH;; stride += MAP_GROUP_WIDTH){
+		const u32 m = lMapGroupMatchFree(&ctrl[pos]);
+		if(likely(m)){
+			return (pos + ctz(m)) & mask;
 		}
-		off = (off + 1) & mask;
+		pos = (pos + stride) & mask;
 	}
-	return NIL;
 }
 
-static bool lMapHasSimple(lMap *map, lVal key){
-	const u32 size = map->size;
-	const u32 mask = size-1;
-	u32 off = lHashVal(key) & mask;
-	for(u32 i=0; i < size; i++){
-		if(map->entries[off].key.type == ltNil){ return false; }
-		if(lValEqual(key, map->entries[off].key)){
-			return true;
-		}
-		off = (off + 1) & mask;
+static void lMapInsertAt(lMap *map, u32 i, lVal key, lVal val, u32 hash){
+	if(lMapCtrl(map)[i] == MAP_CTRL_DELETED){
+		map->tombstones--;
 	}
-	return false;
+	lMapSetCtrl(map, i, lMapH2(hash));
+	lMapHashes(map)[i] = hash;
+	map->entries[i].key = key;
+	map->entries[i].val = val;
+	map->length++;
 }
 
-static void lMapResize(lMap *map, u32 size){
-	if(unlikely(size <= map->length)){ return; }
-	const lMapEntry *oldEntries = map->entries;
-	const u32 oldSize = map->size;
-	map->entries = calloc(size, sizeof(lMapEntry));
+/* Move every entry into a new table of SIZE slots, which also gets rid of all
+ * tombstones. Since the hashes are stored we never have to hash keys again.
+ * Returns false, leaving MAP untouched, if the table couldn't be allocated. */
+static bool lMapResize(lMap *map, u32 size){
+	lMap old = *map;
+	lMapEntry *entries = lSlabAlloc(lMapAllocationSize(size));
+	if(unlikely(entries == NULL)){
+		return false;
+	}
+	map->entries = entries;
 	map->size = size;
-	if(oldEntries != NULL){
-		for(uint i=0; i < oldSize; i++){
-			if(oldEntries[i].key.type == ltNil){ continue;}
-			lMapSetSimple(map, oldEntries[i].key, oldEntries[i].val);
+	map->length = 0;
+	map->tombstones = 0;
+	memset(lMapCtrl(map), MAP_CTRL_EMPTY, size + MAP_GROUP_WIDTH);
+	if(old.entries != NULL){
+		const u8 *ctrl = lMapCtrl(&old);
+		const u32 *hashes = lMapHashes(&old);
+		for(uint i=0; i < old.size; i++){
+			if(ctrl[i] & 0x80){ continue; }
+			const u32 hash = hashes[i];
+			lMapInsertAt(map, lMapFindFree(map, hash), old.entries[i].key, old.entries[i].val, hash);
 		}
-		free((void *)oldEntries);
+		lSlabFree(old.entries, lMapAllocationSize(old.size));
+	}
+	return true;
+}
+
+/* Make sure there is room for another entry, keeping the load factor,
+ * including tombstones, below 7/8. If most of the used slots are tombstones
+ * we rehash in place instead of growing. */
+static bool lMapReserve(lMap *map){
+	if(likely((map->length + map->tombstones) < (map->size - (map->size >> 3)))){
+		return true;
+	}
+	if(map->tombstones > (map->size >> 2)){
+		return lMapResize(map, map->size);
+	}
+	if(unlikely(map->size > (UINT32_MAX >> 1))){
+		return false;
 	}
+	return lMapResize(map, MAX(4, map->size) * 2);
+}
+
+static bool lMapHasSimple(lMap *map, lVal key){
+	return lMapFind(map, key, lHashVal(key)) >= 0;
+}
+
+static void lMapDelete(lMap *map, u32 i){
+	lMapSetCtrl(map, i, MAP_CTRL_DELETED);
+	map->entries[i].key = NIL;
+	map->entries[i].val = NIL;
+	map->length--;
+	map->tombstones++;
 }
 
 lVal lnfMapNew(lVal v) {
 	lMap *m = lMapAllocRaw();
 	m->entries = NULL;
 	lVal e = v;
-	while(e.type == ltPair){
+	while(lValType(e) == ltPair){
 		lVal key = lCar(e);
-		if(unlikely((key.type == ltNil) || (key.type == ltFloat))){
+		if(unlikely((lValType(key) == ltNil) || (lValType(key) == ltFloat))){
 			return lValException(lSymTypeError, "Can't use Nil or Float values as keys", key);
 		}
 		lVal val = lCadr(e);
@@ -133,98 +244,125 @@ lVal lnfMapNew(lVal v) {
 }
 
 lVal lMapSet(lMap *map, lVal key, lVal val) {
-	if(unlikely((key.type == ltNil) || (key.type == ltFloat))){
+	if(unlikely((lValType(key) == ltNil) || (lValType(key) == ltFloat))){
 		return lValException(lSymTypeError, "Can't use Nil or Float values as keys", key);
 	}
-	const u32 resizeSize = (map->size - (uint)(map->size >> 2));
-	if(unlikely(map->length >= resizeSize)){
-		lMapResize(map, MAX(4, map->size) * 2);
+	lMapWriteBarrier(map);
+	const u32 hash = lHashVal(key);
+	const i64 i = lMapFind(map, key, hash);
+	if(i >= 0){
+		map->entries[i].key = key;
+		map->entries[i].val = val;
+		return val;
 	}
-	if(lMapSetSimple(map, key, val)){
-		map->length++;
+	if(unlikely(!lMapReserve(map))){
+		return lValException(lSymOOM, "Couldn't grow the map", key);
 	}
+	lMapInsertAt(map, lMapFindFree(map, hash), key, val, hash);
 	return val;
 }
 
 lVal lMapRef(lMap *map, lVal key) {
-	if(unlikely((key.type == ltNil) || (key.type == ltFloat))){
+	if(unlikely((lValType(key) == ltNil) || (lValType(key) == ltFloat))){
 		return lValException(lSymTypeError, "Can't use Nil or Float values as keys", key);
 	}
-	return lMapRefSimple(map, key);
+	const i64 i = lMapFind(map, key, lHashVal(key));
+	return i >= 0 ? map->entries[i].val : NIL;
 }
 
 lVal lMapRefString(lMap *map, const char *str) {
-	const u32 size = map->size;
-	const u32 mask = size-1;
-	i32 len = strlen(str);
-	u32 off = lHashString(str, len) & mask;
-	for(u32 i=0; i < size; i++){
-		if(map->entries[off].key.type == ltNil){ return NIL; }
-		if(map->entries[off].key.type != ltString){ continue; }
-		const i32 eLen = map->entries[off].key.vString->length;
-		if ((len == eLen) && (memcmp(str, map->entries[off].key.vString->data, len) == 0)){
-			return map->entries[off].val;
+	if(unlikely(map->size == 0)){ return NIL; }
+	const i32 len = strlen(str);
+	const u32 hash = lHashString(str, len);
+	const u32 mask = map->size - 1;
+	const u8 *ctrl = lMapCtrl(map);
+	const u32 *hashes = lMapHashes(map);
+	u32 pos = lMapH1(hash, mask);
+	for(u32 stride = MAP_GROUP_WIDTH;; stride += MAP_GROUP_WIDTH){
+		for(u32 m = lMapGroupMatch(&ctrl[pos], lMapH2(hash)); m; m &= m - 1){
+			const u32 i = (pos + ctz(m)) & mask;
+			const lVal k = map->entries[i].key;
+			if((hashes[i] != hash) || (lValType(k) != ltString)){ continue; }
+			if((lValGetString(k)->length == len) && (memcmp(str, lValGetString(k)->data, len) == 0)){
+				return map->entries[i].val;
+			}
 		}
-		off = (off + 1) & mask;
+		if(likely(lMapGroupMatchEmpty(&ctrl[pos]))){
+			return NIL;
+		}
+		pos = (pos + stride) & mask;
 	}
-	return NIL;
 }
 
 static lVal lnmMapLength(lVal self) {
-	return lValInt(self.vMap->length);
+	return lValInt(lValGetMap(self)->length);
 }
 
 static lVal lnmMapSize(lVal self) {
-	return lValInt(self.vMap->size);
+	return lValInt(lValGetMap(self)->size);
 }
 
 static lVal lnmMapHas(lVal self, lVal key) {
-	return lValBool(lMapHasSimple(self.vMap, key));
+	return lValBool(lMapHasSimple(lValGetMap(self), key));
+}
+
+static lVal lnmMapRemove(lVal self, lVal key) {
+	lMap *map = lValGetMap(self);
+	const i64 i = lMapFind(map, key, lHashVal(key));
+	if(i < 0){
+		return lValBool(false);
+	}
+	lMapWriteBarrier(map);
+	lMapDelete(map, i);
+	return lValBool(true);
 }
 
 static lVal lnmMapKey(lVal self, lVal off) {
 	reqNaturalInt(off);
-	if(unlikely(off.vInt >= self.vMap->size)){
+	if(unlikely(lValGetInt(off) >= lValGetMap(self)->size)){
 		return NIL;
 	}
-	return self.vMap->entries[off.vInt].key;
+	return lValGetMap(self)->entries[lValGetInt(off)].key;
 }
 
 static lVal lnmMapVal(lVal self, lVal off) {
 	reqNaturalInt(off);
-	if(unlikely(off.vInt >= self.vMap->size)){
+	if(unlikely(lValGetInt(off) >= lValGetMap(self)->size)){
 		return NIL;
 	}
-	return self.vMap->entries[off.vInt].val;
+	return lValGetMap(self)->entries[lValGetInt(off)].val;
 }
 
 static lVal lnmMapValues(lVal self) {
 	lVal ret = NIL;
-	const u32 size = self.vMap->size;
+	const u32 size = lValGetMap(self)->size;
 	for(uint i=0; i < size; i++){
-		if(self.vMap->entries[i].key.type == ltNil){ continue; }
-		ret = lCons(self.vMap->entries[i].val, ret);
+		if(lValType(lValGetMap(self)->entries[i].key) == ltNil){ continue; }
+		ret = lCons(lValGetMap(self)->entries[i].val, ret);
 	}
 	return ret;
 }
 
 static lVal lnmMapKeys(lVal self) {
 	lVal ret = NIL;
-	const u32 size = self.vMap->size;
+	const u32 size = lValGetMap(self)->size;
 	for(uint i=0; i < size; i++){
-		if(self.vMap->entries[i].key.type == ltNil){ continue; }
-		ret = lCons(self.vMap->entries[i].key, ret);
+		if(lValType(lValGetMap(self)->entries[i].key) == ltNil){ continue; }
+		ret = lCons(lValGetMap(self)->entries[i].key, ret);
 	}
 	return ret;
 }
 
 static lVal lnmMapClone(lVal self) {
 	lMap *m = lMapAllocRaw();
-	m->length = self.vMap->length;
-	m->flags = self.vMap->flags;
-	m->size = self.vMap->size;
-	m->entries = calloc(m->size, sizeof(lMapEntry));
-	memcpy(m->entries, self.vMap->entries, sizeof(lMapEntry) * m->size);
+	m->length = lValGetMap(self)->length;
+	m->flags = lValGetMap(self)->flags;
+	m->size = lValGetMap(self)->size;
+	m->tombstones = lValGetMap(self)->tombstones;
+	if(m->size){
+		m->entries = lSlabAlloc(lMapAllocationSize(m->size));
+		memcpy(m->entries, lValGetMap(self)->entries, lMapAllocationSize(m->size));
+	}
 	return lValAlloc(ltMap, m);
 }
 
@@ -235,6 +373,7 @@ void lOperationsMap() {
 	lAddNativeMethodVV (Map, lSymS("has?"), "(self key)", lnmMapHas, NFUNC_PURE);
 	lAddNativeMethodV  (Map, lSymS("values"), "(self)", lnmMapValues, NFUNC_PURE);
 	lAddNativeMethodV  (Map, lSymS("keys"), "(self)", lnmMapKeys, NFUNC_PURE);
+	lAddNativeMethodVV (Map, lSymS("remove!"), "(self key)", lnmMapRemove, 0);
 
 	lAddNativeMethodV  (Map, lSymS("size*"), "(self)", lnmMapSize, NFUNC_PURE);
 	lAddNativeMethodVV (Map, lSymS("key*"), "(self off)", lnmMapKey, NFUNC_PURE);
@@ -30,7 +30,7 @@ struct lClass {
 	lTree *methods;
 	lTree *staticMethods;
 };
-extern lClass lClassList[64];
+extern THREAD_LOCAL lClass lClassList[64];
 
 struct lArray {
 	lVal *data;
@@ -76,17 +76,28 @@ struct lBuffer {
 		lBuffer *nextFree;
 	};
 	i32 length;
+	u32 hash;
 	u8 flags;
 };
 #define BUFFER_IMMUTABLE 1
 #define BUFFER_STATIC 2
-
+/* HASH is only valid with BUFFER_HASHED set, which gets cleared whenever the
+ * contents might change. Interned strings are the only string with their
+ * contents in the intern table, so they can be compared by pointer. */
+#define BUFFER_HASHED 4
+#define BUFFER_INTERNED 8
+
+/* Names shorter than SYM_INLINE_SIZE are stored within the symbol itself,
+ * longer ones get their own allocation, C points to either one. */
+#define SYM_INLINE_SIZE 48
 struct lSymbol {
-	u32 hash;
 	union {
-		char c[94];
+		const char *c;
 		struct lSymbol *nextFree;
 	};
+	u32 hash;
+	u32 length;
+	char inlineName[SYM_INLINE_SIZE];
 };
 
 struct lBytecodeArray {
@@ -129,6 +140,39 @@ struct lNFunc {
 #define NFUNC_FOLD 1
 #define NFUNC_PURE 2
 
+#ifdef NUJEL_TREE_HAMT
+/* Trees are persistent hash array mapped tries indexed by the hash of the
+ * key, consuming TREE_BITS of it per level. Leaves carry the association
+ * and are never moved, branches point to a compact, slab allocated array
+ * containing only the children whose bit is set within BITMAP. Branches
+ * without a BITMAP are just a list of LENGTH leaves that get searched
+ * linearly, which is faster than hashing for small trees, and also how
+ * collisions are handled once the hash is used up. */
+struct lTree {
+	union {
+		struct {
+			const lSymbol *key;
+			lVal value;
+		};
+		struct {
+			lTree **children;
+			u32 bitmap;
+			u32 length;
+		};
+		lTree *nextFree;
+	};
+	u8 flags;
+};
+#define TREE_BRANCH    2
+/* Reachable from more than a single root, so it needs to be copied instead
+ * of being mutated, this also applies to everything beneath it */
+#define TREE_SHARED    4
+
+#define TREE_BITS 5
+#define TREE_MASK ((1 << TREE_BITS) - 1)
+#define TREE_FLAT_MAX 8
+#else
+/* Trees are AVL trees ordered by the address of the key */
 struct lTree {
 	lTree *left;
 	lTree *right;
@@ -140,6 +184,7 @@ struct lTree {
 	i16 height;
 	u8 flags;
 };
+#endif
 #define TREE_IMMUTABLE 1
 
 struct lMapEntry {
@@ -147,9 +192,16 @@ struct lMapEntry {
 	lVal val;
 };
 
+/* Maps are SwissTable style hash tables, a single allocation holds SIZE
+ * entries, followed by the hash of every entry and a control byte per slot,
+ * which is either MAP_CTRL_EMPTY, MAP_CTRL_DELETED or the lower 7 bits of the
+ * hash of the entry in that slot. The last MAP_GROUP_WIDTH control bytes
+ * mirror the first ones, so that a whole group can be loaded starting from
+ * any slot. Keys of slots without an entry are always NIL. */
 struct lMap {
 	u32 length;
-	u16 size;
+	u32 size;
+	u32 tombstones;
 	u8 flags;
 	union {
 		lMapEntry *entries;
@@ -158,6 +210,27 @@ struct lMap {
 };
 #define MAP_IMMUTABLE 1
 
+#define MAP_GROUP_WIDTH  16
+#define MAP_CTRL_EMPTY   0x80
+#define MAP_CTRL_DELETED 0xFE
+
+static inline size_t lMapAllocationSize(u32 size){
+	return (size * (sizeof(lMapEntry) + sizeof(u32))) + size + MAP_GROUP_WIDTH;
+}
+static inline u32 *lMapHashes(const lMap *map){
+	return (u32 *)(void *)&map->entries[map->size];
+}
+static inline u8 *lMapCtrl(const lMap *map){
+	return (u8 *)&lMapHashes(map)[map->size];
+}
+
+/* Call closures of lambdas with up to CLOSURE_SLOTS arguments store them
+ * in slots instead of the data tree, so that the compiler can address them
+ * directly with lopGetSlot/lopSetSlot. The bytecode compiler has to use the
+ * same limit, see compile/max-slots.
+ */
+#define CLOSURE_SLOTS 4
+
 struct lClosure {
 	union {
 		lClosure *parent;
@@ -170,9 +243,13 @@ struct lClosure {
 		lVal args;
 		lVal exceptionHandler;
 	};
+	lVal slots[CLOSURE_SLOTS];
 	u16 sp;
 	u8 type;
+	u8 slotCount;
+	u8 flags;
 };
+#define CLOSURE_CAPTURED 1
 
 typedef enum closureType {
 	closureDefault = 0,
@@ -184,6 +261,8 @@ typedef enum closureType {
 
 struct lThread {
 	lBytecodeArray *text;
+	lThread *parent;
+	lCoroutine *coroutine;
 
 	lVal *valueStack;
 	lClosure **closureStack;
@@ -195,12 +274,70 @@ struct lThread {
 	int closureStackSize;
 };
 
+typedef enum {
+	lcsFresh = 0,
+	lcsSuspended,
+	lcsRunning,
+	lcsDone
+} lCoroutineState;
+
+/* A coroutine owns a complete set of VM stacks, swapping them with the ones
+ * of the running lBytecodeEval is all it takes to switch to it. While it
+ * runs, THREAD holds the stacks of whoever resumed it instead. */
+struct lCoroutine {
+	lThread thread;
+	union {
+		lVal fun;
+		lCoroutine *nextFree;
+	};
+	u8 state;
+};
+
+/* resume/yield can't switch stacks themselves, they leave a request here and
+ * return lCoroutineSwitch which the VM then acts upon */
+typedef enum {
+	lcrNone = 0,
+	lcrResume,
+	lcrYield
+} lCoroutineRequestType;
+
+extern THREAD_LOCAL lCoroutineRequestType lCoroutineRequest;
+extern THREAD_LOCAL lCoroutine *lCoroutineTarget;
+extern THREAD_LOCAL lVal lCoroutineTransfer;
+#define lCoroutineSwitch lValAlloc(ltException, NULL)
+
 /*\
  |  Closure related procedures
 \*/
 lClosure *lClosureNew        (lClosure *parent, closureType t);
 lClosure *lClosureNewFunCall (lVal args, lVal lambda);
-bool      lHasClosureSym     (lClosure *c, const lSymbol *s, lVal *v);
+lTree    *lClosureDataTree   (const lClosure *c);
+
+/* Return the slot S is stored in within C, or -1 if it isn't a slot */
+static inline int lClosureSlotIndex(const lClosure *c, const lSymbol *s){
+	lVal n = c->args;
+	for(int i=0; i < c->slotCount; i++){
+		if(likely(lValType(n) == ltPair)){
+			if(lValGetSymbol(lValGetPair(n)->car) == s){
+				return i;
+			}
+			n = lValGetPair(n)->cdr;
+		} else {
+			return lValGetSymbol(n) == s ? i : -1;
+		}
+	}
+	return -1;
+}
+
+/* Return the call closure DEPTH function frames up from C */
+static inline lClosure *lClosureFrame(lClosure *c, int depth){
+	for(; c; c = c->parent){
+		if((c->type == closureCall) && (depth-- == 0)){
+			return c;
+		}
+	}
+	return NULL;
+}
 
 /*\
  |  lVal related procedures
@@ -271,10 +408,50 @@ typedef enum lOpcode {
 	lopBitNot          = 0x36,
 	lopGenSet          = 0x37,
 	lopUnequalPred     = 0x38,
+	lopGetSlot         = 0x39,
+	lopSetSlot         = 0x3A,
+	lopApplyTail       = 0x3B,
+
+	/* Quickened variants, the VM rewrites the generic ops above into these
+	 * once it has seen the argument types and turns them back if the
+	 * guard fails. They never end up in images or (:array) */
+	lopAddIntInt               = 0x3C,
+	lopSubIntInt               = 0x3D,
+	lopMulIntInt               = 0x3E,
+	lopLessPredIntInt          = 0x3F,
+	lopLessEqPredIntInt        = 0x40,
+	lopGreaterEqPredIntInt     = 0x41,
+	lopGreaterPredIntInt       = 0x42,
+	lopAddFloatFloat           = 0x43,
+	lopSubFloatFloat           = 0x44,
+	lopMulFloatFloat           = 0x45,
+	lopLessPredFloatFloat      = 0x46,
+	lopLessEqPredFloatFloat    = 0x47,
+	lopGreaterEqPredFloatFloat = 0x48,
+	lopGreaterPredFloatFloat   = 0x49,
+
+	/* Superinstructions emitted by the assembler's peephole pass, picked
+	 * from the pairs in benchmark/opcode-profile.txt */
+	lopZeroPredJf      = 0x4A,
+	lopEqualPredJf     = 0x4B,
+	lopLessPredJt      = 0x4C,
+	lopGreaterPredJt   = 0x4D,
+	lopSubIntByte      = 0x4E,
+	lopSetValDrop      = 0x4F,
 } lOpcode;
 
 lVal  lBytecodeEval        (lClosure *c, lBytecodeArray *ops);
 lVal  lValBytecodeArray    (const lBytecodeOp *ops, int opsLength, lArray *literals);
+int   lBytecodeOpLength    (lBytecodeOp op);
+lBytecodeOp lBytecodeOpDequicken(lBytecodeOp op);
+void  lBytecodeDequicken   (lBytecodeOp *ops, int len);
+void  lVMDestroy           ();
+void  lReaderDestroy       ();
+lVal  lOpcodeProfile       ();
+lVal  lAllocationProfile   ();
+
+extern THREAD_LOCAL u64 lQuickenCount;
+extern THREAD_LOCAL u64 lDequickenCount;
 
 /*\
  | Workarounds for missing builtins
@@ -284,6 +461,31 @@ uint32_t __builtin_popcount(uint32_t x);
 uint64_t __builtin_popcountll(uint64_t x);
 #endif
 
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(__TINYC__)
+#define prefetch(x) __builtin_prefetch(x)
+#define ctz(x) __builtin_ctz(x)
+#else
+#define prefetch(x)
+static inline uint ctz(u32 x){
+	uint ret = 0;
+	for(;!(x & 1);x >>= 1){ ret++; }
+	return ret;
+}
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__POPCNT__)
+#define popcount(x) __builtin_popcount(x)
+#else
+/* Without a popcnt instruction the builtin turns into a libgcc call, which
+ * is slower than just counting the bits inline */
+static inline uint popcount(u32 x){
+	x -= (x >> 1) & 0x55555555;
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0F0F0F0F;
+	return (x * 0x01010101) >> 24;
+}
+#endif
+
 #if defined(__TINYC__)
 void __sync_synchronize();
 #endif
@@ -293,25 +495,43 @@ void __sync_synchronize();
  | Compatibility procedures
  */
 u64 getMSecs();
+u64 getUSecs();
 void lAddPlatformVars(lClosure *c);
+void *lAlignedAlloc(size_t alignment, size_t size);
+void  lAlignedFree(void *ptr);
 
 /*\
  | GC related procedures
 \*/
 lSymbol *lRootsSymbolPush(lSymbol *v);
 void lDefineTypeVars(lClosure *c);
-extern int lGCRuns;
-extern lMap *lSymbolTable;
+extern THREAD_LOCAL int lGCRuns;
+extern THREAD_LOCAL lMap *lStringInternTable;
 
-extern bool lGCShouldRunSoon;
+extern THREAD_LOCAL bool lGCShouldRunSoon;
+extern THREAD_LOCAL bool lGCShouldRunMajor;
+extern THREAD_LOCAL bool lGCGenerational;
 
 void lGarbageCollect(lThread *ctx);
+void lHeapDestroy();
+void lAllocatorDestroy();
+lVal lGCPauseHistogram();
+lVal lGCStats();
 
 /*\
  | Allocator related definitions
 \*/
-#define SYM_MAX (1<<14)
 #define NFN_MAX (1<<10)
+/* Initial amount of symbols that make the next collection a major one,
+ * afterwards twice the amount that survived the last major collection */
+#define SYM_MAX (1<<14)
+
+/* Nursery sizes, a minor collection is triggered once that many objects of
+ * a type, or HEAP_NURSERY_BYTES worth of them, whichever is less, were
+ * allocated since the last collection. These are also the
+ * initial thresholds for major collections, which are afterwards adjusted
+ * to the amount of live objects, heaps themselves grow without a fixed upper
+ * bound. */
 #define ARR_MAX (1<<14)
 #define CLO_MAX (1<<17)
 #define TRR_MAX (1<<15)
@@ -321,6 +541,31 @@ void lGarbageCollect(lThread *ctx);
 #define TRE_MAX (1<<18)
 #define CON_MAX (1<<18)
 #define MAP_MAX (1<<15)
+#define BXI_MAX (1<<16)
+#define CRT_MAX (1<<12)
+
+/* Every heap is made up of segments of this size, they are aligned to their
+ * size so we can find the segment/mark map of an object by masking its
+ * address. */
+#define HEAP_SEGMENT_BYTES (1 << 18)
+#define HEAP_SEGMENT_CAPACITY(T) ((HEAP_SEGMENT_BYTES - 64) / (sizeof(T) + 1))
+
+/* Upper bound for the memory taken up by young objects of a single type,
+ * keeping the nursery small enough to stay mostly in cache */
+#ifndef HEAP_NURSERY_BYTES
+#define HEAP_NURSERY_BYTES (1 << 21)
+#endif
+#define HEAP_NURSERY_CAPACITY(T, typeMax) MIN((typeMax), HEAP_NURSERY_BYTES / sizeof(T))
+
+/* States an object can be in, as stored in the mark map of its segment.
+ * Objects surviving a collection become old, minor collections then only
+ * look at young objects and old ones that have been written to since, the
+ * write barrier marks those as dirty. */
+#define GC_YOUNG  0
+#define GC_MARKED 1
+#define GC_FREE   2
+#define GC_OLD    3
+#define GC_DIRTY  4
 
 #define allocatorTypes() \
 	defineAllocator(lArray, ARR_MAX) \
@@ -331,28 +576,103 @@ void lGarbageCollect(lThread *ctx);
 	defineAllocator(lBytecodeArray, BCA_MAX) \
 	defineAllocator(lBuffer, BUF_MAX) \
 	defineAllocator(lBufferView, BFV_MAX) \
-	defineAllocator(lPair, CON_MAX)
+	defineAllocator(lPair, CON_MAX) \
+	defineAllocator(lCoroutine, CRT_MAX) \
+	boxedIntAllocator()
+
+#ifdef NUJEL_NAN_BOXING
+#define boxedIntAllocator() defineAllocator(lBoxedInt, BXI_MAX)
+#else
+#define boxedIntAllocator()
+#endif
 
 #define defineAllocator(T, typeMax) \
-extern T T##List[typeMax]; \
-extern uint T##Max;	   \
-extern uint T##Active; \
-extern u8 T##MarkMap[typeMax]; \
-extern T * T##FFree; \
-T * T##AllocRaw();
+typedef struct { \
+	uint id; \
+	uint used; \
+	uint live; \
+	bool young; \
+	bool dirty; \
+	T *freeList; \
+	u8 markMap[HEAP_SEGMENT_CAPACITY(T)]; \
+	T list[HEAP_SEGMENT_CAPACITY(T)]; \
+} T##Segment; \
+extern THREAD_LOCAL T##Segment **T##Segments; \
+extern THREAD_LOCAL uint T##SegmentCount; \
+extern THREAD_LOCAL uint T##Active; \
+extern THREAD_LOCAL uint T##Allocated; \
+extern THREAD_LOCAL uint T##GCThreshold; \
+extern THREAD_LOCAL T * T##FFree; \
+extern THREAD_LOCAL uint T##SweepCursor; \
+extern THREAD_LOCAL bool T##SweepPending; \
+T * T##AllocRaw(); \
+static inline T##Segment *T##SegmentOf(const T *v){ \
+	return (T##Segment *)((uintptr_t)v & ~((uintptr_t)HEAP_SEGMENT_BYTES - 1)); \
+} \
+static inline u8 *T##MarkOf(const T *v){ \
+	T##Segment *seg = T##SegmentOf(v); \
+	return &seg->markMap[v - seg->list]; \
+} \
+/* Has to be called before storing a reference into V, unless V has been \
+ * allocated since the last safe point. Marked objects are caught as well \
+ * since an incremental collection might have already looked at them. */ \
+static inline void T##WriteBarrier(const T *v){ \
+	T##Segment *seg = T##SegmentOf(v); \
+	u8 *mark = &seg->markMap[v - seg->list]; \
+	if(unlikely((*mark == GC_OLD) || (*mark == GC_MARKED))){ \
+		*mark = GC_DIRTY; \
+		seg->dirty = true; \
+	} \
+} \
+static inline i64 T##ID(const T *v){ \
+	const T##Segment *seg = T##SegmentOf(v); \
+	return ((i64)seg->id * HEAP_SEGMENT_CAPACITY(T)) + (v - seg->list); \
+}
 
 allocatorTypes()
 #undef defineAllocator
 
-extern u8 lSymbolMarkMap[SYM_MAX];
+#define defineAllocator(T, typeMax) \
+void T##SweepSegment(T##Segment *seg);
+allocatorTypes()
+#undef defineAllocator
 
-extern lNFunc   lNFuncList[NFN_MAX];
-extern uint     lNFuncMax;
+typedef enum {
+	#define defineAllocator(T, typeMax) lHeapType##T,
+	allocatorTypes()
+	#undef defineAllocator
+	lHeapTypeCount
+} lHeapType;
+const char *lHeapTypeName(lHeapType type);
+
+/* Counts down to the next allocation that gets sampled by the
+ * allocation profiler, starts at 0 so it practically never fires when
+ * profiling is disabled */
+extern THREAD_LOCAL u64 lAllocationSampleCountdown;
+void lAllocationSample(lHeapType type);
+
+extern THREAD_LOCAL size_t lHeapSize;
+extern THREAD_LOCAL size_t lHeapLimit;
+void *lHeapSegmentAlloc();
+void  lHeapSegmentFree(void *seg);
+
+extern THREAD_LOCAL size_t lSlabSize;
+void *lSlabAlloc(size_t bytes);
+void  lSlabFree(void *v, size_t bytes);
+void *lSlabRealloc(void *v, size_t oldBytes, size_t newBytes);
+size_t lSlabBlockBytes(size_t bytes);
+void  lSlabReclaim();
+void  lSlabDestroy();
+
+/* Arrays always keep room for one more value than their length */
+static inline size_t lArrayDataBytes(size_t length){
+	return (length + 1) * sizeof(lVal);
+}
+
+extern THREAD_LOCAL lNFunc   lNFuncList[NFN_MAX];
+extern THREAD_LOCAL uint     lNFuncMax;
 
 
-static inline int lClosureID(const lClosure *n){
-	return n - lClosureList;
-}
 static inline int lNFuncID(const lNFunc *n){
 	return n - lNFuncList;
 }
@@ -360,58 +680,88 @@ static inline int lNFuncID(const lNFunc *n){
 /*\
  | Symbolic procedures
 \*/
-extern lSymbol  lSymbolList [SYM_MAX];
-extern lSymbol *lSymbolFFree;
-extern uint     lSymbolActive;
-extern uint     lSymbolMax;
-
-extern lSymbol *symType;
-extern lSymbol *symArguments;
-extern lSymbol *symCode;
-extern lSymbol *symData;
-extern lSymbol *symName;
-extern lSymbol *symRef;
-
-extern lSymbol *lSymLTNil;
-extern lSymbol *lSymLTBool;
-extern lSymbol *lSymLTPair;
-extern lSymbol *lSymLTLambda;
-extern lSymbol *lSymLTInt;
-extern lSymbol *lSymLTFloat;
-extern lSymbol *lSymLTString;
-extern lSymbol *lSymLTSymbol;
-extern lSymbol *lSymLTKeyword;
-extern lSymbol *lSymLTNativeFunction;
-extern lSymbol *lSymLTEnvironment;
-extern lSymbol *lSymLTMacro;
-extern lSymbol *lSymLTArray;
-extern lSymbol *lSymLTTree;
-extern lSymbol *lSymLTMap;
-extern lSymbol *lSymLTBytecodeArray;
-extern lSymbol *lSymLTBuffer;
-extern lSymbol *lSymLTBufferView;
-extern lSymbol *lSymLTFileHandle;
-extern lSymbol *lSymLTUnknownType;
-extern lSymbol *lSymLTType;
-extern lSymbol *lSymLTAny;
-
-extern lSymbol *symNull;
-extern lSymbol *symQuote;
-extern lSymbol *symQuasiquote;
-extern lSymbol *symUnquote;
-extern lSymbol *symUnquoteSplicing;
-extern lSymbol *symArr;
-extern lSymbol *symTreeNew;
-extern lSymbol *symMapNew;
-extern lSymbol *symDocumentation;
-extern lSymbol *symPure;
-extern lSymbol *symFold;
-
-extern lSymbol *lSymVMError;
+
+/* Symbols live in segments just like the other heaps, but they are only
+ * freed by major collections, which also remove them from the symbol table.
+ * Symbols referenced from C are rooted by marking them as old, which they
+ * then stay forever. */
+typedef struct {
+	uint id;
+	uint used;
+	u8 markMap[HEAP_SEGMENT_CAPACITY(lSymbol)];
+	lSymbol list[HEAP_SEGMENT_CAPACITY(lSymbol)];
+} lSymbolSegment;
+
+extern THREAD_LOCAL lSymbolSegment **lSymbolSegments;
+extern THREAD_LOCAL uint     lSymbolSegmentCount;
+extern THREAD_LOCAL lSymbol *lSymbolFFree;
+extern THREAD_LOCAL uint     lSymbolActive;
+extern THREAD_LOCAL uint     lSymbolMajorThreshold;
+
+static inline lSymbolSegment *lSymbolSegmentOf(const lSymbol *v){
+	return (lSymbolSegment *)((uintptr_t)v & ~((uintptr_t)HEAP_SEGMENT_BYTES - 1));
+}
+static inline u8 *lSymbolMarkOf(const lSymbol *v){
+	lSymbolSegment *seg = lSymbolSegmentOf(v);
+	return &seg->markMap[v - seg->list];
+}
+static inline i64 lSymbolID(const lSymbol *v){
+	const lSymbolSegment *seg = lSymbolSegmentOf(v);
+	return ((i64)seg->id * HEAP_SEGMENT_CAPACITY(lSymbol)) + (v - seg->list);
+}
+
+extern THREAD_LOCAL lSymbol *symType;
+extern THREAD_LOCAL lSymbol *symArguments;
+extern THREAD_LOCAL lSymbol *symCode;
+extern THREAD_LOCAL lSymbol *symData;
+extern THREAD_LOCAL lSymbol *symName;
+extern THREAD_LOCAL lSymbol *symRef;
+
+extern THREAD_LOCAL lSymbol *lSymLTNil;
+extern THREAD_LOCAL lSymbol *lSymLTBool;
+extern THREAD_LOCAL lSymbol *lSymLTPair;
+extern THREAD_LOCAL lSymbol *lSymLTLambda;
+extern THREAD_LOCAL lSymbol *lSymLTInt;
+extern THREAD_LOCAL lSymbol *lSymLTFloat;
+extern THREAD_LOCAL lSymbol *lSymLTString;
+extern THREAD_LOCAL lSymbol *lSymLTSymbol;
+extern THREAD_LOCAL lSymbol *lSymLTKeyword;
+extern THREAD_LOCAL lSymbol *lSymLTNativeFunction;
+extern THREAD_LOCAL lSymbol *lSymLTEnvironment;
+extern THREAD_LOCAL lSymbol *lSymLTMacro;
+extern THREAD_LOCAL lSymbol *lSymLTArray;
+extern THREAD_LOCAL lSymbol *lSymLTTree;
+extern THREAD_LOCAL lSymbol *lSymLTMap;
+extern THREAD_LOCAL lSymbol *lSymLTBytecodeArray;
+extern THREAD_LOCAL lSymbol *lSymLTBuffer;
+extern THREAD_LOCAL lSymbol *lSymLTBufferView;
+extern THREAD_LOCAL lSymbol *lSymLTFileHandle;
+extern THREAD_LOCAL lSymbol *lSymLTUnknownType;
+extern THREAD_LOCAL lSymbol *lSymLTType;
+extern THREAD_LOCAL lSymbol *lSymLTCoroutine;
+extern THREAD_LOCAL lSymbol *lSymLTAny;
+
+extern THREAD_LOCAL lSymbol *symNull;
+extern THREAD_LOCAL lSymbol *symQuote;
+extern THREAD_LOCAL lSymbol *symQuasiquote;
+extern THREAD_LOCAL lSymbol *symUnquote;
+extern THREAD_LOCAL lSymbol *symUnquoteSplicing;
+extern THREAD_LOCAL lSymbol *symArr;
+extern THREAD_LOCAL lSymbol *symTreeNew;
+extern THREAD_LOCAL lSymbol *symMapNew;
+extern THREAD_LOCAL lSymbol *symDocumentation;
+extern THREAD_LOCAL lSymbol *symPure;
+extern THREAD_LOCAL lSymbol *symFold;
+
+extern THREAD_LOCAL lSymbol *lSymVMError;
 
 
 void      lSymbolInit   ();
+void      lSymbolDestroy();
 void      lSymbolFree   (lSymbol *s);
+void      lSymbolSweep  (bool major);
+lSymbol  *lSymIntern    (const char *str, uint len, u32 hash);
+lVal      lSymbolTableMap();
 
 lSymbol  *getTypeSymbol (const lVal a);
 lSymbol  *getTypeSymbolT(const lType T);
@@ -427,10 +777,74 @@ int    lTreeSize   (const lTree *t);
 lVal   lTreeRef    (const lTree *t, const lSymbol *s);
 lTree *lTreeInsert (lTree *t, const lSymbol *s, lVal v);
 
+/* Return the node of T associated to S, or NULL if there is none. Nodes
+ * are never moved, so callers may hold on to them and re-read their value
+ * for as long as the tree isn't modified. */
+static inline const lTree *lTreeLookup(const lTree *t, const lSymbol *s){
+#ifdef NUJEL_TREE_HAMT
+	if(unlikely((t == NULL) || (s == NULL))){return NULL;}
+	const u32 hash = s->hash;
+	uint shift = 0;
+	while(t->flags & TREE_BRANCH){
+		if(t->bitmap == 0){
+			for(uint i=0;i<t->length;i++){
+				if(t->children[i]->key == s){
+					return t->children[i];
+				}
+			}
+			return NULL;
+		}
+		const u32 bit = 1U << ((hash >> shift) & TREE_MASK);
+		if(!(t->bitmap & bit)){
+			return NULL;
+		}
+		t = t->children[popcount(t->bitmap & (bit - 1))];
+		shift += TREE_BITS;
+	}
+	return t->key == s ? t : NULL;
+#else
+	while(t){
+		if(s == t->key){
+			return t;
+		}
+		t = s > t->key ? t->right : t->left;
+	}
+	return NULL;
+#endif
+}
+
+/* Change the value S is associated with in *T to V, returns false if there
+ * is no such association. Since *T might get replaced, the owner needs
+ * a write barrier as well. */
+static inline bool lTreeSet(lTree **t, const lSymbol *s, lVal v){
+#ifdef NUJEL_TREE_HAMT
+	if(lTreeLookup(*t, s) == NULL){
+		return false;
+	}
+	*t = lTreeInsert(*t, s, v);
+#else
+	lTree *node = (lTree *)lTreeLookup(*t, s);
+	if(node == NULL){
+		return false;
+	}
+	lTreeWriteBarrier(node);
+	node->value = v;
+#endif
+	return true;
+}
+
 lVal lnfArrNew  (lVal v);
 lVal lnfTreeNew(lVal v);
 lVal lnfMapNew(lVal v);
 u32  lHashString(const char *str, i32 len);
+static inline u32 lStringHash(lString *s){
+	if(likely(s->flags & BUFFER_HASHED)){
+		return s->hash;
+	}
+	s->hash = lHashString(s->data, s->length);
+	s->flags |= BUFFER_HASHED;
+	return s->hash;
+}
 lVal lnfSerialize(lVal val);
 lVal lnfDeserialize(lVal val);
 
@@ -447,12 +861,18 @@ void lOperationsMap        ();
 void lOperationsArray      ();
 void lOperationsString     ();
 void lOperationsBytecode   ();
+void lOperationsCoroutine  ();
 
 lVal lValBytecodeOp(lBytecodeOp v);
 lVal lGenericRef(lVal col, lVal key);
 lVal lGenericSet(lVal col, lVal key, lVal v);
 
 void lTypesInit();
+void lTypesDestroy();
 lVal lMethodLookup(const lSymbol *method, lVal self);
+lVal lMethodLookupCached(const lBytecodeOp *site, const lSymbol *method, lVal self);
+void lMethodCacheInvalidate();
+extern THREAD_LOCAL u64 lMethodCacheHits;
+extern THREAD_LOCAL u64 lMethodCacheMisses;
 
 #endif
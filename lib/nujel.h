@@ -20,6 +20,18 @@
 #define unlikely(x)    __builtin_expect(!!(x), 0)
 #endif
 
+/* Every thread running Nujel code has its own isolate, that is its own
+ * heaps, symbols, classes and roots, all kept in thread-local variables.
+ * That way several interpreters can run in parallel in a single process,
+ * as long as values never cross from one isolate into another. */
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__EMSCRIPTEN__) || defined(__wasi__) || defined(__DJGPP__)
+#define THREAD_LOCAL
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 #define countof(x) (sizeof(x)/sizeof(*x))
@@ -73,6 +85,7 @@ typedef enum {
 
 	ltFileHandle,
 	ltType,
+	ltCoroutine,
 
 	// These should never be visible from inside the Nujel VM
 	ltComment,
@@ -85,6 +98,7 @@ typedef struct lBufferView    lBufferView;
 typedef struct lArray         lArray;
 typedef struct lClosure       lClosure;
 typedef struct lThread        lThread;
+typedef struct lCoroutine     lCoroutine;
 typedef struct lNFunc         lNFunc;
 typedef struct lSymbol        lSymbol;
 typedef struct lClass         lClass;
@@ -106,6 +120,96 @@ struct lTreeRoot {
 	};
 };
 
+#ifdef NUJEL_NAN_BOXING
+/* Packs every value into 64 bits. Floats are stored XORed with
+ * NAN_BOX_FLOAT_MASK, turning the negative quiet NaNs into everything below
+ * NAN_BOX_FLOAT, which leaves 51 bits for all the other types. Nujel never
+ * stores such a NaN since lValFloatRaw canonicalizes them. The 5 bits above
+ * the 46 bit payload hold the type, pointers are always 8-byte aligned so
+ * they are stored shifted right by 3, which covers 48 bit address spaces.
+ * Ints that don't fit into 45 bits are boxed on the heap, with the topmost
+ * payload bit set. That way a value that is all zeroes is still NIL, just
+ * like with the default representation. */
+struct lVal {
+	u64 raw;
+};
+
+typedef struct lBoxedInt lBoxedInt;
+struct lBoxedInt {
+	union {
+		i64 value;
+		lBoxedInt *nextFree;
+	};
+};
+
+#define NAN_BOX_FLOAT         (1ULL << 51)
+#define NAN_BOX_FLOAT_MASK    0xFFF8000000000000ULL
+#define NAN_BOX_TYPE_SHIFT    46
+#define NAN_BOX_PAYLOAD_MASK  ((1ULL << NAN_BOX_TYPE_SHIFT) - 1)
+#define NAN_BOX_INT_BITS      45
+#define NAN_BOX_INT_BOXED     (1ULL << NAN_BOX_INT_BITS)
+#define NAN_BOX_ADDRESS_LIMIT (1ULL << 48)
+
+static inline lVal lValAlloc(lType T, void *v){
+	return (lVal){((u64)T << NAN_BOX_TYPE_SHIFT) | ((uintptr_t)v >> 3)};
+}
+
+static inline lType lValType(lVal v){
+	const u64 T = v.raw >> NAN_BOX_TYPE_SHIFT;
+	return T < 32 ? (lType)T : ltFloat;
+}
+
+static inline void *lValGetPointer(lVal v){
+	return (void *)(uintptr_t)((v.raw & NAN_BOX_PAYLOAD_MASK) << 3);
+}
+
+lVal lValBoxedInt(i64 v);
+static inline lVal lValInt(i64 v){
+	const int shift = 64 - NAN_BOX_INT_BITS;
+	if(likely(v == (((i64)((u64)v << shift)) >> shift))){
+		return (lVal){((u64)ltInt << NAN_BOX_TYPE_SHIFT) | ((u64)v & (NAN_BOX_INT_BOXED - 1))};
+	}
+	return lValBoxedInt(v);
+}
+
+/* Ints that had to be put on the heap, only these need to be marked */
+static inline lBoxedInt *lValGetBoxedInt(lVal v){
+	if(likely(!(v.raw & NAN_BOX_INT_BOXED))){
+		return NULL;
+	}
+	return (lBoxedInt *)(uintptr_t)((v.raw & (NAN_BOX_INT_BOXED - 1)) << 3);
+}
+
+static inline i64 lValGetInt(lVal v){
+	if(likely(!(v.raw & NAN_BOX_INT_BOXED))){
+		const int shift = 64 - NAN_BOX_INT_BITS;
+		return ((i64)(v.raw << shift)) >> shift;
+	}
+	return lValGetBoxedInt(v)->value;
+}
+
+static inline lVal lValFloatRaw(double v){
+	union { double f; u64 bits; } u = { .f = v };
+	if(unlikely(v != v)){
+		u.bits = 0x7FF8000000000000ULL;
+	}
+	return (lVal){u.bits ^ NAN_BOX_FLOAT_MASK};
+}
+
+static inline double lValGetFloat(lVal v){
+	union { u64 bits; double f; } u = { .bits = v.raw ^ NAN_BOX_FLOAT_MASK };
+	return u.f;
+}
+
+static inline lVal lValBool(bool v){
+	return (lVal){((u64)ltBool << NAN_BOX_TYPE_SHIFT) | v};
+}
+
+static inline bool lValGetBool(lVal v){
+	return v.raw & 1;
+}
+
+#else
 struct lVal {
 	u16 type;
 	union {
@@ -125,16 +229,66 @@ struct lVal {
 		void *          vPointer;
 		lBuffer *       vBuffer;
 		lBufferView *   vBufferView;
+		lCoroutine *    vCoroutine;
 		lClass *        vType;
 	};
 };
 
-extern lVal NIL;
-
 static inline lVal lValAlloc(lType T, void *v){
 	return (lVal){T, .vPointer = v};
 }
 
+static inline lType lValType(lVal v){
+	return v.type;
+}
+
+static inline void *lValGetPointer(lVal v){
+	return v.vPointer;
+}
+
+static inline lVal lValInt(i64 v){
+	return (lVal){ltInt, .vInt = v};
+}
+
+static inline i64 lValGetInt(lVal v){
+	return v.vInt;
+}
+
+static inline lVal lValFloatRaw(double v){
+	return (lVal){ltFloat, .vFloat = v};
+}
+
+static inline double lValGetFloat(lVal v){
+	return v.vFloat;
+}
+
+static inline lVal lValBool(bool v){
+	return (lVal){ltBool, .vBool = v};
+}
+
+static inline bool lValGetBool(lVal v){
+	return v.vBool;
+}
+#endif
+
+/* Accessors for the payload of V, the caller has to check its type */
+static inline lPair          *lValGetPair         (lVal v){ return lValGetPointer(v); }
+static inline const lSymbol  *lValGetSymbol       (lVal v){ return lValGetPointer(v); }
+static inline FILE           *lValGetFileHandle   (lVal v){ return lValGetPointer(v); }
+static inline lBytecodeArray *lValGetBytecodeArray(lVal v){ return lValGetPointer(v); }
+static inline lArray         *lValGetArray        (lVal v){ return lValGetPointer(v); }
+static inline lTreeRoot      *lValGetTreeRoot     (lVal v){ return lValGetPointer(v); }
+static inline lMap           *lValGetMap          (lVal v){ return lValGetPointer(v); }
+static inline lString        *lValGetString       (lVal v){ return lValGetPointer(v); }
+static inline lClosure       *lValGetClosure      (lVal v){ return lValGetPointer(v); }
+static inline lNFunc         *lValGetNFunc        (lVal v){ return lValGetPointer(v); }
+static inline lBuffer        *lValGetBuffer       (lVal v){ return lValGetPointer(v); }
+static inline lBufferView    *lValGetBufferView   (lVal v){ return lValGetPointer(v); }
+static inline lClass         *lValGetClass        (lVal v){ return lValGetPointer(v); }
+static inline lCoroutine     *lValGetCoroutine    (lVal v){ return lValGetPointer(v); }
+
+extern lVal NIL;
+
 struct lPair {
 	lVal car;
 	union {
@@ -147,11 +301,21 @@ struct lPair {
  | Some pretty core Nujel procedures
  */
 void      lInit    ();
+void      lDestroy ();
+void      lSetHeapLimit(size_t bytes);
+void      lSetGenerationalGC(bool enabled);
+void      lSetGCMaxPause(u64 usecs);
+void      lGCPrintPauses(FILE *fp);
+void      lGCPrintStats(FILE *fp);
+void      lSetAllocationProfileRate(uint rate);
+void      lAllocationProfilePrint(FILE *fp);
+void      lAllocationProfileWriteStacks(FILE *fp);
 lClosure *lNewRoot ();
 lClosure *lInitRootClosure();
 lClosure *lRedefineNativeFuncs(lClosure *c);
 lVal      lApply   (lVal fun, lVal args);
 lVal      readImage(const void *ptr, size_t imgSize, bool staticImage);
+void     *writeImage(lVal rootValue, i32 *outSize);
 lClosure *findRoot (lVal v);
 
 const void *         lBufferData            (lBuffer *v);
@@ -171,11 +335,11 @@ static inline lVal lCons(lVal car, lVal cdr){
 }
 
 static inline lVal lCar(lVal v) {
-	return likely(v.type == ltPair) ? v.vList->car : NIL;
+	return likely(lValType(v) == ltPair) ? lValGetPair(v)->car : NIL;
 }
 
 static inline lVal lCdr(lVal v) {
-	return likely(v.type == ltPair) ? v.vList->cdr : NIL;
+	return likely(lValType(v) == ltPair) ? lValGetPair(v)->cdr : NIL;
 }
 
 static inline lVal lCaar  (lVal v){return lCar(lCar(v));}
@@ -203,53 +367,53 @@ lVal lValExceptionNonNumeric (lVal v);
 lVal requireFloat            (lVal v);
 lVal optionalSymbolic        (lVal v, const lSymbol *fallback);
 
-#define reqNaturalInt(str) do { if(unlikely(str.type != ltInt)){\
+#define reqNaturalInt(str) do { if(unlikely(lValType(str) != ltInt)){\
 	return lValException(lSymTypeError, "Need natural Int", str);\
 }\
-if(unlikely(str.vInt < 0)){\
+if(unlikely(lValGetInt(str) < 0)){\
 	return lValException(lSymTypeError, "Expected a Natural int, not: ", str);\
 } } while(0)
 
-#define reqClosure(str) do { if(unlikely((str.type != ltLambda) && (str.type != ltEnvironment) && str.type != ltMacro)){ \
+#define reqClosure(str) do { if(unlikely((lValType(str) != ltLambda) && (lValType(str) != ltEnvironment) && lValType(str) != ltMacro)){ \
 	return lValException(lSymTypeError, "Need a Closure", str);\
 } } while(0)
 
-#define reqBytecodeArray(str) do { if(unlikely(str.type != ltBytecodeArr)){\
+#define reqBytecodeArray(str) do { if(unlikely(lValType(str) != ltBytecodeArr)){\
 	return lValException(lSymTypeError, "Need a BytecodeArr", str);\
 } } while(0)
 
-#define reqInt(str) do { if(unlikely(str.type != ltInt)){\
+#define reqInt(str) do { if(unlikely(lValType(str) != ltInt)){\
 	return lValException(lSymTypeError, "Need an Int", str);\
 } } while(0)
 
-#define reqString(str) do { if(unlikely(str.type != ltString)){\
+#define reqString(str) do { if(unlikely(lValType(str) != ltString)){\
 	return lValException(lSymTypeError, "Need a String", str);\
 } } while(0)
 
-#define reqBuffer(val) do { if(unlikely(val.type != ltBuffer)){\
+#define reqBuffer(val) do { if(unlikely(lValType(val) != ltBuffer)){\
 	return lValException(lSymTypeError, "Need a Buffer", val);\
 } } while(0)
 
-#define reqArray(val) do { if(unlikely(val.type != ltArray)){\
+#define reqArray(val) do { if(unlikely(lValType(val) != ltArray)){\
 	return lValException(lSymTypeError, "Need an Array", val);\
 } } while(0)
 
-#define reqSymbol(val) do { if(unlikely(val.type != ltSymbol)){\
+#define reqSymbol(val) do { if(unlikely(lValType(val) != ltSymbol)){\
 	return lValException(lSymTypeError, "Need a Symbol", val);\
 } } while(0)
 
-#define reqSymbolic(val) do { if(unlikely((val.type != ltSymbol) && (val.type != ltKeyword))){ \
+#define reqSymbolic(val) do { if(unlikely((lValType(val) != ltSymbol) && (lValType(val) != ltKeyword))){ \
 	return lValException(lSymTypeError, "Need a Symbol or Keyword", val);\
 } } while(0)
 
-#define reqFileHandle(val) do { if(unlikely(val.type != ltFileHandle)){\
+#define reqFileHandle(val) do { if(unlikely(lValType(val) != ltFileHandle)){\
 	return lValException(lSymTypeError, "Need a FileHandle", val);\
 } } while(0)
 
-#define reqMutableBuffer(val) do { if(unlikely(val.type != ltBuffer)){\
+#define reqMutableBuffer(val) do { if(unlikely(lValType(val) != ltBuffer)){\
 	return lValException(lSymTypeError, "Need a Buffer", val);\
 }\
-if(unlikely(val.vBuffer->flags & BUFFER_IMMUTABLE)){\
+if(unlikely(lValGetBuffer(val)->flags & BUFFER_IMMUTABLE)){\
 	return lValException(lSymTypeError, "Buffer is immutable", val);\
  } } while(0)
 
@@ -299,19 +463,19 @@ lSymbol  *lSymS         (const char *s);
 lSymbol  *lSymSM        (const char *s);
 lSymbol  *lSymSL        (const char *s, uint len);
 
-extern lSymbol *lSymPrototype;
-extern lSymbol *lSymFloatNaN;
-extern lSymbol *lSymFloatInf;
-extern lSymbol *lSymTypeError;
-extern lSymbol *lSymOutOfBounds;
-extern lSymbol *lSymIOError;
-extern lSymbol *lSymArityError;
-extern lSymbol *lSymDivisionByZero;
-extern lSymbol *lSymReadError;
-extern lSymbol *lSymOOM;
-extern lSymbol *lSymUnmatchedOpeningBracket;
-extern lSymbol *lSymUnboundVariable;
-extern lSymbol *lSymNotSupportedOnPlatform;
+extern THREAD_LOCAL lSymbol *lSymPrototype;
+extern THREAD_LOCAL lSymbol *lSymFloatNaN;
+extern THREAD_LOCAL lSymbol *lSymFloatInf;
+extern THREAD_LOCAL lSymbol *lSymTypeError;
+extern THREAD_LOCAL lSymbol *lSymOutOfBounds;
+extern THREAD_LOCAL lSymbol *lSymIOError;
+extern THREAD_LOCAL lSymbol *lSymArityError;
+extern THREAD_LOCAL lSymbol *lSymDivisionByZero;
+extern THREAD_LOCAL lSymbol *lSymReadError;
+extern THREAD_LOCAL lSymbol *lSymOOM;
+extern THREAD_LOCAL lSymbol *lSymUnmatchedOpeningBracket;
+extern THREAD_LOCAL lSymbol *lSymUnboundVariable;
+extern THREAD_LOCAL lSymbol *lSymNotSupportedOnPlatform;
 
 /*
  | lVal related procedures
@@ -323,48 +487,40 @@ static inline lVal lValFloat(double v){
 	if(unlikely(isinf(v))){
 		return lValException(lSymFloatInf,"INF is disallowed in Nujel", NIL);
 	}
-	return (lVal){ltFloat, .vFloat = v};
+	return lValFloatRaw(v);
 }
 
 static inline lVal lValExceptionSimple(){
-	return (lVal){ltException, .vList = NULL};
-}
-
-static inline lVal lValInt(i64 v){
-	return (lVal){ltInt, .vInt = v};
-}
-
-static inline lVal lValBool(bool v){
-	return (lVal){ltBool, .vBool = v};
+	return lValAlloc(ltException, NULL);
 }
 
-static inline lVal lValType(lClass *T){
-	return (lVal){ltType, .vType = T};
+static inline lVal lValClass(lClass *T){
+	return lValAlloc(ltType, T);
 }
 
 lTreeRoot *lTreeRootAllocRaw();
 static inline lVal lValTree(lTree *v){
 	lTreeRoot *root = lTreeRootAllocRaw();
 	root->root = v;
-	return (lVal){ltTree, .vTree = root};
+	return lValAlloc(ltTree, root);
 }
 
 static inline lVal lValMap(lMap *v){
-	return (lVal){ltMap, .vMap = v};
+	return lValAlloc(ltMap, v);
 }
 
 static inline lVal lValEnvironment(lClosure *v){
-	return (lVal){ltEnvironment, .vClosure = v};
+	return lValAlloc(ltEnvironment, v);
 }
 
 static inline lVal lValLambda(lClosure *v){
-	return (lVal){ltLambda, .vClosure = v};
+	return lValAlloc(ltLambda, v);
 }
 
 /* Return a newly allocated nujel symbol of value S */
 static inline lVal lValSymS(const lSymbol *s){
 	if(unlikely(s == NULL)){return NIL;}
-	return (lVal){ltSymbol, .vSymbol = s};
+	return lValAlloc(ltSymbol, (lSymbol *)s);
 }
 
 /* Return a nujel value for the symbol within S */
@@ -375,7 +531,7 @@ static inline lVal lValSym(const char *s){
 /* Return a newly allocated nujel keyword of value S */
 static inline lVal lValKeywordS(const lSymbol *s){
 	if(unlikely(s == NULL)){return NIL;}
-	return (lVal){ltKeyword, .vSymbol = s};
+	return lValAlloc(ltKeyword, (lSymbol *)s);
 }
 
 /* Return a nujel value for the keyword within S */
@@ -384,7 +540,7 @@ static inline lVal lValKeyword(const char *s){
 }
 
 static inline lVal lValFileHandle(FILE *fh){
-	return (lVal){ltFileHandle, .vFileHandle = fh};
+	return lValAlloc(ltFileHandle, fh);
 }
 
 lVal     lValString       (const char *s);
@@ -20,7 +20,7 @@ typedef struct {
 } lReadContext;
 
 static inline bool isComment(lVal v){
-	return v.type == ltComment;
+	return lValType(v) == ltComment;
 }
 
 static inline lVal lValComment(){
@@ -86,24 +86,32 @@ static void lStringAdvanceUntilEndOfBlockComment(lReadContext *s){
 	}
 }
 
+/* Scratch buffer for string literals, grows as needed */
+static THREAD_LOCAL char *lStringBuf = NULL;
+static THREAD_LOCAL uint lStringBufSize = 1<<12; // Start with 4K
+
+void lReaderDestroy(){
+	free(lStringBuf);
+	lStringBuf = NULL;
+	lStringBufSize = 1<<12;
+}
+
 /* Parse the string literal in s and return the resulting ltString lVal */
 static lVal lParseString(lReadContext *s){
-	static char *buf = NULL;
-	static uint bufSize = 1<<12; // Start with 4K
-	if(buf == NULL){buf = malloc(bufSize);}
-	if(buf == NULL){
+	if(lStringBuf == NULL){lStringBuf = malloc(lStringBufSize);}
+	if(lStringBuf == NULL){
 		exit(20);
 	}
-	char *b = buf;
+	char *b = lStringBuf;
 	uint i=0;
 	while(s->data < s->bufEnd){
-		if(unlikely(++i >= bufSize)){
-			bufSize *= 2;
-			buf = realloc(buf,bufSize);
-			if(buf == NULL){
+		if(unlikely(++i >= lStringBufSize)){
+			lStringBufSize *= 2;
+			lStringBuf = realloc(lStringBuf,lStringBufSize);
+			if(lStringBuf == NULL){
 				exit(21);
 			}
-			b = &buf[i];
+			b = &lStringBuf[i];
 		}
 		if(unlikely(*s->data == '\\')){
 			s->data++;
@@ -147,43 +155,44 @@ static lVal lParseString(lReadContext *s){
 			s->data++;
 		}else if(unlikely(*s->data == '"')){
 			s->data++;
-			return lValAlloc(ltString, lStringNew(buf,b-buf));
+			return lValAlloc(ltString, lStringNew(lStringBuf,b-lStringBuf));
 		}else if(unlikely(*s->data == 0)){
-			if (likely(i < bufSize)) {
-				buf[i] = 0;
+			if (likely(i < lStringBufSize)) {
+				lStringBuf[i] = 0;
 			}
-			return lValException(lSymReadError, "Can't find closing \"", lValString(buf));
+			return lValException(lSymReadError, "Can't find closing \"", lValString(lStringBuf));
 		}else{
 			*b++ = *s->data++;
 		}
 	}
-	if (likely(i < bufSize)) {
-		buf[i] = 0;
+	if (likely(i < lStringBufSize)) {
+		lStringBuf[i] = 0;
 	}
-	return lValException(lSymReadError, "Can't find closing \"", lValString(buf));
+	return lValException(lSymReadError, "Can't find closing \"", lValString(lStringBuf));
 }
 
-static lVal lFinishSymbol(lReadContext *s, uint i, char buf[128], const char *start, bool keyword, lVal refVal){
-	buf[i] = 0;
+static lVal lFinishSymbol(lReadContext *s, uint len, const char *start, bool keyword, lVal refVal){
 	while(isspace((u8)*s->data)){
 		if(*s->data == 0){break;}
 		s->data++;
 	}
 
-	char *kwstart = buf;
-	if((i > 0) && (buf[i-1] == ':')){
-		buf[i-1] = 0;
+	if(unlikely(*start == 0)){
+		return lValExceptionReaderEnd(s, start, "Sym/KW too short");
 	}
-	if(buf[0] == ':'){
-		kwstart = &buf[1];
+	const char *name = start;
+	if((len > 0) && (name[len-1] == ':')){
+		len--;
 	}
-	if(unlikely(*start == 0)){
-		return lValExceptionReaderEnd(s, kwstart, "Sym/KW too short");
+	if((len > 0) && (name[0] == ':')){
+		name++;
+		len--;
 	}
-	lVal ret = keyword
-		? lValKeyword(kwstart)
-		: lValSym(buf);
-	if(unlikely(refVal.type != ltNil)){
+	/* Names are interned right from the input, so symbols we have
+	 * already seen don't need any allocation */
+	lSymbol *sym = lSymIntern(name, len, lHashString(name, len));
+	lVal ret = keyword ? lValKeywordS(sym) : lValSymS(sym);
+	if(unlikely(lValType(refVal) != ltNil)){
 		ret = lCons(lValSymS(symRef), lCons(refVal, lCons(ret, NIL)));
 	}
 	return ret;
@@ -192,13 +201,12 @@ static lVal lFinishSymbol(lReadContext *s, uint i, char buf[128], const char *st
 /* Parse s as a symbol and return the ltSymbol lVal */
 static lVal lParseSymbol(lReadContext *s, lVal refVal){
 	uint i;
-	char buf[128];
-	bool keyword = refVal.type != ltNil;
-	if(unlikely(refVal.type == ltException)){
+	bool keyword = lValType(refVal) != ltNil;
+	if(unlikely(lValType(refVal) == ltException)){
 		return refVal;
 	}
 	const char *start = s->data;
-	for(i=0;i<(sizeof(buf)-1);i++){
+	for(i=0;;i++){
 		const char c = *s->data++;
 		if(c == ':'){
 			if(keyword){
@@ -215,15 +223,14 @@ static lVal lParseSymbol(lReadContext *s, lVal refVal){
 			}
 		}
 		if(c == '.'){
-			return lParseSymbol(s, lFinishSymbol(s, i, buf, start, keyword, refVal));
+			return lParseSymbol(s, lFinishSymbol(s, i, start, keyword, refVal));
 		}
 		if((c == 0) || isspace((u8)c) || isnonsymbol(c)){
 			s->data--;
 			break;
 		}
-		buf[i] = c;
 	}
-	return lFinishSymbol(s, i, buf, start, keyword, refVal);
+	return lFinishSymbol(s, i, start, keyword, refVal);
 }
 
 static lVal lParseNumberBase(lReadContext *s, int base, int maxDigits){
@@ -264,7 +271,7 @@ static lVal lParseNumber(lReadContext *s, int base, int maxDigits){
 		negative = true;
 	}
 	lVal val = lParseNumberBase(s, base, maxDigits);
-	if(unlikely(val.type == ltException)){
+	if(unlikely(lValType(val) == ltException)){
 		return val;
 	}
 	if(*s->data == '.'){
@@ -275,18 +282,18 @@ static lVal lParseNumber(lReadContext *s, int base, int maxDigits){
 			s->data++;
 		}
 		const lVal mantissaVal = lParseNumberBase(s, base, maxDigits);
-		if(unlikely(mantissaVal.type == ltException)){
+		if(unlikely(lValType(mantissaVal) == ltException)){
 			return mantissaVal;
 		}
 		if(*s->data == '.'){
 			return lValExceptionReaderEnd(s, start, "Period at end of number");
 		}else{
-			const double valf = createFloat(val.vInt, mantissaVal.vInt, mantissaLeadingZeroes);
+			const double valf = createFloat(lValGetInt(val), lValGetInt(mantissaVal), mantissaLeadingZeroes);
 			return lValFloat(negative ? -valf : valf);
 		}
 	}
 	if(negative){
-		val.vInt = -val.vInt;
+		val = lValInt(-lValGetInt(val));
 	}
 	return val;
 }
@@ -369,7 +376,7 @@ static lVal lParseBuffer(lReadContext *s){
 		return lValException(lSymOOM, "OOM during buffer parse outtro", NIL);
 	}
 	lVal ret = lValAlloc(ltBuffer, lBufferAlloc(len, true));
-	ret.vBuffer->buf = newBuf;
+	lValGetBuffer(ret)->buf = newBuf;
 	return ret;
 }
 
@@ -402,8 +409,8 @@ static lVal lParseSpecial(lReadContext *s){
 	case '@':{
 		s->data++;
 		lVal ret = lnfTreeNew(lReadList(s,false,')'));
-		if(ret.vTree->root){
-			ret.vTree->root->flags |= TREE_IMMUTABLE;
+		if(lValGetTreeRoot(ret)->root){
+			lValGetTreeRoot(ret)->root->flags |= TREE_IMMUTABLE;
 		}
 		return ret;
 	}}
@@ -414,13 +421,13 @@ static lVal lReadList(lReadContext *s, bool rootForm, char terminator){
 	while(1){
 		lStringAdvanceToNextCharacter(s);
 
-		const char c = *s->data;
-		if((s->data >= s->bufEnd) || (c == 0)){
+		const char c = s->data < s->bufEnd ? *s->data : 0;
+		if(c == 0){
 			if(unlikely(!rootForm)){
 				return lValExceptionReaderCustom(s, "Unmatched opening bracket", lSymUnmatchedOpeningBracket);
 			}
 			s->data++;
-			return ret.type == ltNil ? lCons(NIL,NIL) : ret;
+			return lValType(ret) == ltNil ? lCons(NIL,NIL) : ret;
 		}else if(c == ';'){
 			lStringAdvanceToNextLine(s);
 			continue;
@@ -429,13 +436,13 @@ static lVal lReadList(lReadContext *s, bool rootForm, char terminator){
 				return lValExceptionReader(s, "Unmatched closing bracket");
 			}
 			s->data++;
-			return ret.type == ltNil ? lCons(NIL, NIL) : ret;
+			return lValType(ret) == ltNil ? lCons(NIL, NIL) : ret;
 		}else if(unlikely(isClosingChar(c))){
 			return lValExceptionReader(s, "Unmatched closing char");
 		}else{
 			const u8 next = s->data[1];
 			if((c == '.') && (isspace(next) || isnonsymbol(next))){
-				if(unlikely(v.type == ltNil)){
+				if(unlikely(lValType(v) == ltNil)){
 					return lValExceptionReader(s, "Missing car in dotted pair");
 				}
 				s->data++;
@@ -446,23 +453,23 @@ static lVal lReadList(lReadContext *s, bool rootForm, char terminator){
 					}
 					lStringAdvanceToNextCharacter(s);
 					nv = lReadValue(s);
-					if(unlikely(nv.type == ltException)){
+					if(unlikely(lValType(nv) == ltException)){
 						return nv;
 					}
 				} while(isComment(nv));
-				v.vList->cdr = isComment(nv) ? NIL : nv;
+				lValGetPair(v)->cdr = isComment(nv) ? NIL : nv;
 				continue;
 			}else{
 				lVal nv = lReadValue(s);
 				if(unlikely(isComment(nv))){continue;}
-				if(unlikely(nv.type == ltException)){
+				if(unlikely(lValType(nv) == ltException)){
 					return nv;
 				}
-				if(v.type == ltNil){
+				if(lValType(v) == ltNil){
 					v = ret = lCons(nv, NIL);
 				}else{
-					v.vList->cdr = lCons(nv, NIL);
-					v = v.vList->cdr;
+					lValGetPair(v)->cdr = lCons(nv, NIL);
+					v = lValGetPair(v)->cdr;
 				}
 			}
 		}
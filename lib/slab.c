@@ -0,0 +1,221 @@
+/* Nujel - Copyright (C) 2020-2022 - Benjamin Vincent Schulenburg
+ * This project uses the MIT license, a copy should be included under /LICENSE */
+#ifndef NUJEL_AMALGAMATION
+#include "nujel-private.h"
+#endif
+
+/*
+ * Contains a size-class slab allocator for the payloads of arrays, maps and
+ * bytecode arrays, since most of those are tiny going through malloc/free for
+ * each one of them is quite wasteful.
+ *
+ * Blocks are rounded up to the next power of two and carved out of aligned
+ * pages, every page only containing blocks of a single size class. That way
+ * we can find the page of a block by masking its address, freeing a block
+ * just puts it onto the free list of its page. Pages without any live
+ * blocks are given back in bulk after the GC is done sweeping. Anything
+ * larger than SLAB_MAX_BYTES goes straight to malloc, which is why callers
+ * have to pass the size of a block when freeing it.
+ */
+
+#define SLAB_PAGE_BYTES   (1 << 16)
+#define SLAB_HEADER_BYTES 64
+#define SLAB_MIN_SHIFT    4
+#define SLAB_CLASSES      9
+#define SLAB_MAX_BYTES    (1 << (SLAB_MIN_SHIFT + SLAB_CLASSES - 1))
+#define SLAB_PAGE_CAPACITY(cls) ((uint)((SLAB_PAGE_BYTES - SLAB_HEADER_BYTES) >> ((cls) + SLAB_MIN_SHIFT)))
+
+typedef struct lSlabBlock {
+	struct lSlabBlock *nextFree;
+} lSlabBlock;
+
+typedef struct {
+	lSlabBlock *freeList;
+	uint used;
+	uint live;
+} lSlabPage;
+
+typedef struct {
+	lSlabPage **pages;
+	uint count;
+	uint capacity;
+	uint cursor;
+} lSlabClass;
+
+static THREAD_LOCAL lSlabClass lSlabClasses[SLAB_CLASSES];
+
+/* Total amount of memory used by slab pages */
+THREAD_LOCAL size_t lSlabSize = 0;
+
+static inline uint lSlabClassOf(size_t bytes){
+	uint cls = 0;
+	for(size_t s = 1 << SLAB_MIN_SHIFT; s < bytes; s <<= 1){
+		cls++;
+	}
+	return cls;
+}
+
+static inline lSlabPage *lSlabPageOf(const void *v){
+	return (lSlabPage *)((uintptr_t)v & ~((uintptr_t)SLAB_PAGE_BYTES - 1));
+}
+
+static inline void *lSlabPageBlock(lSlabPage *page, uint cls, uint i){
+	return &((u8 *)page)[SLAB_HEADER_BYTES + ((size_t)i << (cls + SLAB_MIN_SHIFT))];
+}
+
+static lSlabPage *lSlabPageNew(lSlabClass *c){
+	if(c->count >= c->capacity){
+		c->capacity = MAX(16, c->capacity * 2);
+		lSlabPage **t = realloc(c->pages, c->capacity * sizeof(lSlabPage *));
+		if(unlikely(t == NULL)){
+			fprintf(stderr, "OOM: Couldn't grow the slab page list\n");
+			exit(123);
+		}
+		c->pages = t;
+	}
+	lSlabPage *page = lAlignedAlloc(SLAB_PAGE_BYTES, SLAB_PAGE_BYTES);
+	if(unlikely(page == NULL)){
+		fprintf(stderr, "OOM: Couldn't allocate a new slab page\n");
+		exit(123);
+	}
+	page->freeList = NULL;
+	page->used = 0;
+	page->live = 0;
+	lSlabSize += SLAB_PAGE_BYTES;
+	c->pages[c->count++] = page;
+	return page;
+}
+
+/* Look for the next page with a free block, starting from the cursor, and
+ * only add a new page when there is none. */
+static void *lSlabAllocSlow(lSlabClass *c, uint cls){
+	for(;c->cursor < c->count;c->cursor++){
+		lSlabPage *page = c->pages[c->cursor];
+		if(page->freeList){
+			lSlabBlock *ret = page->freeList;
+			page->freeList = ret->nextFree;
+			page->live++;
+			return ret;
+		}
+		if(page->used < SLAB_PAGE_CAPACITY(cls)){
+			page->live++;
+			return lSlabPageBlock(page, cls, page->used++);
+		}
+	}
+	lSlabPage *page = lSlabPageNew(c);
+	c->cursor = c->count - 1;
+	page->live++;
+	return lSlabPageBlock(page, cls, page->used++);
+}
+
+/* Return a zeroed block of at least BYTES bytes, never returns NULL for
+ * blocks that fit into a slab, even when BYTES is 0 */
+void *lSlabAlloc(size_t bytes){
+	if(unlikely(bytes > SLAB_MAX_BYTES)){
+		return calloc(bytes, 1);
+	}
+	const uint cls = lSlabClassOf(bytes);
+	lSlabClass *c = &lSlabClasses[cls];
+	void *ret;
+	lSlabPage *page = c->cursor < c->count ? c->pages[c->cursor] : NULL;
+	if(likely(page && page->freeList)){
+		lSlabBlock *b = page->freeList;
+		page->freeList = b->nextFree;
+		page->live++;
+		ret = b;
+	}else if(page && (page->used < SLAB_PAGE_CAPACITY(cls))){
+		page->live++;
+		ret = lSlabPageBlock(page, cls, page->used++);
+	}else{
+		ret = lSlabAllocSlow(c, cls);
+	}
+	memset(ret, 0, bytes);
+	return ret;
+}
+
+/* Return how many bytes a block of BYTES actually occupies */
+size_t lSlabBlockBytes(size_t bytes){
+	if(bytes > SLAB_MAX_BYTES){
+		return bytes;
+	}
+	return (size_t)1 << (lSlabClassOf(bytes) + SLAB_MIN_SHIFT);
+}
+
+/* Free V which has to have been allocated with a size of BYTES */
+void lSlabFree(void *v, size_t bytes){
+	if(unlikely(v == NULL)){return;}
+	if(unlikely(bytes > SLAB_MAX_BYTES)){
+		free(v);
+		return;
+	}
+	lSlabPage *page = lSlabPageOf(v);
+	lSlabBlock *b = v;
+	b->nextFree = page->freeList;
+	page->freeList = b;
+	page->live--;
+}
+
+/* Resize V from OLDBYTES to NEWBYTES, staying within the same block if the
+ * size class doesn't change. Contents beyond OLDBYTES are undefined, just
+ * like with realloc. Returns NULL when malloc runs out of memory, in which
+ * case V is left untouched. */
+void *lSlabRealloc(void *v, size_t oldBytes, size_t newBytes){
+	if(v == NULL){
+		return lSlabAlloc(newBytes);
+	}
+	if((oldBytes > SLAB_MAX_BYTES) && (newBytes > SLAB_MAX_BYTES)){
+		return realloc(v, newBytes);
+	}
+	if((oldBytes <= SLAB_MAX_BYTES) && (newBytes <= SLAB_MAX_BYTES)
+	   && (lSlabClassOf(oldBytes) == lSlabClassOf(newBytes))){
+		return v;
+	}
+	void *ret = lSlabAlloc(newBytes);
+	if(unlikely(ret == NULL)){
+		return NULL;
+	}
+	memcpy(ret, v, MIN(oldBytes, newBytes));
+	lSlabFree(v, oldBytes);
+	return ret;
+}
+
+/* Give pages without any live blocks back to the OS, keeping a single empty
+ * page per size class so that we don't immediately have to ask for a new
+ * one. Should be called once the GC is done sweeping, since only then are
+ * all the blocks of dead objects back on their free lists. */
+void lSlabReclaim(){
+	for(uint cls=0;cls < SLAB_CLASSES;cls++){
+		lSlabClass *c = &lSlabClasses[cls];
+		bool spare = false;
+		uint kept = 0;
+		for(uint i=0;i < c->count;i++){
+			lSlabPage *page = c->pages[i];
+			if(page->live == 0){
+				if(spare){
+					lAlignedFree(page);
+					lSlabSize -= SLAB_PAGE_BYTES;
+					continue;
+				}
+				page->freeList = NULL;
+				page->used = 0;
+				spare = true;
+			}
+			c->pages[kept++] = page;
+		}
+		c->count = kept;
+		c->cursor = 0;
+	}
+}
+
+/* Give every page back, regardless of whether there are still live blocks */
+void lSlabDestroy(){
+	for(uint cls=0;cls < SLAB_CLASSES;cls++){
+		lSlabClass *c = &lSlabClasses[cls];
+		for(uint i=0;i < c->count;i++){
+			lAlignedFree(c->pages[i]);
+		}
+		free(c->pages);
+		memset(c, 0, sizeof(*c));
+	}
+	lSlabSize = 0;
+}
@@ -31,7 +31,7 @@ lString *lStringNew(const char *str, uint len){
 lVal lValStringLen(const char *c, int len){
 	if(unlikely(c == NULL)){return NIL;}
 	lVal t = lValAlloc(ltString, lStringNew(c,len));
-	return unlikely(t.vString == NULL) ? NIL : t;
+	return unlikely(lValGetString(t) == NULL) ? NIL : t;
 }
 
 /* Create a new string value out of S */
@@ -76,24 +76,24 @@ lVal lValStringError(const char *bufStart, const char *bufEnd, const char *errSt
 
 static lVal lnmStringCut(lVal self, lVal start, lVal stop){
 	i64 slen, len;
-	const char *buf = self.vString->data;
-	slen = len = lBufferLength(self.vString);
+	const char *buf = lValGetString(self)->data;
+	slen = len = lBufferLength(lValGetString(self));
 	reqInt(start);
-	i64 off = MAX(0, start.vInt);
-	len = MIN(slen - off, (((stop.type == ltInt)) ? stop.vInt : len) - off);
+	i64 off = MAX(0, lValGetInt(start));
+	len = MIN(slen - off, (((lValType(stop) == ltInt)) ? lValGetInt(stop) : len) - off);
 
 	if(unlikely(len <= 0)){return lValString("");}
 	return lValStringLen(&buf[off], len);
 }
 
 static lVal lnmStringIndexOf(lVal self, lVal search, lVal start){
-	const char *haystack = self.vString->data;
-	if(unlikely(search.type != ltString)){
+	const char *haystack = lValGetString(self)->data;
+	if(unlikely(lValType(search) != ltString)){
 		return lValExceptionType(search, ltString);
 	}
-	const char *needle = search.vString->data;
-	const i64 haystackLength = self.vString->length;
-	const i64 needleLength   = search.vString->length;
+	const char *needle = lValGetString(search)->data;
+	const i64 haystackLength = lValGetString(self)->length;
+	const i64 needleLength   = lValGetString(search)->length;
 
 	if(needleLength <= 0){return lValInt(-1);}
 	const i64 pos = castToInt(start, 0);
@@ -111,13 +111,13 @@ static lVal lnmStringIndexOf(lVal self, lVal search, lVal start){
 }
 
 static lVal lnmStringLastIndexOf(lVal self, lVal search, lVal start){
-	const char *haystack = self.vString->data;
-	if(unlikely(search.type != ltString)){
+	const char *haystack = lValGetString(self)->data;
+	if(unlikely(lValType(search) != ltString)){
 		return lValExceptionType(search, ltString);
 	}
-	const char *needle = search.vString->data;
-	const i64 haystackLength = self.vString->length;
-	const i64 needleLength   = search.vString->length;
+	const char *needle = lValGetString(search)->data;
+	const i64 haystackLength = lValGetString(self)->length;
+	const i64 needleLength   = lValGetString(search)->length;
 
 	if(needleLength <= 0){return lValInt(-1);}
 	const i64 pos = castToInt(start, haystackLength - needleLength);
@@ -129,7 +129,32 @@ static lVal lnmStringLastIndexOf(lVal self, lVal search, lVal start){
 	return lValInt(-1);
 }
 
+THREAD_LOCAL lMap *lStringInternTable;
+
+/* Interned strings are never freed, since the table holds on to them */
+static lVal lnfStringIntern(lVal self){
+	reqString(self);
+	lString *s = lValGetString(self);
+	if(s->flags & BUFFER_INTERNED){
+		return self;
+	}
+	const lVal canonical = lMapRef(lStringInternTable, self);
+	if(lValType(canonical) == ltString){
+		return canonical;
+	}
+	lVal ret = self;
+	if(!(s->flags & BUFFER_IMMUTABLE)){
+		ret = lValStringLen(s->data, s->length);
+	}
+	lValGetString(ret)->flags |= BUFFER_INTERNED;
+	lMapSet(lStringInternTable, ret, ret);
+	return ret;
+}
+
 void lOperationsString(){
+	lStringInternTable = lMapAllocRaw();
+	lAddNativeFuncV("string/intern", "(s)", "Return a canonical immutable string equal to S, which compares with other interned strings by identity", lnfStringIntern, 0);
+
 	lClass *String = &lClassList[ltString];
 	lAddNativeMethodVVV(String, lSymS("cut"),      "(self start stop)", lnmStringCut, NFUNC_PURE);
 	lAddNativeMethodVVV(String, lSymS("index-of"), "(self search start)", lnmStringIndexOf, NFUNC_PURE);
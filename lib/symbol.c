@@ -5,82 +5,87 @@
 #include "nujel-private.h"
 #endif
 
-lMap *lSymbolTable;
-
-lSymbol  lSymbolList[SYM_MAX];
-uint     lSymbolActive = 0;
-uint     lSymbolMax    = 0;
-lSymbol *lSymbolFFree = NULL;
-
-lSymbol *symNull;
-lSymbol *symQuote;
-lSymbol *symQuasiquote;
-lSymbol *symUnquote;
-lSymbol *symUnquoteSplicing;
-lSymbol *symArr;
-lSymbol *symTreeNew;
-lSymbol *symMapNew;
-lSymbol *symDocumentation;
-lSymbol *symPure;
-lSymbol *symFold;
-lSymbol *symRef;
-
-lSymbol *symType;
-lSymbol *symArguments;
-lSymbol *symCode;
-lSymbol *symData;
-lSymbol *symName;
-
-lSymbol *lSymLTNil;
-lSymbol *lSymLTBool;
-lSymbol *lSymLTPair;
-lSymbol *lSymLTLambda;
-lSymbol *lSymLTInt;
-lSymbol *lSymLTFloat;
-lSymbol *lSymLTString;
-lSymbol *lSymLTSymbol;
-lSymbol *lSymLTKeyword;
-lSymbol *lSymLTNativeFunction;
-lSymbol *lSymLTEnvironment;
-lSymbol *lSymLTMacro;
-lSymbol *lSymLTArray;
-lSymbol *lSymLTTree;
-lSymbol *lSymLTMap;
-lSymbol *lSymLTBytecodeArray;
-lSymbol *lSymLTBuffer;
-lSymbol *lSymLTBufferView;
-lSymbol *lSymLTFileHandle;
-lSymbol *lSymLTUnknownType;
-lSymbol *lSymLTType;
-lSymbol *lSymLTAny;
-lSymbol *lSymPrototype;
-
-lSymbol *lSymFloatNaN;
-lSymbol *lSymFloatInf;
-lSymbol *lSymVMError;
-lSymbol *lSymTypeError;
-lSymbol *lSymOutOfBounds;
-lSymbol *lSymIOError;
-lSymbol *lSymArityError;
-lSymbol *lSymDivisionByZero;
-lSymbol *lSymReadError;
-lSymbol *lSymOOM;
-lSymbol *lSymUnmatchedOpeningBracket;
-lSymbol *lSymUnboundVariable;
-lSymbol *lSymNotSupportedOnPlatform;
+/* The symbol table is an open addressing hash table using linear probing,
+ * every slot holds the hash of its symbol so that probing doesn't have to
+ * look at symbols whose hash doesn't match. */
+typedef struct {
+	u32 hash;
+	lSymbol *sym;
+} lSymbolTableSlot;
+
+static THREAD_LOCAL lSymbolTableSlot *lSymbolTable = NULL;
+static THREAD_LOCAL uint lSymbolTableSize = 0;
+static THREAD_LOCAL uint lSymbolTableLength = 0;
+
+THREAD_LOCAL lSymbolSegment **lSymbolSegments = NULL;
+THREAD_LOCAL uint     lSymbolSegmentCount = 0;
+static THREAD_LOCAL uint lSymbolSegmentCapacity = 0;
+THREAD_LOCAL uint     lSymbolActive = 0;
+THREAD_LOCAL uint     lSymbolMajorThreshold = SYM_MAX;
+THREAD_LOCAL lSymbol *lSymbolFFree = NULL;
+
+THREAD_LOCAL lSymbol *symNull;
+THREAD_LOCAL lSymbol *symQuote;
+THREAD_LOCAL lSymbol *symQuasiquote;
+THREAD_LOCAL lSymbol *symUnquote;
+THREAD_LOCAL lSymbol *symUnquoteSplicing;
+THREAD_LOCAL lSymbol *symArr;
+THREAD_LOCAL lSymbol *symTreeNew;
+THREAD_LOCAL lSymbol *symMapNew;
+THREAD_LOCAL lSymbol *symDocumentation;
+THREAD_LOCAL lSymbol *symPure;
+THREAD_LOCAL lSymbol *symFold;
+THREAD_LOCAL lSymbol *symRef;
+
+THREAD_LOCAL lSymbol *symType;
+THREAD_LOCAL lSymbol *symArguments;
+THREAD_LOCAL lSymbol *symCode;
+THREAD_LOCAL lSymbol *symData;
+THREAD_LOCAL lSymbol *symName;
+
+THREAD_LOCAL lSymbol *lSymLTNil;
+THREAD_LOCAL lSymbol *lSymLTBool;
+THREAD_LOCAL lSymbol *lSymLTPair;
+THREAD_LOCAL lSymbol *lSymLTLambda;
+THREAD_LOCAL lSymbol *lSymLTInt;
+THREAD_LOCAL lSymbol *lSymLTFloat;
+THREAD_LOCAL lSymbol *lSymLTString;
+THREAD_LOCAL lSymbol *lSymLTSymbol;
+THREAD_LOCAL lSymbol *lSymLTKeyword;
+THREAD_LOCAL lSymbol *lSymLTNativeFunction;
+THREAD_LOCAL lSymbol *lSymLTEnvironment;
+THREAD_LOCAL lSymbol *lSymLTMacro;
+THREAD_LOCAL lSymbol *lSymLTArray;
+THREAD_LOCAL lSymbol *lSymLTTree;
+THREAD_LOCAL lSymbol *lSymLTMap;
+THREAD_LOCAL lSymbol *lSymLTBytecodeArray;
+THREAD_LOCAL lSymbol *lSymLTBuffer;
+THREAD_LOCAL lSymbol *lSymLTBufferView;
+THREAD_LOCAL lSymbol *lSymLTFileHandle;
+THREAD_LOCAL lSymbol *lSymLTUnknownType;
+THREAD_LOCAL lSymbol *lSymLTType;
+THREAD_LOCAL lSymbol *lSymLTCoroutine;
+THREAD_LOCAL lSymbol *lSymLTAny;
+THREAD_LOCAL lSymbol *lSymPrototype;
+
+THREAD_LOCAL lSymbol *lSymFloatNaN;
+THREAD_LOCAL lSymbol *lSymFloatInf;
+THREAD_LOCAL lSymbol *lSymVMError;
+THREAD_LOCAL lSymbol *lSymTypeError;
+THREAD_LOCAL lSymbol *lSymOutOfBounds;
+THREAD_LOCAL lSymbol *lSymIOError;
+THREAD_LOCAL lSymbol *lSymArityError;
+THREAD_LOCAL lSymbol *lSymDivisionByZero;
+THREAD_LOCAL lSymbol *lSymReadError;
+THREAD_LOCAL lSymbol *lSymOOM;
+THREAD_LOCAL lSymbol *lSymUnmatchedOpeningBracket;
+THREAD_LOCAL lSymbol *lSymUnboundVariable;
+THREAD_LOCAL lSymbol *lSymNotSupportedOnPlatform;
 
 void lSymbolInit(){
-	lSymbolTable = lMapAllocRaw();
 	lSymbolActive = 0;
-	lSymbolMax    = 0;
 	lSymbolFFree  = NULL;
 
-	lSymbolList[0].nextFree = NULL;
-	lSymbolList[0].c[sizeof(lSymbolList[0].c) - 1] = 0xFF;
-	if(lSymbolList[0].nextFree != NULL){
-		exit(110);
-	}
-
 	symNull              = lSymSM("");
 	symQuote             = lSymSM("quote");
 	symQuasiquote        = lSymSM("quasiquote");
@@ -121,6 +126,7 @@ void lSymbolInit(){
 	lSymLTFileHandle     = lSymSM("file-handle");
 	lSymLTUnknownType    = lSymSM("unknown-type");
 	lSymLTType           = lSymSM("type");
+	lSymLTCoroutine      = lSymSM("coroutine");
 	lSymLTAny            = lSymSM("any");
 
 	lSymPrototype        = lSymSM("prototype*");
@@ -140,27 +146,181 @@ void lSymbolInit(){
 	lSymNotSupportedOnPlatform = lSymSM("not-supported-on-platform");
 }
 
+static void lSymbolNameFree(lSymbol *s){
+	if(s->c != s->inlineName){
+		free((void *)s->c);
+	}
+	s->c = NULL;
+}
+
+void lSymbolDestroy(){
+	for(uint s=0;s < lSymbolSegmentCount;s++){
+		lSymbolSegment *seg = lSymbolSegments[s];
+		for(uint i=0;i < seg->used;i++){
+			if(seg->markMap[i] != GC_FREE){
+				lSymbolNameFree(&seg->list[i]);
+			}
+		}
+		lHeapSegmentFree(seg);
+	}
+	free(lSymbolSegments);
+	lSymbolSegments = NULL;
+	lSymbolSegmentCount = lSymbolSegmentCapacity = 0;
+	free(lSymbolTable);
+	lSymbolTable  = NULL;
+	lSymbolTableSize = lSymbolTableLength = 0;
+	lSymbolActive = 0;
+	lSymbolMajorThreshold = SYM_MAX;
+	lSymbolFFree  = NULL;
+}
+
+/* Return the slot holding the symbol named STR, or the empty slot it would
+ * have to be put in */
+static lSymbolTableSlot *lSymbolTableFind(const char *str, uint len, u32 hash){
+	const uint mask = lSymbolTableSize - 1;
+	for(uint i = hash & mask;; i = (i + 1) & mask){
+		lSymbolTableSlot *slot = &lSymbolTable[i];
+		if(slot->sym == NULL){
+			return slot;
+		}
+		if((slot->hash == hash) && (slot->sym->length == len) && (memcmp(slot->sym->c, str, len) == 0)){
+			return slot;
+		}
+	}
+}
+
+static void lSymbolTableGrow(){
+	lSymbolTableSlot *old = lSymbolTable;
+	const uint oldSize = lSymbolTableSize;
+	lSymbolTableSize = MAX(1024, oldSize * 2);
+	lSymbolTable = calloc(lSymbolTableSize, sizeof(lSymbolTableSlot));
+	if(unlikely(lSymbolTable == NULL)){
+		fprintf(stderr, "OOM: Couldn't grow the symbol table\n");
+		exit(123);
+	}
+	const uint mask = lSymbolTableSize - 1;
+	for(uint i=0;i < oldSize;i++){
+		if(old[i].sym == NULL){continue;}
+		uint j = old[i].hash & mask;
+		while(lSymbolTable[j].sym){
+			j = (j + 1) & mask;
+		}
+		lSymbolTable[j] = old[i];
+	}
+	free(old);
+}
+
+/* Remove S from the symbol table, entries after it are moved back so that
+ * lookups never have to skip over deleted slots */
+static void lSymbolTableRemove(const lSymbol *s){
+	const uint mask = lSymbolTableSize - 1;
+	uint i = s->hash & mask;
+	while(lSymbolTable[i].sym != s){
+		i = (i + 1) & mask;
+	}
+	for(uint j = (i + 1) & mask; lSymbolTable[j].sym; j = (j + 1) & mask){
+		const uint home = lSymbolTable[j].hash & mask;
+		/* Only move the entry at J if its home slot doesn't lie within (I, J] */
+		if(((j - home) & mask) >= ((j - i) & mask)){
+			lSymbolTable[i] = lSymbolTable[j];
+			i = j;
+		}
+	}
+	lSymbolTable[i].sym = NULL;
+	lSymbolTableLength--;
+}
+
+/* Put S onto the free list, it has to be removed from the symbol table already */
 void lSymbolFree(lSymbol *s){
-	 // WIP - should actualle free them in the future
-	(void)s;
-	/*
+	lSymbolNameFree(s);
 	s->nextFree = lSymbolFFree;
-	s->c[sizeof(s->c)-1] = 0xFF;
 	lSymbolFFree = s;
+	*lSymbolMarkOf(s) = GC_FREE;
 	lSymbolActive--;
-	const int symIndex = lSymIndex(s);
-	const int slot = lSymbolBackIndex[symIndex];
-	lSymbolIndex[slot] = -symIndex;
-	lSymbolMarkMap[s - lSymbolList] = 2;
-	*/
+}
+
+/* Called once marking is done, after a major collection every symbol that
+ * hasn't been marked is removed from the symbol table and freed. The symbol
+ * table isn't a root, so every symbol still referenced by anything else
+ * has been marked. */
+void lSymbolSweep(bool major){
+	for(uint s=0;s < lSymbolSegmentCount;s++){
+		lSymbolSegment *seg = lSymbolSegments[s];
+		for(uint i=0;i < seg->used;i++){
+			if(seg->markMap[i] == GC_MARKED){
+				seg->markMap[i] = GC_YOUNG;
+			}else if(major && (seg->markMap[i] == GC_YOUNG)){
+				lSymbolTableRemove(&seg->list[i]);
+				lSymbolFree(&seg->list[i]);
+			}
+		}
+	}
+	if(major){
+		lSymbolMajorThreshold = MAX(SYM_MAX, lSymbolActive * 2);
+	}
+}
+
+static lSymbol *lSymbolAllocRaw(){
+	if(lSymbolFFree){
+		lSymbol *ret = lSymbolFFree;
+		lSymbolFFree = ret->nextFree;
+		*lSymbolMarkOf(ret) = GC_YOUNG;
+		return ret;
+	}
+	lSymbolSegment *seg = lSymbolSegmentCount ? lSymbolSegments[lSymbolSegmentCount-1] : NULL;
+	if((seg == NULL) || (seg->used >= HEAP_SEGMENT_CAPACITY(lSymbol))){
+		if(lSymbolSegmentCount >= lSymbolSegmentCapacity){
+			lSymbolSegmentCapacity = MAX(16, lSymbolSegmentCapacity * 2);
+			lSymbolSegment **t = realloc(lSymbolSegments, lSymbolSegmentCapacity * sizeof(lSymbolSegment *));
+			if(unlikely(t == NULL)){
+				fprintf(stderr, "OOM: Couldn't grow the symbol heap\n");
+				exit(123);
+			}
+			lSymbolSegments = t;
+		}
+		seg = lHeapSegmentAlloc();
+		seg->id = lSymbolSegmentCount;
+		lSymbolSegments[lSymbolSegmentCount++] = seg;
+	}
+	return &seg->list[seg->used++];
+}
+
+/* Return the symbol named by the LEN bytes at STR, whose hash has to be
+ * HASH as computed by lHashString. STR doesn't need to be zero terminated,
+ * so the reader can intern symbols right from its input, symbols that
+ * already exist are returned without allocating anything. */
+lSymbol *lSymIntern(const char *str, uint len, u32 hash){
+	if(unlikely((lSymbolTableLength + 1) * 4 > lSymbolTableSize * 3)){
+		lSymbolTableGrow();
+	}
+	lSymbolTableSlot *slot = lSymbolTableFind(str, len, hash);
+	if(likely(slot->sym)){
+		return slot->sym;
+	}
+
+	lSymbol *ret = lSymbolAllocRaw();
+	lSymbolActive++;
+	ret->hash = hash;
+	ret->length = len;
+	char *name = ret->inlineName;
+	if(len >= sizeof(ret->inlineName)){
+		name = malloc(len + 1);
+		if(unlikely(name == NULL)){
+			fprintf(stderr, "OOM: Couldn't allocate a symbol name\n");
+			exit(123);
+		}
+	}
+	memcpy(name, str, len);
+	name[len] = 0;
+	ret->c = name;
+	slot->hash = hash;
+	slot->sym = ret;
+	lSymbolTableLength++;
+	return ret;
 }
 
 lSymbol *lSymSL(const char *str, uint len){
-	char buf[128];
-	len = MIN(sizeof(buf)-1,len);
-	memcpy(buf,str,len);
-	buf[len] = 0;
-	return lSymS(buf);
+	return lSymIntern(str, len, lHashString(str, len));
 }
 
 lSymbol *lSymSM(const char *str){
@@ -168,28 +328,19 @@ lSymbol *lSymSM(const char *str){
 }
 
 lSymbol *lSymS(const char *str){
-	lVal oldEntry = lMapRefString(lSymbolTable, str);
-	if(oldEntry.type == ltSymbol){
-		return (lSymbol *)oldEntry.vSymbol;
-	}
+	return lSymSL(str, strlen(str));
+}
 
-	lSymbol *ret;
-	if(lSymbolFFree){
-		ret = lSymbolFFree;
-		lSymbolFFree = lSymbolFFree->nextFree;
-	}else{
-		if(unlikely(lSymbolMax >= SYM_MAX)){
-			exit(112);
-		}else{
-			ret = &lSymbolList[lSymbolMax++];
+/* Return a map from the name of every symbol to the symbol itself */
+lVal lSymbolTableMap(){
+	lMap *ret = lMapAllocRaw();
+	for(uint i=0;i < lSymbolTableSize;i++){
+		const lSymbol *s = lSymbolTable[i].sym;
+		if(s){
+			lMapSet(ret, lValStringLen(s->c, s->length), lValSymS(s));
 		}
 	}
-	lSymbolActive++;
-	ret->hash = lHashString(str, strlen(str));
-	strncpy(ret->c, str, sizeof(ret->c));
-	ret->c[sizeof(ret->c)-1] = 0;
-	lMapSet(lSymbolTable, lValString(str), lValAlloc(ltSymbol, ret));
-	return ret;
+	return lValMap(ret);
 }
 
 lSymbol *getTypeSymbolT(const lType T){
@@ -214,10 +365,11 @@ lSymbol *getTypeSymbolT(const lType T){
 		case ltBuffer:      return lSymLTBuffer;
 		case ltBufferView:  return lSymLTBufferView;
 		case ltFileHandle:  return lSymLTFileHandle;
+		case ltCoroutine:   return lSymLTCoroutine;
 		case ltAny:         return lSymLTAny;
 	}
 }
 
 lSymbol *getTypeSymbol(const lVal v){
-	return getTypeSymbolT(v.type);
+	return getTypeSymbolT(lValType(v));
 }
@@ -4,6 +4,184 @@
 #include "nujel-private.h"
 #endif
 
+#ifdef NUJEL_TREE_HAMT
+
+lTree *lTreeNew(const lSymbol *s, lVal v){
+	lTree *ret  = lTreeAllocRaw();
+	ret->key    = s;
+	ret->value  = v;
+	return ret;
+}
+
+static lTree *lTreeBranchNew(u32 bitmap, u32 length){
+	lTree *ret    = lTreeAllocRaw();
+	ret->flags    = TREE_BRANCH;
+	ret->bitmap   = bitmap;
+	ret->length   = length;
+	ret->children = lSlabAlloc(length * sizeof(lTree *));
+	return ret;
+}
+
+/* Return a mutable copy of T, since the children are now reachable from
+ * both nodes they have to be marked as shared */
+static lTree *lTreeCopy(const lTree *t){
+	if(!(t->flags & TREE_BRANCH)){
+		return lTreeNew(t->key, t->value);
+	}
+	lTree *ret = lTreeBranchNew(t->bitmap, t->length);
+	for(uint i=0;i<t->length;i++){
+		t->children[i]->flags |= TREE_SHARED;
+		ret->children[i] = t->children[i];
+	}
+	return ret;
+}
+
+/* Return the total size of the tree T */
+int lTreeSize(const lTree *t){
+	if(t == NULL){return 0;}
+	if(!(t->flags & TREE_BRANCH)){return 1;}
+	int ret = 0;
+	for(uint i=0;i<t->length;i++){
+		ret += lTreeSize(t->children[i]);
+	}
+	return ret;
+}
+
+/* Build a subtrie at SHIFT containing the N LEAVES */
+static lTree *lTreeFromLeaves(lTree **leaves, uint n, uint shift){
+	if(n == 1){
+		return leaves[0];
+	}
+	if((n <= TREE_FLAT_MAX) || (shift >= 32)){
+		lTree *ret = lTreeBranchNew(0, n);
+		memcpy(ret->children, leaves, n * sizeof(lTree *));
+		return ret;
+	}
+	lTree *bucket[TREE_FLAT_MAX + 1];
+	u32 bitmap = 0;
+	for(uint i=0;i<n;i++){
+		bitmap |= 1U << ((leaves[i]->key->hash >> shift) & TREE_MASK);
+	}
+	lTree *ret = lTreeBranchNew(bitmap, popcount(bitmap));
+	for(uint pos=0, idx=0;idx <= TREE_MASK;idx++){
+		if(!(bitmap & (1U << idx))){continue;}
+		uint count = 0;
+		for(uint i=0;i<n;i++){
+			if(((leaves[i]->key->hash >> shift) & TREE_MASK) == idx){
+				bucket[count++] = leaves[i];
+			}
+		}
+		ret->children[pos++] = lTreeFromLeaves(bucket, count, shift + TREE_BITS);
+	}
+	return ret;
+}
+
+/* Add CHILD to the branch T at POS, moving everything after it back */
+static void lTreeBranchInsert(lTree *t, uint pos, lTree *child){
+	t->children = lSlabRealloc(t->children, t->length * sizeof(lTree *), (t->length + 1) * sizeof(lTree *));
+	memmove(&t->children[pos + 1], &t->children[pos], (t->length - pos) * sizeof(lTree *));
+	t->children[pos] = child;
+	t->length++;
+}
+
+static lTree *lTreeInsertRec(lTree *t, const lSymbol *s, lVal v, uint shift){
+	if(!(t->flags & TREE_BRANCH)){
+		if(t->key != s){
+			lTree *leaves[2] = { t, lTreeNew(s, v) };
+			return lTreeFromLeaves(leaves, 2, shift);
+		}
+		if(t->flags & TREE_SHARED){
+			/* Cached method lookups might still refer to the old leaf */
+			lMethodCacheInvalidate();
+			return lTreeNew(s, v);
+		}
+		lTreeWriteBarrier(t);
+		t->value = v;
+		return t;
+	}
+	if(t->flags & TREE_SHARED){
+		t = lTreeCopy(t);
+	}else{
+		lTreeWriteBarrier(t);
+	}
+	if(t->bitmap == 0){
+		for(uint i=0;i<t->length;i++){
+			if(t->children[i]->key == s){
+				t->children[i] = lTreeInsertRec(t->children[i], s, v, shift);
+				return t;
+			}
+		}
+		if((t->length < TREE_FLAT_MAX) || (shift >= 32)){
+			lTreeBranchInsert(t, t->length, lTreeNew(s, v));
+			return t;
+		}
+		lTree *leaves[TREE_FLAT_MAX + 1];
+		memcpy(leaves, t->children, t->length * sizeof(lTree *));
+		leaves[t->length] = lTreeNew(s, v);
+		return lTreeFromLeaves(leaves, t->length + 1, shift);
+	}
+	const u32 bit = 1U << ((s->hash >> shift) & TREE_MASK);
+	const uint pos = popcount(t->bitmap & (bit - 1));
+	if(t->bitmap & bit){
+		t->children[pos] = lTreeInsertRec(t->children[pos], s, v, shift + TREE_BITS);
+	}else{
+		lTreeBranchInsert(t, pos, lTreeNew(s, v));
+		t->bitmap |= bit;
+	}
+	return t;
+}
+
+/* Insert an association S -> V in the tree T and return the new root.
+ * Nodes that are only reachable from T get mutated, shared ones are copied
+ * along with the path leading to them. */
+lTree *lTreeInsert(lTree *t, const lSymbol *s, lVal v){
+	if(unlikely(s == NULL)){
+		return t;
+	}
+	if(unlikely(t == NULL)){
+		return lTreeNew(s,v);
+	}
+	return lTreeInsertRec(t, s, v, 0);
+}
+
+/* Add all the keys within T to the beginning LIST */
+static lVal lTreeAddKeysToList(const lTree *t, lVal list){
+	if(!(t->flags & TREE_BRANCH)){
+		return lCons(lValKeywordS(t->key), list);
+	}
+	for(int i=t->length-1;i >= 0;i--){
+		list = lTreeAddKeysToList(t->children[i], list);
+	}
+	return list;
+}
+/* Add all the values within T to the beginning LIST */
+static lVal lTreeAddValuesToList(const lTree *t, lVal list){
+	if(!(t->flags & TREE_BRANCH)){
+		return lCons(t->value, list);
+	}
+	for(int i=t->length-1;i >= 0;i--){
+		list = lTreeAddValuesToList(t->children[i], list);
+	}
+	return list;
+}
+
+/* Return the leaf that comes first when iterating over T */
+static const lTree *lTreeFirst(const lTree *t){
+	while(t && (t->flags & TREE_BRANCH)){
+		t = t->children[0];
+	}
+	return t;
+}
+
+/* Return a mutable duplicate of t, only the root gets copied right away
+ * while everything else is shared until either of them gets modified */
+lTree *lTreeDup(const lTree *t){
+	if(unlikely(t == NULL)){return NULL;}
+	return lTreeCopy(t);
+}
+
+#else
+
 lTree *lTreeNew(const lSymbol *s, lVal v){
 	lTree *ret  = lTreeAllocRaw();
 	ret->key    = s;
@@ -38,6 +216,8 @@ static lTree *lTreeRotateLeft(lTree *x){
 	if(y == NULL){return x;}
 	lTree *T2 = y->left;
 
+	lTreeWriteBarrier(x);
+	lTreeWriteBarrier(y);
 	y->left = x;
 	x->right = T2;
 
@@ -53,6 +233,8 @@ static lTree *lTreeRotateRight(lTree *y){
 	if(x == NULL){return y;}
 	lTree *T2 = x->right;
 
+	lTreeWriteBarrier(x);
+	lTreeWriteBarrier(y);
 	x->right = y;
 	y->left = T2;
 
@@ -86,7 +268,9 @@ static lTree *lTreeBalance(lTree *t, const lSymbol *s){
 lTree *lTreeInsert(lTree *t, const lSymbol *s, lVal v){
 	if(unlikely(t == NULL)){
 		return lTreeNew(s,v);
-	}else if(unlikely(t->key == NULL)){
+	}
+	lTreeWriteBarrier(t);
+	if(unlikely(t->key == NULL)){
 		t->key = s;
 		t->value = v;
 		return t;
@@ -104,19 +288,6 @@ lTree *lTreeInsert(lTree *t, const lSymbol *s, lVal v){
 	}
 }
 
-/* Get whatever value is associated in T to S,
- * Returns a simple Exception if nothing is found */
-lVal lTreeRef(const lTree *t, const lSymbol *s){
-	const lTree *c = t;
-	while(c){
-		if(s == c->key){
-			return c->value;
-		}
-		c = s > c->key ? c->right : c->left;
-	}
-	return lValExceptionSimple();
-}
-
 /* Add all the keys within T to the beginning LIST */
 static lVal lTreeAddKeysToList(const lTree *t, lVal list){
 	if(unlikely((t == NULL) || (t->key == NULL))){return list;}
@@ -132,14 +303,9 @@ static lVal lTreeAddValuesToList(const lTree *t, lVal list){
 	return lTreeAddValuesToList(t->left, list);
 }
 
-/* Create a list of all the keys within T */
-static lVal lTreeKeysToList(const lTree *t){
-	return t ? lTreeAddKeysToList(t,NIL) : NIL;
-}
-
-/* Create a list of all the values within T */
-static lVal lTreeValuesToList(const lTree *t){
-	return t ? lTreeAddValuesToList(t, NIL) : NIL;
+/* Return the node that comes first when iterating over T */
+static const lTree *lTreeFirst(const lTree *t){
+	return (t && t->key) ? t : NULL;
 }
 
 /* Return a duplicate of t */
@@ -154,58 +320,67 @@ lTree *lTreeDup(const lTree *t){
 	return ret;
 }
 
+#endif
+
+/* Get whatever value is associated in T to S,
+ * Returns a simple Exception if nothing is found */
+lVal lTreeRef(const lTree *t, const lSymbol *s){
+	const lTree *leaf = lTreeLookup(t, s);
+	return leaf ? leaf->value : lValExceptionSimple();
+}
+
+/* Create a list of all the keys within T */
+static lVal lTreeKeysToList(const lTree *t){
+	return t ? lTreeAddKeysToList(t,NIL) : NIL;
+}
+
+/* Create a list of all the values within T */
+static lVal lTreeValuesToList(const lTree *t){
+	return t ? lTreeAddValuesToList(t, NIL) : NIL;
+}
+
 lVal lnfTreeNew(lVal v) {
 	lTreeRoot *t = lTreeRootAllocRaw();
 	lVal ret = lValAlloc(ltTree, t);
 
-	for (lVal n = v; n.type == ltPair; n = lCddr(n)) {
+	for (lVal n = v; lValType(n) == ltPair; n = lCddr(n)) {
 		lVal car = lCar(n);
-		if (car.type == ltNil) { break; }
+		if (lValType(car) == ltNil) { break; }
 		reqSymbolic(car);
-		t->root = lTreeInsert(t->root, car.vSymbol, lCadr(n));
+		t->root = lTreeInsert(t->root, lValGetSymbol(car), lCadr(n));
 	}
 	return ret;
 }
 
 static lVal lnmTreeClone(lVal self) {
-	return lValTree(lTreeDup(self.vTree->root));
+	return lValTree(lTreeDup(lValGetTreeRoot(self)->root));
 }
 
 static lVal lnmTreeLength(lVal self) {
-	return lValInt(lTreeSize(self.vTree->root));
+	return lValInt(lTreeSize(lValGetTreeRoot(self)->root));
 }
 
 static lVal lnmTreeKeys(lVal self) {
-	return lTreeKeysToList(self.vTree->root);
+	return lTreeKeysToList(lValGetTreeRoot(self)->root);
 }
 
 static lVal lnmTreeKeyAst(lVal self) {
-	lTree* tree = self.vTree->root;
-	return tree ? lValKeywordS(tree->key) : NIL;
+	const lTree *leaf = lTreeFirst(lValGetTreeRoot(self)->root);
+	return leaf ? lValKeywordS(leaf->key) : NIL;
 }
 
 static lVal lnmTreeValueAst(lVal self) {
-	lTree* tree = self.vTree->root;
-	return tree ? tree->value : NIL;
-}
-
-static lVal lnmTreeLeftAst(lVal self) {
-	lTree* tree = self.vTree->root;
-	return (tree && tree->left) ? lValTree(tree->left) : NIL;
-}
-
-static lVal lnmTreeRightAst(lVal self) {
-	lTree* tree = self.vTree->root;
-	return (tree && tree->right) ? lValTree(tree->right) : NIL;
+	const lTree *leaf = lTreeFirst(lValGetTreeRoot(self)->root);
+	return leaf ? leaf->value : NIL;
 }
 
 static lVal lnmTreeValues(lVal self) {
-	return lTreeValuesToList(self.vTree->root);
+	return lTreeValuesToList(lValGetTreeRoot(self)->root);
 }
 
 static lVal lnmTreeHas(lVal self, lVal key) {
 	reqSymbolic(key);
-	return lValBool(lTreeRef(self.vTree->root, key.vSymbol).type != ltException);
+	return lValBool(lTreeLookup(lValGetTreeRoot(self)->root, lValGetSymbol(key)) != NULL);
 }
 
 void lOperationsTree() {
@@ -216,7 +391,5 @@ void lOperationsTree() {
 	lAddNativeMethodV (Tree, lSymS("keys"),   "(self)", lnmTreeKeys, NFUNC_PURE);
 	lAddNativeMethodV (Tree, lSymS("key*"),   "(self)", lnmTreeKeyAst, NFUNC_PURE);
 	lAddNativeMethodV (Tree, lSymS("value*"), "(self)", lnmTreeValueAst, NFUNC_PURE);
-	lAddNativeMethodV (Tree, lSymS("left*"),  "(self)", lnmTreeLeftAst, NFUNC_PURE);
-	lAddNativeMethodV (Tree, lSymS("right*"), "(self)", lnmTreeRightAst, NFUNC_PURE);
 	lAddNativeMethodVV(Tree, lSymS("has?"),   "(self key)", lnmTreeHas, NFUNC_PURE);
 }
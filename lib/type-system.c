@@ -9,7 +9,7 @@
 #include "nujel-private.h"
 #endif
 
-lClass lClassList[64];
+THREAD_LOCAL lClass lClassList[64];
 
 static void initType(int i, const lSymbol *name, lClass *parent){
 	lClassList[i].name = name;
@@ -20,17 +20,18 @@ static void initType(int i, const lSymbol *name, lClass *parent){
 
 static lVal lAddNativeMethod(lClass *T, const lSymbol *name, const char *args, void *fun, uint flags, u8 argCount){
 	lVal v = lValAlloc(ltNativeFunc, lNFuncAlloc());
-	v.vNFunc->fp   = fun;
-	v.vNFunc->args = lCar(lRead(args, strlen(args)));
-	v.vNFunc->meta = NULL;
-	v.vNFunc->argCount = argCount;
+	lValGetNFunc(v)->fp   = fun;
+	lValGetNFunc(v)->args = lCar(lRead(args, strlen(args)));
+	lValGetNFunc(v)->meta = NULL;
+	lValGetNFunc(v)->argCount = argCount;
 	if(flags & NFUNC_FOLD){
-		v.vNFunc->meta = lTreeInsert(v.vNFunc->meta, symFold, lValBool(true));
+		lValGetNFunc(v)->meta = lTreeInsert(lValGetNFunc(v)->meta, symFold, lValBool(true));
 	}
 	if(flags & NFUNC_PURE){
-		v.vNFunc->meta = lTreeInsert(v.vNFunc->meta, symPure, lValBool(true));
+		lValGetNFunc(v)->meta = lTreeInsert(lValGetNFunc(v)->meta, symPure, lValBool(true));
 	}
 	T->methods = lTreeInsert(T->methods, name, v);
+	lMethodCacheInvalidate();
 	return v;
 }
 
@@ -46,17 +47,18 @@ lVal lAddNativeMethodVVV(lClass *T, const lSymbol *name, const char *args, lVal
 
 static lVal lAddNativeStaticMethod(lClass *T, const lSymbol *name, const char *args, void *fun, uint flags, u8 argCount){
 	lVal v = lValAlloc(ltNativeFunc, lNFuncAlloc());
-	v.vNFunc->fp   = fun;
-	v.vNFunc->args = lCar(lRead(args, strlen(args)));
-	v.vNFunc->meta = NULL;
-	v.vNFunc->argCount = argCount;
+	lValGetNFunc(v)->fp   = fun;
+	lValGetNFunc(v)->args = lCar(lRead(args, strlen(args)));
+	lValGetNFunc(v)->meta = NULL;
+	lValGetNFunc(v)->argCount = argCount;
 	if(flags & NFUNC_FOLD){
-		v.vNFunc->meta = lTreeInsert(v.vNFunc->meta, symFold, lValBool(true));
+		lValGetNFunc(v)->meta = lTreeInsert(lValGetNFunc(v)->meta, symFold, lValBool(true));
 	}
 	if(flags & NFUNC_PURE){
-		v.vNFunc->meta = lTreeInsert(v.vNFunc->meta, symPure, lValBool(true));
+		lValGetNFunc(v)->meta = lTreeInsert(lValGetNFunc(v)->meta, symPure, lValBool(true));
 	}
 	T->staticMethods = lTreeInsert(T->staticMethods, name, v);
+	lMethodCacheInvalidate();
 	return v;
 }
 
@@ -71,22 +73,22 @@ lVal lAddNativeStaticMethodVVV(lClass *T, const lSymbol *name, const char *args,
 }
 
 static lVal lnmTypeName(lVal self){
-	if(unlikely(self.type != (self.type & 63))){
+	if(unlikely(lValType(self) != (lValType(self) & 63))){
 		return lValException(lSymVMError, "Out-of-bounds Type", self);
 	}
-	lClass *T = &lClassList[self.type];
+	lClass *T = &lClassList[lValType(self)];
 	if(unlikely(T->name == NULL)){
-		fprintf(stderr, "T: %u\n", self.type);
+		fprintf(stderr, "T: %u\n", lValType(self));
 		return lValException(lSymVMError, "Unnamed Type", self);
 	}
 	return lValKeywordS(T->name);
 }
 
 static lVal lnmTypeOf(lVal self){
-	if(unlikely(self.type != (self.type & 63))){
+	if(unlikely(lValType(self) != (lValType(self) & 63))){
 		return lValException(lSymVMError, "Out-of-bounds Type", self);
 	}
-	return lValType(&lClassList[self.type]);
+	return lValClass(&lClassList[lValType(self)]);
 }
 
 static lVal lnmNilMetaGet(lVal self, lVal key){
@@ -102,58 +104,59 @@ static lVal lnmNilLength(lVal self){
 static lVal lnmPairLength(lVal self){
 	lVal l = self;
 	int i = 0;
-	for(; l.type == ltPair; l = l.vList->cdr){
+	for(; lValType(l) == ltPair; l = lValGetPair(l)->cdr){
 		i++;
 	}
-	if(unlikely(l.type != ltNil)){
+	if(unlikely(lValType(l) != ltNil)){
 		i++;
 	}
 	return lValInt(i);
 }
 
 static lVal lnmTName(lVal self){
-	if(unlikely(self.vType->name == NULL)){
+	if(unlikely(lValGetClass(self)->name == NULL)){
 		return lValException(lSymVMError, "Unnamed Type", self);
 	}
-	return lValKeywordS(self.vType->name);
+	return lValKeywordS(lValGetClass(self)->name);
 }
 
 static lVal lnmAddMethod(lVal self, lVal name, lVal fn){
 	reqSymbolic(name);
-	if(unlikely(fn.type != ltLambda)){
+	if(unlikely(lValType(fn) != ltLambda)){
 		return lValExceptionType(fn, ltLambda);
 	}
 
-	self.vType->methods = lTreeInsert(self.vType->methods, name.vSymbol, fn);
+	lValGetClass(self)->methods = lTreeInsert(lValGetClass(self)->methods, lValGetSymbol(name), fn);
+	lMethodCacheInvalidate();
 	return self;
 }
 
 static lVal lnmLambdaHas(lVal self, lVal key){
-	if(unlikely((key.type != ltKeyword) && (key.type != ltSymbol))){
+	if(unlikely((lValType(key) != ltKeyword) && (lValType(key) != ltSymbol))){
 		return lValBool(false);
 	}
-	lVal v = lGetClosureSym(self.vClosure, key.vSymbol);
-	return lValBool(v.type != ltException);
+	lVal v = lGetClosureSym(lValGetClosure(self), lValGetSymbol(key));
+	return lValBool(lValType(v) != ltException);
 }
 
 static lVal lnmLambdaData(lVal self){
-	return lValTree(self.vClosure->data);
+	return lValTree(lClosureDataTree(lValGetClosure(self)));
 }
 
 static lVal lnmLambdaCode(lVal self){
-	return lValAlloc(ltBytecodeArr, self.vClosure->text);
+	return lValAlloc(ltBytecodeArr, lValGetClosure(self)->text);
 }
 
 static lVal lnmLambdaArguments(lVal self){
-	return self.vClosure->args;
+	return lValGetClosure(self)->args;
 }
 
 static lVal lnmLambdaParent(lVal self){
-	if(self.vClosure->parent == NULL){
+	if(lValGetClosure(self)->parent == NULL){
 		return NIL;
 	}else{
 		lType T;
-		switch(self.vClosure->parent->type){
+		switch(lValGetClosure(self)->parent->type){
 		case closureLet:
 		case closureTry:
 			T = ltEnvironment;
@@ -162,40 +165,42 @@ static lVal lnmLambdaParent(lVal self){
 			T = ltLambda;
 			break;
 		}
-		return lValAlloc(T, self.vClosure->parent);
+		return lValAlloc(T, lValGetClosure(self)->parent);
 	}
 }
 
 static lVal lnmLambdaParentSet(lVal self, lVal v){
-	if(v.type == ltNil){
-		self.vClosure->parent = NULL;
+	lClosureWriteBarrier(lValGetClosure(self));
+	if(lValType(v) == ltNil){
+		lValGetClosure(self)->parent = NULL;
 	} else {
 		reqClosure(v);
-		self.vClosure->parent = v.vClosure;
+		lValGetClosure(self)->parent = lValGetClosure(v);
 	}
 	return self;
 }
 
 static lVal lnmNativeMetaGet(lVal self, lVal key){
 	reqSymbolic(key);
-	lVal t = lTreeRef(self.vNFunc->meta, key.vSymbol);
-	return t.type != ltException ? t : NIL;
+	lVal t = lTreeRef(lValGetNFunc(self)->meta, lValGetSymbol(key));
+	return lValType(t) != ltException ? t : NIL;
 }
 
 static lVal lnmNujelMetaGet(lVal self, lVal key){
 	reqSymbolic(key);
-	lVal t = lTreeRef(self.vClosure->meta, key.vSymbol);
-	return t.type != ltException ? t : NIL;
+	lVal t = lTreeRef(lValGetClosure(self)->meta, lValGetSymbol(key));
+	return lValType(t) != ltException ? t : NIL;
 }
 
 static lVal lnmNujelMetaSet(lVal self, lVal key, lVal value){
 	reqSymbolic(key);
-	self.vClosure->meta = lTreeInsert(self.vClosure->meta, key.vSymbol, value);
+	lClosureWriteBarrier(lValGetClosure(self));
+	lValGetClosure(self)->meta = lTreeInsert(lValGetClosure(self)->meta, lValGetSymbol(key), value);
 	return self;
 }
 
 static lVal lnmNFuncArguments(lVal self){
-	return self.vNFunc->args;
+	return lValGetNFunc(self)->args;
 }
 
 static void lTypesAddCoreMethods(){
@@ -227,64 +232,156 @@ static void lTypesAddCoreMethods(){
 	lAddNativeMethodVVV(Type, lSymS("add-method"), "(self name fn)", lnmAddMethod, NFUNC_PURE);
 }
 
-lVal lMethodLookup(const lSymbol *method, lVal self){
-	if(unlikely(self.type != (self.type & 63))){
-		lValException(lSymVMError, "Out-of-bounds Type", self);
+/* Return the tree node containing METHOD for SELF, or NULL if there is none.
+ * Callers may hold on to the node and re-read its value, since nodes are only
+ * ever freed by the GC and keys never change. */
+static const lTree *lMethodLookupNode(const lSymbol *method, lVal self){
+	if(unlikely(lValType(self) != (lValType(self) & 63))){
+		return NULL;
 	}
-	if(self.type == ltTree){
-		lVal v = lTreeRef(self.vTree->root, method);
-		if(v.type != ltException){
-			return v;
+	if(lValType(self) == ltTree){
+		const lTree *t = lTreeLookup(lValGetTreeRoot(self)->root, method);
+		if(t){
+			return t;
 		}
-		lVal proto = lTreeRef(self.vTree->root, lSymPrototype);
-		if(proto.type != ltException){
-			return lMethodLookup(method, proto);
+		lVal proto = lTreeRef(lValGetTreeRoot(self)->root, lSymPrototype);
+		if(lValType(proto) != ltException){
+			return lMethodLookupNode(method, proto);
 		}
 	}
-	if(self.type == ltType){
-		const lClass *T = self.vType;
+	if(lValType(self) == ltType){
+		const lClass *T = lValGetClass(self);
 		for(;T;T = T->parent){
-			for(const lTree *t = T->staticMethods; t; t = (method > t->key) ? t->right : t->left){
-				if(method == t->key){
-					return t->value;
-				}
+			const lTree *t = lTreeLookup(T->staticMethods, method);
+			if(t){
+				return t;
 			}
 		}
 	}
-	const lClass *T = &lClassList[self.type];
+	const lClass *T = &lClassList[lValType(self)];
 	for(;T;T = T->parent){
-		for(const lTree *t = T->methods; t; t = (method > t->key) ? t->right : t->left){
-			if(method == t->key){
-				return t->value;
+		const lTree *t = lTreeLookup(T->methods, method);
+		if(t){
+			return t;
+		}
+	}
+	return NULL;
+}
+
+lVal lMethodLookup(const lSymbol *method, lVal self){
+	const lTree *t = lMethodLookupNode(method, self);
+	if(unlikely(t == NULL)){
+		return lValException(lSymUnboundVariable, "Unbound method", self);
+	}
+	return t->value;
+}
+
+#define METHOD_CACHE_SITES 1024
+#define METHOD_CACHE_WAYS 4
+
+/* Polymorphic inline cache for a single (:method self) call site, since
+ * bytecode can't be extended in place these live in a direct-mapped table
+ * indexed by the address of the lopApply */
+typedef struct {
+	const lBytecodeOp *site;
+	const lSymbol *method;
+	u32 epoch;
+	u8 used;
+	u8 next;
+	struct {
+		const void *receiver;
+		const lTree *node;
+		u8 type;
+	} ways[METHOD_CACHE_WAYS];
+} lMethodCacheSite;
+
+static THREAD_LOCAL lMethodCacheSite lMethodCache[METHOD_CACHE_SITES];
+static THREAD_LOCAL u32 lMethodCacheEpoch = 1;
+THREAD_LOCAL u64 lMethodCacheHits = 0;
+THREAD_LOCAL u64 lMethodCacheMisses = 0;
+
+/* Has to be called whenever a lookup might return a different node than
+ * before: methods being added, prototypes changing, keys being added to a
+ * tree that might shadow a method and the GC reusing memory */
+void lMethodCacheInvalidate(){
+	if(unlikely(++lMethodCacheEpoch == 0)){
+		memset(lMethodCache, 0, sizeof(lMethodCache));
+		lMethodCacheEpoch = 1;
+	}
+}
+
+/* Forget about every class and cached method */
+void lTypesDestroy(){
+	memset(lClassList, 0, sizeof(lClassList));
+	memset(lMethodCache, 0, sizeof(lMethodCache));
+	lMethodCacheEpoch = 1;
+}
+
+/* Trees are cached by identity since they might have their own methods or
+ * prototype, types by class and everything else just by type */
+static inline const void *lMethodCacheReceiver(lVal self){
+	switch(lValType(self)){
+	case ltTree: return lValGetTreeRoot(self);
+	case ltType: return lValGetClass(self);
+	default:     return NULL;
+	}
+}
+
+/* Same as lMethodLookup, but remembers the result for the call site SITE */
+lVal lMethodLookupCached(const lBytecodeOp *site, const lSymbol *method, lVal self){
+	lMethodCacheSite *e = &lMethodCache[((uintptr_t)site) & (METHOD_CACHE_SITES - 1)];
+	const void *receiver = lMethodCacheReceiver(self);
+	if(likely((e->site == site) && (e->method == method) && (e->epoch == lMethodCacheEpoch))){
+		for(int i=0;i<e->used;i++){
+			if((e->ways[i].receiver == receiver) && (e->ways[i].type == lValType(self))){
+				lMethodCacheHits++;
+				return e->ways[i].node->value;
 			}
 		}
+	} else {
+		e->site   = site;
+		e->method = method;
+		e->epoch  = lMethodCacheEpoch;
+		e->used   = 0;
+		e->next   = 0;
+	}
+	lMethodCacheMisses++;
+
+	const lTree *t = lMethodLookupNode(method, self);
+	if(unlikely(t == NULL)){
+		return lValException(lSymUnboundVariable, "Unbound method", self);
 	}
-	return lValException(lSymUnboundVariable, "Unbound method", self);
+	const int i = (e->used < METHOD_CACHE_WAYS) ? e->used++ : (e->next++ & (METHOD_CACHE_WAYS - 1));
+	e->ways[i].receiver = receiver;
+	e->ways[i].type     = lValType(self);
+	e->ways[i].node     = t;
+	return t->value;
 }
 
 
 void lDefineTypeVars(lClosure *c){
-	lDefineVal(c, "Nil",        lValType(&lClassList[ltNil]));
-	lDefineVal(c, "Symbol",     lValType(&lClassList[ltSymbol]));
-	lDefineVal(c, "Keyword",    lValType(&lClassList[ltKeyword]));
-	lDefineVal(c, "Bool",       lValType(&lClassList[ltBool]));
-	lDefineVal(c, "Int",        lValType(&lClassList[ltInt]));
-	lDefineVal(c, "Float",      lValType(&lClassList[ltFloat]));
-	lDefineVal(c, "Pair",       lValType(&lClassList[ltPair]));
-	lDefineVal(c, "Array",      lValType(&lClassList[ltArray]));
-	lDefineVal(c, "Tree",       lValType(&lClassList[ltTree]));
-	lDefineVal(c, "Map",        lValType(&lClassList[ltMap]));
-	lDefineVal(c, "Lambda",     lValType(&lClassList[ltLambda]));
-	lDefineVal(c, "Macro",      lValType(&lClassList[ltMacro]));
-	lDefineVal(c, "NativeFunc", lValType(&lClassList[ltNativeFunc]));
-	lDefineVal(c, "Environment",lValType(&lClassList[ltEnvironment]));
-	lDefineVal(c, "String",     lValType(&lClassList[ltString]));
-	lDefineVal(c, "Buffer",     lValType(&lClassList[ltBuffer]));
-	lDefineVal(c, "BufferView", lValType(&lClassList[ltBufferView]));
-	lDefineVal(c, "BytecodeArr",lValType(&lClassList[ltBytecodeArr]));
-	lDefineVal(c, "FileHandle", lValType(&lClassList[ltFileHandle]));
-	lDefineVal(c, "Type",       lValType(&lClassList[ltType]));
-	lDefineVal(c, "Any",        lValType(&lClassList[ltAny]));
+	lDefineVal(c, "Nil",        lValClass(&lClassList[ltNil]));
+	lDefineVal(c, "Symbol",     lValClass(&lClassList[ltSymbol]));
+	lDefineVal(c, "Keyword",    lValClass(&lClassList[ltKeyword]));
+	lDefineVal(c, "Bool",       lValClass(&lClassList[ltBool]));
+	lDefineVal(c, "Int",        lValClass(&lClassList[ltInt]));
+	lDefineVal(c, "Float",      lValClass(&lClassList[ltFloat]));
+	lDefineVal(c, "Pair",       lValClass(&lClassList[ltPair]));
+	lDefineVal(c, "Array",      lValClass(&lClassList[ltArray]));
+	lDefineVal(c, "Tree",       lValClass(&lClassList[ltTree]));
+	lDefineVal(c, "Map",        lValClass(&lClassList[ltMap]));
+	lDefineVal(c, "Lambda",     lValClass(&lClassList[ltLambda]));
+	lDefineVal(c, "Macro",      lValClass(&lClassList[ltMacro]));
+	lDefineVal(c, "NativeFunc", lValClass(&lClassList[ltNativeFunc]));
+	lDefineVal(c, "Environment",lValClass(&lClassList[ltEnvironment]));
+	lDefineVal(c, "String",     lValClass(&lClassList[ltString]));
+	lDefineVal(c, "Buffer",     lValClass(&lClassList[ltBuffer]));
+	lDefineVal(c, "BufferView", lValClass(&lClassList[ltBufferView]));
+	lDefineVal(c, "BytecodeArr",lValClass(&lClassList[ltBytecodeArr]));
+	lDefineVal(c, "FileHandle", lValClass(&lClassList[ltFileHandle]));
+	lDefineVal(c, "Type",       lValClass(&lClassList[ltType]));
+	lDefineVal(c, "Coroutine",  lValClass(&lClassList[ltCoroutine]));
+	lDefineVal(c, "Any",        lValClass(&lClassList[ltAny]));
 }
 
 void lTypesInit(){
@@ -316,6 +413,7 @@ void lTypesInit(){
 
 	initType(ltFileHandle, lSymLTFileHandle, tAny);
 	initType(ltType, lSymLTType, tAny);
+	initType(ltCoroutine, lSymLTCoroutine, tAny);
 	initType(ltComment, NULL, tAny);
 	initType(ltException, NULL, tAny);
 
@@ -342,20 +440,20 @@ lVal lValExceptionNonNumeric(lVal v){
 
 /* Cast v to be an int without memory allocations, or return fallback */
 i64 castToInt(const lVal v, i64 fallback){
-	switch(v.type){
-		case ltFloat: return v.vFloat;
-		case ltInt:   return v.vInt;
+	switch(lValType(v)){
+		case ltFloat: return lValGetFloat(v);
+		case ltInt:   return lValGetInt(v);
 		default:      return fallback;
 	}
 }
 
 /* Cast v to be a bool without memory allocations, or return false */
 bool castToBool(const lVal v){
-	return (v.type == ltBool ? v.vBool : likely(v.type != ltNil));
+	return (lValType(v) == ltBool ? lValGetBool(v) : likely(lValType(v) != ltNil));
 }
 
 const char *castToString(const lVal v, const char *fallback){
-	return (v.type != ltString) ? fallback : v.vString->data;
+	return (lValType(v) != ltString) ? fallback : lValGetString(v)->data;
 }
 
 /* Determine which type has the highest precedence between a and b */
@@ -370,20 +468,20 @@ lType lTypecast(const lType a, const lType b){
 }
 
 lVal requireFloat(lVal v){
-	if(likely(v.type == ltFloat)){
+	if(likely(lValType(v) == ltFloat)){
 		return v;
-	} else if(v.type == ltInt){
-		return lValFloat(v.vInt);
+	} else if(lValType(v) == ltInt){
+		return lValFloat(lValGetInt(v));
 	} else {
 		return lValException(lSymTypeError, "Need an :Int or :Float", v);
 	}
 }
 
 lVal optionalSymbolic(lVal v, const lSymbol *fallback){
-	if(likely(v.type == ltNil)){
+	if(likely(lValType(v) == ltNil)){
 		return lValSymS(fallback);
 	}
-	if(unlikely((v.type != ltKeyword) && (v.type != ltSymbol))){
+	if(unlikely((lValType(v) != ltKeyword) && (lValType(v) != ltSymbol))){
 		return lValException(lSymTypeError, "Need a :Symbol or :Keyword", v);
 	}
 	return v;
@@ -23,8 +23,8 @@ static inline i64 lStringGreater(const lBuffer *a, const lBuffer *b) {
 }
 
 static inline i64 lSymbolGreater(const lSymbol *a, const lSymbol *b) {
-	const uint alen = strnlen(a->c, sizeof(a->c));
-	const uint blen = strnlen(b->c, sizeof(b->c));
+	const uint alen = strlen(a->c);
+	const uint blen = strlen(b->c);
 	const uint len	= MIN(alen,blen);
 	const char *ab	= a->c;
 	const char *bb	= b->c;
@@ -42,60 +42,68 @@ static inline i64 lSymbolGreater(const lSymbol *a, const lSymbol *b) {
  | or if they are equal.
  */
 i64 lValGreater(const lVal a, const lVal b){
-	if(unlikely(a.type != b.type)){
-		if((a.type == ltInt) && (b.type == ltFloat)){
-			return (((float)a.vInt) < b.vFloat)
+	if(unlikely(lValType(a) != lValType(b))){
+		if((lValType(a) == ltInt) && (lValType(b) == ltFloat)){
+			return (((float)lValGetInt(a)) < lValGetFloat(b))
 				? -1
-				: (((float)a.vInt) > b.vFloat)
+				: (((float)lValGetInt(a)) > lValGetFloat(b))
 				  ? 1
 				  : 0;
-		} else if ((a.type == ltFloat) && (b.type == ltInt)) {
-			return (a.vFloat < ((float)b.vInt))
+		} else if ((lValType(a) == ltFloat) && (lValType(b) == ltInt)) {
+			return (lValGetFloat(a) < ((float)lValGetInt(b)))
 				? -1
-				: (a.vFloat > ((float)b.vInt))
+				: (lValGetFloat(a) > ((float)lValGetInt(b)))
 				  ? 1
 				  : 0;
 		}
 		return 0;
 	}
-	switch(a.type){
+	switch(lValType(a)){
 	default:
 		return 0;
-	case ltInt:
-		return a.vInt - b.vInt;
+	case ltInt: {
+		/* Subtracting could overflow, and has to agree with the quickened
+		 * int comparisons anyway */
+		const i64 ai = lValGetInt(a);
+		const i64 bi = lValGetInt(b);
+		return (ai > bi) - (ai < bi); }
 	case ltFloat:
-		return a.vFloat < b.vFloat ? -1 : 1;
+		return lValGetFloat(a) < lValGetFloat(b) ? -1 : 1;
 	case ltKeyword:
 	case ltSymbol:
-		return lSymbolGreater(a.vSymbol, b.vSymbol);
+		return lSymbolGreater(lValGetSymbol(a), lValGetSymbol(b));
 	case ltString:
-		return lStringGreater(a.vString, b.vString);
+		return lStringGreater(lValGetString(a), lValGetString(b));
 	}
 }
 
 /* Check two values for equality */
 bool lValEqual(const lVal a, const lVal b) {
-	if (unlikely(a.type != b.type)) {
-		if ((a.type == ltInt) && (b.type == ltFloat)) {
-			return ((float)a.vInt) == b.vFloat;
-		} else if ((a.type == ltFloat) && (b.type == ltInt)) {
-			return a.vFloat == ((float)b.vInt);
+	if (unlikely(lValType(a) != lValType(b))) {
+		if ((lValType(a) == ltInt) && (lValType(b) == ltFloat)) {
+			return ((float)lValGetInt(a)) == lValGetFloat(b);
+		} else if ((lValType(a) == ltFloat) && (lValType(b) == ltInt)) {
+			return lValGetFloat(a) == ((float)lValGetInt(b));
 		}
 		return false;
 	}
-	switch(a.type){
+	switch(lValType(a)){
 	case(ltString):{
-		const uint alen = lBufferLength(a.vString);
-		const uint blen = lBufferLength(b.vString);
-		return (alen == blen) && (memcmp(a.vString->data, b.vString->data, alen) == 0); }
+		const lString *as = lValGetString(a);
+		const lString *bs = lValGetString(b);
+		if(as == bs){ return true; }
+		const u8 flags = as->flags & bs->flags;
+		if((flags & BUFFER_INTERNED) || (as->length != bs->length)){ return false; }
+		if((flags & BUFFER_HASHED) && (as->hash != bs->hash)){ return false; }
+		return memcmp(as->data, bs->data, as->length) == 0; }
 	case(ltBool):
-		return a.vBool == b.vBool;
+		return lValGetBool(a) == lValGetBool(b);
 	case(ltInt):
-		return a.vInt == b.vInt;
+		return lValGetInt(a) == lValGetInt(b);
 	case(ltFloat):
-		return a.vFloat == b.vFloat;
+		return lValGetFloat(a) == lValGetFloat(b);
 	default:
-		return a.vPointer == b.vPointer;
+		return lValGetPointer(a) == lValGetPointer(b);
 	}
 }
 
@@ -103,6 +111,6 @@ lVal lValException(const lSymbol *symbol, const char *error, lVal v) {
 	lVal l = lCons(v, NIL);
 	l = lCons(lValString(error),l);
 	l = lCons(lValKeywordS(symbol),l);
-	l.type = ltException;
+	l = lValAlloc(ltException, lValGetPair(l));
 	return l;
 }
@@ -4,17 +4,72 @@
 #include "nujel-private.h"
 #endif
 
-#if !defined(NUJEL_USE_JUMPTABLE)
+#if !defined(NUJEL_USE_JUMPTABLE) && !defined(NUJEL_OPCODE_PROFILE)
 #if defined(__GNUC__)
 #define NUJEL_USE_JUMPTABLE 1
 #endif
 #endif
 
+#ifdef NUJEL_OPCODE_PROFILE
+/* Instrumentation build that counts how often each pair and triple of
+ * opcodes gets executed in sequence, to determine which ops are worth
+ * fusing into a superinstruction, see tools/opcode-profile.nuj. Forces the
+ * switch based dispatch so there is a single place to record each op */
+#define PROFILE_TRIPLES_SIZE (1 << 16)
+static u64 lOpcodePairs[256][256];
+static struct {
+	u32 key;
+	u64 count;
+} lOpcodeTriples[PROFILE_TRIPLES_SIZE];
+static u32 lOpcodeHistory = 0;
+
+static void lOpcodeProfileRecord(lBytecodeOp op){
+	lOpcodeHistory = ((lOpcodeHistory << 8) | op) & 0xFFFFFF;
+	lOpcodePairs[(lOpcodeHistory >> 8) & 0xFF][op]++;
+	const u32 key = lOpcodeHistory | 0x1000000;
+	for(u32 i = (key * 2654435761u) >> 16; ; i = (i + 1) & (PROFILE_TRIPLES_SIZE-1)){
+		if(lOpcodeTriples[i].key == key){
+			lOpcodeTriples[i].count++;
+			return;
+		} else if(lOpcodeTriples[i].key == 0){
+			lOpcodeTriples[i].key = key;
+			lOpcodeTriples[i].count = 1;
+			return;
+		}
+	}
+}
+
+lVal lOpcodeProfile(){
+	lVal ret = NIL;
+	for(int a=0;a<256;a++){
+	for(int b=0;b<256;b++){
+		if(lOpcodePairs[a][b] == 0){continue;}
+		lVal e = lCons(lValInt(b), NIL);
+		e = lCons(lValInt(a), e);
+		ret = lCons(lCons(lValInt(lOpcodePairs[a][b]), e), ret);
+	}
+	}
+	for(int i=0;i<PROFILE_TRIPLES_SIZE;i++){
+		if(lOpcodeTriples[i].key == 0){continue;}
+		const u32 key = lOpcodeTriples[i].key;
+		lVal e = lCons(lValInt(key & 0xFF), NIL);
+		e = lCons(lValInt((key >> 8) & 0xFF), e);
+		e = lCons(lValInt((key >> 16) & 0xFF), e);
+		ret = lCons(lCons(lValInt(lOpcodeTriples[i].count), e), ret);
+	}
+	return ret;
+}
+#else
+lVal lOpcodeProfile(){
+	return lValException(lSymVMError, "Opcode profiling is disabled, rebuild with -DNUJEL_OPCODE_PROFILE", NIL);
+}
+#endif
+
 static inline void lClosureSetMeta(lClosure *c, lVal doc){
-	if(unlikely(doc.type != ltTree)){
+	if(unlikely(lValType(doc) != ltTree)){
 		return;
 	}
-	lTree *t = doc.vTree->root;
+	lTree *t = lValGetTreeRoot(doc)->root;
 	c->meta = (t && t->flags & TREE_IMMUTABLE) ? lTreeDup(t) : t;
 }
 
@@ -22,9 +77,9 @@ static inline void lClosureSetMeta(lClosure *c, lVal doc){
 static inline lVal lLambdaNew(lClosure *parent, lVal args, lVal body){
 	reqBytecodeArray(body);
 	lVal ret = lValAlloc(ltLambda, lClosureNew(parent, closureDefault));
-	ret.vClosure->args = args;
-	ret.vClosure->text = body.vBytecodeArr;
-	ret.vClosure->ip   = ret.vClosure->text->data;
+	lValGetClosure(ret)->args = args;
+	lValGetClosure(ret)->text = lValGetBytecodeArray(body);
+	lValGetClosure(ret)->ip   = lValGetClosure(ret)->text->data;
 	return ret;
 }
 
@@ -44,6 +99,99 @@ static lVal lStackBuildList(lVal *stack, int sp, int len){
 	return ret;
 }
 
+#define THREAD_POOL_MAX 8
+#define THREAD_POOL_MAX_STACK 8192
+
+/* Stacks of lBytecodeEval invocations that have returned, these get handed
+ * to the next (possibly nested) evaluation, so calling back into Nujel from
+ * native code doesn't have to malloc fresh stacks every time */
+static THREAD_LOCAL lThread lThreadPool[THREAD_POOL_MAX];
+static THREAD_LOCAL int lThreadPoolCount = 0;
+
+/* Innermost running lBytecodeEval, outer ones are reachable via ->parent */
+static THREAD_LOCAL lThread *lThreadActive = NULL;
+
+static void lThreadAcquire(lThread *ctx){
+	if(lThreadPoolCount > 0){
+		const lThread *t = &lThreadPool[--lThreadPoolCount];
+		ctx->closureStackSize = t->closureStackSize;
+		ctx->valueStackSize   = t->valueStackSize;
+		ctx->closureStack     = t->closureStack;
+		ctx->valueStack       = t->valueStack;
+	} else {
+		ctx->closureStackSize = 512;
+		ctx->valueStackSize   = 512;
+		ctx->closureStack     = malloc(ctx->closureStackSize * sizeof(lClosure *));
+		ctx->valueStack       = malloc(ctx->valueStackSize * sizeof(lVal));
+		if(unlikely((ctx->closureStack == NULL) || (ctx->valueStack == NULL))){
+			exit(58);
+		}
+	}
+	ctx->parent = lThreadActive;
+	lThreadActive = ctx;
+}
+
+/* Give the stacks of CTX back to the pool, unless the pool is full or they
+ * have grown so large that keeping them around would be wasteful */
+static void lThreadRelease(lThread *ctx){
+	lThreadActive = ctx->parent;
+	if((lThreadPoolCount < THREAD_POOL_MAX)
+	   && (ctx->closureStackSize <= THREAD_POOL_MAX_STACK)
+	   && (ctx->valueStackSize <= THREAD_POOL_MAX_STACK)){
+		lThread *t = &lThreadPool[lThreadPoolCount++];
+		t->closureStackSize = ctx->closureStackSize;
+		t->valueStackSize   = ctx->valueStackSize;
+		t->closureStack     = ctx->closureStack;
+		t->valueStack       = ctx->valueStack;
+	} else {
+		free(ctx->closureStack);
+		free(ctx->valueStack);
+	}
+}
+
+THREAD_LOCAL lCoroutineRequestType lCoroutineRequest = lcrNone;
+THREAD_LOCAL lCoroutine *lCoroutineTarget = NULL;
+THREAD_LOCAL lVal lCoroutineTransfer;
+
+/* Give CO its own stacks with a call to its function, passing ARG along */
+static void lCoroutineStart(lCoroutine *co, lVal arg){
+	lThread *t = &co->thread;
+	t->closureStackSize = 512;
+	t->valueStackSize   = 512;
+	t->closureStack     = malloc(t->closureStackSize * sizeof(lClosure *));
+	t->valueStack       = malloc(t->valueStackSize * sizeof(lVal));
+	if(unlikely((t->closureStack == NULL) || (t->valueStack == NULL))){
+		exit(58);
+	}
+	t->coroutine       = co;
+	t->csp             = 0;
+	t->sp              = 0;
+	t->valueStack[0]   = NIL;
+	t->closureStack[0] = lClosureNewFunCall(lCons(arg, NIL), co->fun);
+	t->text            = t->closureStack[0]->text;
+}
+
+/* Exchange the stacks CTX is running on with the ones stored in CO */
+static void lCoroutineSwap(lThread *ctx, lCoroutine *co){
+	const lThread t = *ctx;
+	*ctx = co->thread;
+	ctx->parent = t.parent;
+	co->thread = t;
+	lCoroutineWriteBarrier(co);
+}
+
+/* Switch from the coroutine CTX is running back to whoever resumed it, for
+ * good, since the coroutine has either returned or thrown */
+static void lCoroutineFinish(lThread *ctx){
+	lCoroutine *co = ctx->coroutine;
+	co->state = lcsDone;
+	lCoroutineSwap(ctx, co);
+	free(co->thread.closureStack);
+	free(co->thread.valueStack);
+	memset(&co->thread, 0, sizeof(co->thread));
+	co->thread.csp = co->thread.sp = -1;
+}
+
 static void lBytecodeEnsureSufficientStack(lThread *ctx){
 	const int closureSizeLeft = (ctx->closureStackSize - ctx->csp) - 1;
 	if(unlikely(closureSizeLeft < 16)){
@@ -62,6 +210,71 @@ static void lBytecodeEnsureSufficientStack(lThread *ctx){
 	}
 }
 
+THREAD_LOCAL u64 lQuickenCount = 0;
+THREAD_LOCAL u64 lDequickenCount = 0;
+
+/* Return the length in bytes of OP, including its arguments */
+int lBytecodeOpLength(lBytecodeOp op){
+	switch(op){
+	default:
+		return 1;
+	case lopIntByte:
+	case lopApply:
+	case lopSetVal:
+	case lopDefVal:
+	case lopGetVal:
+	case lopPushVal:
+	case lopList:
+	case lopApplyTail:
+	case lopSubIntByte:
+	case lopSetValDrop:
+		return 2;
+	case lopPushValExt:
+	case lopDefValExt:
+	case lopJmp:
+	case lopJt:
+	case lopJf:
+	case lopGetValExt:
+	case lopSetValExt:
+	case lopTry:
+	case lopGetSlot:
+	case lopSetSlot:
+	case lopZeroPredJf:
+	case lopEqualPredJf:
+	case lopLessPredJt:
+	case lopGreaterPredJt:
+		return 3;
+	}
+}
+
+/* Return the generic opcode a quickened OP was derived from */
+lBytecodeOp lBytecodeOpDequicken(lBytecodeOp op){
+	switch(op){
+	default:                         return op;
+	case lopAddIntInt:
+	case lopAddFloatFloat:           return lopAdd;
+	case lopSubIntInt:
+	case lopSubFloatFloat:           return lopSub;
+	case lopMulIntInt:
+	case lopMulFloatFloat:           return lopMul;
+	case lopLessPredIntInt:
+	case lopLessPredFloatFloat:      return lopLessPred;
+	case lopLessEqPredIntInt:
+	case lopLessEqPredFloatFloat:    return lopLessEqPred;
+	case lopGreaterEqPredIntInt:
+	case lopGreaterEqPredFloatFloat: return lopGreaterEqPred;
+	case lopGreaterPredIntInt:
+	case lopGreaterPredFloatFloat:   return lopGreaterPred;
+	}
+}
+
+/* Turn every quickened op in OPS back into its generic variant */
+void lBytecodeDequicken(lBytecodeOp *ops, int len){
+	for(int i=0; i < len; i += lBytecodeOpLength(ops[i])){
+		ops[i] = lBytecodeOpDequicken(ops[i]);
+	}
+}
+
 static lVal stackTrace(const lThread *ctx){
 	lVal ret = NIL;
 	for(int i=0;i<=ctx->csp;i++){
@@ -70,21 +283,289 @@ static lVal stackTrace(const lThread *ctx){
 			break;
 		}
 		if(c->type == closureCall){
+			c->flags |= CLOSURE_CAPTURED;
 			ret = lCons(lValLambda(c),ret);
 		}
 	}
 	return ret;
 }
 
+/* Sampling allocation profiler, every lAllocationSampleRate-th allocation
+ * records the names of the functions on the stack at that point. Samples
+ * are aggregated per stack, for collapsed stacks as used by flamegraph.pl,
+ * and per innermost function, for a flat table. The ip of the innermost
+ * frame only lives in a register of lBytecodeEval, so samples are
+ * attributed to functions and not to individual ops. */
+#define ALLOCATION_PROFILE_MAX_DEPTH 128
+#define ALLOCATION_PROFILE_TOP 50
+/* Longer function names get truncated within stacks */
+#define ALLOCATION_PROFILE_MAX_NAME 96
+
+typedef struct {
+	char *key;
+	u64 count[lHeapTypeCount];
+} lAllocationSite;
+
+typedef struct {
+	lAllocationSite *sites;
+	uint size;
+	uint count;
+} lAllocationTable;
+
+typedef struct {
+	const char *key;
+	lHeapType type;
+	u64 count;
+} lAllocationRow;
+
+THREAD_LOCAL u64 lAllocationSampleCountdown = 0;
+static THREAD_LOCAL uint lAllocationSampleRate = 0;
+static THREAD_LOCAL u64 lAllocationSamples = 0;
+static THREAD_LOCAL lAllocationTable lAllocationStacks;
+static THREAD_LOCAL lAllocationTable lAllocationFunctions;
+
+static void lAllocationTableGrow(lAllocationTable *t){
+	const lAllocationTable old = *t;
+	t->size = old.size ? old.size * 2 : 256;
+	t->sites = calloc(t->size, sizeof(lAllocationSite));
+	if(unlikely(t->sites == NULL)){
+		exit(59);
+	}
+	for(uint i=0;i<old.size;i++){
+		if(old.sites[i].key == NULL){continue;}
+		uint j = lHashString(old.sites[i].key, strlen(old.sites[i].key)) & (t->size - 1);
+		while(t->sites[j].key){
+			j = (j + 1) & (t->size - 1);
+		}
+		t->sites[j] = old.sites[i];
+	}
+	free(old.sites);
+}
+
+static lAllocationSite *lAllocationTableGet(lAllocationTable *t, const char *key){
+	if((t->count + 1) * 2 > t->size){
+		lAllocationTableGrow(t);
+	}
+	const uint len = strlen(key);
+	for(uint i = lHashString(key, len) & (t->size - 1); ; i = (i + 1) & (t->size - 1)){
+		lAllocationSite *site = &t->sites[i];
+		if(site->key == NULL){
+			site->key = malloc(len + 1);
+			if(unlikely(site->key == NULL)){
+				exit(59);
+			}
+			memcpy(site->key, key, len + 1);
+			t->count++;
+			return site;
+		}else if(strcmp(site->key, key) == 0){
+			return site;
+		}
+	}
+}
+
+static void lAllocationTableFree(lAllocationTable *t){
+	for(uint i=0;i < t->size;i++){
+		free(t->sites[i].key);
+	}
+	free(t->sites);
+	memset(t, 0, sizeof(*t));
+}
+
+/* Free the stacks of the pool as well as the allocation profile, has to
+ * be called outside of any lBytecodeEval */
+void lVMDestroy(){
+	for(int i=0;i < lThreadPoolCount;i++){
+		free(lThreadPool[i].closureStack);
+		free(lThreadPool[i].valueStack);
+	}
+	lThreadPoolCount = 0;
+	lThreadActive = NULL;
+	lAllocationTableFree(&lAllocationStacks);
+	lAllocationTableFree(&lAllocationFunctions);
+}
+
+static const char *lClosureName(const lClosure *c){
+	if(c->parent){
+		const lVal name = lTreeRef(c->parent->meta, symName);
+		if(lValType(name) == ltSymbol){
+			return lValGetSymbol(name)->c;
+		}
+	}
+	return "anonymous";
+}
+
+/* Store the names of the innermost MAX functions on the stack in FRAMES */
+static uint lAllocationFrames(const char **frames, uint max){
+	uint n = 0;
+	for(const lThread *t = lThreadActive; t && (n < max); t = t->parent){
+		for(int i = t->csp; (i >= 0) && (n < max); i--){
+			const lClosure *c = t->closureStack[i];
+			if(likely(c && (c->type == closureCall))){
+				frames[n++] = lClosureName(c);
+			}
+		}
+	}
+	return n;
+}
+
+/* Called by the allocator, must not allocate anything on the Nujel heap */
+void lAllocationSample(lHeapType type){
+	static THREAD_LOCAL char stack[ALLOCATION_PROFILE_MAX_DEPTH * (ALLOCATION_PROFILE_MAX_NAME + 1) + 8];
+	const char *frames[ALLOCATION_PROFILE_MAX_DEPTH];
+	lAllocationSampleCountdown = lAllocationSampleRate;
+	lAllocationSamples++;
+
+	const uint n = lAllocationFrames(frames, ALLOCATION_PROFILE_MAX_DEPTH);
+	if(n == 0){
+		frames[0] = "(native)";
+	}
+	char *end = stack;
+	if(n == ALLOCATION_PROFILE_MAX_DEPTH){
+		memcpy(end, "...;", 4);
+		end += 4;
+	}
+	for(int i = MAX(n, 1u) - 1; i >= 0; i--){
+		const size_t len = strnlen(frames[i], ALLOCATION_PROFILE_MAX_NAME);
+		memcpy(end, frames[i], len);
+		end[len] = ';';
+		end += len + 1;
+	}
+	end[-1] = 0;
+	lAllocationTableGet(&lAllocationStacks, stack)->count[type]++;
+	lAllocationTableGet(&lAllocationFunctions, frames[0])->count[type]++;
+}
+
+/* Sample every RATE-th allocation, 0 turns the profiler off again */
+void lSetAllocationProfileRate(uint rate){
+	lAllocationSampleRate = rate;
+	lAllocationSampleCountdown = rate;
+}
+
+static int lAllocationRowCompare(const void *a, const void *b){
+	const lAllocationRow *ra = a;
+	const lAllocationRow *rb = b;
+	if(ra->count != rb->count){
+		return ra->count < rb->count ? 1 : -1;
+	}
+	return strcmp(ra->key, rb->key);
+}
+
+/* Return every site/type combination in T, most frequent first, the caller
+ * has to free the returned rows */
+static lAllocationRow *lAllocationTableRows(const lAllocationTable *t, uint *count){
+	uint n = 0;
+	lAllocationRow *rows = malloc(MAX(1u, t->count * lHeapTypeCount) * sizeof(lAllocationRow));
+	if(unlikely(rows == NULL)){
+		exit(59);
+	}
+	for(uint i=0;i<t->size;i++){
+		if(t->sites[i].key == NULL){continue;}
+		for(int type=0;type<lHeapTypeCount;type++){
+			if(t->sites[i].count[type] == 0){continue;}
+			rows[n++] = (lAllocationRow){t->sites[i].key, type, t->sites[i].count[type]};
+		}
+	}
+	qsort(rows, n, sizeof(lAllocationRow), lAllocationRowCompare);
+	*count = n;
+	return rows;
+}
+
+/* Print the functions allocating the most objects of each type to FP,
+ * counts are estimates derived from the samples */
+void lAllocationProfilePrint(FILE *fp){
+	uint n;
+	lAllocationRow *rows = lAllocationTableRows(&lAllocationFunctions, &n);
+	fprintf(fp, "Allocation profile: %llu samples, 1 in %u allocations\n",
+		(unsigned long long)lAllocationSamples, lAllocationSampleRate);
+	fprintf(fp, "%12s %7s  %-16s %s\n", "allocations", "share", "type", "function");
+	for(uint i=0;i < MIN(n, ALLOCATION_PROFILE_TOP);i++){
+		fprintf(fp, "%12llu %6.2f%%  %-16s %s\n",
+			(unsigned long long)rows[i].count * lAllocationSampleRate,
+			(rows[i].count * 100.0) / lAllocationSamples,
+			lHeapTypeName(rows[i].type),
+			rows[i].key);
+	}
+	free(rows);
+}
+
+/* Write every sampled stack to FP in the collapsed format understood by
+ * flamegraph.pl, with the type of the allocation as the innermost frame */
+void lAllocationProfileWriteStacks(FILE *fp){
+	uint n;
+	lAllocationRow *rows = lAllocationTableRows(&lAllocationStacks, &n);
+	for(uint i=0;i<n;i++){
+		fprintf(fp, "%s;[%s] %llu\n",
+			rows[i].key,
+			lHeapTypeName(rows[i].type),
+			(unsigned long long)rows[i].count * lAllocationSampleRate);
+	}
+	free(rows);
+}
+
+/* Return a list of (count . stack) for every sampled stack */
+lVal lAllocationProfile(){
+	uint n;
+	lAllocationRow *rows = lAllocationTableRows(&lAllocationStacks, &n);
+	lVal ret = NIL;
+	for(int i=n-1;i>=0;i--){
+		const char *type = lHeapTypeName(rows[i].type);
+		const size_t len = strlen(rows[i].key) + strlen(type) + 4;
+		char *buf = malloc(len);
+		if(unlikely(buf == NULL)){
+			exit(59);
+		}
+		snprintf(buf, len, "%s;[%s]", rows[i].key, type);
+		const lVal stack = lValString(buf);
+		free(buf);
+		ret = lCons(lCons(lValInt(rows[i].count * lAllocationSampleRate), stack), ret);
+	}
+	free(rows);
+	return ret;
+}
+
 static inline lClosure *funCallClosure(lVal lambda) {
 	lClosure *tmpc = lClosureAllocRaw();
-	tmpc->parent = lambda.vClosure;
+	tmpc->parent = lValGetClosure(lambda);
 	tmpc->type   = closureCall;
-	tmpc->text   = lambda.vClosure->text;
+	tmpc->text   = lValGetClosure(lambda)->text;
 	tmpc->ip     = tmpc->text->data;
 	return tmpc;
 }
 
+/* Turn the call closure C into a fresh one for LAMBDA, only safe as long
+ * as nothing else might have a reference to C */
+static inline lClosure *funCallClosureReuse(lClosure *c, lVal lambda) {
+	if(c->flags & CLOSURE_CAPTURED){
+		return funCallClosure(lambda);
+	}
+	lClosureWriteBarrier(c);
+	memset(c, 0, sizeof(lClosure));
+	c->parent = lValGetClosure(lambda);
+	c->type   = closureCall;
+	c->text   = lValGetClosure(lambda)->text;
+	c->ip     = c->text->data;
+	return c;
+}
+
+/* Set the binding of S visible from C to V, returns false if S is unbound */
+static inline bool lSetValInClosure(lClosure *c, const lSymbol *s, lVal v){
+	for (lClosure *cc = c; cc; cc = cc->parent) {
+		if(cc->slotCount){
+			const int i = lClosureSlotIndex(cc, s);
+			if(i >= 0){
+				lClosureWriteBarrier(cc);
+				cc->slots[i] = v;
+				return true;
+			}
+		}
+		if(lTreeSet(&cc->data, s, v)){
+			lClosureWriteBarrier(cc);
+			return true;
+		}
+	}
+	return false;
+}
+
 #define lStoreInClosure(ipOffset) do {\
 	c->ip = ip + (ipOffset);\
 	c->sp = ctx.sp;\
@@ -108,6 +589,14 @@ static inline lClosure *funCallClosure(lVal lambda) {
 	goto throwException;\
 } while(0)
 
+/* Natives return lCoroutineSwitch when they want us to switch stacks */
+#define vmThrowOrSwitch(v) do {\
+	if(unlikely(lValGetPointer(v) == NULL)){\
+		goto coroutineSwitch;\
+	}\
+	lThrow(v);\
+} while(0)
+
 /* Evaluate ops within callingClosure after pushing args on the stack.
  *
  * Doesn't look particularly elegant at times, but gets turned into pretty
@@ -188,12 +677,33 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		&&llopBitNot,
 		&&llopGenSet,
 		&&llopUnequalPred,
+		&&llopGetSlot,
+		&&llopSetSlot,
+		&&llopApplyTail,
+		&&llopAddIntInt,
+		&&llopSubIntInt,
+		&&llopMulIntInt,
+		&&llopLessPredIntInt,
+		&&llopLessEqPredIntInt,
+		&&llopGreaterEqPredIntInt,
+		&&llopGreaterPredIntInt,
+		&&llopAddFloatFloat,
+		&&llopSubFloatFloat,
+		&&llopMulFloatFloat,
+		&&llopLessPredFloatFloat,
+		&&llopLessEqPredFloatFloat,
+		&&llopGreaterEqPredFloatFloat,
+		&&llopGreaterPredFloatFloat,
+		&&llopZeroPredJf,
+		&&llopEqualPredJf,
+		&&llopLessPredJt,
+		&&llopGreaterPredJt,
+		&&llopSubIntByte,
+		&&llopSetValDrop,
 	};
 #endif
-	ctx.closureStackSize = 512;
-	ctx.valueStackSize   = 512;
-	ctx.closureStack     = malloc(ctx.closureStackSize * sizeof(lClosure *));
-	ctx.valueStack       = malloc(ctx.valueStackSize * sizeof(lVal));
+	lThreadAcquire(&ctx);
+	ctx.coroutine        = NULL;
 	ctx.csp              = 0;
 	ctx.sp              = 0;
 	ctx.closureStack[0]  = c;
@@ -205,33 +715,80 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 
 	while(true){
 	dispatchLoop:
+	#ifdef NUJEL_OPCODE_PROFILE
+	lOpcodeProfileRecord(lBytecodeOpDequicken(*ip));
+	#endif
 	vmdispatch(*ip++){
 	vmcase(lopNOP)
 		vmbreak;
 	vmcase(lopIntByte)
 		ctx.valueStack[++ctx.sp] = lValInt((i8)*ip++);
 		vmbreak;
+/* Bytecode arrays are always writable, ip is only const for the VM's sake */
+#define vmQuicken(OP) do {\
+	((lBytecodeOp *)ip)[-1] = (OP);\
+	lQuickenCount++;\
+	} while(0)
+
+/* Turn the current op back into GENERIC and execute that instead */
+#define vmDequicken(GENERIC) do {\
+	((lBytecodeOp *)ip)[-1] = (GENERIC);\
+	lDequickenCount++;\
+	ip--;\
+	goto dispatchLoop;\
+	} while(0)
+
+#define vmQuickArithmeticOp(T, GET, CTOR, OP, GENERIC) do{\
+	const lVal a = ctx.valueStack[ctx.sp-1];\
+	const lVal b = ctx.valueStack[ctx.sp];\
+	if(unlikely((lValType(a) != T) || (lValType(b) != T))){\
+		vmDequicken(GENERIC);\
+	}\
+	ctx.sp--;\
+	ctx.valueStack[ctx.sp] = CTOR(GET(a) OP GET(b));\
+	} while(0)
+
+	vmcase(lopAddIntInt)
+		vmQuickArithmeticOp(ltInt, lValGetInt, lValInt, +, lopAdd);
+		vmbreak;
+	vmcase(lopSubIntInt)
+		vmQuickArithmeticOp(ltInt, lValGetInt, lValInt, -, lopSub);
+		vmbreak;
+	vmcase(lopMulIntInt)
+		vmQuickArithmeticOp(ltInt, lValGetInt, lValInt, *, lopMul);
+		vmbreak;
+	vmcase(lopAddFloatFloat)
+		vmQuickArithmeticOp(ltFloat, lValGetFloat, lValFloatRaw, +, lopAdd);
+		vmbreak;
+	vmcase(lopSubFloatFloat)
+		vmQuickArithmeticOp(ltFloat, lValGetFloat, lValFloatRaw, -, lopSub);
+		vmbreak;
+	vmcase(lopMulFloatFloat)
+		vmQuickArithmeticOp(ltFloat, lValGetFloat, lValFloatRaw, *, lopMul);
+		vmbreak;
 	vmcase(lopAdd) {
 		const lVal a = ctx.valueStack[ctx.sp-1];
 		const lVal b = ctx.valueStack[ctx.sp];
 		ctx.sp--;
-		if(likely(a.type == ltInt)){
-			if(likely(b.type == ltInt)){
-				ctx.valueStack[ctx.sp].vInt += b.vInt;
-			} else if(likely(b.type == ltFloat)){
-				ctx.valueStack[ctx.sp] = lValFloat(b.vFloat + a.vInt);
-			} else if(b.type != ltNil){
+		if(likely(lValType(a) == ltInt)){
+			if(likely(lValType(b) == ltInt)){
+				vmQuicken(lopAddIntInt);
+				ctx.valueStack[ctx.sp] = lValInt(lValGetInt(ctx.valueStack[ctx.sp]) + lValGetInt(b));
+			} else if(likely(lValType(b) == ltFloat)){
+				ctx.valueStack[ctx.sp] = lValFloat(lValGetFloat(b) + lValGetInt(a));
+			} else if(lValType(b) != ltNil){
 				lThrow(lValExceptionNonNumeric(b));
 			}
-		} else if(likely(a.type == ltFloat)){
-			if(likely(b.type == ltFloat)){
-				ctx.valueStack[ctx.sp].vFloat += b.vFloat;
-			} else if(likely(b.type == ltInt)){
-				ctx.valueStack[ctx.sp].vFloat += b.vInt;
-			} else if(b.type != ltNil) {
+		} else if(likely(lValType(a) == ltFloat)){
+			if(likely(lValType(b) == ltFloat)){
+				vmQuicken(lopAddFloatFloat);
+				ctx.valueStack[ctx.sp] = lValFloatRaw(lValGetFloat(ctx.valueStack[ctx.sp]) + lValGetFloat(b));
+			} else if(likely(lValType(b) == ltInt)){
+				ctx.valueStack[ctx.sp] = lValFloatRaw(lValGetFloat(ctx.valueStack[ctx.sp]) + lValGetInt(b));
+			} else if(lValType(b) != ltNil) {
 				lThrow(lValExceptionNonNumeric(b));
 			}
-		} else if(a.type != ltNil){
+		} else if(lValType(a) != ltNil){
 			lThrow(lValExceptionNonNumeric(b));
 		} else {
 			ctx.valueStack[ctx.sp] = lValInt(0);
@@ -241,57 +798,74 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		const lVal a = ctx.valueStack[ctx.sp-1];
 		const lVal b = ctx.valueStack[ctx.sp];
 		ctx.sp--;
-		if(likely(a.type == ltInt)){
-			if(likely(b.type == ltInt)){
-				ctx.valueStack[ctx.sp].vInt -= b.vInt;
-			} else if(likely(b.type == ltFloat)){
-				ctx.valueStack[ctx.sp] = lValFloat(a.vInt - b.vFloat);
-			} else if(b.type != ltNil){
+		if(likely(lValType(a) == ltInt)){
+			if(likely(lValType(b) == ltInt)){
+				vmQuicken(lopSubIntInt);
+				ctx.valueStack[ctx.sp] = lValInt(lValGetInt(ctx.valueStack[ctx.sp]) - lValGetInt(b));
+			} else if(likely(lValType(b) == ltFloat)){
+				ctx.valueStack[ctx.sp] = lValFloat(lValGetInt(a) - lValGetFloat(b));
+			} else if(lValType(b) != ltNil){
 				lThrow(lValExceptionNonNumeric(b));
 			} else {
-				ctx.valueStack[ctx.sp].vInt = -ctx.valueStack[ctx.sp].vInt;
-			}
-		} else if(likely(a.type == ltFloat)){
-			if(likely(b.type == ltFloat)){
-				ctx.valueStack[ctx.sp].vFloat -= b.vFloat;
-			} else if(likely(b.type == ltInt)){
-				ctx.valueStack[ctx.sp].vFloat -= b.vInt;
-			} else if(b.type != ltNil) {
+				ctx.valueStack[ctx.sp] = lValInt(-lValGetInt(ctx.valueStack[ctx.sp]));
+			}
+		} else if(likely(lValType(a) == ltFloat)){
+			if(likely(lValType(b) == ltFloat)){
+				vmQuicken(lopSubFloatFloat);
+				ctx.valueStack[ctx.sp] = lValFloatRaw(lValGetFloat(ctx.valueStack[ctx.sp]) - lValGetFloat(b));
+			} else if(likely(lValType(b) == ltInt)){
+				ctx.valueStack[ctx.sp] = lValFloatRaw(lValGetFloat(ctx.valueStack[ctx.sp]) - lValGetInt(b));
+			} else if(lValType(b) != ltNil) {
 				lThrow(lValExceptionNonNumeric(b));
 			} else {
-				ctx.valueStack[ctx.sp].vFloat = -ctx.valueStack[ctx.sp].vFloat;
+				ctx.valueStack[ctx.sp] = lValFloatRaw(-lValGetFloat(ctx.valueStack[ctx.sp]));
 			}
-		} else if(a.type != ltNil){
+		} else if(lValType(a) != ltNil){
 			lThrow(lValExceptionNonNumeric(b));
 		} else {
 			lThrow(lValExceptionArity(a, 2));
 		}
 		vmbreak; }
+	vmcase(lopSubIntByte) {
+		const lVal a = ctx.valueStack[ctx.sp];
+		const i8 b = (i8)*ip++;
+		if(likely(lValType(a) == ltInt)){
+			ctx.valueStack[ctx.sp] = lValInt(lValGetInt(ctx.valueStack[ctx.sp]) - b);
+		} else if(likely(lValType(a) == ltFloat)){
+			ctx.valueStack[ctx.sp] = lValFloatRaw(lValGetFloat(ctx.valueStack[ctx.sp]) - b);
+		} else if(lValType(a) != ltNil){
+			lThrow(lValExceptionNonNumeric(a));
+		} else {
+			lThrow(lValExceptionArity(a, 2));
+		}
+		vmbreak; }
 	vmcase(lopMul) {
 		const lVal a = ctx.valueStack[ctx.sp-1];
 		const lVal b = ctx.valueStack[ctx.sp];
 		ctx.sp--;
-		if(likely(a.type == ltInt)){
-			if(likely(b.type == ltInt)){
-				ctx.valueStack[ctx.sp].vInt *= b.vInt;
-			} else if(likely(b.type == ltFloat)){
-				ctx.valueStack[ctx.sp] = lValFloat(a.vInt * b.vFloat);
-			} else if(b.type != ltNil){
+		if(likely(lValType(a) == ltInt)){
+			if(likely(lValType(b) == ltInt)){
+				vmQuicken(lopMulIntInt);
+				ctx.valueStack[ctx.sp] = lValInt(lValGetInt(ctx.valueStack[ctx.sp]) * lValGetInt(b));
+			} else if(likely(lValType(b) == ltFloat)){
+				ctx.valueStack[ctx.sp] = lValFloat(lValGetInt(a) * lValGetFloat(b));
+			} else if(lValType(b) != ltNil){
 				lThrow(lValExceptionNonNumeric(b));
 			} else {
 				lThrow(lValExceptionArity(a, 2));
 			}
-		} else if(likely(a.type == ltFloat)){
-			if(likely(b.type == ltFloat)){
-				ctx.valueStack[ctx.sp].vFloat *= b.vFloat;
-			} else if(likely(b.type == ltInt)){
-				ctx.valueStack[ctx.sp].vFloat *= b.vInt;
-			} else if(b.type != ltNil) {
+		} else if(likely(lValType(a) == ltFloat)){
+			if(likely(lValType(b) == ltFloat)){
+				vmQuicken(lopMulFloatFloat);
+				ctx.valueStack[ctx.sp] = lValFloatRaw(lValGetFloat(ctx.valueStack[ctx.sp]) * lValGetFloat(b));
+			} else if(likely(lValType(b) == ltInt)){
+				ctx.valueStack[ctx.sp] = lValFloatRaw(lValGetFloat(ctx.valueStack[ctx.sp]) * lValGetInt(b));
+			} else if(lValType(b) != ltNil) {
 				lThrow(lValExceptionNonNumeric(b));
 			} else {
 				lThrow(lValExceptionArity(a, 2));
 			}
-		} else if(a.type != ltNil){
+		} else if(lValType(a) != ltNil){
 			lThrow(lValExceptionNonNumeric(b));
 		} else {
 			ctx.valueStack[ctx.sp] = lValInt(1);
@@ -301,43 +875,43 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		const lVal a = ctx.valueStack[ctx.sp-1];
 		const lVal b = ctx.valueStack[ctx.sp];
 		ctx.sp--;
-		if(likely(a.type == ltInt)){
-			if(likely(b.type == ltInt)){
-				lVal r = lValFloat((float)a.vInt / (float)b.vInt);
-				if(unlikely(r.type == ltException)){
+		if(likely(lValType(a) == ltInt)){
+			if(likely(lValType(b) == ltInt)){
+				lVal r = lValFloat((float)lValGetInt(a) / (float)lValGetInt(b));
+				if(unlikely(lValType(r) == ltException)){
 					lThrow(r);
 				}
 				ctx.valueStack[ctx.sp] = r;
-			} else if(likely(b.type == ltFloat)){
-				lVal r = lValFloat((float)a.vInt / b.vFloat);
-				if(unlikely(r.type == ltException)){
+			} else if(likely(lValType(b) == ltFloat)){
+				lVal r = lValFloat((float)lValGetInt(a) / lValGetFloat(b));
+				if(unlikely(lValType(r) == ltException)){
 					lThrow(r);
 				}
 				ctx.valueStack[ctx.sp] = r;
-			} else if(b.type != ltNil){
+			} else if(lValType(b) != ltNil){
 				lThrow(lValExceptionNonNumeric(b));
 			} else {
 				lThrow(lValExceptionArity(a, 2));
 			}
-		} else if(likely(a.type == ltFloat)){
-			if(likely(b.type == ltFloat)){
-				const lVal r = lValFloat(a.vFloat / b.vFloat);
-				if(unlikely(r.type == ltException)){
+		} else if(likely(lValType(a) == ltFloat)){
+			if(likely(lValType(b) == ltFloat)){
+				const lVal r = lValFloat(lValGetFloat(a) / lValGetFloat(b));
+				if(unlikely(lValType(r) == ltException)){
 					lThrow(r);
 				}
 				ctx.valueStack[ctx.sp] = r;
-			} else if(likely(b.type == ltInt)){
-				const lVal r = lValFloat(a.vFloat / (float)b.vInt);
-				if(unlikely(r.type == ltException)){
+			} else if(likely(lValType(b) == ltInt)){
+				const lVal r = lValFloat(lValGetFloat(a) / (float)lValGetInt(b));
+				if(unlikely(lValType(r) == ltException)){
 					lThrow(r);
 				}
 				ctx.valueStack[ctx.sp] = r;
-			} else if(b.type != ltNil) {
+			} else if(lValType(b) != ltNil) {
 				lThrow(lValExceptionNonNumeric(b));
 			} else {
 				lThrow(lValExceptionArity(a, 2));
 			}
-		} else if(a.type != ltNil){
+		} else if(lValType(a) != ltNil){
 			lThrow(lValExceptionNonNumeric(b));
 		} else {
 			lThrow(lValExceptionArity(a, 2));
@@ -347,35 +921,35 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		const lVal a = ctx.valueStack[ctx.sp-1];
 		const lVal b = ctx.valueStack[ctx.sp];
 		ctx.sp--;
-		if(likely(a.type == ltInt)){
-			if(likely(b.type == ltInt)){
-				ctx.valueStack[ctx.sp].vInt = a.vInt % b.vInt;
-			} else if(likely(b.type == ltFloat)){
-				const lVal r = lValFloat(fmod(a.vInt, b.vFloat));
-				if(unlikely(r.type == ltException)){
+		if(likely(lValType(a) == ltInt)){
+			if(likely(lValType(b) == ltInt)){
+				ctx.valueStack[ctx.sp] = lValInt(lValGetInt(a) % lValGetInt(b));
+			} else if(likely(lValType(b) == ltFloat)){
+				const lVal r = lValFloat(fmod(lValGetInt(a), lValGetFloat(b)));
+				if(unlikely(lValType(r) == ltException)){
 					lThrow(r);
 				}
 				ctx.valueStack[ctx.sp] = r;
-			} else if(unlikely(b.type != ltNil)){
+			} else if(unlikely(lValType(b) != ltNil)){
 				lThrow(lValExceptionNonNumeric(b));
 			}
-		} else if(likely(a.type == ltFloat)){
-			if(likely(b.type == ltFloat)){
-				const lVal r = lValFloat(fmod(a.vFloat, b.vFloat));
-				if(unlikely(r.type == ltException)){
+		} else if(likely(lValType(a) == ltFloat)){
+			if(likely(lValType(b) == ltFloat)){
+				const lVal r = lValFloat(fmod(lValGetFloat(a), lValGetFloat(b)));
+				if(unlikely(lValType(r) == ltException)){
 					lThrow(r);
 				}
 				ctx.valueStack[ctx.sp] = r;
-			} else if(likely(b.type == ltInt)){
-				const lVal r = lValFloat(fmod(a.vFloat, b.vInt));
-				if(unlikely(r.type == ltException)){
+			} else if(likely(lValType(b) == ltInt)){
+				const lVal r = lValFloat(fmod(lValGetFloat(a), lValGetInt(b)));
+				if(unlikely(lValType(r) == ltException)){
 					lThrow(r);
 				}
 				ctx.valueStack[ctx.sp] = r;
-			} else if(unlikely(b.type != ltNil)) {
+			} else if(unlikely(lValType(b) != ltNil)) {
 				lThrow(lValExceptionNonNumeric(b));
 			}
-		} else if(unlikely(a.type != ltNil)){
+		} else if(unlikely(lValType(a) != ltNil)){
 			lThrow(lValExceptionNonNumeric(b));
 		}
 		vmbreak; }
@@ -384,8 +958,8 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 	const lVal a = ctx.valueStack[ctx.sp-1];\
 	const lVal b = ctx.valueStack[ctx.sp];\
 	ctx.sp--;\
-	if(likely((a.type == ltInt) && (b.type == ltInt))){\
-		ctx.valueStack[ctx.sp].vInt = a.vInt OP b.vInt;\
+	if(likely((lValType(a) == ltInt) && (lValType(b) == ltInt))){\
+		ctx.valueStack[ctx.sp] = lValInt(lValGetInt(a) OP lValGetInt(b));\
 	} else {\
 		lThrow(lValExceptionNonNumeric(b));\
 	}\
@@ -408,15 +982,15 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		vmbreak;
 
 	vmcase(lopBitNot)
-		if(likely(ctx.valueStack[ctx.sp].type == ltInt)){
-			ctx.valueStack[ctx.sp].vInt = ~ctx.valueStack[ctx.sp].vInt;
+		if(likely(lValType(ctx.valueStack[ctx.sp]) == ltInt)){
+			ctx.valueStack[ctx.sp] = lValInt(~lValGetInt(ctx.valueStack[ctx.sp]));
 		} else {
 			lThrow(lValExceptionNonNumeric(ctx.valueStack[ctx.sp]));
 		}
 		vmbreak;
 	vmcase(lopIntAdd)
-		if(likely((ctx.valueStack[ctx.sp-1].type == ltInt) && (ctx.valueStack[ctx.sp].type == ltInt))){
-			ctx.valueStack[ctx.sp-1].vInt += ctx.valueStack[ctx.sp].vInt;
+		if(likely((lValType(ctx.valueStack[ctx.sp-1]) == ltInt) && (lValType(ctx.valueStack[ctx.sp]) == ltInt))){
+			ctx.valueStack[ctx.sp-1] = lValInt(lValGetInt(ctx.valueStack[ctx.sp-1]) + lValGetInt(ctx.valueStack[ctx.sp]));
 			ctx.sp--;
 		} else {
 			lThrow(lValExceptionNonNumeric(ctx.valueStack[ctx.sp]));
@@ -434,20 +1008,66 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 	ctx.valueStack[ctx.sp] = lValBool(OP);\
 	} while(0)
 
+/* Same as vmBinaryPredicateOp, but quickens the op for int/float pairs */
+#define vmQuickeningPredicateOp(OP, INTOP, FLOATOP) do{\
+	const lVal a = ctx.valueStack[ctx.sp-1];\
+	const lVal b = ctx.valueStack[ctx.sp];\
+	if(lValType(a) == lValType(b)){\
+		if(lValType(a) == ltInt){\
+			vmQuicken(INTOP);\
+		} else if(lValType(a) == ltFloat){\
+			vmQuicken(FLOATOP);\
+		}\
+	}\
+	ctx.sp--;\
+	ctx.valueStack[ctx.sp] = lValBool(OP);\
+	} while(0)
+
+#define vmQuickPredicateOp(T, OP, GENERIC) do{\
+	const lVal a = ctx.valueStack[ctx.sp-1];\
+	const lVal b = ctx.valueStack[ctx.sp];\
+	if(unlikely((lValType(a) != T) || (lValType(b) != T))){\
+		vmDequicken(GENERIC);\
+	}\
+	ctx.sp--;\
+	ctx.valueStack[ctx.sp] = lValBool(OP);\
+	} while(0)
+
 	vmcase(lopLessPred)
-		vmBinaryPredicateOp(lValGreater(a, b) < 0);
+		vmQuickeningPredicateOp(lValGreater(a, b) < 0, lopLessPredIntInt, lopLessPredFloatFloat);
 		vmbreak;
 	vmcase(lopLessEqPred)
-		vmBinaryPredicateOp(lValGreater(a, b) <= 0);
+		vmQuickeningPredicateOp(lValGreater(a, b) <= 0, lopLessEqPredIntInt, lopLessEqPredFloatFloat);
 		vmbreak;
 	vmcase(lopEqualPred)
 		vmBinaryPredicateOp(lValEqual(a, b));
 		vmbreak;
 	vmcase(lopGreaterEqPred)
-		vmBinaryPredicateOp(lValGreater(a,b) >= 0);
+		vmQuickeningPredicateOp(lValGreater(a,b) >= 0, lopGreaterEqPredIntInt, lopGreaterEqPredFloatFloat);
 		vmbreak;
 	vmcase(lopGreaterPred)
-		vmBinaryPredicateOp(lValGreater(a, b) > 0);
+		vmQuickeningPredicateOp(lValGreater(a, b) > 0, lopGreaterPredIntInt, lopGreaterPredFloatFloat);
+		vmbreak;
+	vmcase(lopLessPredIntInt)
+		vmQuickPredicateOp(ltInt, lValGetInt(a) < lValGetInt(b), lopLessPred);
+		vmbreak;
+	vmcase(lopLessEqPredIntInt)
+		vmQuickPredicateOp(ltInt, lValGetInt(a) <= lValGetInt(b), lopLessEqPred);
+		vmbreak;
+	vmcase(lopGreaterEqPredIntInt)
+		vmQuickPredicateOp(ltInt, lValGetInt(a) >= lValGetInt(b), lopGreaterEqPred);
+		vmbreak;
+	vmcase(lopGreaterPredIntInt)
+		vmQuickPredicateOp(ltInt, lValGetInt(a) > lValGetInt(b), lopGreaterPred);
+		vmbreak;
+	/* lValGreater never considers two floats to be equal, so neither do we */
+	vmcase(lopLessPredFloatFloat)
+	vmcase(lopLessEqPredFloatFloat)
+		vmQuickPredicateOp(ltFloat, lValGetFloat(a) < lValGetFloat(b), lBytecodeOpDequicken(ip[-1]));
+		vmbreak;
+	vmcase(lopGreaterEqPredFloatFloat)
+	vmcase(lopGreaterPredFloatFloat)
+		vmQuickPredicateOp(ltFloat, !(lValGetFloat(a) < lValGetFloat(b)), lBytecodeOpDequicken(ip[-1]));
 		vmbreak;
 	vmcase(lopUnequalPred)
 		vmBinaryPredicateOp(!lValEqual(a, b));
@@ -491,42 +1111,74 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		lGarbageCollectIfNecessary();
 		ip += !castToBool(ctx.valueStack[ctx.sp--]) ? lBytecodeGetOffset16(ip)-1 : 2;
 		vmbreak;
+
+#define vmJumpIf(COND) do {\
+	lGarbageCollectIfNecessary();\
+	ip += (COND) ? lBytecodeGetOffset16(ip)-1 : 2;\
+	} while(0)
+
+	vmcase(lopZeroPredJf) {
+		const lVal a = ctx.valueStack[ctx.sp--];
+		vmJumpIf(!(lValType(a) == ltInt ? lValGetInt(a) == 0 : (lValType(a) == ltFloat) && (lValGetFloat(a) == 0.0)));
+		vmbreak; }
+	vmcase(lopEqualPredJf) {
+		const lVal a = ctx.valueStack[ctx.sp-1];
+		const lVal b = ctx.valueStack[ctx.sp];
+		ctx.sp -= 2;
+		vmJumpIf(!lValEqual(a, b));
+		vmbreak; }
+	vmcase(lopLessPredJt) {
+		const lVal a = ctx.valueStack[ctx.sp-1];
+		const lVal b = ctx.valueStack[ctx.sp];
+		ctx.sp -= 2;
+		vmJumpIf(((lValType(a) == ltInt) && (lValType(b) == ltInt)) ? lValGetInt(a) < lValGetInt(b) : lValGreater(a, b) < 0);
+		vmbreak; }
+	vmcase(lopGreaterPredJt) {
+		const lVal a = ctx.valueStack[ctx.sp-1];
+		const lVal b = ctx.valueStack[ctx.sp];
+		ctx.sp -= 2;
+		vmJumpIf(((lValType(a) == ltInt) && (lValType(b) == ltInt)) ? lValGetInt(a) > lValGetInt(b) : lValGreater(a, b) > 0);
+		vmbreak; }
 	vmcase(lopDefValExt) {
 		const uint v = (ip[0] << 8) | (ip[1]);
 		ip += 2;
-		lDefineClosureSym(c, lits[v].vSymbol, ctx.valueStack[ctx.sp]);
+		lDefineClosureSym(c, lValGetSymbol(lits[v]), ctx.valueStack[ctx.sp]);
 		vmbreak; }
 	vmcase(lopDefVal) {
 		const uint v = *ip++;
-		lDefineClosureSym(c, lits[v].vSymbol, ctx.valueStack[ctx.sp]);
+		lDefineClosureSym(c, lValGetSymbol(lits[v]), ctx.valueStack[ctx.sp]);
 		vmbreak; }
 	vmcase(lopGetValExt) {
 		// Could be optimized like lopGetVal, but this opcode so rarely
 		// used that I prefer to keep it simple
 		const uint off = (ip[0] << 8) | (ip[1]);
 		ip += 2;
-		lVal v = lGetClosureSym(c, lits[off].vSymbol);
-		if(unlikely(v.type == ltException)){
+		lVal v = lGetClosureSym(c, lValGetSymbol(lits[off]));
+		if(unlikely(lValType(v) == ltException)){
 			lThrow(v);
 		}
 		ctx.valueStack[++ctx.sp] = v;
 		vmbreak; }
 	vmcase(lopGetVal) {
-		const lSymbol *s = lits[*ip++].vSymbol;
+		const lSymbol *s = lValGetSymbol(lits[*ip++]);
 		for (lClosure *cc = c; cc; cc = cc->parent) {
-			lTree *t = cc->data;
-			while(t){
-				if(s == t->key){
-					ctx.valueStack[++ctx.sp] = t->value;
+			if(cc->slotCount){
+				const int i = lClosureSlotIndex(cc, s);
+				if(i >= 0){
+					ctx.valueStack[++ctx.sp] = cc->slots[i];
 					goto dispatchLoop;
 				}
-				t = s > t->key ? t->right : t->left;
+			}
+			const lTree *t = lTreeLookup(cc->data, s);
+			if(t){
+				ctx.valueStack[++ctx.sp] = t->value;
+				goto dispatchLoop;
 			}
 		}
 		lThrow(lValException(lSymUnboundVariable, "Can't resolve symbol", lValSymS(s))); }
 	vmcase(lopRef) {
 		lVal v = lGenericRef(ctx.valueStack[ctx.sp-1], ctx.valueStack[ctx.sp]);
-		if(unlikely(v.type == ltException)){
+		if(unlikely(lValType(v) == ltException)){
 			lThrow(v);
 		}
 		ctx.valueStack[--ctx.sp] = v;
@@ -536,27 +1188,43 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		// used that I prefer to keep it simple
 		const uint v = (ip[0] << 8) | (ip[1]);
 		ip += 2;
-		lSetClosureSym(c, lits[v].vSymbol, ctx.valueStack[ctx.sp]);
+		lSetClosureSym(c, lValGetSymbol(lits[v]), ctx.valueStack[ctx.sp]);
 		vmbreak; }
 	vmcase(lopSetVal) {
-		const lSymbol *s = lits[*ip++].vSymbol;
-		for (lClosure *cc = c; cc; cc = cc->parent) {
-			lTree *t = cc->data;
-			while(t){
-				if(t->key == s){
-					t->value = ctx.valueStack[ctx.sp];
-					goto dispatchLoop;
-				}
-				t = s > t->key ? t->right : t->left;
-			}
+		const lSymbol *s = lValGetSymbol(lits[*ip++]);
+		if(unlikely(!lSetValInClosure(c, s, ctx.valueStack[ctx.sp]))){
+			lThrow(lValException(lSymUnboundVariable, "Can't set symbol", lValSymS(s)));
+		}
+		vmbreak; }
+	vmcase(lopSetValDrop) {
+		const lSymbol *s = lValGetSymbol(lits[*ip++]);
+		if(unlikely(!lSetValInClosure(c, s, ctx.valueStack[ctx.sp--]))){
+			lThrow(lValException(lSymUnboundVariable, "Can't set symbol", lValSymS(s)));
 		}
-		lThrow(lValException(lSymUnboundVariable, "Can't set symbol", lValSymS(s))); }
+		vmbreak; }
+	vmcase(lopGetSlot) {
+		lClosure *cc = lClosureFrame(c, ip[0]);
+		if(unlikely((cc == NULL) || (ip[1] >= cc->slotCount))){
+			lThrow(lValException(lSymVMError, "Invalid frame slot", lValInt(ip[1])));
+		}
+		ctx.valueStack[++ctx.sp] = cc->slots[ip[1]];
+		ip += 2;
+		vmbreak; }
+	vmcase(lopSetSlot) {
+		lClosure *cc = lClosureFrame(c, ip[0]);
+		if(unlikely((cc == NULL) || (ip[1] >= cc->slotCount))){
+			lThrow(lValException(lSymVMError, "Invalid frame slot", lValInt(ip[1])));
+		}
+		lClosureWriteBarrier(cc);
+		cc->slots[ip[1]] = ctx.valueStack[ctx.sp];
+		ip += 2;
+		vmbreak; }
 	vmcase(lopGenSet) {
 		lVal val = ctx.valueStack[ctx.sp];
 		lVal key = ctx.valueStack[ctx.sp-1];
 		lVal col = ctx.valueStack[ctx.sp-2];
 		lVal ret = lGenericSet(col, key, val);
-		if(unlikely(ret.type == ltException)){
+		if(unlikely(lValType(ret) == ltException)){
 			lThrow(ret);
 		}
 		ctx.sp -= 2;
@@ -565,18 +1233,18 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 	vmcase(lopZeroPred) {
 		const lVal a = ctx.valueStack[ctx.sp];
 
-		if (likely(a.type == ltInt)) {
-			ctx.valueStack[ctx.sp] = lValBool(a.vInt == 0);
-		} else if(a.type == ltFloat) {
-			ctx.valueStack[ctx.sp] = lValBool(a.vFloat == 0.0);
+		if (likely(lValType(a) == ltInt)) {
+			ctx.valueStack[ctx.sp] = lValBool(lValGetInt(a) == 0);
+		} else if(lValType(a) == ltFloat) {
+			ctx.valueStack[ctx.sp] = lValBool(lValGetFloat(a) == 0.0);
 		} else {
 			ctx.valueStack[ctx.sp] = lValBool(false);
 		}
 		vmbreak;
 	}
 	vmcase(lopIncInt)
-		if(likely(ctx.valueStack[ctx.sp].type == ltInt)){
-			ctx.valueStack[ctx.sp].vInt++;
+		if(likely(lValType(ctx.valueStack[ctx.sp]) == ltInt)){
+			ctx.valueStack[ctx.sp] = lValInt(lValGetInt(ctx.valueStack[ctx.sp]) + 1);
 		}
 		vmbreak;
 	vmcase(lopCar)
@@ -595,6 +1263,7 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		ctx.valueStack[++ctx.sp] = cargs;
 		vmbreak; }
 	vmcase(lopClosurePush)
+		c->flags |= CLOSURE_CAPTURED;
 		ctx.valueStack[++ctx.sp] = lValEnvironment(c);
 		vmbreak;
 	vmcase(lopLet)
@@ -615,28 +1284,35 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		vmbreak;
 	vmcase(lopThrow) {
 		lVal v = ctx.valueStack[ctx.sp];
-		if(likely(v.type == ltPair)){
-			v.type = ltException;
+		if(likely(lValType(v) == ltPair)){
+			v = lValAlloc(ltException, lValGetPair(v));
 		}
 		exceptionThrownValue = v;
 	throwException:
-		if(unlikely((exceptionThrownValue.type != ltPair) && (exceptionThrownValue.type != ltException))){
+		if(unlikely((lValType(exceptionThrownValue) != ltPair) && (lValType(exceptionThrownValue) != ltException))){
 			exceptionThrownValue = lCons(exceptionThrownValue, NIL);
 		}
 
-		if(likely(exceptionThrownValue.type == ltException)){
-			exceptionThrownValue.type = ltPair;
-			lPair *t = exceptionThrownValue.vList;
-			while(t->cdr.type == ltPair){
-				t=t->cdr.vList;
+		if(likely(lValType(exceptionThrownValue) == ltException)){
+			exceptionThrownValue = lValAlloc(ltPair, lValGetPair(exceptionThrownValue));
+			lPair *t = lValGetPair(exceptionThrownValue);
+			while(lValType(t->cdr) == ltPair){
+				t=lValGetPair(t->cdr);
 			}
+			lPairWriteBarrier(t);
 			t->cdr = lCons(stackTrace(&ctx),NIL);
 		}
 
 		while(likely(c != NULL) && (c->type != closureTry)){
 			if(unlikely(ctx.csp <= 0)){
-				ctx.valueStack[ctx.sp] = exceptionThrownValue;
-				ctx.valueStack[ctx.sp].type = ltException;
+				if(unlikely(ctx.coroutine != NULL)){
+					/* Uncaught within the coroutine, rethrow in whoever resumed it */
+					lCoroutineFinish(&ctx);
+					c = ctx.closureStack[ctx.csp];
+					lRestoreFromClosure();
+					goto throwException;
+				}
+				ctx.valueStack[ctx.sp] = lValAlloc(ltException, lValGetPair(exceptionThrownValue));
 				goto topLevelReturn;
 			}
 			c = ctx.closureStack[--ctx.csp];
@@ -648,37 +1324,46 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		}
 		lVal fun = c->exceptionHandler;
 		c = ctx.closureStack[--ctx.csp];
-		switch(fun.type){
+		switch(lValType(fun)){
 		case ltLambda:
-			c = ctx.closureStack[++ctx.csp] = lClosureNewFunCall(cargs, fun);
+			c = lClosureNewFunCall(cargs, fun);
+			ctx.closureStack[++ctx.csp] = c;
 			lRestoreFromClosure();
 			lBytecodeEnsureSufficientStack(&ctx);
 			lGarbageCollectIfNecessary();
 			break;
 		case ltNativeFunc: {
 			lVal nv;
-			switch(fun.vNFunc->argCount){
-			case  0: nv = fun.vNFunc->fp(); break;
-			case  1: nv = fun.vNFunc->fpC(c); break;
-			case  2: nv = fun.vNFunc->fpV(lCar(cargs)); break;
-			case  3: nv = fun.vNFunc->fpCV(c, lCar(cargs)); break;
-			case  4: nv = fun.vNFunc->fpVV(lCar(cargs), lCadr(cargs)); break;
-			case  5: nv = fun.vNFunc->fpCVV(c, lCar(cargs), lCadr(cargs)); break;
-			case  6: nv = fun.vNFunc->fpVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs)); break;
-			case  7: nv = fun.vNFunc->fpCVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs)); break;
-			case  8: nv = fun.vNFunc->fpVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs)); break;
-			case  9: nv = fun.vNFunc->fpCVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs)); break;
-			case 10: nv = fun.vNFunc->fpVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs)))); break;
-			case 11: nv = fun.vNFunc->fpCVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs)))); break;
-			case 12: nv = fun.vNFunc->fpVVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCadr(lCddr(lCddr(cargs)))); break;
-			case 13: nv = fun.vNFunc->fpCVVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCadr(lCddr(lCddr(cargs)))); break;
-			case 14: nv = fun.vNFunc->fpVVVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCaddr(lCddr(lCddr(cargs))), lCadddr(lCddr(lCddr(cargs)))); break;
-			case 15: nv = fun.vNFunc->fpCVVVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCaddr(lCddr(lCddr(cargs))), lCadddr(lCddr(lCddr(cargs)))); break;
-			case 16: nv = fun.vNFunc->fpR(cargs); break;
-			case 17: nv = fun.vNFunc->fpCR(c, cargs); break;
+			if(lValGetNFunc(fun)->argCount & 1){
+				c->flags |= CLOSURE_CAPTURED;
+			}
+			switch(lValGetNFunc(fun)->argCount){
+			case  0: nv = lValGetNFunc(fun)->fp(); break;
+			case  1: nv = lValGetNFunc(fun)->fpC(c); break;
+			case  2: nv = lValGetNFunc(fun)->fpV(lCar(cargs)); break;
+			case  3: nv = lValGetNFunc(fun)->fpCV(c, lCar(cargs)); break;
+			case  4: nv = lValGetNFunc(fun)->fpVV(lCar(cargs), lCadr(cargs)); break;
+			case  5: nv = lValGetNFunc(fun)->fpCVV(c, lCar(cargs), lCadr(cargs)); break;
+			case  6: nv = lValGetNFunc(fun)->fpVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs)); break;
+			case  7: nv = lValGetNFunc(fun)->fpCVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs)); break;
+			case  8: nv = lValGetNFunc(fun)->fpVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs)); break;
+			case  9: nv = lValGetNFunc(fun)->fpCVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs)); break;
+			case 10: nv = lValGetNFunc(fun)->fpVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs)))); break;
+			case 11: nv = lValGetNFunc(fun)->fpCVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs)))); break;
+			case 12: nv = lValGetNFunc(fun)->fpVVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCadr(lCddr(lCddr(cargs)))); break;
+			case 13: nv = lValGetNFunc(fun)->fpCVVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCadr(lCddr(lCddr(cargs)))); break;
+			case 14: nv = lValGetNFunc(fun)->fpVVVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCaddr(lCddr(lCddr(cargs))), lCadddr(lCddr(lCddr(cargs)))); break;
+			case 15: nv = lValGetNFunc(fun)->fpCVVVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCaddr(lCddr(lCddr(cargs))), lCadddr(lCddr(lCddr(cargs)))); break;
+			case 16: nv = lValGetNFunc(fun)->fpR(cargs); break;
+			case 17: nv = lValGetNFunc(fun)->fpCR(c, cargs); break;
 			default: nv = lValException(lSymVMError, "Unsupported funcall", fun); break;
 			}
-			if(unlikely(nv.type == ltException)){
+			if(unlikely(lValType(nv) == ltException)){
+				if(unlikely(lValGetPointer(nv) == NULL)){
+					lRestoreFromClosure();
+					ctx.sp = c->sp;
+					goto coroutineSwitch;
+				}
 				lThrow(nv);
 			}
 			lRestoreFromClosure();
@@ -696,9 +1381,9 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		lVal cDocs = ctx.valueStack[ctx.sp--];
 		lVal cArgs = ctx.valueStack[ctx.sp--];
 		lVal fun = lLambdaNew(c, cArgs, cBody);
-		lClosureSetMeta(fun.vClosure, cDocs);
+		lClosureSetMeta(lValGetClosure(fun), cDocs);
 		if(unlikely(curOp == lopMacroDynamic)){
-			fun.type = ltMacro;
+			fun = lValAlloc(ltMacro, lValGetClosure(fun));
 		}
 		ctx.valueStack[++ctx.sp] = fun;
 		vmbreak; }
@@ -707,60 +1392,93 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		const lBytecodeOp curOp = ip[-1];
 		lVal env = ctx.valueStack[ctx.sp--];
 		lVal bc = ctx.valueStack[ctx.sp--];
-		if(unlikely((env.type != ltEnvironment) || (bc.type != ltBytecodeArr))){
+		if(unlikely((lValType(env) != ltEnvironment) || (lValType(bc) != ltBytecodeArr))){
 			lThrow(lValException(lSymTypeError, "Can't eval in that", env));
 		}
 
 		lStoreInClosure(0);
 
 		if(unlikely(curOp == lopMutableEval)){
-			c = ctx.closureStack[++ctx.csp] = env.vClosure;
+			c = ctx.closureStack[++ctx.csp] = lValGetClosure(env);
 		} else {
-			c = ctx.closureStack[++ctx.csp] = lClosureNew(env.vClosure, closureCall);
+			c = lClosureNew(lValGetClosure(env), closureCall);
+			ctx.closureStack[++ctx.csp] = c;
 		}
 
-		c->text = bc.vBytecodeArr;
+		lClosureWriteBarrier(c);
+		c->text = lValGetBytecodeArray(bc);
 		c->ip = c->text->data;
 		lRestoreFromClosure();
 		lBytecodeEnsureSufficientStack(&ctx);
 		lGarbageCollectIfNecessary();
 
 		vmbreak; }
+	vmcase(lopApplyTail)
 	vmcase(lopApply) {
+		const lBytecodeOp curOp = ip[-1];
 		const int len = *ip++;
 		const int argsSp = ctx.sp;
 		ctx.sp -= len;
 		lVal fun = ctx.valueStack[ctx.sp--];
 		lVal *vs = &ctx.valueStack[argsSp];
-		if(unlikely(fun.type == ltKeyword)){
+		if(unlikely(lValType(fun) == ltKeyword)){
 			const lVal self = vs[1-len];
-			const lVal nfun = lMethodLookup(fun.vSymbol, self);
-			if(unlikely(nfun.type == ltException)){
-				lThrow(lValException(lSymTypeError, "Unknown method", lCons(fun, lCons(lValType(&lClassList[self.type]), NIL))));
+			const lVal nfun = lMethodLookupCached(ip, lValGetSymbol(fun), self);
+			if(unlikely(lValType(nfun) == ltException)){
+				lThrow(lValException(lSymTypeError, "Unknown method", lCons(fun, lCons(lValClass(&lClassList[lValType(self)]), NIL))));
 			}
 			fun = nfun;
 		}
-		switch(fun.type){
+		switch(lValType(fun)){
 		case ltMacro:
 		case ltLambda: {
-			lStoreInClosure(0);
-
-			ctx.closureStack[++ctx.csp] = c = funCallClosure(fun);
+			if((curOp == lopApplyTail) && (c->type == closureCall) && (ctx.csp > 0)){
+				/* Tail call, replace the current frame instead of
+				 * pushing a new one, the arguments are still in vs */
+				ctx.sp = ctx.closureStack[ctx.csp-1]->sp;
+				ctx.closureStack[ctx.csp] = c = funCallClosureReuse(c, fun);
+			} else {
+				lStoreInClosure(0);
+				c = funCallClosure(fun);
+				ctx.closureStack[++ctx.csp] = c;
+			}
 			int vsi = -(len-1);
-			for (lVal n = fun.vClosure->args; ; n = n.vList->cdr) {
-				if (likely(n.type == ltPair)) {
+			int si = 0;
+			lVal n = lValGetClosure(fun)->args;
+			for(; (lValType(n) == ltPair) && (si < CLOSURE_SLOTS); n = lValGetPair(n)->cdr){
+				c->slots[si++] = vsi > 0 ? NIL : vs[vsi++];
+			}
+			if(likely(lValType(n) == ltNil) || ((lValType(n) == ltSymbol) && (si < CLOSURE_SLOTS))){
+				if(lValType(n) == ltSymbol){
+					lVal rest = NIL;
+					for(int i=0; i >= vsi; i--){
+						rest = lCons(vs[i], rest);
+					}
+					c->slots[si++] = rest;
+				}
+				c->args = lValGetClosure(fun)->args;
+				c->slotCount = si;
+				lRestoreFromClosure();
+				lBytecodeEnsureSufficientStack(&ctx);
+				lGarbageCollectIfNecessary();
+				break;
+			}
+			memset(c->slots, 0, sizeof(c->slots));
+			vsi = -(len-1);
+			for (n = lValGetClosure(fun)->args; ; n = lValGetPair(n)->cdr) {
+				if (likely(lValType(n) == ltPair)) {
 					if(unlikely(vsi > 0)){
-						c->data = lTreeInsert(c->data, n.vList->car.vSymbol, NIL);
+						c->data = lTreeInsert(c->data, lValGetSymbol(lValGetPair(n)->car), NIL);
 					} else {
-						c->data = lTreeInsert(c->data, n.vList->car.vSymbol, vs[vsi++]);
+						c->data = lTreeInsert(c->data, lValGetSymbol(lValGetPair(n)->car), vs[vsi++]);
 					}
 					continue;
-				} else if(likely(n.type == ltSymbol)) {
+				} else if(likely(lValType(n) == ltSymbol)) {
 					lVal rest = NIL;
 					for(int i=0; i >= vsi; i--){
 						rest = lCons(vs[i], rest);
 					}
-					c->data = lTreeInsert(c->data, n.vSymbol, rest);
+					c->data = lTreeInsert(c->data, lValGetSymbol(n), rest);
 				}
 				break;
 			}
@@ -770,7 +1488,7 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 			break; }
 		case ltNativeFunc: {
 			lVal v;
-			const int ac = ((fun.vNFunc->argCount >> 1)&7);
+			const int ac = ((lValGetNFunc(fun)->argCount >> 1)&7);
 			if(unlikely(len != ac)){
 				const int m = ac - len;
 				vs+= m;
@@ -780,29 +1498,32 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 					}
 				}
 			}
-			switch(fun.vNFunc->argCount){
-			case  0: v = fun.vNFunc->fp(); break;
-			case  1: v = fun.vNFunc->fpC(c); break;
-			case  2: v = fun.vNFunc->fpV(vs[0]); break;
-			case  3: v = fun.vNFunc->fpCV(c, vs[0]); break;
-			case  4: v = fun.vNFunc->fpVV(vs[-1], vs[0]); break;
-			case  5: v = fun.vNFunc->fpCVV(c, vs[-1], vs[0]); break;
-			case  6: v = fun.vNFunc->fpVVV(vs[-2], vs[-1], vs[0]); break;
-			case  7: v = fun.vNFunc->fpCVVV(c, vs[-2], vs[-1], vs[0]); break;
-			case  8: v = fun.vNFunc->fpVVVV(vs[-3], vs[-2], vs[-1], vs[0]); break;
-			case  9: v = fun.vNFunc->fpCVVVV(c, vs[-3], vs[-2], vs[-1], vs[0]); break;
-			case 10: v = fun.vNFunc->fpVVVVV(vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
-			case 11: v = fun.vNFunc->fpCVVVVV(c, vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
-			case 12: v = fun.vNFunc->fpVVVVVV(vs[-5], vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
-			case 13: v = fun.vNFunc->fpCVVVVVV(c, vs[-5], vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
-			case 14: v = fun.vNFunc->fpVVVVVVV(vs[-6], vs[-5], vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
-			case 15: v = fun.vNFunc->fpCVVVVVVV(c, vs[-6], vs[-5], vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
-			case 16: v = fun.vNFunc->fpR(lStackBuildList(ctx.valueStack, argsSp, len)); break;
-			case 17: v = fun.vNFunc->fpCR(c, lStackBuildList(ctx.valueStack, argsSp, len)); break;
+			if(lValGetNFunc(fun)->argCount & 1){
+				c->flags |= CLOSURE_CAPTURED;
+			}
+			switch(lValGetNFunc(fun)->argCount){
+			case  0: v = lValGetNFunc(fun)->fp(); break;
+			case  1: v = lValGetNFunc(fun)->fpC(c); break;
+			case  2: v = lValGetNFunc(fun)->fpV(vs[0]); break;
+			case  3: v = lValGetNFunc(fun)->fpCV(c, vs[0]); break;
+			case  4: v = lValGetNFunc(fun)->fpVV(vs[-1], vs[0]); break;
+			case  5: v = lValGetNFunc(fun)->fpCVV(c, vs[-1], vs[0]); break;
+			case  6: v = lValGetNFunc(fun)->fpVVV(vs[-2], vs[-1], vs[0]); break;
+			case  7: v = lValGetNFunc(fun)->fpCVVV(c, vs[-2], vs[-1], vs[0]); break;
+			case  8: v = lValGetNFunc(fun)->fpVVVV(vs[-3], vs[-2], vs[-1], vs[0]); break;
+			case  9: v = lValGetNFunc(fun)->fpCVVVV(c, vs[-3], vs[-2], vs[-1], vs[0]); break;
+			case 10: v = lValGetNFunc(fun)->fpVVVVV(vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
+			case 11: v = lValGetNFunc(fun)->fpCVVVVV(c, vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
+			case 12: v = lValGetNFunc(fun)->fpVVVVVV(vs[-5], vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
+			case 13: v = lValGetNFunc(fun)->fpCVVVVVV(c, vs[-5], vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
+			case 14: v = lValGetNFunc(fun)->fpVVVVVVV(vs[-6], vs[-5], vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
+			case 15: v = lValGetNFunc(fun)->fpCVVVVVVV(c, vs[-6], vs[-5], vs[-4], vs[-3], vs[-2], vs[-1], vs[0]); break;
+			case 16: v = lValGetNFunc(fun)->fpR(lStackBuildList(ctx.valueStack, argsSp, len)); break;
+			case 17: v = lValGetNFunc(fun)->fpCR(c, lStackBuildList(ctx.valueStack, argsSp, len)); break;
 			default: v = lValException(lSymVMError, "Unsupported funcall", fun); break;
 			}
-			if(unlikely(v.type == ltException)){
-				lThrow(v);
+			if(unlikely(lValType(v) == ltException)){
+				vmThrowOrSwitch(v);
 			}
 			ctx.valueStack[++ctx.sp] = v;
 			break; }
@@ -813,21 +1534,21 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 	vmcase(lopApplyCollection) {
 		lVal cargs = ctx.valueStack[ctx.sp--];
 		lVal fun = ctx.valueStack[ctx.sp--];
-		if(unlikely(fun.type == ltKeyword)){
+		if(unlikely(lValType(fun) == ltKeyword)){
 			lVal self = lCar(cargs);
-			lVal nfun = lMethodLookup(fun.vSymbol, self);
-			if(unlikely(nfun.type == ltException)){
-				lThrow(lValException(lSymTypeError, "Unknown method", lCons(fun, lCons(lValType(&lClassList[self.type]), NIL))));
+			lVal nfun = lMethodLookup(lValGetSymbol(fun), self);
+			if(unlikely(lValType(nfun) == ltException)){
+				lThrow(lValException(lSymTypeError, "Unknown method", lCons(fun, lCons(lValClass(&lClassList[lValType(self)]), NIL))));
 			}
 			fun = nfun;
 		}
-		switch(fun.type){
+		switch(lValType(fun)){
 		case ltMacro:
 		case ltLambda:
 			lStoreInClosure(0);
 
-			ctx.closureStack[++ctx.csp] = lClosureNewFunCall(cargs, fun);
-			c = ctx.closureStack[ctx.csp];
+			c = lClosureNewFunCall(cargs, fun);
+			ctx.closureStack[++ctx.csp] = c;
 
 			lRestoreFromClosure();
 			lBytecodeEnsureSufficientStack(&ctx);
@@ -835,29 +1556,32 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 			break;
 		case ltNativeFunc: {
 			lVal v;
-			switch(fun.vNFunc->argCount){
-			case  0: v = fun.vNFunc->fp(); break;
-			case  1: v = fun.vNFunc->fpC(c); break;
-			case  2: v = fun.vNFunc->fpV(lCar(cargs)); break;
-			case  3: v = fun.vNFunc->fpCV(c, lCar(cargs)); break;
-			case  4: v = fun.vNFunc->fpVV(lCar(cargs), lCadr(cargs)); break;
-			case  5: v = fun.vNFunc->fpCVV(c, lCar(cargs), lCadr(cargs)); break;
-			case  6: v = fun.vNFunc->fpVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs)); break;
-			case  7: v = fun.vNFunc->fpCVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs)); break;
-			case  8: v = fun.vNFunc->fpVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs)); break;
-			case  9: v = fun.vNFunc->fpCVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs)); break;
-			case 10: v = fun.vNFunc->fpVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs)))); break;
-			case 11: v = fun.vNFunc->fpCVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs)))); break;
-			case 12: v = fun.vNFunc->fpVVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCadr(lCddr(lCddr(cargs)))); break;
-			case 13: v = fun.vNFunc->fpCVVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCadr(lCddr(lCddr(cargs)))); break;
-			case 14: v = fun.vNFunc->fpVVVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCaddr(lCddr(lCddr(cargs))), lCadddr(lCddr(lCddr(cargs)))); break;
-			case 15: v = fun.vNFunc->fpCVVVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCaddr(lCddr(lCddr(cargs))), lCadddr(lCddr(lCddr(cargs)))); break;
-			case 16: v = fun.vNFunc->fpR(cargs); break;
-			case 17: v = fun.vNFunc->fpCR(c, cargs); break;
+			if(lValGetNFunc(fun)->argCount & 1){
+				c->flags |= CLOSURE_CAPTURED;
+			}
+			switch(lValGetNFunc(fun)->argCount){
+			case  0: v = lValGetNFunc(fun)->fp(); break;
+			case  1: v = lValGetNFunc(fun)->fpC(c); break;
+			case  2: v = lValGetNFunc(fun)->fpV(lCar(cargs)); break;
+			case  3: v = lValGetNFunc(fun)->fpCV(c, lCar(cargs)); break;
+			case  4: v = lValGetNFunc(fun)->fpVV(lCar(cargs), lCadr(cargs)); break;
+			case  5: v = lValGetNFunc(fun)->fpCVV(c, lCar(cargs), lCadr(cargs)); break;
+			case  6: v = lValGetNFunc(fun)->fpVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs)); break;
+			case  7: v = lValGetNFunc(fun)->fpCVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs)); break;
+			case  8: v = lValGetNFunc(fun)->fpVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs)); break;
+			case  9: v = lValGetNFunc(fun)->fpCVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs)); break;
+			case 10: v = lValGetNFunc(fun)->fpVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs)))); break;
+			case 11: v = lValGetNFunc(fun)->fpCVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs)))); break;
+			case 12: v = lValGetNFunc(fun)->fpVVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCadr(lCddr(lCddr(cargs)))); break;
+			case 13: v = lValGetNFunc(fun)->fpCVVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCadr(lCddr(lCddr(cargs)))); break;
+			case 14: v = lValGetNFunc(fun)->fpVVVVVVV(lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCaddr(lCddr(lCddr(cargs))), lCadddr(lCddr(lCddr(cargs)))); break;
+			case 15: v = lValGetNFunc(fun)->fpCVVVVVVV(c, lCar(cargs), lCadr(cargs), lCaddr(cargs), lCadddr(cargs), lCar(lCddr(lCddr(cargs))), lCaddr(lCddr(lCddr(cargs))), lCadddr(lCddr(lCddr(cargs)))); break;
+			case 16: v = lValGetNFunc(fun)->fpR(cargs); break;
+			case 17: v = lValGetNFunc(fun)->fpCR(c, cargs); break;
 			default: v = lValException(lSymVMError, "Unsupported funcall", fun); break;
 			}
-			if(unlikely(v.type == ltException)){
-				lThrow(v);
+			if(unlikely(lValType(v) == ltException)){
+				vmThrowOrSwitch(v);
 			}
 			ctx.valueStack[++ctx.sp] = v;
 			break; }
@@ -880,8 +1604,40 @@ lVal lBytecodeEval(lClosure *callingClosure, lBytecodeArray *text){
 		}
 	topLevelReturn: {
 		lVal ret = ctx.valueStack[ctx.sp];
-		free(ctx.closureStack);
-		free(ctx.valueStack);
+		if(unlikely(ctx.coroutine != NULL)){
+			/* The coroutine returned, which resumes whoever resumed it */
+			lCoroutineFinish(&ctx);
+			c = ctx.closureStack[ctx.csp];
+			lRestoreFromClosure();
+			ctx.valueStack[++ctx.sp] = ret;
+			vmbreak;
+		}
+		lThreadRelease(&ctx);
 		return ret; }
+	coroutineSwitch: {
+		const lCoroutineRequestType req = lCoroutineRequest;
+		lCoroutine *co = req == lcrResume ? lCoroutineTarget : ctx.coroutine;
+		const lVal v = lCoroutineTransfer;
+		lCoroutineRequest = lcrNone;
+		lCoroutineTarget = NULL;
+		lCoroutineTransfer = NIL;
+		if(unlikely(co == NULL)){
+			lThrow(lValException(lSymVMError, "Can only yield from within a coroutine, and not across native functions", v));
+		}
+		const bool fresh = co->state == lcsFresh;
+		if(fresh){
+			lCoroutineStart(co, v);
+		}
+		co->state = req == lcrResume ? lcsRunning : lcsSuspended;
+		lStoreInClosure(0);
+		lCoroutineSwap(&ctx, co);
+		c = ctx.closureStack[ctx.csp];
+		lRestoreFromClosure();
+		if(!fresh){
+			ctx.valueStack[++ctx.sp] = v;
+		}
+		lBytecodeEnsureSufficientStack(&ctx);
+		lGarbageCollectIfNecessary();
+		vmbreak; }
 	}}
 }
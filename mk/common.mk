@@ -5,6 +5,9 @@ bindir                = $(exec_prefix)/bin/
 AFL_CC               := afl-gcc
 AFL_FUZZ             := afl-fuzz
 FUZZ_NUJEL           := fuzz-nujel
+PROFILE_NUJEL        := nujel-opcode-profile
+NANBOX_NUJEL         := nujel-nan-boxing
+HAMT_NUJEL           := nujel-hamt
 CC                   := cc
 CAT                  := cat
 AR                   := ar
@@ -27,7 +30,7 @@ CSTD                 := -std=c99
 OPTIMIZATION         := -O2
 WARNINGS             := -Wall -Werror -Wextra -Wshadow -Wcast-align -Wno-missing-braces
 
-LIBS                 := -lm
+LIBS                 := -lm -lpthread
 
 RELEASE_OPTIMIZATION := -O3
 VERSION_ARCH         := $(shell uname -m)
@@ -4,7 +4,7 @@ include mk/disable_implicit_rules.mk
 
 UNAME_S := $(shell uname -s)
 ifeq ($(UNAME_S),Linux)
-	LIBS := -lm -lrt
+	LIBS := -lm -lrt -lpthread
 endif
 
 LIB_SRCS      := $(shell find lib -type f -name '*.c')
@@ -50,8 +50,8 @@ endif
 
 all: $(NUJEL)
 .PHONY: all release release.musl release.amalgamation
-.PHONY: rund runn install install.musl profile web
-.PHONY: test.future check test test.verbose test.debug test.slow test.slow.debug test.ridiculous test.wasm
+.PHONY: rund runn install install.musl profile opcode-profile web
+.PHONY: test.future check test test.nan-boxing test.hamt test.verbose test.debug test.slow test.slow.debug test.ridiculous test.wasm
 
 ifdef EMSDK
 all: nujel.wa
@@ -1,5 +1,5 @@
 clean:
-	@rm -f -- nujel nujel.exe nujel.wasm nujel-bootstrap nujel-bootstrap.exe future-nujel future-nujel.exe nujel.c nujel.h nujel.a nujel.wa nujel.com nujel.com.dbg tools/assets tools/assets.exe DOSNUJEL.EXE
+	@rm -f -- nujel nujel.exe nujel.wasm nujel-bootstrap nujel-bootstrap.exe future-nujel future-nujel.exe nujel.c nujel.h nujel.a nujel.wa nujel.com nujel.com.dbg nujel-opcode-profile nujel-nan-boxing nujel-hamt tools/assets tools/assets.exe DOSNUJEL.EXE
 	@rm -f -- $(FILES_TO_CLEAN)
 	@rm -f -- $(NOBS_TO_CLEAN)
 	@rm -f ./callgrind.out.*
@@ -89,6 +89,27 @@ valgrind: $(NUJEL)
 profile: $(NUJEL)
 	valgrind --tool=callgrind --dump-instr=yes --cache-sim=yes --branch-sim=yes ./$(NUJEL) --only-test-suite tools/tests.nuj
 
+$(PROFILE_NUJEL): $(RUNTIME_SRCS)
+	@$(CC) -o $@ $^ $(LDFLAGS) $(CFLAGS) -DNUJEL_OPCODE_PROFILE $(CINCLUDES) $(OPTIMIZATION) $(WARNINGS) $(CSTD) $(LIBS)
+	@echo "$(ANSI_BG_GREEN)" "[CC] " "$(ANSI_RESET)" $@
+
+$(NANBOX_NUJEL): $(RUNTIME_SRCS)
+	@$(CC) -o $@ $^ $(LDFLAGS) $(CFLAGS) -DNUJEL_NAN_BOXING $(CINCLUDES) $(OPTIMIZATION) $(WARNINGS) $(CSTD) $(LIBS)
+	@echo "$(ANSI_BG_GREEN)" "[CC] " "$(ANSI_RESET)" $@
+
+test.nan-boxing: $(NANBOX_NUJEL)
+	@./$(NANBOX_NUJEL) tools/tests.nuj
+
+$(HAMT_NUJEL): $(RUNTIME_SRCS)
+	@$(CC) -o $@ $^ $(LDFLAGS) $(CFLAGS) -DNUJEL_TREE_HAMT $(CINCLUDES) $(OPTIMIZATION) $(WARNINGS) $(CSTD) $(LIBS)
+	@echo "$(ANSI_BG_GREEN)" "[CC] " "$(ANSI_RESET)" $@
+
+test.hamt: $(HAMT_NUJEL)
+	@./$(HAMT_NUJEL) tools/tests.nuj
+
+opcode-profile: $(PROFILE_NUJEL)
+	@./$(PROFILE_NUJEL) tools/opcode-profile.nuj benchmark/opcode-profile.txt benchmark/for/nujel.nuj benchmark/euler1/nujel.nuj benchmark/euler4/nujel.nuj tests/slow/recfib.nuj tests/slow/euler003.nuj tests/slow/euler004.nuj
+
 web:
 	./tools/buildwasm
 	rsync -avhe ssh --delete ./web/ wolkenwelten.net:/home/nujel/nujel/